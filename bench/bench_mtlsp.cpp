@@ -0,0 +1,314 @@
+// native 环境下的 mtlsp 基准测试：握手速率与延迟、记录层吞吐量、AEAD 吞吐量
+// 运行：pio run -e native_bench -t exec
+#include "SocketClient.h"
+#include "aead.h"
+#include "esp_timer.h"
+#include "mtlsp.h"
+#include "mtlsp_frame.h"
+#include "mtlsp_precompute.h"
+#include "mtlsp_server.h"
+#include "mtlsp_session.h"
+#include "mtlsp_ticket.h"
+#include "mtlsp_trace.h"
+#include <algorithm>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+using namespace mtlsp;
+
+enum HandshakeKind { FULL, FAST, RESUME };
+enum WriteMode { SPLIT, COALESCED, VECTORED };
+
+static const char *write_mode_name[] = {"split", "coalesced", "vectored"};
+
+static const char *kind_name[] = {"full", "fast", "resume"};
+static const uint32_t fingerprint_sizes[] = {10 * 1024, 50 * 1024, 100 * 1024,
+                                             200 * 1024, 500 * 1024};
+static const uint32_t record_sizes[] = {64, 512, 1400, 4096, 16384};
+
+static ServerContext server_ctx;
+
+/// Serial 在基准测试中被静音，分阶段统计直接打印到 stdout
+class StdoutPrint : public Print {
+public:
+  size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+};
+
+/// 打印一组延迟（微秒）的统计值
+static void report(const char *name, uint32_t fp_len,
+                   std::vector<int64_t> &lat) {
+  std::sort(lat.begin(), lat.end());
+  int64_t total = 0;
+  for (int64_t v : lat) {
+    total += v;
+  }
+  size_t n = lat.size();
+  printf("%-8s %7u KB %6zu %10.1f %10.1f %10lld %10lld\n", name,
+         fp_len / 1024, n, n * 1e6 / total, (double)total / n,
+         (long long)lat[n / 2], (long long)lat[n * 99 / 100]);
+}
+
+/**
+ * @brief 在回环连接上反复握手
+ * @return 每次握手的耗时（微秒），失败时返回空
+ */
+static std::vector<int64_t> bench_handshake(HandshakeKind kind,
+                                            const std::vector<uint8_t> &fp,
+                                            int rounds) {
+  std::vector<int64_t> lat;
+  std::vector<uint8_t> rx(fp.size());
+  TicketStore tickets;
+  for (int i = 0; i < rounds + (kind == RESUME); ++i) {
+    SocketClient device, server;
+    SocketClient::pair(device, server);
+    uint8_t client_master[BYTE256b], server_master[BYTE256b];
+    ServerHandshakeInfo info;
+    int server_ret = -1;
+    std::thread t([&] {
+      server_ret = handshake_server(server_master, server, server_ctx,
+                                    rx.data(), rx.size(), &info);
+    });
+
+    int64_t start = esp_timer_get_time();
+    int ret;
+    if (kind == FULL) {
+      ret = handshake_client(client_master, device, fp.data(), fp.size());
+    } else if (kind == FAST || i == 0) { // 恢复测试的第一次握手用于取得票据
+      ret = handshake_client_fast(client_master, device, fp.data(), fp.size(),
+                                  kind == RESUME ? &tickets : nullptr);
+    } else {
+      ret = resume_client(client_master, device, tickets);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    t.join();
+    if (ret != 0 || server_ret != 0) {
+      fprintf(stderr, "%s handshake failed\n", kind_name[kind]);
+      return {};
+    }
+    if (kind != RESUME || i > 0) {
+      lat.push_back(elapsed);
+    }
+  }
+  return lat;
+}
+
+/**
+ * @brief 记录层吞吐量：设备端连续 seal_send，服务器端 recv_open
+ * @return MB/s
+ */
+static double bench_session(uint32_t record_size, uint32_t total_bytes,
+                            uint8_t aead_id) {
+  SocketClient device, server;
+  SocketClient::pair(device, server);
+  uint8_t master_secret[BYTE256b];
+  esp_fill_random(master_secret, sizeof(master_secret));
+  Session tx(device, master_secret, true, record_size);
+  Session rx(server, master_secret, false, record_size);
+  std::thread n([&rx, aead_id] { rx.negotiate_server(&aead_id, 1); });
+  tx.negotiate(&aead_id, 1);
+  n.join();
+
+  std::vector<uint8_t> msg(record_size, 0x5a);
+  uint32_t count = total_bytes / record_size;
+  std::thread reader([&rx, record_size, count] {
+    std::vector<uint8_t> buf(record_size);
+    for (uint32_t i = 0; i < count; ++i) {
+      rx.recv_open(buf.data(), record_size);
+    }
+  });
+  int64_t start = esp_timer_get_time();
+  for (uint32_t i = 0; i < count; ++i) {
+    tx.seal_send(msg.data(), record_size);
+  }
+  reader.join();
+  int64_t elapsed = esp_timer_get_time() - start;
+  return (double)record_size * count / elapsed;
+}
+
+/**
+ * @brief 在 127.0.0.1 上建立一对 TCP 连接（socketpair 没有 Nagle，测不出差别）
+ * @return int 0 成功，-1 失败
+ */
+static int tcp_pair(SocketClient &a, SocketClient &b) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof(addr);
+  if (listener < 0 ||
+      bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      listen(listener, 1) < 0 ||
+      getsockname(listener, reinterpret_cast<sockaddr *>(&addr), &addr_len) <
+          0 ||
+      !a.connect(IPAddress((uint32_t)addr.sin_addr.s_addr),
+                 ntohs(addr.sin_port))) {
+    close(listener);
+    return -1;
+  }
+  int fd = accept(listener, nullptr, nullptr);
+  close(listener);
+  if (fd < 0) {
+    return -1;
+  }
+  b.attach(fd);
+  return 0;
+}
+
+/**
+ * @brief 小帧请求/应答往返：一侧发出与 server hello 相同的三帧，另一侧回复
+ * 一帧。SPLIT 按旧的 mtlsp::send 先写前缀再写内容。
+ * @return 平均往返时间（微秒），失败为 -1
+ */
+static double bench_frames(WriteMode mode, bool nodelay, int rounds) {
+  SocketClient device, server;
+  if (tcp_pair(device, server) < 0) {
+    return -1;
+  }
+  FrameWriter dev_raw(device.fd()), srv_raw(server.fd());
+  dev_raw.set_nodelay(nodelay);
+  srv_raw.set_nodelay(nodelay);
+  FrameWriter dev_buf(device), srv_buf(server);
+  FrameWriter &dev_writer = mode == VECTORED ? dev_raw : dev_buf;
+  FrameWriter &srv_writer = mode == VECTORED ? srv_raw : srv_buf;
+
+  static const uint32_t lens[] = {BYTE256b, BYTE256b, BYTE512b};
+  uint8_t payload[BYTE512b] = {0};
+  auto write_frames = [&](Client &c, FrameWriter &w, const uint32_t *sizes,
+                          int count) {
+    for (int i = 0; i < count; ++i) {
+      if (mode == SPLIT) {
+        uint32_t be_len = htonl(sizes[i]);
+        c.write(reinterpret_cast<uint8_t *>(&be_len), 4);
+        c.write(payload, sizes[i]);
+      } else {
+        w.queue(payload, sizes[i]);
+      }
+    }
+    if (mode != SPLIT) {
+      w.flush();
+    }
+  };
+
+  std::thread peer([&] {
+    FrameReader reader(server, HANDSHAKE_FRAME_BUFFER);
+    uint8_t *frame;
+    static const uint32_t reply[] = {1 + crypto_box_SEALBYTES};
+    for (int i = 0; i < rounds; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        reader.next(&frame);
+      }
+      write_frames(server, srv_writer, reply, 1);
+    }
+  });
+
+  FrameReader reader(device, HANDSHAKE_FRAME_BUFFER);
+  uint8_t *frame;
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < rounds; ++i) {
+    write_frames(device, dev_writer, lens, 3);
+    if (reader.next(&frame) < 0) {
+      peer.join();
+      return -1;
+    }
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  peer.join();
+  return (double)elapsed / rounds;
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 50;
+  Serial.mute(true);
+  trace_init();
+  if (server_context_init(server_ctx, NATIVE_SERVER_SEED) < 0) {
+    return 1;
+  }
+  precompute_init();
+
+  printf("# handshake (loopback, %d rounds)\n", rounds);
+  printf("%-8s %10s %6s %10s %10s %10s %10s\n", "kind", "fp", "n", "hs/s",
+         "mean_us", "p50_us", "p99_us");
+  for (uint32_t fp_len : fingerprint_sizes) {
+    std::vector<uint8_t> fp(fp_len);
+    esp_fill_random(fp.data(), fp.size());
+    for (HandshakeKind kind : {FULL, FAST, RESUME}) {
+      std::vector<int64_t> lat = bench_handshake(kind, fp, rounds);
+      if (lat.empty()) {
+        return 1;
+      }
+      report(kind_name[kind], fp_len, lat);
+    }
+  }
+
+  // 各阶段耗时分解，区分链路、服务器与本机算力
+  StdoutPrint out;
+  std::vector<uint8_t> phase_fp(100 * 1024);
+  esp_fill_random(phase_fp.data(), phase_fp.size());
+  for (HandshakeKind kind : {FULL, FAST, RESUME}) {
+    printf("\n# %s handshake phases (100 KB)\n", kind_name[kind]);
+    trace_reset();
+    if (bench_handshake(kind, phase_fp, rounds).empty()) {
+      return 1;
+    }
+    trace_print(out);
+  }
+
+  printf("\n# fingerprint stream encryption (Aes256Gcm, %u B chunks)\n",
+         STREAM_CHUNK_SIZE);
+  printf("%10s %10s\n", "fp", "MB/s");
+  for (uint32_t fp_len : fingerprint_sizes) {
+    std::vector<uint8_t> fp(fp_len), chunk(STREAM_CHUNK_SIZE);
+    uint8_t key[AES_KEY_SIZE], nonce[IV_SIZE], tag[TAG_SIZE];
+    esp_fill_random(key, sizeof(key));
+    esp_fill_random(nonce, sizeof(nonce));
+    Aes256Gcm aead(key);
+    int64_t start = esp_timer_get_time();
+    for (int r = 0; r < rounds; ++r) {
+      aead.stream_start(MBEDTLS_GCM_ENCRYPT, nonce);
+      for (uint32_t off = 0; off < fp_len; off += STREAM_CHUNK_SIZE) {
+        uint32_t n = std::min<uint32_t>(STREAM_CHUNK_SIZE, fp_len - off);
+        aead.stream_update(chunk.data(), &fp[off], n);
+      }
+      aead.stream_finish(tag);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    printf("%7u KB %10.1f\n", fp_len / 1024,
+           (double)fp_len * rounds / elapsed);
+  }
+
+  printf("\n# small-frame round trips (TCP loopback, 3 frames -> 1 frame)\n");
+  printf("%-10s %8s %10s\n", "writes", "nodelay", "rtt_us");
+  for (bool nodelay : {false, true}) {
+    for (WriteMode mode : {SPLIT, COALESCED, VECTORED}) {
+      printf("%-10s %8s %10.1f\n", write_mode_name[mode],
+             nodelay ? "on" : "off", bench_frames(mode, nodelay, rounds));
+    }
+  }
+
+  printf("\n# aead backends (encrypt, in place)\n");
+  printf("%-24s %8s %10s\n", "backend", "record", "MB/s");
+  AeadBenchResult results[AEAD_BACKEND_COUNT * 5];
+  size_t n = aead_benchmark(results, AEAD_BACKEND_COUNT * 5, record_sizes, 5,
+                            8 * 1024 * 1024);
+  for (size_t i = 0; i < n; ++i) {
+    printf("%-24s %8u %10.1f\n", aead_name(results[i].id),
+           results[i].record_size, results[i].bytes_per_sec / 1e6);
+  }
+
+  printf("\n# session records (loopback, seal_send -> recv_open)\n");
+  printf("%-24s %8s %10s\n", "backend", "record", "MB/s");
+  for (uint8_t id = 1; id <= AEAD_BACKEND_COUNT; ++id) {
+    if (!aead_available(id)) {
+      continue;
+    }
+    for (uint32_t size : {512U, 1400U, RECORD_MAX}) {
+      printf("%-24s %8u %10.1f\n", aead_name(id), size,
+             bench_session(size, 32 * 1024 * 1024, id));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,230 @@
+#include "aead.h"
+
+/// mbedtls AES256-GCM 后端，复用 Aes256Gcm 会话上下文
+class MbedtlsAes256Gcm : public AeadBackend {
+public:
+  uint8_t id() const override { return AEAD_MBEDTLS_AES256GCM; }
+  int setkey(const uint8_t *k) override { return ctx.setkey(k); }
+  void clear() override { ctx.clear(); }
+  int encrypt(uint8_t *buf, uint64_t mlen, const uint8_t *ad, uint64_t adlen,
+              const uint8_t *npub) override {
+    return ctx.encrypt(buf, mlen, ad, adlen, npub);
+  }
+  int decrypt(uint8_t *buf, uint64_t clen, const uint8_t *ad, uint64_t adlen,
+              const uint8_t *npub) override {
+    return ctx.decrypt(buf, clen, ad, adlen, npub);
+  }
+
+private:
+  Aes256Gcm ctx;
+};
+
+/// libsodium AES256-GCM 后端，密钥扩展结果保存在 beforenm 状态中
+class SodiumAes256Gcm : public AeadBackend {
+public:
+  SodiumAes256Gcm() : keyed(false) {}
+  ~SodiumAes256Gcm() { clear(); }
+  uint8_t id() const override { return AEAD_SODIUM_AES256GCM; }
+  int setkey(const uint8_t *k) override {
+    keyed = crypto_aead_aes256gcm_beforenm(&state, k) == 0;
+    return keyed ? 0 : -1;
+  }
+  void clear() override {
+    sodium_memzero(&state, sizeof(state));
+    keyed = false;
+  }
+  int encrypt(uint8_t *buf, uint64_t mlen, const uint8_t *ad, uint64_t adlen,
+              const uint8_t *npub) override {
+    if (!keyed) {
+      return -1;
+    }
+    return crypto_aead_aes256gcm_encrypt_afternm(buf, nullptr, buf, mlen, ad,
+                                                 adlen, nullptr, npub, &state);
+  }
+  int decrypt(uint8_t *buf, uint64_t clen, const uint8_t *ad, uint64_t adlen,
+              const uint8_t *npub) override {
+    if (!keyed) {
+      return -1;
+    }
+    return crypto_aead_aes256gcm_decrypt_afternm(buf, nullptr, nullptr, buf,
+                                                 clen, ad, adlen, npub, &state);
+  }
+
+private:
+  crypto_aead_aes256gcm_state state;
+  bool keyed;
+};
+
+/// libsodium ChaCha20-Poly1305 (IETF) 后端，没有密钥扩展，只保存密钥
+class SodiumChacha20Poly1305 : public AeadBackend {
+public:
+  SodiumChacha20Poly1305() : keyed(false) {}
+  ~SodiumChacha20Poly1305() { clear(); }
+  uint8_t id() const override { return AEAD_SODIUM_CHACHA20POLY1305; }
+  int setkey(const uint8_t *k) override {
+    memcpy(key, k, sizeof(key));
+    keyed = true;
+    return 0;
+  }
+  void clear() override {
+    sodium_memzero(key, sizeof(key));
+    keyed = false;
+  }
+  int encrypt(uint8_t *buf, uint64_t mlen, const uint8_t *ad, uint64_t adlen,
+              const uint8_t *npub) override {
+    if (!keyed) {
+      return -1;
+    }
+    return crypto_aead_chacha20poly1305_ietf_encrypt(
+        buf, nullptr, buf, mlen, ad, adlen, nullptr, npub, key);
+  }
+  int decrypt(uint8_t *buf, uint64_t clen, const uint8_t *ad, uint64_t adlen,
+              const uint8_t *npub) override {
+    if (!keyed) {
+      return -1;
+    }
+    return crypto_aead_chacha20poly1305_ietf_decrypt(
+        buf, nullptr, nullptr, buf, clen, ad, adlen, npub, key);
+  }
+
+private:
+  uint8_t key[crypto_aead_chacha20poly1305_ietf_KEYBYTES];
+  bool keyed;
+};
+
+/// 当前平台是否支持该后端
+bool aead_available(uint8_t id) {
+  switch (id) {
+  case AEAD_MBEDTLS_AES256GCM:
+  case AEAD_SODIUM_CHACHA20POLY1305:
+    return true;
+  case AEAD_SODIUM_AES256GCM:
+    return sodium_init() >= 0 && crypto_aead_aes256gcm_is_available();
+  default:
+    return false;
+  }
+}
+
+/// 后端名称，未知 id 返回 "unknown"
+const char *aead_name(uint8_t id) {
+  switch (id) {
+  case AEAD_MBEDTLS_AES256GCM:
+    return "mbedtls-aes256gcm";
+  case AEAD_SODIUM_AES256GCM:
+    return "sodium-aes256gcm";
+  case AEAD_SODIUM_CHACHA20POLY1305:
+    return "sodium-chacha20poly1305";
+  default:
+    return "unknown";
+  }
+}
+
+/// 创建后端实例（未设置密钥），不可用时返回 nullptr，用完由调用方 delete
+AeadBackend *aead_create(uint8_t id) {
+  if (!aead_available(id)) {
+    return nullptr;
+  }
+  switch (id) {
+  case AEAD_MBEDTLS_AES256GCM:
+    return new MbedtlsAes256Gcm();
+  case AEAD_SODIUM_AES256GCM:
+    return new SodiumAes256Gcm();
+  case AEAD_SODIUM_CHACHA20POLY1305:
+    return new SodiumChacha20Poly1305();
+  default:
+    return nullptr;
+  }
+}
+
+/**
+ * @brief 对所有可用后端做加密吞吐量测试
+ *
+ * @param results 传出参数，测试结果
+ * @param max_results results 的容量
+ * @param record_sizes 要测试的记录长度
+ * @param n_sizes record_sizes 的个数
+ * @param bytes_per_run 每个（后端, 记录长度）组合加密的总字节数
+ * @return size_t 写入 results 的条数，record_sizes 中有 0 时为 0
+ */
+size_t aead_benchmark(AeadBenchResult *results, size_t max_results,
+                      const uint32_t *record_sizes, size_t n_sizes,
+                      uint32_t bytes_per_run) {
+  uint32_t max_size = 0;
+  for (size_t i = 0; i < n_sizes; ++i) {
+    if (record_sizes[i] == 0)
+      return 0;
+    if (record_sizes[i] > max_size)
+      max_size = record_sizes[i];
+  }
+  uint8_t *buf = (uint8_t *)pvPortMalloc(max_size + TAG_SIZE);
+  if (!buf) {
+    return 0;
+  }
+  uint8_t key[AES_KEY_SIZE];
+  uint8_t nonce[IV_SIZE];
+  esp_fill_random(key, sizeof(key));
+  memset(nonce, 0, sizeof(nonce));
+  memset(buf, 0xA5, max_size);
+
+  size_t n = 0;
+  for (uint8_t id = 1; id <= AEAD_BACKEND_COUNT; ++id) {
+    AeadBackend *aead = aead_create(id);
+    if (!aead) {
+      continue;
+    }
+    aead->setkey(key);
+    for (size_t i = 0; i < n_sizes && n < max_results; ++i) {
+      uint32_t size = record_sizes[i];
+      uint32_t rounds = bytes_per_run / size + 1;
+      unsigned long start = micros();
+      for (uint32_t r = 0; r < rounds; ++r) {
+        nonce[0] = (uint8_t)r; // 仅用于测试，nonce 不必唯一
+        aead->encrypt(buf, size, nullptr, 0, nonce);
+      }
+      unsigned long elapsed = micros() - start;
+      if (elapsed == 0)
+        elapsed = 1;
+      results[n].id = id;
+      results[n].record_size = size;
+      results[n].bytes_per_sec =
+          (uint32_t)((uint64_t)size * rounds * 1000000ULL / elapsed);
+      ++n;
+    }
+    delete aead;
+  }
+
+  sodium_memzero(key, sizeof(key));
+  vPortFree(buf);
+  return n;
+}
+
+/**
+ * @brief 在给定记录长度下测试所有可用后端，按吞吐量从高到低排序
+ *
+ * @param ids 传出参数，后端 id 列表
+ * @param max_ids ids 的容量
+ * @param record_size 记录长度，一般取 RECORD_MAX
+ * @return size_t 写入 ids 的个数
+ */
+size_t aead_rank(uint8_t *ids, size_t max_ids, uint32_t record_size) {
+  AeadBenchResult results[AEAD_BACKEND_COUNT];
+  size_t n = aead_benchmark(results, AEAD_BACKEND_COUNT, &record_size, 1,
+                            64 * 1024);
+
+  // 插入排序，后端数量很少
+  for (size_t i = 1; i < n; ++i) {
+    AeadBenchResult r = results[i];
+    size_t j = i;
+    while (j > 0 && results[j - 1].bytes_per_sec < r.bytes_per_sec) {
+      results[j] = results[j - 1];
+      --j;
+    }
+    results[j] = r;
+  }
+
+  size_t count = n < max_ids ? n : max_ids;
+  for (size_t i = 0; i < count; ++i) {
+    ids[i] = results[i].id;
+  }
+  return count;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "aes256gcm.h"
+#include "sodium.h"
+#include <Arduino.h>
+#include <esp_system.h>
+
+// 所有后端统一为 256 位密钥、12 字节 nonce、16 字节认证标签，可以互相替换
+#define AEAD_NONE 0x00                    // 协商结果：没有双方都支持的后端
+#define AEAD_MBEDTLS_AES256GCM 0x01       // mbedtls，ESP32-S3 上走硬件 AES
+#define AEAD_SODIUM_AES256GCM 0x02        // libsodium，需要 AES-NI / ARMv8 Crypto
+#define AEAD_SODIUM_CHACHA20POLY1305 0x03 // libsodium，纯软件实现
+#define AEAD_BACKEND_COUNT 3U
+
+const char *aead_name(uint8_t id);
+
+/// AEAD 后端接口，只提供原地加解密：buf 前 mlen 字节为明文，加密后为
+/// mlen + TAG_SIZE 字节的密文和标签
+class AeadBackend {
+public:
+  virtual ~AeadBackend() {}
+  virtual uint8_t id() const = 0;
+  const char *name() const { return aead_name(id()); }
+  virtual int setkey(const uint8_t *k) = 0;
+  virtual void clear() = 0;
+  virtual int encrypt(uint8_t *buf, uint64_t mlen, const uint8_t *ad,
+                      uint64_t adlen, const uint8_t *npub) = 0;
+  virtual int decrypt(uint8_t *buf, uint64_t clen, const uint8_t *ad,
+                      uint64_t adlen, const uint8_t *npub) = 0;
+};
+
+/// 单项基准测试结果
+struct AeadBenchResult {
+  uint8_t id;
+  uint32_t record_size;   // 每次加密的明文长度
+  uint32_t bytes_per_sec; // 加密吞吐量
+};
+
+bool aead_available(uint8_t id);
+
+AeadBackend *aead_create(uint8_t id);
+
+size_t aead_benchmark(AeadBenchResult *results, size_t max_results,
+                      const uint32_t *record_sizes, size_t n_sizes,
+                      uint32_t bytes_per_run);
+
+size_t aead_rank(uint8_t *ids, size_t max_ids, uint32_t record_size);
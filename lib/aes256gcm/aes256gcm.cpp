@@ -4,66 +4,144 @@
 // #define IV_SIZE 12      // 12 字节 IV
 // #define TAG_SIZE 16     // 128-bit 认证标签
 
-/// AES256-GCM 加密
+/// AES256-GCM 加密（一次性，内部创建并释放上下文）
 /// @return 0 成功，其他值为错误代码
 int aes256gcm_encrypt(uint8_t *c, uint64_t *clen_p, const uint8_t *m,
                       uint64_t mlen, const uint8_t *ad, uint64_t adlen,
                       const uint8_t *nsec, const uint8_t *npub,
                       const uint8_t *k) {
-  // 初始化上下文
-  mbedtls_gcm_context ctx;
-  mbedtls_gcm_init(&ctx);
-
-  // 设置密钥
-  if (mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, k, 256) < 0) {
+  Aes256Gcm aead;
+  if (aead.setkey(k) < 0) {
     return -1;
   }
-
-  // 加密
-  uint8_t tag[TAG_SIZE];
-  if (mbedtls_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_ENCRYPT, mlen, npub, IV_SIZE,
-                                ad, adlen, m, c, TAG_SIZE, tag)) {
-    return -1;
-  }
-  *clen_p = mlen + TAG_SIZE;
-
-  // 组合
-  memcpy(c + mlen, tag, TAG_SIZE);
-
-  return 0;
+  return aead.encrypt(c, clen_p, m, mlen, ad, adlen, npub);
 }
 
-/// AES256-GCM 解密
+/// AES256-GCM 解密（一次性，内部创建并释放上下文）
 /// @return 0 成功，其他值为错误代码
 int aes256gcm_decrypt(uint8_t *m, uint64_t *mlen_p, uint8_t *nsec,
                       const uint8_t *c, uint64_t clen, const uint8_t *ad,
                       uint64_t adlen, const uint8_t *npub, const uint8_t *k) {
-  // 提取 tag
-  if (clen < TAG_SIZE) {
+  Aes256Gcm aead;
+  if (aead.setkey(k) < 0) {
     return -1;
   }
-  uint32_t mlen = clen - TAG_SIZE;
-  uint8_t *tag = const_cast<uint8_t *>(c) + mlen;
+  return aead.decrypt(m, mlen_p, c, clen, ad, adlen, npub);
+}
+
+/// 常数时间比较两个认证标签
+static int tag_equal(const uint8_t *a, const uint8_t *b) {
+  uint8_t diff = 0;
+  for (size_t i = 0; i < TAG_SIZE; ++i) {
+    diff |= a[i] ^ b[i];
+  }
+  return diff == 0;
+}
+
+Aes256Gcm::Aes256Gcm() : keyed(false) { mbedtls_gcm_init(&ctx); }
 
-  // 初始化上下文
-  mbedtls_gcm_context ctx;
+Aes256Gcm::Aes256Gcm(const uint8_t *k) : keyed(false) {
   mbedtls_gcm_init(&ctx);
+  setkey(k);
+}
+
+Aes256Gcm::~Aes256Gcm() { mbedtls_gcm_free(&ctx); }
+
+/// 设置（或更换）会话密钥，只在这里做一次密钥扩展
+/// @return 0 成功，其他值为错误代码
+int Aes256Gcm::setkey(const uint8_t *k) {
+  keyed = mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, k, 256) == 0;
+  return keyed ? 0 : -1;
+}
+
+/// 释放上下文并清除扩展后的密钥，对象可以再次 setkey
+void Aes256Gcm::clear() {
+  mbedtls_gcm_free(&ctx); // mbedtls_gcm_free 会清零整个上下文
+  mbedtls_gcm_init(&ctx);
+  keyed = false;
+}
 
-  // 设置密钥
-  if (mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, k, 256) < 0) {
-    
+/// 加密，c 中依次为密文和认证标签
+/// @return 0 成功，其他值为错误代码
+int Aes256Gcm::encrypt(uint8_t *c, uint64_t *clen_p, const uint8_t *m,
+                       uint64_t mlen, const uint8_t *ad, uint64_t adlen,
+                       const uint8_t *npub) {
+  if (!keyed) {
     return -1;
   }
-
-  // 解密验证
-  if (mbedtls_gcm_auth_decrypt(&ctx, mlen, npub, IV_SIZE, ad, adlen, tag,
-                               TAG_SIZE, c, m) < 0) {
+  if (mbedtls_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_ENCRYPT, mlen, npub, IV_SIZE,
+                                ad, adlen, m, c, TAG_SIZE, c + mlen)) {
     return -1;
   }
+  if (clen_p) {
+    *clen_p = mlen + TAG_SIZE;
+  }
+  return 0;
+}
 
+/// 解密并校验，c 中依次为密文和认证标签
+/// @return 0 成功，其他值为错误代码
+int Aes256Gcm::decrypt(uint8_t *m, uint64_t *mlen_p, const uint8_t *c,
+                       uint64_t clen, const uint8_t *ad, uint64_t adlen,
+                       const uint8_t *npub) {
+  if (!keyed || clen < TAG_SIZE) {
+    return -1;
+  }
+  uint64_t mlen = clen - TAG_SIZE;
+  if (mbedtls_gcm_auth_decrypt(&ctx, mlen, npub, IV_SIZE, ad, adlen, c + mlen,
+                               TAG_SIZE, c, m) != 0) {
+    return -1;
+  }
   if (mlen_p) {
     *mlen_p = mlen;
   }
-
   return 0;
-}
\ No newline at end of file
+}
+
+/// 原地加密：buf 前 mlen 字节为明文，完成后为 mlen + TAG_SIZE 字节密文
+/// @return 0 成功，其他值为错误代码
+int Aes256Gcm::encrypt(uint8_t *buf, uint64_t mlen, const uint8_t *ad,
+                       uint64_t adlen, const uint8_t *npub) {
+  return encrypt(buf, nullptr, buf, mlen, ad, adlen, npub);
+}
+
+/// 原地解密：buf 前 clen 字节为密文和标签，成功后前 clen - TAG_SIZE 字节为明文
+/// @return 0 成功，其他值为错误代码
+int Aes256Gcm::decrypt(uint8_t *buf, uint64_t clen, const uint8_t *ad,
+                       uint64_t adlen, const uint8_t *npub) {
+  return decrypt(buf, nullptr, buf, clen, ad, adlen, npub);
+}
+
+/// 开始一次流式加解密
+/// @param mode MBEDTLS_GCM_ENCRYPT / MBEDTLS_GCM_DECRYPT
+/// @return 0 成功，其他值为错误代码
+int Aes256Gcm::stream_start(int mode, const uint8_t *npub) {
+  if (!keyed) {
+    return -1;
+  }
+  return mbedtls_gcm_starts(&ctx, mode, npub, IV_SIZE, nullptr, 0) == 0 ? 0
+                                                                         : -1;
+}
+
+/// 流式加解密一个分块，out 与 in 可以是同一块内存
+/// @note mbedtls 2.x 要求除最后一块外每块长度都是 16 的整数倍
+/// @return 0 成功，其他值为错误代码
+int Aes256Gcm::stream_update(uint8_t *out, const uint8_t *in, size_t len) {
+  return mbedtls_gcm_update(&ctx, len, in, out) == 0 ? 0 : -1;
+}
+
+/// 结束流式加密，输出认证标签；密钥保留，可继续下一次流式加密
+/// @return 0 成功，其他值为错误代码
+int Aes256Gcm::stream_finish(uint8_t *tag) {
+  return mbedtls_gcm_finish(&ctx, tag, TAG_SIZE) == 0 ? 0 : -1;
+}
+
+/// 结束流式解密并校验认证标签
+/// @return 0 校验通过，-1 校验失败
+int Aes256Gcm::stream_verify(const uint8_t *tag) {
+  uint8_t check_tag[TAG_SIZE];
+  if (mbedtls_gcm_finish(&ctx, check_tag, TAG_SIZE) != 0) {
+    return -1;
+  }
+  return tag_equal(check_tag, tag) ? 0 : -1;
+}
@@ -15,3 +15,39 @@ int aes256gcm_encrypt(uint8_t *c, uint64_t *clen_p, const uint8_t *m,
 int aes256gcm_decrypt(uint8_t *m, uint64_t *mlen_p, uint8_t *nsec,
                       const uint8_t *c, uint64_t clen, const uint8_t *ad,
                       uint64_t adlen, const uint8_t *npub, const uint8_t *k);
+
+/// AES256-GCM 会话上下文：每个连接只做一次密钥扩展，之后所有加解密复用，
+/// 析构时释放 mbedtls 上下文并清除密钥材料
+class Aes256Gcm {
+public:
+  Aes256Gcm();
+  explicit Aes256Gcm(const uint8_t *k);
+  ~Aes256Gcm();
+  Aes256Gcm(const Aes256Gcm &) = delete;
+  Aes256Gcm &operator=(const Aes256Gcm &) = delete;
+
+  int setkey(const uint8_t *k);
+  void clear();
+  bool ready() const { return keyed; }
+
+  int encrypt(uint8_t *c, uint64_t *clen_p, const uint8_t *m, uint64_t mlen,
+              const uint8_t *ad, uint64_t adlen, const uint8_t *npub);
+  int decrypt(uint8_t *m, uint64_t *mlen_p, const uint8_t *c, uint64_t clen,
+              const uint8_t *ad, uint64_t adlen, const uint8_t *npub);
+
+  // 原地加解密：buf 容量至少为 mlen + TAG_SIZE，标签紧跟在密文之后
+  int encrypt(uint8_t *buf, uint64_t mlen, const uint8_t *ad, uint64_t adlen,
+              const uint8_t *npub);
+  int decrypt(uint8_t *buf, uint64_t clen, const uint8_t *ad, uint64_t adlen,
+              const uint8_t *npub);
+
+  // 流式加解密，复用已扩展的密钥
+  int stream_start(int mode, const uint8_t *npub);
+  int stream_update(uint8_t *out, const uint8_t *in, size_t len);
+  int stream_finish(uint8_t *tag);
+  int stream_verify(const uint8_t *tag);
+
+private:
+  mbedtls_gcm_context ctx;
+  bool keyed;
+};
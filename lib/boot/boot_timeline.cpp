@@ -0,0 +1,56 @@
+#include "boot_timeline.h"
+#include <esp_timer.h>
+
+BootTimeline boot_timeline;
+
+/**
+ * @brief 开始一个阶段
+ *
+ * @param name 阶段名，须为静态字符串
+ * @return int 阶段下标，交给 end；阶段数已满时为 -1
+ */
+int BootTimeline::begin(const char *name) {
+  int64_t now = esp_timer_get_time();
+  uint32_t i = n.load(std::memory_order_relaxed);
+  do {
+    if (i >= BOOT_STAGES_MAX) {
+      return -1;
+    }
+  } while (!n.compare_exchange_weak(i, i + 1, std::memory_order_acq_rel));
+  stages[i].name = name;
+  stages[i].end_us = 0;
+  stages[i].start_us = now;
+  return i;
+}
+
+/**
+ * @brief 结束 begin 返回的阶段，下标为 -1 时忽略
+ */
+void BootTimeline::end(int stage) {
+  if (stage < 0 || stage >= (int)count()) {
+    return;
+  }
+  stages[stage].end_us = esp_timer_get_time();
+}
+
+size_t BootTimeline::count() const {
+  return n.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief 每个阶段一行：名称、开始、结束与耗时（微秒），未结束的阶段结束时间为 -
+ */
+void BootTimeline::print(Print &out) const {
+  size_t total = count();
+  out.println("boot stage          start_us     end_us   duration");
+  for (size_t i = 0; i < total; i++) {
+    const BootStage &s = stages[i];
+    if (s.end_us == 0) {
+      out.printf("%-16s %10lld          -          -\n", s.name,
+                 (long long)s.start_us);
+    } else {
+      out.printf("%-16s %10lld %10lld %10lld\n", s.name, (long long)s.start_us,
+                 (long long)s.end_us, (long long)(s.end_us - s.start_us));
+    }
+  }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+#define BOOT_STAGES_MAX 16U
+
+/// 一个启动阶段，时间为自上电起的微秒数（esp_timer_get_time）
+struct BootStage {
+  const char *name;
+  int64_t start_us;
+  int64_t end_us; // 0 表示尚未结束
+};
+
+/// 启动时间线
+///
+/// 各阶段可以在不同任务中并行开始与结束，begin 返回的下标只由开始它的任务
+/// 结束。按固定格式打印，便于跨版本比较启动耗时。
+class BootTimeline {
+public:
+  BootTimeline() : n(0) {}
+
+  int begin(const char *name);
+  void end(int stage);
+  size_t count() const;
+  const BootStage &stage(size_t i) const { return stages[i]; }
+  void print(Print &out) const;
+
+private:
+  BootStage stages[BOOT_STAGES_MAX];
+  std::atomic<uint32_t> n;
+};
+
+extern BootTimeline boot_timeline;
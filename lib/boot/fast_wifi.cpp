@@ -0,0 +1,207 @@
+#include "fast_wifi.h"
+#include <Preferences.h>
+#include <time.h>
+
+#define EVENT_GOT_IP (1U << 0)
+#define EVENT_DISCONNECTED (1U << 1)
+
+static FastWifi *instance = nullptr; // WiFi 事件回调不带上下文
+
+FastWifi::FastWifi(const char *ssid, const char *password, bool reuse_lease)
+    : ssid(ssid), password(password), reuse_lease(reuse_lease),
+      used_cache(false), used_lease(false), connected(false),
+      events(nullptr) {
+  memset(&cache, 0, sizeof(cache));
+}
+
+/**
+ * @brief WiFi 事件回调，在 WiFi 事件任务中执行，只置位事件组
+ */
+void FastWifi::on_event(arduino_event_id_t event) {
+  if (instance == nullptr) {
+    return;
+  }
+  if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+    xEventGroupSetBits(instance->events, EVENT_GOT_IP);
+  } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+    xEventGroupSetBits(instance->events, EVENT_DISCONNECTED);
+  }
+}
+
+/**
+ * @brief 从 NVS 读取缓存，版本或 SSID 不符时视为没有缓存
+ *
+ * @return int 0 表示读到可用的缓存， -1 表示没有
+ */
+int FastWifi::load() {
+  Preferences prefs;
+  if (!prefs.begin(FAST_WIFI_NVS_NAMESPACE, true)) {
+    return -1;
+  }
+  bool ok = prefs.getBytes(FAST_WIFI_NVS_KEY, &cache, sizeof(cache)) ==
+                sizeof(cache) &&
+            cache.version == FAST_WIFI_CACHE_VERSION &&
+            strncmp(cache.ssid, ssid, sizeof(cache.ssid)) == 0 &&
+            cache.channel > 0;
+  prefs.end();
+  if (!ok) {
+    memset(&cache, 0, sizeof(cache));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief 缓存的租约是否还能作为静态地址使用
+ *
+ * @details 系统时间早于保存时刻说明其间断过电，无法判断租约是否还在，按过期处理
+ */
+bool FastWifi::lease_valid() const {
+  if (cache.ip == 0) {
+    return false;
+  }
+  uint32_t now = (uint32_t)time(nullptr);
+  return now >= cache.lease_at && now - cache.lease_at < FAST_WIFI_LEASE_S;
+}
+
+/**
+ * @brief 常规连接：扫描全部信道并走 DHCP
+ */
+void FastWifi::connect_full() {
+  used_cache = false;
+  used_lease = false;
+  WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0),
+              IPAddress((uint32_t)0)); // 恢复 DHCP
+  WiFi.begin(ssid, password);
+}
+
+/**
+ * @brief 开始连接，立即返回；与其他初始化并行，之后用 wait 等待拿到 IP
+ *
+ * @return int 0 表示按缓存直连，1 表示常规连接，-1 表示失败
+ */
+int FastWifi::begin() {
+  if (events == nullptr) {
+    events = xEventGroupCreate();
+    if (events == nullptr) {
+      return -1;
+    }
+  }
+  instance = this;
+  xEventGroupClearBits(events, EVENT_GOT_IP | EVENT_DISCONNECTED);
+  connected = false;
+
+  WiFi.persistent(false); // 由本类决定写什么进 NVS
+  WiFi.mode(WIFI_STA);
+  WiFi.onEvent(on_event, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+  WiFi.onEvent(on_event, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+
+  if (load() < 0) {
+    connect_full();
+    return 1;
+  }
+  used_cache = true;
+  used_lease = reuse_lease && lease_valid();
+  if (used_lease) {
+    WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway),
+                IPAddress(cache.subnet), IPAddress(cache.dns));
+  }
+  WiFi.begin(ssid, password, cache.channel, cache.bssid);
+  return 0;
+}
+
+/**
+ * @brief 阻塞等待拿到 IP，期间不占用 CPU
+ *
+ * @param timeout_ms 总的等待时间
+ * @return int 0 表示已连接， -1 表示超时
+ *
+ * @details 按缓存直连时，断开事件或超过 FAST_WIFI_FAST_TIMEOUT_MS 视为缓存
+ * 过期（接入点换了信道、租约已被分配给别人等），清除缓存后常规重连一次。
+ */
+int FastWifi::wait(uint32_t timeout_ms) {
+  uint32_t start = millis();
+  if (used_cache) {
+    uint32_t fast_ms = timeout_ms < FAST_WIFI_FAST_TIMEOUT_MS
+                           ? timeout_ms
+                           : FAST_WIFI_FAST_TIMEOUT_MS;
+    EventBits_t bits = xEventGroupWaitBits(
+        events, EVENT_GOT_IP | EVENT_DISCONNECTED, pdFALSE, pdFALSE,
+        pdMS_TO_TICKS(fast_ms));
+    if (bits & EVENT_GOT_IP) {
+      connected = true;
+      return 0;
+    }
+    forget();
+    WiFi.disconnect();
+    xEventGroupClearBits(events, EVENT_DISCONNECTED);
+    connect_full();
+  }
+
+  uint32_t elapsed = millis() - start;
+  if (elapsed >= timeout_ms) {
+    return -1;
+  }
+  // 常规连接中的断开由自动重连处理，只等 IP
+  EventBits_t bits = xEventGroupWaitBits(events, EVENT_GOT_IP, pdFALSE,
+                                         pdFALSE,
+                                         pdMS_TO_TICKS(timeout_ms - elapsed));
+  connected = (bits & EVENT_GOT_IP) != 0;
+  return connected ? 0 : -1;
+}
+
+/**
+ * @brief 连接成功后把接入点与租约写入 NVS，内容未变时不写，减少闪存擦写
+ *
+ * @return int 0 表示成功（含无需写入）， -1 表示失败
+ */
+int FastWifi::save() {
+  if (!connected) {
+    return -1;
+  }
+  WifiCache now;
+  memset(&now, 0, sizeof(now));
+  now.version = FAST_WIFI_CACHE_VERSION;
+  strncpy(now.ssid, ssid, sizeof(now.ssid) - 1);
+  const uint8_t *bssid = WiFi.BSSID();
+  if (bssid == nullptr) {
+    return -1;
+  }
+  memcpy(now.bssid, bssid, sizeof(now.bssid));
+  now.channel = WiFi.channel();
+  if (reuse_lease) {
+    now.ip = WiFi.localIP();
+    now.gateway = WiFi.gatewayIP();
+    now.subnet = WiFi.subnetMask();
+    now.dns = WiFi.dnsIP();
+    // 复用的租约没有经过 DHCP 续约，保留原来的时刻
+    now.lease_at = used_lease ? cache.lease_at : (uint32_t)time(nullptr);
+  }
+  if (memcmp(&now, &cache, sizeof(now)) == 0) {
+    return 0;
+  }
+
+  Preferences prefs;
+  if (!prefs.begin(FAST_WIFI_NVS_NAMESPACE, false)) {
+    return -1;
+  }
+  size_t n = prefs.putBytes(FAST_WIFI_NVS_KEY, &now, sizeof(now));
+  prefs.end();
+  if (n != sizeof(now)) {
+    return -1;
+  }
+  cache = now;
+  return 0;
+}
+
+/**
+ * @brief 删除缓存，下次启动走常规连接
+ */
+void FastWifi::forget() {
+  memset(&cache, 0, sizeof(cache));
+  Preferences prefs;
+  if (prefs.begin(FAST_WIFI_NVS_NAMESPACE, false)) {
+    prefs.remove(FAST_WIFI_NVS_KEY);
+    prefs.end();
+  }
+}
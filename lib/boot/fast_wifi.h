@@ -0,0 +1,59 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+
+#define FAST_WIFI_NVS_NAMESPACE "fastwifi"
+#define FAST_WIFI_NVS_KEY "cache"
+#define FAST_WIFI_CACHE_VERSION 2U
+#define FAST_WIFI_FAST_TIMEOUT_MS 3000U // 按缓存直连超过该时间仍未拿到 IP 即改为扫描
+#define FAST_WIFI_LEASE_S 1800U // 复用租约的期限，取常见 DHCP 租期的续约点（T1）
+
+/// 上次成功连接的接入点与地址，保存在 NVS 中
+struct WifiCache {
+  uint8_t version;
+  char ssid[33];     // 换了 SSID 缓存即失效
+  uint8_t bssid[6];
+  int32_t channel;
+  uint32_t ip;       // 以下为 DHCP 租约，全 0 表示不复用
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint32_t lease_at; // 拿到租约时的系统时间（秒）
+};
+
+/// 快速重连
+///
+/// 有缓存时跳过扫描，直接在缓存的信道上关联缓存的 BSSID，并把上次的 DHCP
+/// 租约作为静态地址使用（也跳过 DHCP）；关联失败或超时后清除缓存，按常规
+/// 扫描与 DHCP 重连一次。租约只在 FAST_WIFI_LEASE_S 内复用，系统时间在软件
+/// 复位与深度睡眠后仍然连续，上电后从 0 开始，此时视为过期改走 DHCP。
+/// 就绪由 WiFi 事件驱动，等待期间不轮询 status()。
+class FastWifi {
+public:
+  FastWifi(const char *ssid, const char *password, bool reuse_lease = true);
+  FastWifi(const FastWifi &) = delete;
+  FastWifi &operator=(const FastWifi &) = delete;
+
+  int begin();
+  int wait(uint32_t timeout_ms);
+  int save();
+  void forget();
+
+  /// 本次是否按缓存直连成功
+  bool fast() const { return used_cache && connected; }
+
+private:
+  static void on_event(arduino_event_id_t event);
+  int load();
+  bool lease_valid() const;
+  void connect_full();
+
+  const char *ssid;
+  const char *password;
+  bool reuse_lease;
+  bool used_cache;
+  bool used_lease; // 本次按缓存的租约配置了静态地址
+  bool connected;
+  WifiCache cache;
+  EventGroupHandle_t events;
+};
@@ -0,0 +1,111 @@
+#include "bitrate.h"
+#include <esp_timer.h>
+
+const OperatingPoint BITRATE_LADDER[] = {
+    {FRAMESIZE_QQVGA, 20, 5},
+    {FRAMESIZE_QCIF, 12, 10}, // camera_init 的默认配置
+    {FRAMESIZE_QVGA, 12, 10},
+    {FRAMESIZE_CIF, 12, 15},
+    {FRAMESIZE_VGA, 12, 15},
+    {FRAMESIZE_VGA, 10, 20},
+};
+const uint8_t BITRATE_LEVELS =
+    sizeof(BITRATE_LADDER) / sizeof(BITRATE_LADDER[0]);
+
+BitrateController::BitrateController(CapturePipeline &pipeline, uint8_t level)
+    : pipeline(pipeline),
+      current(level < BITRATE_LEVELS ? level : BITRATE_LEVELS - 1),
+      calm_windows(0), rate(0), busy_pct(0), window_start(0), win_frames(0),
+      win_full(0), win_bytes(0), win_send_us(0) {}
+
+/**
+ * @brief 把当前档位写入摄像头与流水线
+ *
+ * @return int 0 表示成功， -1 表示失败
+ */
+int BitrateController::apply() {
+  sensor_t *s = esp_camera_sensor_get();
+  if (s == NULL) {
+    return -1;
+  }
+  const OperatingPoint &p = BITRATE_LADDER[current];
+  if (s->set_framesize(s, p.frame_size) != 0 ||
+      s->set_quality(s, p.quality) != 0) {
+    return -1;
+  }
+  pipeline.set_frame_interval(1000000U / p.fps);
+  return 0;
+}
+
+/**
+ * @brief 切换到指定档位并重新开始统计
+ *
+ * @details 流水线的平均延迟同时清零：旧档位的延迟尖峰留在 1/8 权重的均值里，
+ * 会让新档位的第一个窗口再降一档
+ *
+ * @param level 档位，0 为最低
+ * @return int 0 表示成功， -1 表示失败
+ */
+int BitrateController::set_level(uint8_t level) {
+  if (level >= BITRATE_LEVELS) {
+    return -1;
+  }
+  current = level;
+  calm_windows = 0;
+  window_start = 0;
+  pipeline.reset_latency();
+  return apply();
+}
+
+/**
+ * @brief 记录一帧的发送结果，窗口期满时调整档位
+ *
+ * @param bytes 本帧明文字节数
+ * @param send_us 本帧加密发送耗时，套接字发送缓冲区满时包含阻塞时间
+ */
+void BitrateController::on_frame(uint32_t bytes, uint32_t send_us) {
+  int64_t now = esp_timer_get_time();
+  if (window_start == 0) {
+    window_start = now;
+    win_frames = win_full = 0;
+    win_bytes = win_send_us = 0;
+  }
+  ++win_frames;
+  win_bytes += bytes;
+  win_send_us += send_us;
+  // 正在发送的这一帧也计入深度，等于容量说明采集端已经在等待消费者
+  if (pipeline.depth() >= pipeline.capacity()) {
+    ++win_full;
+  }
+  if (now - window_start >= BITRATE_WINDOW_US) {
+    evaluate(now);
+  }
+}
+
+void BitrateController::evaluate(int64_t now) {
+  uint64_t elapsed = now - window_start;
+  rate = win_send_us ? (uint32_t)(win_bytes * 1000000U / win_send_us) : 0;
+  busy_pct = (uint32_t)(win_send_us * 100U / elapsed);
+  uint32_t full_pct = win_full * 100U / win_frames;
+  CaptureStats st;
+  pipeline.stats(st);
+  window_start = 0;
+
+  // 降档不等待：延迟一旦超限，每多一个窗口都在继续累积
+  if (busy_pct > BITRATE_BUSY_HIGH_PCT || full_pct > BITRATE_FULL_HIGH_PCT ||
+      st.latency_us > BITRATE_LATENCY_MAX_US) {
+    if (current > 0) {
+      set_level(current - 1);
+    }
+    calm_windows = 0;
+    return;
+  }
+  if (busy_pct < BITRATE_BUSY_LOW_PCT && win_full == 0 &&
+      st.latency_us < BITRATE_LATENCY_MAX_US / 2) {
+    if (++calm_windows >= BITRATE_UP_WINDOWS && current + 1 < BITRATE_LEVELS) {
+      set_level(current + 1);
+    }
+    return;
+  }
+  calm_windows = 0;
+}
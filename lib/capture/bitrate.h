@@ -0,0 +1,61 @@
+#pragma once
+#include "capture.h"
+#include <Arduino.h>
+#include <esp_camera.h>
+
+#define BITRATE_WINDOW_US 1000000U   // 每个统计窗口 1 s
+#define BITRATE_BUSY_HIGH_PCT 85U    // 发送占用超过该比例即降档
+#define BITRATE_BUSY_LOW_PCT 40U     // 发送占用低于该比例才考虑升档
+#define BITRATE_FULL_HIGH_PCT 50U    // 超过一半的帧看到队列已满即降档
+#define BITRATE_UP_WINDOWS 3U        // 连续满足条件的窗口数，防止来回跳档
+#define BITRATE_LATENCY_MAX_US 500000U // 端到端延迟上限，超过即降档
+#define BITRATE_DEFAULT_LEVEL 1U
+
+/// 一个工作点：分辨率、JPEG 质量（0~63，越低画质越高）与目标帧率
+struct OperatingPoint {
+  framesize_t frame_size;
+  uint8_t quality;
+  uint8_t fps;
+};
+
+/// 从低到高排列的工作点，最高档的分辨率不得超过 CAMERA_MAX_FRAMESIZE
+extern const OperatingPoint BITRATE_LADDER[];
+extern const uint8_t BITRATE_LEVELS;
+
+/// 自适应码率控制器
+///
+/// 消费者每发完一帧调用 on_frame，控制器按窗口统计发送耗时占比、队列深度与
+/// 流水线延迟：链路跟不上时立即降一档，连续 BITRATE_UP_WINDOWS 个窗口都很空闲
+/// 才升一档。档位通过 sensor_t 的 set_framesize / set_quality 与流水线的取帧
+/// 间隔生效，只在消费者任务中调用。
+class BitrateController {
+public:
+  explicit BitrateController(CapturePipeline &pipeline,
+                             uint8_t level = BITRATE_DEFAULT_LEVEL);
+
+  int apply();
+  int set_level(uint8_t level);
+  void on_frame(uint32_t bytes, uint32_t send_us);
+
+  uint8_t level() const { return current; }
+  const OperatingPoint &point() const { return BITRATE_LADDER[current]; }
+  /// 上一个窗口实测的发送吞吐量，字节/秒（只计发送耗时）
+  uint32_t throughput() const { return rate; }
+  /// 上一个窗口的发送耗时占比，百分数
+  uint32_t busy() const { return busy_pct; }
+
+private:
+  void evaluate(int64_t now);
+
+  CapturePipeline &pipeline;
+  volatile uint8_t current;
+  uint8_t calm_windows; // 连续空闲窗口数
+  volatile uint32_t rate;
+  volatile uint32_t busy_pct;
+
+  int64_t window_start;
+  uint32_t win_frames;
+  uint32_t win_full;    // 发送时队列已满的帧数
+  uint64_t win_bytes;
+  uint64_t win_send_us;
+};
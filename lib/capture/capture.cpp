@@ -0,0 +1,219 @@
+#include "capture.h"
+#include <esp_timer.h>
+
+#define CAPTURE_IDLE_WAIT_MS 100U // 在途帧已满时，采集任务等待消费者通知的最长时间
+#define CAPTURE_STOP_POLL_MS 10U
+
+/// 指数滑动平均，权重 1/8
+static void ewma(std::atomic<uint32_t> &avg, uint32_t sample) {
+  uint32_t old = avg.load(std::memory_order_relaxed);
+  avg.store(old == 0 ? sample : old - (old >> 3) + (sample >> 3),
+            std::memory_order_relaxed);
+}
+
+/**
+ * @brief 创建采集流水线，start 之前不占用任何资源
+ *
+ * @param consumer 在消费者核上对每一帧调用
+ * @param arg 传给 consumer 的参数
+ * @param max_in_flight 同时在途的帧数上限，不超过 CAPTURE_QUEUE_LEN，
+ * 应取 CAMERA_FB_COUNT - 1
+ */
+CapturePipeline::CapturePipeline(FrameConsumer consumer, void *arg,
+                                 uint32_t max_in_flight)
+    : consumer(consumer), consumer_arg(arg),
+      max_in_flight(max_in_flight == 0                   ? 1
+                    : max_in_flight > CAPTURE_QUEUE_LEN ? CAPTURE_QUEUE_LEN
+                                                        : max_in_flight),
+      max_age_us(0), frame_interval_us(0), in_flight(0), run(false),
+      capture_handle(NULL), consumer_handle(NULL), exited(NULL) {
+  reset_stats();
+}
+
+CapturePipeline::~CapturePipeline() { stop(); }
+
+/**
+ * @brief 创建采集任务与消费者任务，相机须已初始化
+ *
+ * @param capture_core 采集任务所在的核
+ * @param consumer_core 消费者任务所在的核
+ * @param priority 两个任务的优先级
+ * @return int 0 表示成功， -1 表示失败
+ */
+int CapturePipeline::start(BaseType_t capture_core, BaseType_t consumer_core,
+                           UBaseType_t priority) {
+  if (run || capture_handle != NULL || consumer_handle != NULL) {
+    return -1;
+  }
+  exited = xSemaphoreCreateCounting(2, 0);
+  if (exited == NULL) {
+    return -1;
+  }
+  run = true;
+  // 先建消费者，采集任务第一次通知时句柄已经有效
+  if (xTaskCreatePinnedToCore(consumer_task, "cap_consume",
+                              CAPTURE_CONSUMER_STACK_SIZE, this, priority,
+                              &consumer_handle, consumer_core) != pdPASS) {
+    run = false;
+    consumer_handle = NULL;
+    vSemaphoreDelete(exited);
+    exited = NULL;
+    return -1;
+  }
+  if (xTaskCreatePinnedToCore(capture_task, "cap_grab", CAPTURE_STACK_SIZE,
+                              this, priority, &capture_handle,
+                              capture_core) != pdPASS) {
+    capture_handle = NULL;
+    stop();
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief 停止两个任务并把队列中剩余的帧缓冲区归还驱动，阻塞直到任务退出
+ *
+ * @details 任务退出循环后 give exited 并挂起自己，由这里删除；句柄只在这里
+ * 清空，因此等待期间反复通知的对象始终是存在的任务（运行中或已挂起）
+ */
+void CapturePipeline::stop() {
+  run = false;
+  uint32_t alive = (capture_handle != NULL) + (consumer_handle != NULL);
+  while (alive > 0) {
+    if (capture_handle != NULL) {
+      xTaskNotifyGive(capture_handle);
+    }
+    if (consumer_handle != NULL) {
+      xTaskNotifyGive(consumer_handle);
+    }
+    if (xSemaphoreTake(exited, pdMS_TO_TICKS(CAPTURE_STOP_POLL_MS)) == pdTRUE) {
+      --alive;
+    }
+  }
+  if (capture_handle != NULL) {
+    vTaskDelete(capture_handle);
+    capture_handle = NULL;
+  }
+  if (consumer_handle != NULL) {
+    vTaskDelete(consumer_handle);
+    consumer_handle = NULL;
+  }
+  if (exited != NULL) {
+    vSemaphoreDelete(exited);
+    exited = NULL;
+  }
+  Slot slot;
+  while (queue.pop(slot)) {
+    esp_camera_fb_return(slot.fb);
+  }
+  in_flight.store(0);
+}
+
+void CapturePipeline::stats(CaptureStats &out) const {
+  out.captured = captured.load(std::memory_order_relaxed);
+  out.consumed = consumed.load(std::memory_order_relaxed);
+  out.dropped = dropped.load(std::memory_order_relaxed);
+  out.failed = failed.load(std::memory_order_relaxed);
+  out.capture_us = capture_us.load(std::memory_order_relaxed);
+  out.consume_us = consume_us.load(std::memory_order_relaxed);
+  out.latency_us = latency_us.load(std::memory_order_relaxed);
+  out.latency_max_us = latency_max_us.load(std::memory_order_relaxed);
+}
+
+void CapturePipeline::reset_stats() {
+  captured = consumed = dropped = failed = 0;
+  capture_us = consume_us = latency_us = latency_max_us = 0;
+}
+
+/**
+ * @brief 任务退出循环后通知 stop 并挂起，等待 stop 删除
+ */
+void CapturePipeline::park(CapturePipeline *self) {
+  xSemaphoreGive(self->exited);
+  for (;;) {
+    vTaskSuspend(NULL);
+  }
+}
+
+void CapturePipeline::capture_task(void *arg) {
+  CapturePipeline *self = static_cast<CapturePipeline *>(arg);
+  self->capture_loop();
+  park(self);
+}
+
+void CapturePipeline::consumer_task(void *arg) {
+  CapturePipeline *self = static_cast<CapturePipeline *>(arg);
+  self->consumer_loop();
+  park(self);
+}
+
+/**
+ * @details 在途帧达到上限时不再取帧，把最后一个缓冲区留给驱动持续覆盖写入，
+ * 消费者归还一帧后立即取到的就是最新的一帧
+ */
+void CapturePipeline::capture_loop() {
+  int64_t last_grab = 0;
+  while (run) {
+    if (in_flight.load(std::memory_order_acquire) >= max_in_flight) {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CAPTURE_IDLE_WAIT_MS));
+      continue;
+    }
+    int64_t t0 = esp_timer_get_time();
+    int64_t wait = last_grab + frame_interval_us.load() - t0;
+    if (wait > 0) { // 限帧率：等到间隔期满再取，GRAB_LATEST 下取到的仍是最新帧
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait / 1000) + 1);
+      continue;
+    }
+    last_grab = t0;
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (fb == NULL) {
+      failed.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    Slot slot = {fb, esp_timer_get_time()};
+    ewma(capture_us, (uint32_t)(slot.grabbed_us - t0));
+    in_flight.fetch_add(1, std::memory_order_acq_rel);
+    if (!queue.push(slot)) {
+      in_flight.fetch_sub(1, std::memory_order_acq_rel);
+      esp_camera_fb_return(fb);
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    captured.fetch_add(1, std::memory_order_relaxed);
+    TaskHandle_t peer = consumer_handle;
+    if (peer != NULL) {
+      xTaskNotifyGive(peer);
+    }
+  }
+}
+
+void CapturePipeline::consumer_loop() {
+  while (run) {
+    Slot slot;
+    if (!queue.pop(slot)) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    int64_t t0 = esp_timer_get_time();
+    if (max_age_us != 0 && t0 - slot.grabbed_us > max_age_us) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+    } else if (consumer(slot.fb, consumer_arg) < 0) {
+      failed.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      int64_t t1 = esp_timer_get_time();
+      uint32_t latency = (uint32_t)(t1 - slot.grabbed_us);
+      ewma(consume_us, (uint32_t)(t1 - t0));
+      ewma(latency_us, latency);
+      if (latency > latency_max_us.load(std::memory_order_relaxed)) {
+        latency_max_us.store(latency, std::memory_order_relaxed);
+      }
+      consumed.fetch_add(1, std::memory_order_relaxed);
+    }
+    esp_camera_fb_return(slot.fb);
+    in_flight.fetch_sub(1, std::memory_order_acq_rel);
+    TaskHandle_t peer = capture_handle; // start 中可能尚未创建采集任务
+    if (peer != NULL) {
+      xTaskNotifyGive(peer);
+    }
+  }
+}
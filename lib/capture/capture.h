@@ -0,0 +1,85 @@
+#pragma once
+#include "spsc_queue.h"
+#include <Arduino.h>
+#include <atomic>
+#include <esp_camera.h>
+
+#define CAPTURE_QUEUE_LEN 2U          // 须为 2 的幂
+#define CAPTURE_STACK_SIZE 4096U
+#define CAPTURE_CONSUMER_STACK_SIZE 8192U // 消费者要加密发送，栈大一些
+
+/// 消费一帧（例如加密发送），返回负数表示失败。返回后帧缓冲区即被归还驱动
+typedef int (*FrameConsumer)(camera_fb_t *fb, void *arg);
+
+/// 流水线统计，时间单位为微秒，均值为指数滑动平均
+struct CaptureStats {
+  uint32_t captured;     // 采集并入队的帧数
+  uint32_t consumed;     // 消费成功的帧数
+  uint32_t dropped;      // 入队失败或在队列中超过 max_age_us 而丢弃的帧数
+  uint32_t failed;       // 取帧失败或消费失败的次数
+  uint32_t capture_us;   // 等待一帧（esp_camera_fb_get）的平均耗时
+  uint32_t consume_us;   // 消费一帧的平均耗时
+  uint32_t latency_us;   // 取到帧到消费完成的平均延迟
+  uint32_t latency_max_us;
+};
+
+/// 相机采集流水线
+///
+/// 采集任务与消费任务分别固定在两个核上，通过无锁队列传递帧缓冲区指针。
+/// 同时在途（排队与正在消费）的帧不超过 CAMERA_FB_COUNT - 1，驱动始终保留
+/// 一个缓冲区以 CAMERA_GRAB_LATEST 方式持续采集，因此消费者拿到的总是较新的帧。
+/// 稳态帧率由较慢的一级决定，而不是两级耗时之和。
+class CapturePipeline {
+public:
+  CapturePipeline(FrameConsumer consumer, void *arg,
+                  uint32_t max_in_flight = CAPTURE_QUEUE_LEN);
+  ~CapturePipeline();
+  CapturePipeline(const CapturePipeline &) = delete;
+  CapturePipeline &operator=(const CapturePipeline &) = delete;
+
+  int start(BaseType_t capture_core = 0, BaseType_t consumer_core = 1,
+            UBaseType_t priority = tskIDLE_PRIORITY + 2);
+  void stop();
+  bool running() const { return run; }
+  /// 采集与消费任务的句柄，未运行时为 nullptr
+  TaskHandle_t grab_task() const { return capture_handle; }
+  TaskHandle_t consume_task() const { return consumer_handle; }
+
+  void set_max_age(uint32_t us) { max_age_us = us; }
+  /// 两次取帧的最小间隔，用于限制帧率，0 表示不限制
+  void set_frame_interval(uint32_t us) { frame_interval_us = us; }
+  /// 当前在途（排队与正在消费）的帧数
+  uint32_t depth() const { return in_flight.load(std::memory_order_acquire); }
+  uint32_t capacity() const { return max_in_flight; }
+  void stats(CaptureStats &out) const;
+  void reset_stats();
+  /// 重新开始平均延迟，下一帧的延迟即为新的均值；最大延迟保留
+  void reset_latency() { latency_us.store(0, std::memory_order_relaxed); }
+
+private:
+  struct Slot {
+    camera_fb_t *fb;
+    int64_t grabbed_us;
+  };
+
+  static void capture_task(void *arg);
+  static void consumer_task(void *arg);
+  static void park(CapturePipeline *self);
+  void capture_loop();
+  void consumer_loop();
+
+  FrameConsumer consumer;
+  void *consumer_arg;
+  uint32_t max_in_flight;
+  uint32_t max_age_us; // 0 表示不丢弃旧帧
+  std::atomic<uint32_t> frame_interval_us;
+  SpscQueue<Slot, CAPTURE_QUEUE_LEN> queue;
+  std::atomic<uint32_t> in_flight;
+  volatile bool run;
+  TaskHandle_t capture_handle; // 只由 start / stop 修改
+  TaskHandle_t consumer_handle;
+  SemaphoreHandle_t exited;    // 每个任务退出循环时 give 一次
+
+  std::atomic<uint32_t> captured, consumed, dropped, failed;
+  std::atomic<uint32_t> capture_us, consume_us, latency_us, latency_max_us;
+};
@@ -0,0 +1,163 @@
+#include "fingerprint.h"
+#include "motion.h"
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <img_converters.h>
+#include <string.h>
+
+/**
+ * @brief 把一帧 JPEG 全尺寸解码为灰度，写入 buf 的前 width * height 字节
+ *
+ * @param buf 至少 width * height * 2 字节的解码缓冲区
+ * @return int 0 表示成功， -1 表示失败
+ */
+static int decode_gray(const camera_fb_t *fb, uint8_t *buf) {
+  if (fb->format != PIXFORMAT_JPEG ||
+      !jpg2rgb565(fb->buf, fb->len, buf, JPG_SCALE_NONE)) {
+    return -1;
+  }
+  rgb565_to_gray(buf, buf, fb->width * fb->height);
+  return 0;
+}
+
+/**
+ * @brief acc[i] += src[i]，按 32 位字一次累加两个 16 位通道
+ *
+ * @details 调用方保证累加不超过 FP_ACCUMULATE_MAX 帧，各通道不会溢出到相邻通道
+ */
+void accumulate_u8(uint16_t *acc, const uint8_t *src, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint32_t s, lo, hi;
+    memcpy(&s, src + i, 4);
+    memcpy(&lo, acc + i, 4);
+    memcpy(&hi, acc + i + 2, 4);
+    // 小端下 acc[i] 在低 16 位：把源字节 0、1 展开到 lo 的两个通道，2、3 到 hi
+    lo += (s & 0xff) | ((s & 0xff00) << 8);
+    hi += ((s >> 16) & 0xff) | ((s >> 8) & 0xff0000);
+    memcpy(acc + i, &lo, 4);
+    memcpy(acc + i + 2, &hi, 4);
+  }
+  for (; i < n; ++i) {
+    acc[i] += src[i];
+  }
+}
+
+/**
+ * @brief out[i] = round(acc[i] / frames)
+ */
+void average_u16(const uint16_t *acc, uint8_t *out, size_t n,
+                 uint16_t frames) {
+  uint32_t half = frames / 2;
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = (uint8_t)((acc[i] + half) / frames);
+  }
+}
+
+/**
+ * @brief 由一帧 JPEG 生成噪声残差指纹（prnu_descriptor），握手时可代替原始
+ * JPEG 上传
+ *
+ * @param fb JPEG 格式的一帧
+ * @param out 传出参数，描述子，PRNU_DESCRIPTOR_MAX 字节足够
+ * @param out_len out 的大小
+ * @return int 描述子字节数，失败为 -1
+ *
+ * @details 全尺寸解码到 PSRAM 中的临时缓冲区，原地转为灰度后计算残差，
+ * 返回前释放缓冲区
+ */
+int residual_fingerprint(const camera_fb_t *fb, uint8_t *out, size_t out_len) {
+  size_t pixels = fb->width * fb->height;
+  uint8_t *buf = (uint8_t *)heap_caps_malloc(pixels * 2, MALLOC_CAP_SPIRAM);
+  if (buf == NULL) {
+    return -1;
+  }
+  int len = -1;
+  if (decode_gray(fb, buf) == 0) {
+    len = prnu_descriptor(buf, fb->width, fb->height, out, out_len);
+  }
+  heap_caps_free(buf);
+  return len;
+}
+
+/**
+ * @brief 连续取 frames 帧，平均后生成一个噪声残差指纹
+ *
+ * @param frames 累加帧数，1 ~ FP_ACCUMULATE_MAX
+ * @param frame_size 采集分辨率，宽高都不能超过当前分辨率（驱动的帧缓冲区按
+ * 当前配置分配，更大的 JPEG 放不下）；结束后恢复原分辨率
+ * @param out 传出参数，描述子，PRNU_DESCRIPTOR_MAX 字节足够
+ * @param out_len out 的大小
+ * @param stats 非空时传出耗时统计
+ * @return int 描述子字节数，失败为 -1
+ *
+ * @details 逐帧流式累加：每帧解码到同一个 PSRAM 解码缓冲区，加到 16 位累加器后
+ * 立即归还帧缓冲区，常驻内存只有解码缓冲区与累加器。N 帧平均使时间噪声的方差
+ * 降为 1/N，而传感器的固定噪声模式不变，单帧 QCIF 的残差因此更稳定。
+ */
+int accumulate_fingerprint(uint8_t frames, framesize_t frame_size,
+                           uint8_t *out, size_t out_len,
+                           AccumulateStats *stats) {
+  int64_t t_start = esp_timer_get_time();
+  AccumulateStats st = {};
+  sensor_t *s = esp_camera_sensor_get();
+  if (frames == 0 || s == NULL) {
+    return -1;
+  }
+  framesize_t old_size = s->status.framesize;
+  if (frame_size >= FRAMESIZE_INVALID ||
+      resolution[frame_size].width > resolution[old_size].width ||
+      resolution[frame_size].height > resolution[old_size].height) {
+    return -1; // 需要更大的分辨率时先用 camera_set_profile 切换配置
+  }
+  if (old_size != frame_size && s->set_framesize(s, frame_size) != 0) {
+    return -1;
+  }
+  uint16_t width = resolution[frame_size].width;
+  uint16_t height = resolution[frame_size].height;
+  size_t pixels = (size_t)width * height;
+
+  int len = -1;
+  uint8_t *buf = (uint8_t *)heap_caps_malloc(pixels * 2, MALLOC_CAP_SPIRAM);
+  uint16_t *acc = (uint16_t *)heap_caps_malloc(pixels * sizeof(uint16_t),
+                                               MALLOC_CAP_SPIRAM);
+  if (buf != NULL && acc != NULL) {
+    memset(acc, 0, pixels * sizeof(uint16_t));
+    while (st.frames < frames && st.skipped < FP_SETTLE_FRAMES + frames) {
+      int64_t t0 = esp_timer_get_time();
+      camera_fb_t *fb = esp_camera_fb_get();
+      int64_t t1 = esp_timer_get_time();
+      st.grab_us += t1 - t0;
+      if (fb == NULL) {
+        ++st.skipped;
+        continue;
+      }
+      // 切换分辨率后驱动中可能还有旧尺寸的帧
+      bool ok = fb->width == width && fb->height == height &&
+                decode_gray(fb, buf) == 0;
+      esp_camera_fb_return(fb);
+      st.decode_us += esp_timer_get_time() - t1;
+      if (!ok) {
+        ++st.skipped;
+        continue;
+      }
+      accumulate_u8(acc, buf, pixels);
+      ++st.frames;
+    }
+    if (st.frames == frames) {
+      average_u16(acc, buf, pixels, st.frames);
+      len = prnu_descriptor(buf, width, height, out, out_len);
+    }
+  }
+  heap_caps_free(acc);
+  heap_caps_free(buf);
+  if (old_size != frame_size) {
+    s->set_framesize(s, old_size);
+  }
+
+  st.total_us = esp_timer_get_time() - t_start;
+  if (stats) {
+    *stats = st;
+  }
+  return len;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "prnu.h"
+#include <Arduino.h>
+#include <esp_camera.h>
+
+#define FP_ACCUMULATE_FRAMES 8U  // 默认累加的帧数
+#define FP_ACCUMULATE_MAX 255U   // 255 帧 8 bit 灰度之和不会超过 16 bit
+#define FP_SETTLE_FRAMES 3U      // 切换分辨率后最多丢弃的旧尺寸帧数
+
+/// 多帧累加的耗时统计，时间单位为微秒
+struct AccumulateStats {
+  uint8_t frames;    // 实际累加的帧数
+  uint32_t skipped;  // 因尺寸不符或解码失败丢弃的帧数，上限可超过 255
+  uint32_t grab_us;  // 等待取帧
+  uint32_t decode_us; // JPEG 解码与灰度转换
+  uint32_t total_us;  // 含累加、求平均与计算描述子
+};
+
+void accumulate_u8(uint16_t *acc, const uint8_t *src, size_t n);
+void average_u16(const uint16_t *acc, uint8_t *out, size_t n, uint16_t frames);
+
+int residual_fingerprint(const camera_fb_t *fb, uint8_t *out, size_t out_len);
+int accumulate_fingerprint(uint8_t frames, framesize_t frame_size,
+                           uint8_t *out, size_t out_len,
+                           AccumulateStats *stats = nullptr);
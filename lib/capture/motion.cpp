@@ -0,0 +1,100 @@
+#include "motion.h"
+#include <img_converters.h>
+#include <stdlib.h>
+#include <string.h>
+
+MotionGate::MotionGate(uint32_t pixel_threshold, uint16_t min_blocks,
+                       uint32_t keyframe_ms)
+    : pixel_threshold(pixel_threshold), min_blocks(min_blocks),
+      keyframe_ms(keyframe_ms), rgb(NULL), gray(NULL), ref(NULL), capacity(0),
+      width(0), height(0), last_sent_ms(0), n_passed(0), n_suppressed(0),
+      n_keyframes(0), last_changed(0) {}
+
+MotionGate::~MotionGate() {
+  free(rgb);
+  free(gray);
+  free(ref);
+}
+
+/**
+ * @brief 设置变化阈值
+ *
+ * @param pixel_threshold 块内平均每像素灰度差（7 bit 灰度，0~127）
+ * @param min_blocks 至少有多少块变化才发送
+ */
+void MotionGate::set_threshold(uint32_t pixel_threshold, uint16_t min_blocks) {
+  this->pixel_threshold = pixel_threshold;
+  this->min_blocks = min_blocks;
+}
+
+/**
+ * @brief 判断一帧是否需要发送，需要发送时把它的预览设为新的参考帧
+ *
+ * @param fb JPEG 格式的一帧
+ * @return int 1 表示发送，0 表示与参考帧相比没有明显变化可以跳过，
+ * -1 表示无法生成预览（调用方应照常发送）
+ */
+int MotionGate::check(const camera_fb_t *fb) {
+  uint16_t ref_w = width, ref_h = height;
+  if (preview(fb) < 0) {
+    width = height = 0; // 参考帧已失效
+    ++n_passed;
+    return -1;
+  }
+
+  uint32_t now = millis();
+  if (ref_w != width || ref_h != height || now - last_sent_ms >= keyframe_ms) {
+    ++n_keyframes;
+  } else {
+    last_changed = gray_changed_blocks(gray, ref, width, height, MOTION_BLOCK,
+                                       pixel_threshold);
+    if (last_changed < min_blocks) {
+      ++n_suppressed;
+      return 0;
+    }
+  }
+
+  uint8_t *t = ref;
+  ref = gray;
+  gray = t;
+  last_sent_ms = now;
+  ++n_passed;
+  return 1;
+}
+
+/**
+ * @brief 把 fb 以 1/8 比例解码为灰度预览，写入 gray
+ *
+ * @return int 0 表示成功， -1 表示失败
+ */
+int MotionGate::preview(const camera_fb_t *fb) {
+  if (fb->format != PIXFORMAT_JPEG) {
+    return -1;
+  }
+  uint16_t w = fb->width >> MOTION_SCALE_SHIFT;
+  uint16_t h = fb->height >> MOTION_SCALE_SHIFT;
+  size_t pixels = (size_t)w * h;
+  if (pixels == 0) {
+    return -1;
+  }
+  if (pixels > capacity) {
+    free(rgb);
+    free(gray);
+    free(ref);
+    rgb = (uint8_t *)malloc(pixels * 2);
+    gray = (uint8_t *)malloc(pixels);
+    ref = (uint8_t *)malloc(pixels);
+    capacity = rgb && gray && ref ? pixels : 0;
+    if (capacity == 0) {
+      return -1;
+    }
+  }
+  if (!jpg2rgb565(fb->buf, fb->len, rgb, JPG_SCALE_8X)) {
+    return -1;
+  }
+
+  rgb565_to_gray(rgb, gray, pixels);
+  width = w;
+  height = h;
+  return 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "gray_diff.h"
+#include <Arduino.h>
+#include <esp_camera.h>
+
+#define MOTION_SCALE_SHIFT 3U          // 预览为原图的 1/8，JPEG 以 1/8 解码时只用 DC 系数
+#define MOTION_BLOCK 4U                // 比较块边长（预览像素），即原图 32x32
+#define MOTION_PIXEL_THRESHOLD 6U      // 块内平均灰度差（7 bit 灰度）超过该值视为变化
+#define MOTION_MIN_BLOCKS 2U           // 变化块达到该数量才发送
+#define MOTION_KEYFRAME_MS 10000U      // 静止画面也按该间隔发送一帧关键帧
+
+/// 变化检测：只有画面变化超过阈值或到了关键帧间隔的帧才需要发送
+///
+/// 每帧 JPEG 以 1/8 比例解码成灰度预览（每个 8x8 DCT 块一个像素，只需熵解码与
+/// DC 系数），按 MOTION_BLOCK 分块与上一帧已发送的预览比较。参考帧只在发送时
+/// 更新，缓慢的变化会累积到超过阈值为止。分辨率变化时下一帧总是发送。
+class MotionGate {
+public:
+  explicit MotionGate(uint32_t pixel_threshold = MOTION_PIXEL_THRESHOLD,
+                      uint16_t min_blocks = MOTION_MIN_BLOCKS,
+                      uint32_t keyframe_ms = MOTION_KEYFRAME_MS);
+  ~MotionGate();
+  MotionGate(const MotionGate &) = delete;
+  MotionGate &operator=(const MotionGate &) = delete;
+
+  int check(const camera_fb_t *fb);
+  void set_threshold(uint32_t pixel_threshold, uint16_t min_blocks);
+  void set_keyframe_interval(uint32_t ms) { keyframe_ms = ms; }
+
+  uint32_t passed() const { return n_passed; }
+  uint32_t suppressed() const { return n_suppressed; }
+  uint32_t keyframes() const { return n_keyframes; }
+  uint16_t last_changed_blocks() const { return last_changed; }
+
+private:
+  int preview(const camera_fb_t *fb);
+
+  uint32_t pixel_threshold;
+  uint16_t min_blocks;
+  uint32_t keyframe_ms;
+
+  uint8_t *rgb;     // 1/8 解码输出，RGB565
+  uint8_t *gray;    // 当前帧预览
+  uint8_t *ref;     // 上一次发送的帧预览
+  size_t capacity;  // 预览像素容量
+  uint16_t width, height; // 预览尺寸，0 表示还没有参考帧
+  uint32_t last_sent_ms;
+
+  volatile uint32_t n_passed;
+  volatile uint32_t n_suppressed;
+  volatile uint32_t n_keyframes;
+  volatile uint16_t last_changed;
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+
+/// 单生产者单消费者的有界无锁队列，生产者与消费者可以在不同的核上。
+/// N 须为 2 的幂；head / tail 只增不减，溢出后按无符号差值仍然正确。
+template <typename T, uint32_t N> class SpscQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+  SpscQueue() : head(0), tail(0) {}
+
+  /// 仅由生产者调用，队列满时返回 false
+  bool push(const T &item) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    items[t & (N - 1)] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// 仅由消费者调用，队列空时返回 false
+  bool pop(T &out) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (tail.load(std::memory_order_acquire) == h) {
+      return false;
+    }
+    out = items[h & (N - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  uint32_t size() const {
+    return tail.load(std::memory_order_acquire) -
+           head.load(std::memory_order_acquire);
+  }
+
+private:
+  T items[N];
+  std::atomic<uint32_t> head; // 下一个出队位置，只由消费者写
+  std::atomic<uint32_t> tail; // 下一个入队位置，只由生产者写
+};
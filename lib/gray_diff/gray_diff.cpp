@@ -0,0 +1,70 @@
+#include "gray_diff.h"
+#include <string.h>
+
+uint32_t block_sad(const uint8_t *a, const uint8_t *b, size_t n) {
+  uint32_t sum = 0;
+  size_t i = 0;
+  while (i + 4 <= n) {
+    // 每个 16 位通道最多累加 255 次 128，不会溢出
+    uint32_t lo = 0, hi = 0;
+    size_t end = n - i > 4 * 255 ? i + 4 * 255 : n - (n - i) % 4;
+    for (; i < end; i += 4) {
+      uint32_t x, y;
+      memcpy(&x, a + i, 4);
+      memcpy(&y, b + i, 4);
+      x = (x >> 1) & 0x7f7f7f7fU;
+      y = (y >> 1) & 0x7f7f7f7fU;
+      // 每字节 128 + x - y，落在 1~255，不会向相邻字节借位
+      uint32_t v = (x | 0x80808080U) - y;
+      uint32_t neg = (~v & 0x80808080U) >> 7; // x < y 的字节为 1
+      uint32_t d = ((v & 0x7f7f7f7fU) ^ (neg * 0x7fU)) + neg;
+      lo += d & 0x00ff00ffU;
+      hi += (d >> 8) & 0x00ff00ffU;
+    }
+    lo += hi;
+    sum += (lo & 0xffffU) + (lo >> 16);
+  }
+  for (; i < n; ++i) {
+    int d = (a[i] >> 1) - (b[i] >> 1);
+    sum += d < 0 ? -d : d;
+  }
+  return sum;
+}
+
+void rgb565_to_gray(const uint8_t *rgb, uint8_t *gray, size_t pixels) {
+  // 近似亮度 (2R + 5G + B) / 8；第 i 个灰度只覆盖已读过的字节
+  for (size_t i = 0; i < pixels; ++i) {
+    uint8_t h8 = rgb[2 * i], l8 = rgb[2 * i + 1];
+    uint32_t r = h8 & 0xf8;
+    uint32_t g = ((h8 & 0x07) << 5) | ((l8 & 0xe0) >> 3);
+    uint32_t b = (l8 & 0x1f) << 3;
+    gray[i] = (uint8_t)((2 * r + 5 * g + b) >> 3);
+  }
+}
+
+/**
+ * @brief 统计两幅同尺寸灰度图中平均差超过阈值的块数
+ *
+ * @param block 块边长，右边与下边不足一块的部分单独成块
+ * @param pixel_threshold 块内平均每像素灰度差（7 bit 灰度，0~127）
+ */
+uint16_t gray_changed_blocks(const uint8_t *gray, const uint8_t *ref,
+                             uint16_t width, uint16_t height, uint16_t block,
+                             uint32_t pixel_threshold) {
+  uint16_t changed = 0;
+  for (uint16_t by = 0; by < height; by += block) {
+    uint16_t bh = height - by < block ? height - by : block;
+    for (uint16_t bx = 0; bx < width; bx += block) {
+      uint16_t bw = width - bx < block ? width - bx : block;
+      uint32_t sad = 0;
+      for (uint16_t y = by; y < by + bh; ++y) {
+        size_t off = (size_t)y * width + bx;
+        sad += block_sad(gray + off, ref + off, bw);
+      }
+      if (sad > pixel_threshold * bw * bh) {
+        ++changed;
+      }
+    }
+  }
+  return changed;
+}
@@ -0,0 +1,25 @@
+#pragma once
+// 灰度预览的逐块比较：设备端的变化检测与 native 单元测试共用同一份实现
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief 两段 8 bit 灰度的绝对差之和，按 32 位字一次处理 4 个像素
+ *
+ * @details 先各右移 1 位到 7 bit，逐字节相减不会跨字节借位；结果约为 8 bit
+ * 绝对差之和的一半。n 不是 4 的倍数时尾部逐字节处理。
+ *
+ * 没有 ESP32-S3 PIE 向量版本：变化检测每次只比较预览中一行 MOTION_BLOCK（4）
+ * 个像素，只占 128 位 PIE 寄存器的四分之一，而一个 32 位字已经能一次处理这
+ * 4 个像素。
+ */
+uint32_t block_sad(const uint8_t *a, const uint8_t *b, size_t n);
+
+/**
+ * @brief jpg2rgb565 的输出（高字节在前的 RGB565）转为 8 bit 灰度，可以原地转换
+ */
+void rgb565_to_gray(const uint8_t *rgb, uint8_t *gray, size_t pixels);
+
+uint16_t gray_changed_blocks(const uint8_t *gray, const uint8_t *ref,
+                             uint16_t width, uint16_t height, uint16_t block,
+                             uint32_t pixel_threshold);
@@ -25,76 +25,136 @@
 #include "camera.h"
 #include "esp_camera.h"
 #include "xl9555.h"
+#include <Wire.h>
+#include <esp_timer.h>
 
 camera_fb_t *fb = NULL;   /* 定义一个指向camera_fb_t变量的指针(camera_fb_t结构体存放图像缓冲区相关信息) */
 
+const camera_profile_info_t camera_profiles[CAMERA_PROFILE_NUM] =
+{
+    {"fingerprint", FRAMESIZE_QCIF,       PIXFORMAT_JPEG, 10},
+    {"preview",     FRAMESIZE_QQVGA,      PIXFORMAT_JPEG, 20},
+    {"stream",      CAMERA_MAX_FRAMESIZE, PIXFORMAT_JPEG, 12},
+};
+
+static camera_profile_t camera_profile = CAMERA_PROFILE_FINGERPRINT;   /* 当前拍摄配置 */
+static pixformat_t camera_fb_format = PIXFORMAT_JPEG;                  /* 图像缓冲区按该格式分配 */
+static size_t camera_fb_capacity = 0;                                  /* 单个图像缓冲区的大小 */
+static camera_timing_t camera_timing = {0, 0, 0, 0};
+
 /**
- * @brief       摄像头(OV5640 / OV2640)初始化
- * @param       无
- * @retval      0:表示初始化成功 / 1:表示失败 
+ * @brief       单个图像缓冲区的大小，与驱动分配缓冲区的方式一致
+ * @param       size   : 分辨率
+ * @param       format : 图像格式
+ * @retval      字节数
  */
-uint8_t camera_init(void)
+static size_t camera_fb_bytes(framesize_t size, pixformat_t format)
 {
-    camera_config_t camera_config;
+    size_t pixels = (size_t)resolution[size].width * resolution[size].height;
+
+    switch (format)
+    {
+        case PIXFORMAT_JPEG:
+            return pixels / 5;          /* 驱动按原始大小的1/5估计JPEG缓冲区 */
+        case PIXFORMAT_GRAYSCALE:
+            return pixels;
+        case PIXFORMAT_RGB888:
+            return pixels * 3;
+        default:
+            return pixels * 2;
+    }
+}
+
+/**
+ * @brief       按拍摄配置填写驱动配置
+ * @param       config  : 驱动配置
+ * @param       profile : 拍摄配置
+ * @retval      无
+ */
+static void camera_fill_config(camera_config_t *config, const camera_profile_info_t *profile)
+{
+    config->ledc_channel = LEDC_CHANNEL_0;  /* 产生XCLK时钟通道 */
+    config->ledc_timer = LEDC_TIMER_0;      /* 产生XCLK时钟的定时器  */
+    config->xclk_freq_hz = 20000000;        /* 设定外部时钟频率20M */
+
+    config->pin_d7 = OV_D7_PIN;             /* 数据线7 */
+    config->pin_d6 = OV_D6_PIN;             /* 数据线6 */
+    config->pin_d5 = OV_D5_PIN;             /* 数据线5 */
+    config->pin_d4 = OV_D4_PIN;             /* 数据线4 */
+    config->pin_d3 = OV_D3_PIN;             /* 数据线3 */
+    config->pin_d2 = OV_D2_PIN;             /* 数据线2 */
+    config->pin_d1 = OV_D1_PIN;             /* 数据线1 */
+    config->pin_d0 = OV_D0_PIN;             /* 数据线0 */
+
+    config->pin_xclk  = OV_XCLK_PIN;        /* 外部时钟脚 */ 
+    config->pin_pclk  = OV_PCLK_PIN;        /* 像素时钟脚 */
+    config->pin_vsync = OV_VSYNC_PIN;       /* 垂直同步脚  */
+    config->pin_href  = OV_HREF_PIN;        /* 水平同步脚 */
+
+    config->pin_sscb_sda = OV_SDA_PIN;      /* SCCB数据线 */
+    config->pin_sscb_scl = OV_SCL_PIN;      /* SCCB时钟线 */
 
-    camera_config.ledc_channel = LEDC_CHANNEL_0;  /* 产生XCLK时钟通道 */
-    camera_config.ledc_timer = LEDC_TIMER_0;      /* 产生XCLK时钟的定时器  */
-    camera_config.xclk_freq_hz = 20000000;        /* 设定外部时钟频率20M */
-
-    camera_config.pin_d7 = OV_D7_PIN;             /* 数据线7 */
-    camera_config.pin_d6 = OV_D6_PIN;             /* 数据线6 */
-    camera_config.pin_d5 = OV_D5_PIN;             /* 数据线5 */
-    camera_config.pin_d4 = OV_D4_PIN;             /* 数据线4 */
-    camera_config.pin_d3 = OV_D3_PIN;             /* 数据线3 */
-    camera_config.pin_d2 = OV_D2_PIN;             /* 数据线2 */
-    camera_config.pin_d1 = OV_D1_PIN;             /* 数据线1 */
-    camera_config.pin_d0 = OV_D0_PIN;             /* 数据线0 */
-
-    camera_config.pin_xclk  = OV_XCLK_PIN;        /* 外部时钟脚 */ 
-    camera_config.pin_pclk  = OV_PCLK_PIN;        /* 像素时钟脚 */
-    camera_config.pin_vsync = OV_VSYNC_PIN;       /* 垂直同步脚  */
-    camera_config.pin_href  = OV_HREF_PIN;        /* 水平同步脚 */
-
-    camera_config.pin_sscb_sda = OV_SDA_PIN;      /* SCCB数据线 */
-    camera_config.pin_sscb_scl = OV_SCL_PIN;      /* SCCB时钟线 */
-
-    camera_config.pin_pwdn  = OV_PWDN_PIN;        /* 断电引脚 */
-    camera_config.pin_reset = OV_RESET_PIN;       /* 复位引脚 */
+    config->pin_pwdn  = OV_PWDN_PIN;        /* 断电引脚 */
+    config->pin_reset = OV_RESET_PIN;       /* 复位引脚 */
     
-    camera_config.frame_size   = FRAMESIZE_QCIF;  /* 图像大小 */  
-    camera_config.pixel_format = PIXFORMAT_JPEG;/* 设置图像格式 */
-    camera_config.grab_mode    = CAMERA_GRAB_WHEN_EMPTY;  /* 相机初始化的配置结构 */
-    camera_config.fb_location  = CAMERA_FB_IN_PSRAM;      /* 摄像头图像缓冲区存放位置 */
+    config->frame_size   = profile->frame_size;     /* 图像大小，决定图像缓冲区的大小 */  
+    config->pixel_format = profile->pixel_format;   /* 设置图像格式 */
+    config->grab_mode    = CAMERA_GRAB_LATEST;      /* 总是返回最新的一帧，缓冲区满时覆盖旧帧 */
+    config->fb_location  = CAMERA_FB_IN_PSRAM;      /* 摄像头图像缓冲区存放位置 */
 
-    camera_config.jpeg_quality = 12;              /* 设置JPEG图像画质(0~63,数字越低画质越高) */          
-    camera_config.fb_count     = 1;               /* 图像缓冲区数量 */            
+    config->jpeg_quality = profile->jpeg_quality;   /* 设置JPEG图像画质(0~63,数字越低画质越高) */          
+    config->fb_count     = CAMERA_FB_COUNT;         /* 图像缓冲区数量 */            
+    config->sccb_i2c_port = -1;                     /* 驱动自行初始化SCCB */
+}
+
+/**
+ * @brief       等待传感器在SCCB总线上应答(OV2640地址0x30，OV5640/OV3660地址0x3C)
+ * @param       timeout_ms : 最长等待时间
+ * @retval      0:传感器已就绪 / 1:超时
+ */
+static uint8_t camera_wait_ready(uint32_t timeout_ms)
+{
+    static const uint8_t addrs[] = {0x30, 0x3C};
+    uint32_t start = millis();
+    uint8_t ret = 1;
 
+    Wire1.begin(OV_SDA_PIN, OV_SCL_PIN, 100000);    /* 借用SCCB引脚探测，驱动初始化前释放 */
 
-    if (OV_PWDN_PIN == -1)                        /* 摄像头上电 */  
+    do
     {
-        xl9555_io_config(OV_PWDN, IO_SET_OUTPUT);   /* PWDN引脚用了XL9555的IO */
-        xl9555_pin_set(OV_PWDN, IO_SET_LOW);        /* 上电 */
-    } 
-
-    if (OV_RESET_PIN == -1)                       /* 硬件复位 */
-    { 
-        xl9555_io_config(OV_RESET, IO_SET_OUTPUT);  /* RESET引脚用了XL9555的IO */
-        xl9555_pin_set(OV_RESET, IO_SET_LOW);
-        delay(20);
-        xl9555_pin_set(OV_RESET, IO_SET_HIGH);
-        delay(20);
-    } 
+        for (uint8_t i = 0; i < sizeof(addrs) && ret; i++)
+        {
+            Wire1.beginTransmission(addrs[i]);
+            if (Wire1.endTransmission() == 0)       /* 收到ACK */
+            {
+                ret = 0;
+            }
+        }
 
-    esp_err_t err =  esp_camera_init(&camera_config);   /* 摄像头初始化 */
-    if (err != ESP_OK) 
+        if (ret)
+        {
+            delay(1);                               /* 让出CPU，传感器上电需要数毫秒 */
+        }
+    } while (ret && millis() - start < timeout_ms);
+
+    Wire1.end();
+    return ret;
+}
+
+/**
+ * @brief       驱动初始化后的公共传感器设置
+ * @param       无
+ * @retval      0:成功 / 1:失败
+ */
+static uint8_t camera_sensor_setup(void)
+{
+    sensor_t * s = esp_camera_sensor_get();             /* 获取摄像头信息 */
+
+    if (s == NULL)
     {
-        Serial.printf("摄像头初始化失败,错误码:0x%x", err);
         return 1;
     }
 
-    sensor_t * s = esp_camera_sensor_get();             /* 获取摄像头信息 */
-    Serial.printf("摄像头ID:%#x  \r\n", s->id.PID);      /* 打印摄像头ID */
-    
     s->set_brightness(s, 0);      /* 设置亮度 (-2 ~ 2) */         
     s->set_contrast(s, 0);        /* 设置对比度 (-2 ~ 2) */
     s->set_saturation(s, 0);      /* 设置饱和度 (-2 ~ 2) */
@@ -104,5 +164,145 @@ uint8_t camera_init(void)
     return 0;
 }
 
+/**
+ * @brief       按拍摄配置初始化驱动并记录缓冲区大小
+ * @param       profile : 拍摄配置
+ * @retval      0:成功 / 1:失败
+ */
+static uint8_t camera_start(camera_profile_t profile)
+{
+    camera_config_t camera_config;
+    const camera_profile_info_t *p = &camera_profiles[profile];
 
+    camera_fill_config(&camera_config, p);
 
+    esp_err_t err =  esp_camera_init(&camera_config);   /* 摄像头初始化 */
+    if (err != ESP_OK) 
+    {
+        Serial.printf("摄像头初始化失败,错误码:0x%x", err);
+        camera_fb_capacity = 0;
+        return 1;
+    }
+
+    camera_profile = profile;
+    camera_fb_format = p->pixel_format;
+    camera_fb_capacity = camera_fb_bytes(p->frame_size, p->pixel_format);
+
+    return camera_sensor_setup();
+}
+
+/**
+ * @brief       摄像头(OV5640 / OV2640)初始化，使用握手指纹配置
+ * @param       无
+ * @retval      0:表示初始化成功 / 1:表示失败 
+ */
+uint8_t camera_init(void)
+{
+    int64_t start = esp_timer_get_time();
+
+    uint16_t xl_pins = 0;                         /* 用了XL9555的IO的PWDN/RESET引脚 */
+
+    if (OV_PWDN_PIN == -1)
+    {
+        xl_pins |= OV_PWDN;
+    }
+
+    if (OV_RESET_PIN == -1)
+    {
+        xl_pins |= OV_RESET;
+    }
+
+    if (xl_pins)                                  /* 摄像头上电并硬件复位 */
+    {
+        xl9555_write_mask(xl_pins, 0);            /* 先写输出电平，切换为输出时不产生毛刺 */
+        xl9555_config_mask(xl_pins, 0);           /* PWDN、RESET同时设为输出 */
+        delay(CAMERA_RESET_PULSE_MS);
+        xl9555_write_mask(xl_pins & OV_RESET, OV_RESET);
+    }
+
+    int64_t ready = esp_timer_get_time();
+    if (camera_wait_ready(CAMERA_READY_TIMEOUT_MS))   /* 轮询传感器应答，代替固定延时 */
+    {
+        Serial.println("摄像头无应答");
+        return 1;
+    }
+    camera_timing.ready_us = esp_timer_get_time() - ready;
+
+    if (camera_start(CAMERA_PROFILE_FINGERPRINT))
+    {
+        return 1;
+    }
+
+    sensor_t * s = esp_camera_sensor_get();
+    Serial.printf("摄像头ID:%#x  \r\n", s->id.PID);      /* 打印摄像头ID */
+
+    camera_timing.init_us = esp_timer_get_time() - start;
+    return 0;
+}
+
+/**
+ * @brief       切换拍摄配置
+ * @param       profile : 目标配置
+ * @retval      0:成功 / 1:失败
+ * @note        图像格式不变且现有缓冲区放得下时只改写传感器寄存器；否则重新初始化
+ *              驱动，传感器保持上电，不再复位
+ */
+uint8_t camera_set_profile(camera_profile_t profile)
+{
+    int64_t start = esp_timer_get_time();
+    const camera_profile_info_t *p;
+    uint8_t ret = 0;
+
+    if (profile >= CAMERA_PROFILE_NUM)
+    {
+        return 1;
+    }
+    p = &camera_profiles[profile];
+
+    camera_timing.reallocated = p->pixel_format != camera_fb_format ||
+                                camera_fb_bytes(p->frame_size, p->pixel_format) > camera_fb_capacity;
+
+    if (camera_timing.reallocated)
+    {
+        esp_camera_deinit();
+        ret = camera_start(profile);
+    }
+    else
+    {
+        sensor_t * s = esp_camera_sensor_get();
+
+        if (s == NULL ||
+            s->set_framesize(s, p->frame_size) != 0 ||
+            s->set_quality(s, p->jpeg_quality) != 0)
+        {
+            ret = 1;
+        }
+        else
+        {
+            camera_profile = profile;
+        }
+    }
+
+    camera_timing.switch_us = esp_timer_get_time() - start;
+    return ret;
+}
+
+/**
+ * @brief       当前拍摄配置
+ * @param       无
+ * @retval      拍摄配置
+ */
+camera_profile_t camera_get_profile(void)
+{
+    return camera_profile;
+}
+
+/**
+ * @brief       获取耗时统计
+ * @param       timing : 传出参数
+ * @retval      无
+ */
+void camera_get_timing(camera_timing_t *timing)
+{
+    *timing = camera_timing;
+}
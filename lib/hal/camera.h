@@ -26,6 +26,7 @@
 #define __CAMERA_H
 
 #include "Arduino.h"
+#include "esp_camera.h"
 
 /* 引脚定义 */
 #define OV_SCL_PIN       38 
@@ -45,6 +46,39 @@
 #define OV_RESET_PIN     -1
 #define OV_PWDN_PIN      -1
 
+#define CAMERA_MAX_FRAMESIZE FRAMESIZE_VGA /* 推流配置按该分辨率分配缓冲区，推流时只能在此之下切换分辨率 */
+#define CAMERA_FB_COUNT  3    /* PSRAM 图像缓冲区数量：采集与发送各占一个，驱动保留一个持续采集 */
+#define CAMERA_RESET_PULSE_MS    1     /* 复位脉冲宽度(传感器要求至少1ms) */
+#define CAMERA_READY_TIMEOUT_MS  100   /* 上电/复位后等待传感器SCCB应答的最长时间 */
+
+/* 拍摄配置 */
+typedef enum
+{
+    CAMERA_PROFILE_FINGERPRINT = 0,   /* 握手指纹：QCIF，高画质 */
+    CAMERA_PROFILE_PREVIEW,           /* 预览：QQVGA，低画质 */
+    CAMERA_PROFILE_STREAM,            /* 推流：按CAMERA_MAX_FRAMESIZE分配缓冲区，分辨率由码率控制调整 */
+    CAMERA_PROFILE_NUM,
+} camera_profile_t;
+
+typedef struct
+{
+    const char *name;
+    framesize_t frame_size;
+    pixformat_t pixel_format;
+    uint8_t jpeg_quality;             /* JPEG图像画质(0~63,数字越低画质越高) */
+} camera_profile_info_t;
+
+/* 耗时统计，单位微秒 */
+typedef struct
+{
+    uint32_t init_us;                 /* 冷启动：上电、复位与驱动初始化 */
+    uint32_t ready_us;                /* 其中等待传感器应答的时间 */
+    uint32_t switch_us;               /* 最近一次切换配置 */
+    uint8_t reallocated;              /* 最近一次切换是否重新分配了图像缓冲区 */
+} camera_timing_t;
+
+extern const camera_profile_info_t camera_profiles[CAMERA_PROFILE_NUM];
+
 /* 在xl9555.h文件已经有定义
 #define OV_RESET     
 #define OV_PWDN        
@@ -52,5 +86,8 @@
 
 /* 函数声明 */
 uint8_t camera_init(void);            /* 摄像头初始化 */
+uint8_t camera_set_profile(camera_profile_t profile);   /* 切换拍摄配置 */
+camera_profile_t camera_get_profile(void);              /* 当前拍摄配置 */
+void camera_get_timing(camera_timing_t *timing);        /* 获取耗时统计 */
 
 #endif
\ No newline at end of file
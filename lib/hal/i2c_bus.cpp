@@ -0,0 +1,390 @@
+/**
+ ****************************************************************************************************
+ * @file        i2c_bus.cpp
+ * @brief       IIC总线事务调度：多个任务共享一条IIC总线时按描述符排队，由总线任务串行执行
+ ****************************************************************************************************
+ */
+
+#include "i2c_bus.h"
+#include <esp_timer.h>
+#include <string.h>
+
+/**
+ * @brief       指数滑动平均，权重1/8
+ * @param       avg    : 当前均值
+ * @param       x      : 新样本
+ * @retval      新均值
+ */
+static uint32_t i2c_bus_ema(uint32_t avg, uint32_t x)
+{
+    return avg == 0 ? x : (uint32_t)((int32_t)avg + ((int32_t)x - (int32_t)avg) / 8);
+}
+
+/**
+ * @brief       在总线上执行一个事务
+ * @param       wire   : 总线
+ * @param       txn    : 描述符，读事务的数据与结果写回其中
+ * @retval      无
+ */
+static void i2c_bus_exec(TwoWire *wire, i2c_txn_t *txn)
+{
+    wire->beginTransmission(txn->addr);                 /* 发送从机的7位器件地址到发送队列 */
+    wire->write(txn->reg);                              /* 发送寄存器地址 */
+
+    if (txn->op == I2C_OP_WRITE)
+    {
+        wire->write(txn->data, txn->len);
+        txn->result = wire->endTransmission() == 0 ? 0 : 1;
+        return;
+    }
+
+    if (wire->endTransmission(false) != 0)              /* 重复起始，保持总线 */
+    {
+        txn->result = 1;
+        return;
+    }
+
+    uint8_t n = wire->requestFrom(txn->addr, txn->len);
+
+    for (uint8_t i = 0; i < n && wire->available() != 0; i++)
+    {
+        txn->data[i] = wire->read();
+    }
+
+    txn->result = n == txn->len ? 0 : 1;
+}
+
+/**
+ * @brief       判断 next 能否合并进 cur：同一器件的写，写同一段寄存器且两者都声明
+ *              overwrite 时新值覆盖旧值，紧接在 cur 之后且不超过器件的连续写入长度时追加
+ * @param       cur    : 已取出、尚未执行的写
+ * @param       next   : 队首的描述符
+ * @retval      0:不能合并 / 1:覆盖 / 2:追加
+ */
+static uint8_t i2c_bus_mergeable(const i2c_txn_t *cur, const i2c_txn_t *next)
+{
+    if (next->op != I2C_OP_WRITE || next->addr != cur->addr || cur->burst == 0)
+    {
+        return 0;
+    }
+
+    if (next->reg == cur->reg && next->len == cur->len)
+    {
+        return (cur->overwrite && next->overwrite) ? 1 : 0;     /* 否则依次执行，保留中间值(如复位脉冲) */
+    }
+
+    if (next->reg == cur->reg + cur->len && cur->len + next->len <= cur->burst)
+    {
+        return 2;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief       通知提交者事务已完成
+ * @param       txn    : 描述符
+ * @retval      无
+ */
+static void i2c_bus_complete(i2c_txn_t *txn)
+{
+    if (txn->done != NULL)
+    {
+        txn->done(txn, txn->arg);
+    }
+
+    if (txn->reply != NULL)
+    {
+        SemaphoreHandle_t wake = txn->wake;
+
+        memcpy(txn->reply, txn, sizeof(i2c_txn_t));     /* 写回后提交者才会被唤醒 */
+        xSemaphoreGive(wake);
+    }
+}
+
+/**
+ * @brief       总线任务：取出描述符，合并相邻的写后执行，并记录耗时
+ * @param       arg    : i2c_bus_t
+ * @retval      无
+ */
+static void i2c_bus_loop(void *arg)
+{
+    i2c_bus_t *bus = (i2c_bus_t *)arg;
+    i2c_txn_t cur;
+    i2c_txn_t absorbed[I2C_BUS_MAX_MERGE - 1];          /* 被合并的描述符，执行后一起完成 */
+
+    while (1)
+    {
+        if (xQueueReceive(bus->queue, &cur, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+
+        if (cur.op == I2C_OP_STOP)
+        {
+            break;
+        }
+
+        uint8_t count = 0;
+        i2c_txn_t next;
+
+        while (cur.op == I2C_OP_WRITE && count < I2C_BUS_MAX_MERGE - 1 &&
+               xQueuePeek(bus->queue, &next, 0) == pdTRUE)
+        {
+            uint8_t how = i2c_bus_mergeable(&cur, &next);
+
+            if (how == 0)
+            {
+                break;
+            }
+
+            xQueueReceive(bus->queue, &next, 0);
+
+            if (how == 1)
+            {
+                memcpy(cur.data, next.data, next.len);
+            }
+            else
+            {
+                memcpy(cur.data + cur.len, next.data, next.len);
+                cur.len += next.len;
+            }
+
+            absorbed[count++] = next;
+        }
+
+        int64_t start = esp_timer_get_time();
+        i2c_bus_exec(bus->wire, &cur);
+        int64_t end = esp_timer_get_time();
+
+        cur.bus_us = (uint32_t)(end - start);
+        cur.latency_us = (uint32_t)(end - cur.queued_us);
+
+        bus->stats.requests += 1 + count;
+        bus->stats.executed++;
+        bus->stats.merged += count;
+        bus->stats.failed += cur.result;
+        bus->stats.bus_us = i2c_bus_ema(bus->stats.bus_us, cur.bus_us);
+
+        for (uint8_t i = 0; i < count; i++)                /* 被合并的写与执行的写同时完成 */
+        {
+            absorbed[i].result = cur.result;
+            absorbed[i].bus_us = cur.bus_us;
+            absorbed[i].latency_us = (uint32_t)(end - absorbed[i].queued_us);
+            i2c_bus_complete(&absorbed[i]);
+        }
+
+        if (cur.latency_us > bus->stats.latency_max_us)
+        {
+            bus->stats.latency_max_us = cur.latency_us;
+        }
+        bus->stats.latency_us = i2c_bus_ema(bus->stats.latency_us, cur.latency_us);
+
+        i2c_bus_complete(&cur);
+    }
+
+    bus->task = NULL;
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief       启动总线任务
+ * @param       bus      : 总线
+ * @param       wire     : 已 begin 的 TwoWire，此后只应通过 bus 访问
+ * @param       priority : 总线任务的优先级，应高于提交事务的任务
+ * @retval      0:成功 / 1:失败
+ */
+uint8_t i2c_bus_start(i2c_bus_t *bus, TwoWire *wire, UBaseType_t priority)
+{
+    memset(bus, 0, sizeof(i2c_bus_t));
+    bus->wire = wire;
+    bus->queue = xQueueCreate(I2C_BUS_QUEUE_LEN, sizeof(i2c_txn_t));
+
+    if (bus->queue == NULL)
+    {
+        return 1;
+    }
+
+    if (xTaskCreate(i2c_bus_loop, "i2c_bus", I2C_BUS_STACK_SIZE, bus, priority, &bus->task) != pdPASS)
+    {
+        vQueueDelete(bus->queue);
+        bus->queue = NULL;
+        bus->task = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief       执行完已排队的事务后停止总线任务
+ * @param       bus    : 总线
+ * @retval      无
+ */
+void i2c_bus_stop(i2c_bus_t *bus)
+{
+    i2c_txn_t stop;
+
+    if (bus->task == NULL)
+    {
+        return;
+    }
+
+    memset(&stop, 0, sizeof(stop));
+    stop.op = I2C_OP_STOP;
+    xQueueSend(bus->queue, &stop, portMAX_DELAY);
+
+    while (bus->task != NULL)                           /* 等待任务退出 */
+    {
+        delay(1);
+    }
+
+    vQueueDelete(bus->queue);
+    bus->queue = NULL;
+}
+
+/**
+ * @brief       总线任务是否在运行
+ * @param       bus    : 总线
+ * @retval      0:未运行 / 1:运行中
+ */
+uint8_t i2c_bus_running(const i2c_bus_t *bus)
+{
+    return bus->task != NULL ? 1 : 0;
+}
+
+/**
+ * @brief       异步提交一个事务，完成后在总线任务中调用 txn->done
+ * @param       bus    : 总线
+ * @param       txn    : 描述符，按值复制，返回后即可复用
+ * @param       wait   : 队列满时最多等待的tick数
+ * @retval      0:已排队 / 1:参数错误、总线未运行或队列满
+ */
+uint8_t i2c_bus_submit(i2c_bus_t *bus, const i2c_txn_t *txn, TickType_t wait)
+{
+    i2c_txn_t copy;
+
+    if (bus->task == NULL || txn->len > I2C_BUS_MAX_DATA || txn->op > I2C_OP_READ)
+    {
+        return 1;
+    }
+
+    copy = *txn;
+    copy.queued_us = esp_timer_get_time();
+
+    return xQueueSend(bus->queue, &copy, wait) == pdTRUE ? 0 : 1;
+}
+
+/**
+ * @brief       同步执行一个事务：提交后阻塞在信号量上直到总线任务完成，期间不占用CPU
+ * @param       bus    : 总线
+ * @param       txn    : 描述符，完成后数据、结果与耗时写回其中
+ * @retval      0:成功 / 1:失败
+ * @note        总线任务未运行时直接在调用者中执行
+ */
+uint8_t i2c_bus_transfer(i2c_bus_t *bus, i2c_txn_t *txn)
+{
+    StaticSemaphore_t buf;
+
+    if (txn->len > I2C_BUS_MAX_DATA)
+    {
+        return 1;
+    }
+
+    if (bus->task == NULL)
+    {
+        int64_t start = esp_timer_get_time();
+
+        i2c_bus_exec(bus->wire, txn);
+        txn->bus_us = txn->latency_us = (uint32_t)(esp_timer_get_time() - start);
+        return txn->result;
+    }
+
+    txn->wake = xSemaphoreCreateBinaryStatic(&buf);
+    txn->reply = txn;
+
+    if (i2c_bus_submit(bus, txn, portMAX_DELAY) != 0)
+    {
+        return 1;
+    }
+
+    xSemaphoreTake(txn->wake, portMAX_DELAY);          /* 总线任务写回结果后才释放 */
+    return txn->result;
+}
+
+/**
+ * @brief       异步写寄存器，不等待完成
+ * @param       bus    : 总线
+ * @param       addr   : 7位器件地址
+ * @param       reg    : 起始寄存器地址
+ * @param       data   : 数据
+ * @param       len    : 字节数，不超过 I2C_BUS_MAX_DATA
+ * @param       burst  : 从reg起器件一次可连续写入的字节数，0表示不合并
+ * @param       overwrite : 1表示可被随后写同一段寄存器的写覆盖，中间值有意义时传0
+ * @retval      0:已排队 / 1:失败
+ * @note        总线任务未运行时直接执行
+ */
+uint8_t i2c_bus_write(i2c_bus_t *bus, uint8_t addr, uint8_t reg, const uint8_t *data, uint8_t len, uint8_t burst, uint8_t overwrite)
+{
+    i2c_txn_t txn;
+
+    if (len > I2C_BUS_MAX_DATA)
+    {
+        return 1;
+    }
+
+    memset(&txn, 0, sizeof(txn));
+    txn.addr = addr;
+    txn.reg = reg;
+    txn.op = I2C_OP_WRITE;
+    txn.len = len;
+    txn.burst = burst;
+    txn.overwrite = overwrite;
+    memcpy(txn.data, data, len);
+
+    if (bus->task == NULL)
+    {
+        return i2c_bus_transfer(bus, &txn);
+    }
+
+    return i2c_bus_submit(bus, &txn, portMAX_DELAY);
+}
+
+/**
+ * @brief       同步读寄存器
+ * @param       bus    : 总线
+ * @param       addr   : 7位器件地址
+ * @param       reg    : 起始寄存器地址
+ * @param       data   : 传出参数，读到的数据；失败时保持不变
+ * @param       len    : 字节数，不超过 I2C_BUS_MAX_DATA
+ * @retval      0:成功 / 1:失败
+ */
+uint8_t i2c_bus_read(i2c_bus_t *bus, uint8_t addr, uint8_t reg, uint8_t *data, uint8_t len)
+{
+    i2c_txn_t txn;
+
+    memset(&txn, 0, sizeof(txn));
+    txn.addr = addr;
+    txn.reg = reg;
+    txn.op = I2C_OP_READ;
+    txn.len = len;
+
+    if (i2c_bus_transfer(bus, &txn) != 0)
+    {
+        return 1;
+    }
+
+    memcpy(data, txn.data, len);
+    return 0;
+}
+
+/**
+ * @brief       获取统计
+ * @param       bus    : 总线
+ * @param       stats  : 传出参数
+ * @retval      无
+ */
+void i2c_bus_get_stats(const i2c_bus_t *bus, i2c_bus_stats_t *stats)
+{
+    *stats = bus->stats;
+}
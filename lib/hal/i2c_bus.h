@@ -0,0 +1,91 @@
+/**
+ ****************************************************************************************************
+ * @file        i2c_bus.h
+ * @brief       IIC总线事务调度：多个任务共享一条IIC总线时按描述符排队，由总线任务串行执行
+ ****************************************************************************************************
+ * @attention
+ *
+ * 调用者提交描述符后立即返回(写)，或阻塞在信号量上等待完成(读)，不再在
+ * Wire.endTransmission / requestFrom 中占用CPU；同一器件相邻的寄存器写在执行前合并。
+ * 写同一段寄存器的两个写只有在都声明 overwrite 时才只执行后一个，输出脉冲等
+ * 中间电平有意义的写不要声明。
+ *
+ ****************************************************************************************************
+ */
+
+#ifndef __I2C_BUS_H
+#define __I2C_BUS_H
+
+#include "Arduino.h"
+#include <Wire.h>
+
+#define I2C_BUS_QUEUE_LEN       16      /* 描述符队列深度 */
+#define I2C_BUS_MAX_DATA        8       /* 一个描述符携带的最多数据字节 */
+#define I2C_BUS_MAX_MERGE       4       /* 一次执行最多合并的描述符数 */
+#define I2C_BUS_STACK_SIZE      3072
+
+/* 事务类型 */
+typedef enum
+{
+    I2C_OP_WRITE = 0x00,                /* 写寄存器地址后连续写数据 */
+    I2C_OP_READ,                        /* 写寄存器地址后重复起始连续读数据 */
+    I2C_OP_STOP,                        /* 内部使用：结束总线任务 */
+} i2c_op_t;
+
+typedef struct i2c_txn i2c_txn_t;
+
+/* 完成回调，在总线任务中调用，不要在其中阻塞 */
+typedef void (*i2c_done_t)(const i2c_txn_t *txn, void *arg);
+
+/* 事务描述符，提交时按值复制进队列 */
+struct i2c_txn
+{
+    uint8_t addr;                       /* 7位器件地址 */
+    uint8_t reg;                        /* 起始寄存器地址 */
+    uint8_t op;                         /* i2c_op_t */
+    uint8_t len;                        /* 数据字节数，不超过 I2C_BUS_MAX_DATA */
+    uint8_t burst;                      /* 写：从reg起器件一次可连续写入的字节数，0表示不与相邻的写合并 */
+    uint8_t overwrite;                  /* 写：1表示只关心最终值，可被随后写同一段寄存器的写覆盖 */
+    uint8_t data[I2C_BUS_MAX_DATA];     /* 写入的数据 / 读到的数据 */
+    uint8_t result;                     /* 0:成功 / 1:失败 */
+    i2c_done_t done;                    /* 非空时完成后回调 */
+    void *arg;
+    uint32_t latency_us;                /* 提交到完成的耗时 */
+    uint32_t bus_us;                    /* 其中占用总线的耗时 */
+    int64_t queued_us;                  /* 内部使用 */
+    i2c_txn_t *reply;                   /* 内部使用：同步事务的结果写回处 */
+    SemaphoreHandle_t wake;             /* 内部使用：同步事务完成信号 */
+};
+
+/* 总线统计，时间单位为微秒，均值为指数滑动平均 */
+typedef struct
+{
+    uint32_t requests;                  /* 处理的描述符数 */
+    uint32_t executed;                  /* 实际执行的总线事务数(合并后) */
+    uint32_t merged;                    /* 被合并进前一个写的描述符数 */
+    uint32_t failed;                    /* 失败的总线事务数 */
+    uint32_t latency_us;                /* 提交到完成 */
+    uint32_t latency_max_us;
+    uint32_t bus_us;                    /* 占用总线 */
+} i2c_bus_stats_t;
+
+/* 一条IIC总线 */
+typedef struct
+{
+    TwoWire *wire;
+    QueueHandle_t queue;
+    TaskHandle_t task;
+    i2c_bus_stats_t stats;
+} i2c_bus_t;
+
+/* 函数声明 */
+uint8_t i2c_bus_start(i2c_bus_t *bus, TwoWire *wire, UBaseType_t priority);    /* 启动总线任务，wire 需已 begin */
+void i2c_bus_stop(i2c_bus_t *bus);                                              /* 执行完已排队的事务后停止 */
+uint8_t i2c_bus_running(const i2c_bus_t *bus);                                  /* 总线任务是否在运行 */
+uint8_t i2c_bus_submit(i2c_bus_t *bus, const i2c_txn_t *txn, TickType_t wait); /* 异步提交，完成后回调 */
+uint8_t i2c_bus_transfer(i2c_bus_t *bus, i2c_txn_t *txn);                       /* 同步提交，阻塞到完成，结果写回 txn */
+uint8_t i2c_bus_write(i2c_bus_t *bus, uint8_t addr, uint8_t reg, const uint8_t *data, uint8_t len, uint8_t burst, uint8_t overwrite);  /* 异步写寄存器 */
+uint8_t i2c_bus_read(i2c_bus_t *bus, uint8_t addr, uint8_t reg, uint8_t *data, uint8_t len);  /* 同步读寄存器 */
+void i2c_bus_get_stats(const i2c_bus_t *bus, i2c_bus_stats_t *stats);          /* 获取统计 */
+
+#endif
@@ -24,6 +24,24 @@
 
 #include "xl9555.h"
 #include <Wire.h>
+#include <esp_timer.h>
+
+/* 输出寄存器与配置寄存器的影子副本(P1在高8位)，写入时不必先读芯片 */
+static uint16_t xl_output = 0xFFFF;           /* 上电默认输出高电平 */
+static uint16_t xl_config = 0xFFFF;           /* 上电默认全部为输入 */
+static uint32_t xl_transactions = 0;          /* 累计IIC传输次数 */
+static i2c_bus_t xl_bus;                      /* IIC_SDA/IIC_SCL 总线的事务调度 */
+static SemaphoreHandle_t xl_lock = NULL;      /* 影子寄存器的读-改-写与提交顺序一致 */
+static volatile uint8_t xl_stale = 0;         /* 异步写失败后影子副本与芯片可能不一致，下次改写前重新读取 */
+
+/* 输入事件 */
+static TaskHandle_t xl_event_task = NULL;     /* 读取输入并发布事件的任务 */
+static QueueHandle_t xl_event_queue = NULL;   /* xl9555_event_t 队列 */
+static volatile uint16_t xl_event_mask = 0;   /* 发布事件的IO */
+static volatile uint16_t xl_input = 0xFFFF;   /* 消抖后的输入状态 */
+static int64_t xl_irq_us = 0;                 /* 上次被事件任务取走后第一次中断的时刻，0表示没有 */
+static portMUX_TYPE xl_irq_mux = portMUX_INITIALIZER_UNLOCKED;   /* 64位时刻在32位核上不能一次读写 */
+static volatile bool xl_event_run = false;
 
 /**
 * @brief       初始化IO扩展芯片
@@ -34,13 +52,118 @@ void xl9555_init(void)
 {
     pinMode(IIC_INT_PIN, INPUT_PULLUP);     /* 配置中断引脚 */
 
+    if (xl_lock == NULL)
+    {
+        xl_lock = xSemaphoreCreateMutex();  /* 在其他任务访问扩展芯片之前创建 */
+    }
+
     Wire.begin(IIC_SDA, IIC_SCL, 400000);   /* 初始化IIC连接 */
 
+    if (!i2c_bus_running(&xl_bus) && i2c_bus_start(&xl_bus, &Wire, XL9555_BUS_PRIORITY))
+    {
+        xl_bus.wire = &Wire;                /* 总线任务启动失败时在调用者中直接执行 */
+    }
+
+    xl9555_sync();                          /* 建立影子寄存器 */
+
     /* 上电先读取一次清除中断标志 */
     xl9555_read_port(0);
     xl9555_read_port(1);
 }
 
+/**
+ * @brief       锁住影子寄存器，多个任务改写IO时互不覆盖
+ * @param       无
+ * @retval      无
+ */
+static void xl9555_lock(void)
+{
+    if (xl_lock != NULL)
+    {
+        xSemaphoreTake(xl_lock, portMAX_DELAY);
+    }
+}
+
+/**
+ * @brief       释放影子寄存器
+ * @param       无
+ * @retval      无
+ */
+static void xl9555_unlock(void)
+{
+    if (xl_lock != NULL)
+    {
+        xSemaphoreGive(xl_lock);
+    }
+}
+
+/**
+ * @brief      异步写的完成回调(总线任务中)：失败时标记影子寄存器失效
+ * @param      txn    : 完成的描述符
+ * @param      arg    : 未使用
+ * @retval     无
+ */
+static void xl9555_write_done(const i2c_txn_t *txn, void *arg)
+{
+    if (txn->result != 0)
+    {
+        xl_stale = 1;
+    }
+}
+
+/**
+ * @brief      提交写并同步影子寄存器，调用者需持有 xl_lock
+ * @param      reg    : 起始寄存器地址
+ * @param      data   : 写入的数据
+ * @param      len    : 字节数
+ * @retval     无
+ * @note       输出寄存器的写不允许被总线任务覆盖合并，连续的低→高脉冲会原样执行。
+ *             影子寄存器先于实际写入更新，写失败由 xl9555_write_done 标记失效
+ */
+static void xl9555_submit(uint8_t reg, const uint8_t *data, uint8_t len)
+{
+    i2c_txn_t txn;
+
+    memset(&txn, 0, sizeof(txn));
+    txn.addr = EXIO_ADDR;
+    txn.reg = reg;
+    txn.op = I2C_OP_WRITE;
+    txn.len = len;
+    txn.burst = (reg & 1) ? 1 : 2;                              /* 相邻的写由总线任务合并 */
+    txn.overwrite = (reg & ~1) != XL9555_OUTPUT_PORT0_REG;
+    txn.done = xl9555_write_done;
+    memcpy(txn.data, data, len);
+
+    if (i2c_bus_running(&xl_bus))
+    {
+        if (i2c_bus_submit(&xl_bus, &txn, portMAX_DELAY) != 0)  /* 排队后立即返回 */
+        {
+            xl_stale = 1;
+        }
+    }
+    else if (i2c_bus_transfer(&xl_bus, &txn) != 0)              /* 总线任务未运行时直接执行 */
+    {
+        xl_stale = 1;
+    }
+
+    xl_transactions++;
+
+    for (uint8_t i = 0; i < len; i++)         /* 同步影子寄存器 */
+    {
+        uint8_t r = (reg & ~1) | ((reg + i) & 1);
+        uint16_t shift = (r & 1) ? 8 : 0;
+
+        if (r == XL9555_OUTPUT_PORT0_REG || r == XL9555_OUTPUT_PORT1_REG)
+        {
+            xl_output = (xl_output & ~(0xFF << shift)) | (data[i] << shift);
+        }
+        else if (r == XL9555_CONFIG_PORT0_REG || r == XL9555_CONFIG_PORT1_REG)
+        {
+            xl_config = (xl_config & ~(0xFF << shift)) | (data[i] << shift);
+        }
+    }
+}
+
 /**
  * @brief      向XL9555相关寄存器写数据
  * @param      reg    : 寄存器地址
@@ -49,10 +172,24 @@ void xl9555_init(void)
  */
 void xl9555_write_reg(uint8_t reg, uint8_t data)
 {
-    Wire.beginTransmission(EXIO_ADDR);        /* 发送从机的7位器件地址到发送队列 */
-    Wire.write(reg);                          /* 发送要写入从机寄存器的地址到发送队列 */
-    Wire.write(data);                         /* 发送要写入从机寄存器的数据到发送队列 */
-    Wire.endTransmission();                   /* IIC 发送 发送队列的数据(不带参数,表示发送stop信号,结束传输) */          
+    xl9555_write_regs(reg, &data, 1);
+}
+
+/**
+ * @brief      从reg开始连续写寄存器，一次IIC传输
+ * @param      reg    : 起始寄存器地址
+ * @param      data   : 写入的数据
+ * @param      len    : 字节数
+ * @retval     无
+ * @note       芯片的寄存器成对排列(0/1, 2/3, 4/5, 6/7)，连续访问时地址在同一对内
+ *             交替，因此 len 为 2 时正好写入一对寄存器的P0与P1。写经总线调度异步执行，
+ *             影子寄存器立即更新
+ */
+void xl9555_write_regs(uint8_t reg, const uint8_t *data, uint8_t len)
+{
+    xl9555_lock();
+    xl9555_submit(reg, data, len);
+    xl9555_unlock();
 }
 
 /**
@@ -62,17 +199,161 @@ void xl9555_write_reg(uint8_t reg, uint8_t data)
  */
 uint8_t xl9555_read_reg(uint8_t reg)
 {
-    Wire.beginTransmission(EXIO_ADDR);        /* 发送从机的7位器件地址到发送队列 */
-    Wire.write(reg);                          /* 发送要读取从机的寄存器地址到发送队列 */
-    Wire.endTransmission(0);                  /* IIC 发送 发送队列的数据(传参为0,表示重新发送一个start信号,保持IIC总线有效连接) */
+    uint8_t data = 0xFF;
+
+    xl9555_read_regs(reg, &data, 1);
+    return data;
+}
+
+/**
+ * @brief       从reg开始连续读寄存器，一次IIC传输(写地址后重复起始再读)
+ * @param       reg    : 起始寄存器地址
+ * @param       data   : 传出参数，读到的数据；失败时保持不变
+ * @param       len    : 字节数，地址在同一对寄存器内交替
+ * @retval      成功时为len，失败为0
+ */
+uint8_t xl9555_read_regs(uint8_t reg, uint8_t *data, uint8_t len)
+{
+    xl_transactions++;
+
+    return i2c_bus_read(&xl_bus, EXIO_ADDR, reg, data, len) == 0 ? len : 0;   /* 排在已提交的写之后执行，阻塞等待结果 */
+}
+
+/**
+ * @brief       读取芯片的输出与配置寄存器刷新影子副本，调用者需持有 xl_lock
+ * @param       无
+ * @retval      无
+ * @note        读排在已提交的写之后执行，读完时之前的写都已完成；读失败时保持失效
+ */
+static void xl9555_refresh(void)
+{
+    uint8_t regs[2];
+
+    xl_stale = 0;
+
+    if (xl9555_read_regs(XL9555_OUTPUT_PORT0_REG, regs, 2) == 2)
+    {
+        xl_output = regs[0] | (regs[1] << 8);
+    }
+    else
+    {
+        xl_stale = 1;
+    }
+
+    if (xl9555_read_regs(XL9555_CONFIG_PORT0_REG, regs, 2) == 2)
+    {
+        xl_config = regs[0] | (regs[1] << 8);
+    }
+    else
+    {
+        xl_stale = 1;
+    }
+}
+
+/**
+ * @brief       从芯片重新读取输出与配置寄存器，刷新影子副本(两次传输)
+ * @param       无
+ * @retval      无
+ * @note        芯片被其他主机改写或复位后调用
+ */
+void xl9555_sync(void)
+{
+    xl9555_lock();
+    xl9555_refresh();
+    xl9555_unlock();
+}
+
+/**
+ * @brief       把新的16位寄存器值写入一对寄存器，只写有变化的端口，调用者需持有 xl_lock
+ * @param       reg0   : 该对寄存器中P0的地址
+ * @param       old    : 影子副本
+ * @param       value  : 新值
+ * @retval      无
+ */
+static void xl9555_write_pair(uint8_t reg0, uint16_t old, uint16_t value)
+{
+    uint16_t diff = old ^ value;
+    uint8_t data[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+
+    if (diff == 0)                                  /* 没有变化，不访问总线 */
+    {
+        return;
+    }
+
+    if ((diff & XL_PORT1_ALL_PIN) == 0)             /* 只有P0变化 */
+    {
+        xl9555_submit(reg0, data, 1);
+    }
+    else if ((diff & XL_PORT0_ALL_PIN) == 0)        /* 只有P1变化 */
+    {
+        xl9555_submit(reg0 + 1, data + 1, 1);
+    }
+    else                                            /* P0、P1一次写入 */
+    {
+        xl9555_submit(reg0, data, 2);
+    }
+}
+
+/**
+ * @brief       一次设置任意多个输出IO的电平，至多一次IIC传输
+ * @param       mask   : 要设置的IO(XL_PIN_Pxx按位或，可跨P0/P1)
+ * @param       value  : mask中各IO的电平，1为高电平
+ * @retval      无
+ */
+void xl9555_write_mask(uint16_t mask, uint16_t value)
+{
+    xl9555_lock();
+
+    if (xl_stale)                                   /* 之前的写失败过，先与芯片对齐 */
+    {
+        xl9555_refresh();
+    }
+
+    uint16_t out = (xl_output & ~mask) | (value & mask);
+
+    xl9555_write_pair(XL9555_OUTPUT_PORT0_REG, xl_stale ? ~out : xl_output, out);   /* 仍不可信时两个端口都写 */
+    xl9555_unlock();
+}
+
+/**
+ * @brief       一次设置任意多个IO的输入/输出模式，至多一次IIC传输
+ * @param       mask   : 要设置的IO(XL_PIN_Pxx按位或，可跨P0/P1)
+ * @param       inputs : mask中设为输入的IO，其余设为输出
+ * @retval      无
+ */
+void xl9555_config_mask(uint16_t mask, uint16_t inputs)
+{
+    xl9555_lock();
 
-    Wire.requestFrom(EXIO_ADDR, 1);           /* 主机向从机发送数据请求,并获取到数据 */
-    if (Wire.available() != 0)                /* 得到已经接收到的数据字节数 */
+    if (xl_stale)
     {
-        return Wire.read();                   /* 到数据缓冲区读取数据 */
+        xl9555_refresh();
     }
 
-    return 0xFF;
+    uint16_t config = (xl_config & ~mask) | (inputs & mask);
+
+    xl9555_write_pair(XL9555_CONFIG_PORT0_REG, xl_stale ? ~config : xl_config, config);
+    xl9555_unlock();
+}
+
+/**
+ * @brief       输出寄存器的影子副本
+ * @param       无
+ * @retval      P0在低8位，P1在高8位
+ */
+uint16_t xl9555_output_shadow(void)
+{
+    return xl_output;
+}
+
+/**
+ * @brief       累计IIC传输次数，用于统计各操作的总线开销
+ * @param       无
+ * @retval      传输次数
+ */
+uint32_t xl9555_transactions(void)
+{
+    return xl_transactions;
 }
 
 /**
@@ -104,21 +385,7 @@ uint8_t xl9555_read_port(uint8_t portx)
  */
 void xl9555_io_config(uint16_t port_pin, io_mode_t mode)
 {
-    uint8_t config_reg = 0;
-    uint8_t config_value = 0;
-
-    config_reg  = xl9555_read_reg(port_pin > XL_PORT0_ALL_PIN ? XL9555_CONFIG_PORT1_REG : XL9555_CONFIG_PORT0_REG);   /* 先读取设置Pin所在的寄存器情况 */
-
-    if (mode == IO_SET_OUTPUT)    /* 根据 mode参数 设置输入输出情况，不能影响其他IO */
-    {
-        config_value = config_reg & (~(port_pin >> (port_pin > XL_PORT0_ALL_PIN ? 8 : 0)));   /* 得到某个IO设置为输出功能后的PORT值但不影响未设置的其他IO的状态 */
-    }
-    else
-    {
-        config_value = config_reg | (port_pin >> (port_pin > XL_PORT0_ALL_PIN ? 8 : 0));      /* 得到某个IO设置为输入功能的PORT值但不影响未设置的其他IO的状态 */
-    }
-
-    xl9555_write_reg(port_pin > XL_PORT0_ALL_PIN ? XL9555_CONFIG_PORT1_REG : XL9555_CONFIG_PORT0_REG, config_value);    /* 向配置寄存器设置IO输入输出状态 */
+    xl9555_config_mask(port_pin, mode == IO_SET_INPUT ? port_pin : 0);     /* 按影子寄存器改写，不影响其他IO，不需要先读 */
 }
 
 /**
@@ -129,21 +396,7 @@ void xl9555_io_config(uint16_t port_pin, io_mode_t mode)
  */
 void xl9555_pin_set(uint16_t port_pin, io_state_t state)
 {
-    uint8_t pin_reg = 0;
-    uint8_t pin_value = 0;
-
-    pin_reg = xl9555_read_reg(port_pin > XL_PORT0_ALL_PIN ? XL9555_OUTPUT_PORT1_REG : XL9555_OUTPUT_PORT0_REG);     /* 先读取设置Pin所在的寄存器情况 */
-
-    if (state == IO_SET_HIGH)    /* 根据 state参数 设置IO的高低电平 */
-    {
-        pin_value = pin_reg | (port_pin >> (port_pin > XL_PORT0_ALL_PIN ? 8 : 0));          /* 得到某个IO设置为高电平后的PORT值但不影响未设置的其他IO的状态 */
-    }
-    else
-    {
-        pin_value = pin_reg & (~(port_pin >> (port_pin > XL_PORT0_ALL_PIN ? 8 : 0)));       /* 得到某个IO设置为低电平后的PORT值但不影响未设置的其他IO的状态 */
-    }
-
-    xl9555_write_reg(port_pin > XL_PORT0_ALL_PIN ? XL9555_OUTPUT_PORT1_REG : XL9555_OUTPUT_PORT0_REG, pin_value);   /* 向输出寄存器设置IO高低电平状态 */
+    xl9555_write_mask(port_pin, state == IO_SET_HIGH ? port_pin : 0);      /* 按影子寄存器改写，电平不变时不访问总线 */
 }
 
 /**
@@ -156,9 +409,227 @@ uint8_t xl9555_get_pin(uint16_t port_pin)
     uint8_t pin_state = 0;
     uint8_t port_value = 0;
 
+    if (xl_event_run && (port_pin & xl_event_mask) == port_pin)   /* 事件任务已在跟踪这些IO，不必读总线 */
+    {
+        return (xl_input & port_pin) ? 1 : 0;
+    }
+
     port_value = xl9555_read_reg(port_pin > XL_PORT0_ALL_PIN ? XL9555_INPUT_PORT1_REG : XL9555_INPUT_PORT0_REG);  /* 读取pin所在port的状态：1没有按下，0按下 */
     pin_state = port_pin >> (port_pin > XL_PORT0_ALL_PIN ? 8 : 0);    /* 假如是PORT1的PIN需要先右移8位 */
     pin_state = pin_state & port_value;                               /* 得到需要查询位的状态 */
 
     return pin_state ? 1 : 0;
 }
+
+/**
+ * @brief       IIC_INT_PIN 下降沿中断：记下时刻并唤醒事件任务
+ * @param       无
+ * @retval      无
+ */
+static void IRAM_ATTR xl9555_isr(void)
+{
+    BaseType_t woken = pdFALSE;
+
+    portENTER_CRITICAL_ISR(&xl_irq_mux);
+
+    if (xl_irq_us == 0)
+    {
+        xl_irq_us = esp_timer_get_time();
+    }
+
+    portEXIT_CRITICAL_ISR(&xl_irq_mux);
+
+    vTaskNotifyGiveFromISR(xl_event_task, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+/**
+ * @brief       取走中断记下的时刻
+ * @param       无
+ * @retval      第一次中断的时刻，0表示取走之后没有新的中断
+ */
+static int64_t xl9555_irq_take(void)
+{
+    int64_t time_us;
+
+    portENTER_CRITICAL(&xl_irq_mux);
+    time_us = xl_irq_us;
+    xl_irq_us = 0;
+    portEXIT_CRITICAL(&xl_irq_mux);
+
+    return time_us;
+}
+
+/**
+ * @brief       事件任务：被中断唤醒后一次读取P0、P1两个输入寄存器(读取同时清除
+ *              芯片的中断)，输入在 XL9555_DEBOUNCE_MS 内不再变化后与上次的稳定
+ *              状态比较，每个变化的IO发布一个事件
+ * @param       arg    : 未使用
+ * @retval      无
+ * @note        稳定期间若再有变化芯片会再次拉低INT，所以最后一次读到的值就是当前值，
+ *              消抖本身不需要额外的总线访问。待发布的时刻由任务自己保存：发布期间
+ *              到来的中断留下新的时刻与通知，下一轮一定会读取并再次发布
+ */
+static void xl9555_event_loop(void *arg)
+{
+    uint8_t regs[2];
+    uint16_t raw = xl_input;
+    int64_t pending_us = 0;                         /* 本轮第一次中断的时刻，0表示没有待发布的变化 */
+
+    while (xl_event_run)
+    {
+        TickType_t wait = pending_us ? pdMS_TO_TICKS(XL9555_DEBOUNCE_MS) : portMAX_DELAY;
+
+        if (ulTaskNotifyTake(pdTRUE, wait) != 0)    /* 有新的中断：读取并重新开始消抖计时 */
+        {
+            int64_t irq_us = xl9555_irq_take();
+
+            if (pending_us == 0)
+            {
+                pending_us = irq_us ? irq_us : esp_timer_get_time();
+            }
+
+            if (xl9555_read_regs(XL9555_INPUT_PORT0_REG, regs, 2) == 2)
+            {
+                raw = regs[0] | (regs[1] << 8);
+            }
+            continue;
+        }
+
+        if (pending_us == 0)
+        {
+            continue;
+        }
+
+        uint16_t changed = (raw ^ xl_input) & xl_event_mask;
+        int64_t time_us = pending_us;
+
+        xl_input = raw;
+        pending_us = 0;
+
+        while (changed)                             /* 从低位到高位逐个发布 */
+        {
+            xl9555_event_t event;
+
+            event.pin = changed & (~changed + 1);
+            event.level = (raw & event.pin) ? 1 : 0;
+            event.time_us = time_us;
+            xQueueSend(xl_event_queue, &event, 0);  /* 队列满时丢弃，消费者可用 xl9555_input_state 取当前状态 */
+            changed &= changed - 1;
+        }
+    }
+
+    xl_event_task = NULL;
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief       启动中断驱动的输入事件：mask 中的IO设为输入，IIC_INT_PIN 下降沿唤醒
+ *              事件任务，消费者用 xl9555_wait_event 等待边沿而不必轮询总线
+ * @param       mask     : 要发布事件的IO(XL_PIN_Pxx按位或，可跨P0/P1)
+ * @param       priority : 事件任务的优先级
+ * @retval      0:成功 / 1:失败
+ * @note        需先调用 xl9555_init，IIC_INT_PIN 需要用跳线帽进行连接
+ */
+uint8_t xl9555_events_start(uint16_t mask, UBaseType_t priority)
+{
+    uint8_t regs[2];
+
+    if (xl_event_run)
+    {
+        return 1;
+    }
+
+    xl_event_queue = xQueueCreate(XL9555_EVENT_QUEUE_LEN, sizeof(xl9555_event_t));
+
+    if (xl_event_queue == NULL)
+    {
+        return 1;
+    }
+
+    xl9555_config_mask(mask, mask);                 /* 只改动这些IO的模式 */
+
+    if (xl9555_read_regs(XL9555_INPUT_PORT0_REG, regs, 2) == 2)   /* 初始状态，同时清除中断 */
+    {
+        xl_input = regs[0] | (regs[1] << 8);
+    }
+
+    xl_event_mask = mask;
+    xl9555_irq_take();                              /* 丢弃上次运行留下的时刻 */
+    xl_event_run = true;
+
+    if (xTaskCreate(xl9555_event_loop, "xl9555_evt", XL9555_EVENT_STACK_SIZE, NULL, priority, &xl_event_task) != pdPASS)
+    {
+        xl_event_run = false;
+        vQueueDelete(xl_event_queue);
+        xl_event_queue = NULL;
+        return 1;
+    }
+
+    attachInterrupt(digitalPinToInterrupt(IIC_INT_PIN), xl9555_isr, FALLING);
+
+    return 0;
+}
+
+/**
+ * @brief       停止输入事件任务并释放事件队列
+ * @param       无
+ * @retval      无
+ */
+void xl9555_events_stop(void)
+{
+    if (!xl_event_run)
+    {
+        return;
+    }
+
+    detachInterrupt(digitalPinToInterrupt(IIC_INT_PIN));
+    xl_event_run = false;
+    xTaskNotifyGive(xl_event_task);
+
+    while (xl_event_task != NULL)                   /* 等待任务退出 */
+    {
+        delay(1);
+    }
+
+    vQueueDelete(xl_event_queue);
+    xl_event_queue = NULL;
+}
+
+/**
+ * @brief       等待一个输入边沿事件
+ * @param       event      : 传出参数，收到的事件
+ * @param       timeout_ms : 超时时间，portMAX_DELAY 表示一直等待
+ * @retval      0:收到事件 / 1:超时或事件任务未启动
+ */
+uint8_t xl9555_wait_event(xl9555_event_t *event, uint32_t timeout_ms)
+{
+    if (xl_event_queue == NULL)
+    {
+        return 1;
+    }
+
+    TickType_t wait = timeout_ms == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+
+    return xQueueReceive(xl_event_queue, event, wait) == pdTRUE ? 0 : 1;
+}
+
+/**
+ * @brief       消抖后的输入状态，事件任务运行时不访问总线
+ * @param       无
+ * @retval      P0在低8位，P1在高8位
+ */
+uint16_t xl9555_input_state(void)
+{
+    return xl_input;
+}
+
+/**
+ * @brief       XL9555所在的IIC总线(IIC_SDA/IIC_SCL)，板上同一总线的其他器件也应经它访问
+ * @param       无
+ * @retval      总线
+ */
+i2c_bus_t *xl9555_bus(void)
+{
+    return &xl_bus;
+}
@@ -26,6 +26,7 @@
 #define __XL9555_H
 
 #include "Arduino.h"
+#include "i2c_bus.h"
 
 /* 引脚定义 */
 #define IIC_SCL       42
@@ -33,9 +34,15 @@
 #define IIC_INT_PIN   0     /* 需要用跳线帽进行连接 */
 
 #define EXIO_ADDR     0x20  /* 7位器件地址 */
+#define XL9555_BUS_PRIORITY           (tskIDLE_PRIORITY + 5)  /* IIC总线任务优先级，高于访问总线的任务 */
 
 #define IIC_INT       digitalRead(IIC_INT_PIN) 
 
+/* 输入事件 */
+#define XL9555_EVENT_QUEUE_LEN        16          /* 事件队列深度，满时丢弃新事件 */
+#define XL9555_DEBOUNCE_MS            20          /* 输入保持稳定这么久才发布边沿 */
+#define XL9555_EVENT_STACK_SIZE       3072
+
 /* IO扩展芯片XL9555的各个IO功能 */
 #define KEY0                          XL_PIN_P17  /* 按键0引脚 P17 */    
 #define KEY1                          XL_PIN_P16  /* 按键1引脚 P16 */    
@@ -99,6 +106,14 @@ typedef enum
   IO_SET_HIGH,       
 } io_state_t;
 
+/* IO输入边沿事件 */
+typedef struct
+{
+    uint16_t pin;       /* 发生变化的IO(单个XL_PIN_Pxx) */
+    uint8_t level;      /* 变化后的电平：0低电平 / 1高电平 */
+    int64_t time_us;    /* 本次变化中第一次中断的时刻(esp_timer_get_time) */
+} xl9555_event_t;
+
 /* 函数声明 */
 void xl9555_init(void);                                     /* 初始化IO扩展芯片 */
 void xl9555_write_reg(uint8_t reg, uint8_t data);           /* 向XL9555相关寄存器写数据 */
@@ -108,5 +123,17 @@ uint8_t xl9555_read_port(uint8_t portx);                    /* 读取XL9555的P0
 void xl9555_io_config(uint16_t port_pin, io_mode_t mode);   /* 设置XL9555某个IO的模式(输出或输入) */
 void xl9555_pin_set(uint16_t port_pin, io_state_t state);   /* 设置XL9555配置为输出功能的IO的输出状态(高电平或低电平) */
 uint8_t xl9555_get_pin(uint16_t port_pin);                  /* 获取XL9555配置为输入功能的IO的状态(高电平或低电平) */
+void xl9555_write_regs(uint8_t reg, const uint8_t *data, uint8_t len);  /* 从reg开始连续写寄存器(一次传输) */
+uint8_t xl9555_read_regs(uint8_t reg, uint8_t *data, uint8_t len);      /* 从reg开始连续读寄存器(一次传输) */
+void xl9555_sync(void);                                     /* 从芯片重新读取输出与配置寄存器的影子副本 */
+void xl9555_write_mask(uint16_t mask, uint16_t value);      /* 一次设置任意多个输出IO的电平(跨P0/P1) */
+void xl9555_config_mask(uint16_t mask, uint16_t inputs);    /* 一次设置任意多个IO的输入/输出模式(跨P0/P1) */
+uint16_t xl9555_output_shadow(void);                        /* 输出寄存器的影子副本，P1在高8位 */
+uint32_t xl9555_transactions(void);                         /* 累计IIC传输次数 */
+i2c_bus_t *xl9555_bus(void);                                /* XL9555所在的IIC总线，同一总线上的其他器件也经它访问 */
+uint8_t xl9555_events_start(uint16_t mask, UBaseType_t priority);   /* 启动中断驱动的输入事件任务 */
+void xl9555_events_stop(void);                              /* 停止输入事件任务 */
+uint8_t xl9555_wait_event(xl9555_event_t *event, uint32_t timeout_ms);  /* 等待一个输入边沿事件 */
+uint16_t xl9555_input_state(void);                          /* 消抖后的输入状态，不访问总线 */
 
 #endif
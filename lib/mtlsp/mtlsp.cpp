@@ -1,4 +1,6 @@
 #include "mtlsp.h"
+#include "mtlsp_frame.h"
+#include "mtlsp_handshake.h"
 
 // #define BYTE256b 32U
 // #define BYTE512b 64U
@@ -14,177 +16,67 @@ using namespace mtlsp;
  * @param client 客户端，相当于套接字
  * @param raw_fingerprint 用于prnu认证的原始指纹字节流（一个jpg图片）
  * @param raw_fingerprint_length raw_fingerprint的长度，单位为Byte
+ * @param tickets 非空时向服务器请求会话恢复票据并存入其中
+ * @param residual 非空时提出以噪声残差描述子代替 raw_fingerprint 上传
+ * @param residual_length residual 的长度，单位为Byte
  *
  * @return int 0 表示成功， -1 表示失败
  *
- * @details: mtlsp 的含义是 modelled tls protocol，是根据实际需要改版的tls
+ * @details: mtlsp 的含义是 modelled tls protocol，是根据实际需要改版的tls。
+ * 阻塞直到握手结束，需要与其他工作交替运行时直接使用 HandshakeStateMachine。
+ * 旧版 server 不认识指纹格式字节时回复 NotOK，此时在同一连接上不带该字节重试。
  */
 int mtlsp::handshake_client(uint8_t master_secret[BYTE256b], Client &client,
                             const uint8_t *raw_fingerprint,
-                            size_t raw_fingerprint_length) {
-  if (sodium_init() < 0) {
-    return handshake_error(
-        "mtlsp handshake failed, cryptologic moduel initalization failed");
-  }
-
-  if (WiFi.status() != WL_CONNECTED) {
-    return handshake_error("mtlsp handshake failed, wifi not connected");
-  }
-
-  if (!client.connected()) {
-    return handshake_error("TCP not connected");
-  }
-  // 发送 client_random
-  uint8_t client_random[BYTE256b];
-  esp_fill_random(client_random, sizeof(client_random));
-  send(client, client_random, sizeof(client_random));
-
-  // 接收 server 发送的第一波信息
-  uint8_t server_random[BYTE256b];  // server_random随机数
-  uint8_t server_eph_pub[BYTE256b]; // 服务器临时 ECDH 公钥
-  uint8_t sig[BYTE512b];            // Sig(H(Q_s||client_random||server_random))
-  if (recv(client, server_random, sizeof(server_random)) < 0) {
-    return handshake_error("sr not received");
-  }
-  if (recv(client, server_eph_pub, sizeof(server_eph_pub)) < 0) {
-    return handshake_error("Qs not received");
-  }
-  if (recv(client, sig, sizeof(sig)) < 0) {
-    return handshake_error("Sig not received");
-  }
-
-  // 计算 H(Q_s||client_random||server_random)
-  uint8_t tmp_msg_qscs[3 * BYTE256b];
-  memcpy(tmp_msg_qscs, server_eph_pub, BYTE256b);
-  memcpy(tmp_msg_qscs + BYTE256b, client_random, BYTE256b);
-  memcpy(tmp_msg_qscs + 2 * BYTE256b, server_random, BYTE256b);
-  uint8_t hashed_msg[BYTE256b];
-  crypto_hash_sha256(hashed_msg, tmp_msg_qscs, sizeof(tmp_msg_qscs));
-
-  // 验签
-  if (crypto_sign_verify_detached(sig, hashed_msg, BYTE256b, ed_server_pub) <
-      0) {
-    client.stop();
-    return handshake_error("mtlsp message verification failed");
-  }
-
-  Serial.print("DEBUG Q_s: ");
-  for (int i = 0; i < 32; ++i) {
-    Serial.printf("%02x", server_eph_pub[i]);
-  }
-  Serial.println();
-
-  // 确定 client 临时ECDH公私钥
-  uint8_t client_eph_sec[BYTE256b]; // 客户端临时 ECDH 私钥
-  uint8_t client_eph_pub[BYTE256b]; // 客户端临时 ECDH 公钥
-  crypto_kx_keypair(client_eph_pub, client_eph_sec);
-
-  Serial.print("DEBUG Q_c: ");
-  for (int i = 0; i < 32; ++i) {
-    Serial.printf("%02x", client_eph_pub[i]);
-  }
-  Serial.println();
-
-  // 加密并发送 Q_c||client_random||server_random
-  uint8_t x_server_pub[BYTE256b];
-  if (crypto_sign_ed25519_pk_to_curve25519(x_server_pub, ed_server_pub) < 0) {
-    return handshake_error("key transform failed");
-  }
-  uint8_t tmp_msg_qccs[3 * BYTE256b]; // Q_c||client_random||server_random
-  memcpy(tmp_msg_qccs, client_eph_pub, BYTE256b);
-  memcpy(tmp_msg_qccs + BYTE256b, client_random, BYTE256b);
-  memcpy(tmp_msg_qccs + 2 * BYTE256b, server_random, BYTE256b);
-  uint8_t cipher_msg[crypto_box_SEALBYTES + sizeof(tmp_msg_qccs)];
-  crypto_box_seal(cipher_msg, tmp_msg_qccs, sizeof(tmp_msg_qccs), x_server_pub);
-  send(client, cipher_msg, sizeof(cipher_msg));
-
-  // 验收 OK 信号
-  uint8_t sealed_signal[1 + crypto_box_SEALBYTES];
-  if (recv(client, sealed_signal, sizeof(sealed_signal)) < 0) {
-    return handshake_error("OK1 not received");
-  }
-  uint8_t unsealed_signal;
-  if (crypto_box_seal_open(&unsealed_signal, sealed_signal,
-                           sizeof(sealed_signal), client_eph_pub,
-                           client_eph_sec) < 0) {
-    return handshake_error("ecc crypto error");
-  }
-  if (unsealed_signal != OK) {
-    client.stop();
-    return handshake_error("mtlsp denied");
-  }
-
-  // 计算预主密钥
-  uint8_t pre_master_secret[BYTE256b];
-  if (crypto_scalarmult_curve25519(pre_master_secret, client_eph_sec, server_eph_pub) <
-      0) {
-    return handshake_error("scalarmult crypto error");
-  };
-
-  Serial.print("DEBUG pre_master_secret: ");
-  for (int i = 0; i < 32; ++i) {
-    Serial.printf("%02x", pre_master_secret[i]);
-  }
-  Serial.println();
-
-  // 计算主密钥 M = H(Z || client_random || server_random)
-  uint8_t tmp_msg_zcs[3 * BYTE256b]; // Z||client_random||server_random
-  memcpy(tmp_msg_zcs, pre_master_secret, BYTE256b);
-  memcpy(tmp_msg_zcs + BYTE256b, client_random, BYTE256b);
-  memcpy(tmp_msg_zcs + 2 * BYTE256b, server_random, BYTE256b);
-  crypto_hash_sha256(master_secret, tmp_msg_zcs, sizeof(tmp_msg_zcs));
-
-  Serial.print("DEBUG master_secret: ");
-  for (int i = 0; i < 32; ++i) {
-    Serial.printf("%x", master_secret[i]);
-  }
-  Serial.println();
-
-  // 加密发送设备原始指纹
-  uint8_t *enc_fingerprint = (uint8_t *)pvPortMalloc(
-      raw_fingerprint_length + crypto_aead_aes256gcm_ABYTES); // 加密后原始指纹
-  if(!enc_fingerprint) {
-    return handshake_error("pvPortMalloc failed for fingerprint buffer");
+                            size_t raw_fingerprint_length,
+                            TicketStore *tickets, const uint8_t *residual,
+                            size_t residual_length) {
+  HandshakeStateMachine hs(client);
+  hs.offer_residual(residual, residual_length);
+  int ret;
+  do {
+    if (hs.begin_full(raw_fingerprint, raw_fingerprint_length, tickets) < 0) {
+      return -1;
+    }
+    ret = hs.run(master_secret);
+  } while (ret == 1 && hs.offer_rejected()); // 已撤回残差提议，重试一次
+  return ret == 0 ? 0 : -1;
 }
-  uint64_t enc_fingerprint_len; // 加密后原始指纹长度
-  uint8_t nonce_client
-      [crypto_aead_aes256gcm_NPUBBYTES]; // 计数器初始向量，公共随机数
-  esp_fill_random(nonce_client, sizeof(nonce_client));
-  aes256gcm_encrypt(enc_fingerprint, &enc_fingerprint_len, raw_fingerprint,
-                    raw_fingerprint_length, nullptr, 0, nullptr, nonce_client,
-                    master_secret);
-  send(client, nonce_client, sizeof(nonce_client));
-  send(client, enc_fingerprint, enc_fingerprint_len);
-  vPortFree(enc_fingerprint);
-
-  // 确认 OK 信号
-  uint8_t nonce_server[crypto_aead_aes256gcm_NPUBBYTES];
-  uint8_t final_cipher[1 + crypto_aead_aes256gcm_ABYTES];
-  uint8_t final_signal;
-  if (recv(client, nonce_server, sizeof(nonce_server)) < 0) {
-    return handshake_error("OK2 nonce not received");
-  }
-  if (recv(client, final_cipher, sizeof(final_cipher)) < 0) {
-    return handshake_error("OK2 cipher not received");
-  }
-  Serial.println("OK confirmed");
-
-  uint64_t mlen;
-  if (aes256gcm_decrypt(&final_signal, &mlen, nullptr, final_cipher,
-                        sizeof(final_cipher), nullptr, 0, nonce_server,
-                        master_secret) < 0) {
-    return handshake_error("aes crypto error");
-  };
-
-  Serial.println("Decrypt confirmed");
-
-  if (final_signal != OK) {
-    return handshake_error("device may not registed");
-  }
 
-  // 握手成功，(client, master) 可为消息传输模块所用
-  Serial.println("mtlsp handshake succeed!");
-  return 0;
+/**
+ * @brief 快速握手（两个往返），消息格式见 mtlsp.md「快速握手」一节
+ *
+ * @param master_secret 传出参数，256 bits 主密钥
+ * @param client 客户端，相当于套接字
+ * @param raw_fingerprint 用于prnu认证的原始指纹字节流（一个jpg图片）
+ * @param raw_fingerprint_length raw_fingerprint的长度，单位为Byte
+ * @param tickets 非空时向服务器请求会话恢复票据并存入其中
+ * @param residual 非空时提出以噪声残差描述子代替 raw_fingerprint 上传
+ * @param residual_length residual 的长度，单位为Byte
+ *
+ * @return int 0 表示成功；1 表示服务器不支持快速握手，同一连接上可直接改用
+ * handshake_client；-1 表示失败
+ *
+ * @details Q_c 随 client_random 一起发出，server 在一个 flight 内回复签名后的
+ * Q_s 与 BOX_{Q_c}(OK)，client 验证后立即上传加密指纹，不再单独等待 OK1。
+ */
+int mtlsp::handshake_client_fast(uint8_t master_secret[BYTE256b],
+                                 Client &client,
+                                 const uint8_t *raw_fingerprint,
+                                 size_t raw_fingerprint_length,
+                                 TicketStore *tickets,
+                                 const uint8_t *residual,
+                                 size_t residual_length) {
+  HandshakeStateMachine hs(client);
+  hs.offer_residual(residual, residual_length);
+  int ret;
+  do {
+    if (hs.begin_fast(raw_fingerprint, raw_fingerprint_length, tickets) < 0) {
+      return -1;
+    }
+    ret = hs.run(master_secret);
+  } while (ret == 1 && hs.offer_rejected()); // 已撤回残差提议，重试一次
+  return ret;
 }
 
 /**
@@ -203,13 +95,26 @@ int mtlsp::handshake_error(const char *msg) {
  * @param data 要传送的数据
  * @param data_len 要传送的数据长度
  * @return int 传送成功的字节数，失败为 -1
+ *
+ * @details 不超过 SEND_COALESCE_MAX 的帧与长度前缀拼在一起一次写出，避免
+ * 4 字节前缀单独成为一个报文段
  */
 int mtlsp::send(Client &client, uint8_t *data, const uint32_t data_len) {
-  uint8_t prefix[4];
+  uint8_t frame[4 + SEND_COALESCE_MAX];
   uint32_t be_len = htonl(data_len);
-  memcpy(prefix, &be_len, 4);
-  client.write(prefix, 4);
-  return client.write(data, data_len);
+  memcpy(frame, &be_len, 4);
+  if (data_len <= SEND_COALESCE_MAX) {
+    memcpy(frame + 4, data, data_len);
+    if (client.write(frame, 4 + data_len) != 4 + data_len)
+      return -1;
+    return data_len;
+  }
+  // 短写会使对端按错位的长度前缀解析，前缀与数据都必须完整写出
+  if (client.write(frame, 4) != 4)
+    return -1;
+  if (client.write(data, data_len) != data_len)
+    return -1;
+  return data_len;
 }
 
 /**
@@ -226,7 +131,9 @@ int mtlsp::recv(Client &client, uint8_t *buf, const uint32_t buf_len) {
   if (client.readBytes(prefix, 4) != 4)
     return -1;
 
-  uint32_t len = ntohl(*reinterpret_cast<uint32_t *>(prefix));
+  uint32_t be_len;
+  memcpy(&be_len, prefix, 4);
+  uint32_t len = ntohl(be_len);
   if (buf_len < len)
     return -1;
 
@@ -239,4 +146,121 @@ int mtlsp::recv(Client &client, uint8_t *buf, const uint32_t buf_len) {
     total_read += bytes_read;
   }
   return total_read;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief mtlsp接收，从帧解析器的缓冲区中取出一帧
+ *
+ * @param reader 本连接的帧解析器
+ * @param buf 传出参数，指向内存块的指针
+ * @param buf_len 内存块的大小
+ * @return int 接收的字节数，失败为 -1
+ */
+int mtlsp::recv(FrameReader &reader, uint8_t *buf, const uint32_t buf_len) {
+  return reader.read(buf, buf_len);
+}
+
+/**
+ * @brief mtlsp流式加密传送
+ *
+ * @param writer 本连接的帧发送器，已排队的帧与本帧的第一个分块一起写出
+ * @param data 要加密传送的明文
+ * @param data_len 明文长度
+ * @param npub 12 字节 nonce
+ * @param aead 已设置密钥的会话 AEAD 上下文
+ * @return int 传送的密文字节数（含认证标签），失败为 -1
+ *
+ * @details 线上格式与 send(E_K(data)) 完全一致：4 字节长度前缀
+ * (data_len + TAG_SIZE)，随后是密文，最后是认证标签。明文按 STREAM_CHUNK_SIZE
+ * 分块加密，每块加密完成后立即写入套接字，只占用一个分块大小的栈缓冲区；
+ * 最后一个分块与认证标签合并写出。
+ */
+int mtlsp::send_encrypted(FrameWriter &writer, const uint8_t *data,
+                          const uint32_t data_len, const uint8_t *npub,
+                          Aes256Gcm &aead) {
+  uint8_t prefix[4];
+  uint32_t be_len = htonl(data_len + TAG_SIZE);
+  memcpy(prefix, &be_len, 4);
+  if (writer.queue_raw(prefix, 4) < 0)
+    return -1;
+
+  if (aead.stream_start(MBEDTLS_GCM_ENCRYPT, npub) < 0)
+    return -1;
+
+  uint8_t chunk[STREAM_CHUNK_SIZE];
+  uint32_t offset = 0;
+  while (offset < data_len) {
+    uint32_t n = data_len - offset;
+    if (n > STREAM_CHUNK_SIZE)
+      n = STREAM_CHUNK_SIZE;
+    if (aead.stream_update(chunk, data + offset, n) < 0)
+      return -1;
+    offset += n;
+    // 最后一个分块留到与认证标签一起写出；chunk 复用前必须先 flush
+    if (writer.queue_raw(chunk, n) < 0 ||
+        (offset < data_len && writer.flush() < 0))
+      return -1;
+  }
+
+  uint8_t tag[TAG_SIZE];
+  if (aead.stream_finish(tag) < 0)
+    return -1;
+  if (writer.queue_raw(tag, TAG_SIZE) < 0 || writer.flush() < 0)
+    return -1;
+  return data_len + TAG_SIZE;
+}
+
+/**
+ * @brief mtlsp流式解密接收，与 send_encrypted / send(E_K(data)) 的格式对应
+ *
+ * @param client 客户端，相当于套接字
+ * @param buf 传出参数，存放明文的内存块
+ * @param buf_len 内存块的大小
+ * @param npub 12 字节 nonce
+ * @param aead 已设置密钥的会话 AEAD 上下文
+ * @return int 明文字节数，失败（含认证失败）为 -1
+ *
+ * @details 密文边读边原地解密到 buf，不需要额外的密文缓冲区；认证失败时清零 buf。
+ */
+int mtlsp::recv_decrypted(Client &client, uint8_t *buf, const uint32_t buf_len,
+                          const uint8_t *npub, Aes256Gcm &aead) {
+  uint8_t prefix[4];
+  if (client.readBytes(prefix, 4) != 4)
+    return -1;
+
+  uint32_t be_len;
+  memcpy(&be_len, prefix, 4);
+  uint32_t len = ntohl(be_len);
+  if (len < TAG_SIZE || buf_len < len - TAG_SIZE)
+    return -1;
+  uint32_t mlen = len - TAG_SIZE;
+
+  if (aead.stream_start(MBEDTLS_GCM_DECRYPT, npub) < 0)
+    return -1;
+
+  // 按分块读取，凑满一个分块（或剩余部分）后再解密，满足 16 字节对齐要求
+  uint32_t total_read = 0;
+  while (total_read < mlen) {
+    uint32_t want = mlen - total_read;
+    if (want > STREAM_CHUNK_SIZE)
+      want = STREAM_CHUNK_SIZE;
+    uint32_t got = 0;
+    while (got < want) {
+      int bytes_read = client.read(buf + total_read + got, want - got);
+      if (bytes_read <= 0)
+        return -1;
+      got += bytes_read;
+    }
+    if (aead.stream_update(buf + total_read, buf + total_read, want) < 0)
+      return -1;
+    total_read += want;
+  }
+
+  uint8_t tag[TAG_SIZE];
+  if (client.readBytes(tag, TAG_SIZE) != TAG_SIZE ||
+      aead.stream_verify(tag) < 0) {
+    memset(buf, 0, mlen);
+    return -1;
+  }
+  return mlen;
+}
@@ -13,16 +13,52 @@
 #define BYTE512b 64U
 #define OK 0b01010101
 #define NOK 0b10101010
+#define HELLO_FULL_TICKET 0x01 // 完整握手并请求会话恢复票据
+#define HELLO_RESUME 0x02      // 使用票据恢复会话
+#define HELLO_FAST 0x03        // 快速握手
+#define HELLO_FAST_TICKET 0x04 // 快速握手并请求会话恢复票据
+#define HELLO_FULL 0x05        // 完整握手，不请求票据（仅在携带指纹格式字节时使用）
+#define FP_FORMAT_JPEG 0x01     // 指纹为原始 JPEG 图片
+#define FP_FORMAT_RESIDUAL 0x02 // 指纹为噪声残差描述子（lib/prnu）
+#define TICKET_MAX 192U        // 票据（对客户端不透明）最大长度
+#define STREAM_CHUNK_SIZE 2048U // 流式加密分块大小，须为 16 的整数倍
+#define SEND_COALESCE_MAX 512U  // 不超过该长度的帧与长度前缀合并为一次写出
 
 namespace mtlsp {
 
+class TicketStore;
+class FrameReader;
+class FrameWriter;
+
 int handshake_client(uint8_t master_secret[BYTE256b], Client &client,
                      const uint8_t *raw_fingerprint,
-                     size_t raw_fingerprint_length);
+                     size_t raw_fingerprint_length,
+                     TicketStore *tickets = nullptr,
+                     const uint8_t *residual = nullptr,
+                     size_t residual_length = 0);
+
+int handshake_client_fast(uint8_t master_secret[BYTE256b], Client &client,
+                          const uint8_t *raw_fingerprint,
+                          size_t raw_fingerprint_length,
+                          TicketStore *tickets = nullptr,
+                          const uint8_t *residual = nullptr,
+                          size_t residual_length = 0);
+
+int resume_client(uint8_t master_secret[BYTE256b], Client &client,
+                  TicketStore &tickets);
 
 int handshake_error(const char *msg);
 
 int send(Client &client, uint8_t *data, const uint32_t data_len);
 
 int recv(Client &client, uint8_t *buf, const uint32_t buf_len);
+
+int recv(FrameReader &reader, uint8_t *buf, const uint32_t buf_len);
+
+int send_encrypted(FrameWriter &writer, const uint8_t *data,
+                   const uint32_t data_len, const uint8_t *npub,
+                   Aes256Gcm &aead);
+
+int recv_decrypted(Client &client, uint8_t *buf, const uint32_t buf_len,
+                   const uint8_t *npub, Aes256Gcm &aead);
 }; // namespace mtlsp
@@ -0,0 +1,410 @@
+#include "mtlsp_frame.h"
+#include "mtlsp.h"
+#include "mtlsp_memory.h"
+#include <cerrno>
+#if defined(ESP_PLATFORM)
+#include <lwip/sockets.h>
+#else
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define FRAME_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define FRAME_SEND_FLAGS 0
+#endif
+
+using namespace mtlsp;
+
+/**
+ * @brief 创建帧解析器
+ *
+ * @param client 客户端，相当于套接字
+ * @param capacity 缓冲区大小，构造时一次性分配
+ * @param max_frame 允许的最大帧长度（不含前缀），0 或超过缓冲区时取
+ * capacity - FRAME_HEADER；超长的帧视为协议错误
+ * @param timeout_ms next / read 等待一个完整帧的最长时间
+ */
+FrameReader::FrameReader(Client &client, uint32_t capacity, uint32_t max_frame,
+                         uint32_t timeout_ms)
+    : client(client), buf(nullptr), capacity(capacity), max_frame(max_frame),
+      timeout_ms(timeout_ms), head(0), tail(0), pending(0), broken(false) {
+  if (this->max_frame == 0 || this->max_frame > capacity - FRAME_HEADER) {
+    this->max_frame = capacity - FRAME_HEADER;
+  }
+  buf = (uint8_t *)mem_alloc(capacity, MEM_BULK);
+  if (!buf) {
+    broken = true;
+  }
+}
+
+FrameReader::~FrameReader() {
+  if (buf) {
+    sodium_memzero(buf, capacity);
+    mem_free(buf);
+  }
+}
+
+/**
+ * @brief 释放上一次返回的帧
+ */
+void FrameReader::release() {
+  head += pending;
+  pending = 0;
+  if (head == tail) {
+    head = tail = 0;
+  }
+}
+
+/**
+ * @brief 从缓冲区中解析一个完整帧
+ * @return int 帧长度，缓冲区中还没有完整帧或帧超长时为 -1
+ */
+int FrameReader::parse(uint8_t **frame) {
+  if (tail - head < FRAME_HEADER) {
+    return -1;
+  }
+  uint32_t be_len; // head 随帧长前移，不一定 4 字节对齐
+  memcpy(&be_len, buf + head, FRAME_HEADER);
+  uint32_t len = ntohl(be_len);
+  if (len > max_frame) {
+    broken = true;
+    return handshake_error("mtlsp frame too large");
+  }
+  if (tail - head - FRAME_HEADER < len) {
+    return -1;
+  }
+  *frame = buf + head + FRAME_HEADER;
+  pending = FRAME_HEADER + len;
+  return len;
+}
+
+/**
+ * @brief 从套接字读入数据，一次读取已到达的全部字节（不超过剩余空间）
+ *
+ * @param block false 时只读取 available() 报告的字节，不等待
+ * @return int 读入的字节数，0 表示暂无数据，-1 表示连接已断开
+ */
+int FrameReader::fill(bool block) {
+  if (tail == capacity) { // 写满时把未读部分搬到开头
+    memmove(buf, buf + head, tail - head);
+    tail -= head;
+    head = 0;
+  }
+  uint32_t space = capacity - tail;
+  int avail = client.available();
+  if (avail <= 0 && !block) {
+    if (!client.connected()) {
+      broken = true;
+      return -1;
+    }
+    return 0;
+  }
+  uint32_t want = avail > 0 && (uint32_t)avail < space ? avail : space;
+  int n = client.read(buf + tail, want);
+  if (n > 0) {
+    tail += n;
+    return n;
+  }
+  if (!client.connected()) {
+    broken = true;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief 等待下一个完整帧
+ *
+ * @param frame 传出参数，指向缓冲区内帧内容的视图
+ * @return int 帧长度，超时或出错为 -1（出错时 failed() 为 true；超时时已收到
+ * 的部分字节仍保留在缓冲区中） *
+ * @details WiFiClient 的 read 不阻塞，由这里按 timeout_ms 计时；底层 read 本身
+ * 阻塞时（如 native 的 SocketClient），单次等待还受 Client 自身超时的影响。
+ */
+int FrameReader::next(uint8_t **frame) {
+  release();
+  unsigned long start = millis();
+  while (!broken) {
+    int len = parse(frame);
+    if (len >= 0) {
+      return len;
+    }
+    if (broken) {
+      break;
+    }
+    int n = fill(true);
+    if (n < 0) {
+      break;
+    }
+    if (n == 0) {
+      if (millis() - start >= timeout_ms) {
+        return -1;
+      }
+      delay(1); // WiFiClient 的 read 不阻塞，让出 CPU 给 lwIP
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief 非阻塞地取下一个完整帧，只读取套接字中已有的数据
+ *
+ * @param frame 传出参数，指向缓冲区内帧内容的视图
+ * @return int 帧长度，暂无完整帧或出错为 -1（出错时 failed() 为 true）
+ */
+int FrameReader::poll(uint8_t **frame) {
+  release();
+  if (broken) {
+    return -1;
+  }
+  int len = parse(frame);
+  if (len >= 0 || broken) {
+    return len;
+  }
+  if (fill(false) <= 0) {
+    return -1;
+  }
+  return parse(frame);
+}
+
+/**
+ * @brief 缓冲区中（上一次返回的帧之后）是否已有完整帧
+ */
+bool FrameReader::complete() const {
+  uint32_t start = head + pending;
+  if (tail - start < FRAME_HEADER) {
+    return false;
+  }
+  uint32_t be_len;
+  memcpy(&be_len, buf + start, FRAME_HEADER);
+  uint32_t len = ntohl(be_len);
+  return len > max_frame || tail - start - FRAME_HEADER >= len;
+}
+
+/**
+ * @brief 等待新数据到达，但不取出帧，供非阻塞调用方（如握手状态机）在无事
+ * 可做时让出 CPU。之后上一次返回的视图失效。
+ *
+ * @param ms 最长等待时间
+ * @return int 1 表示有新数据或已有完整帧，0 表示超时，-1 表示出错
+ */
+int FrameReader::wait(uint32_t ms) {
+  if (broken) {
+    return -1;
+  }
+  if (complete()) {
+    return 1;
+  }
+  unsigned long start = millis();
+  for (;;) {
+    int n = fill(true);
+    if (n < 0) {
+      return -1;
+    }
+    if (n > 0) {
+      return 1;
+    }
+    if (millis() - start >= ms) {
+      return 0;
+    }
+    delay(1);
+  }
+}
+
+/**
+ * @brief 等待下一个完整帧并拷贝到 buf，语义与 mtlsp::recv 相同
+ *
+ * @param out 传出参数，指向内存块的指针
+ * @param out_len 内存块的大小
+ * @return int 接收的字节数，失败或帧长于 out_len 为 -1
+ */
+int FrameReader::read(uint8_t *out, uint32_t out_len) {
+  uint8_t *frame;
+  int len = next(&frame);
+  if (len < 0 || (uint32_t)len > out_len) {
+    return -1;
+  }
+  memcpy(out, frame, len);
+  return len;
+}
+
+/**
+ * @brief Client 模式，帧拷贝进合并缓冲区
+ *
+ * @param client 客户端，相当于套接字
+ * @param capacity 合并缓冲区大小，构造时一次性分配
+ */
+FrameWriter::FrameWriter(Client &client, uint32_t capacity)
+    : client(&client), sock(-1), buf(nullptr), capacity(capacity), used(0),
+      segment_count(0), prefix_count(0), broken(false) {
+  buf = (uint8_t *)mem_alloc(capacity, MEM_BULK);
+  if (!buf) {
+    broken = true;
+  }
+}
+
+/**
+ * @brief 套接字模式，帧不拷贝，flush 时以 sendmsg 一次发出
+ *
+ * @param fd 已连接的 TCP 套接字（例如 WiFiClient::fd()），不接管其生命周期
+ */
+FrameWriter::FrameWriter(int fd)
+    : client(nullptr), sock(fd), buf(nullptr), capacity(0), used(0),
+      segment_count(0), prefix_count(0), broken(fd < 0) {}
+
+FrameWriter::~FrameWriter() {
+  if (buf) {
+    sodium_memzero(buf, capacity);
+    mem_free(buf);
+  }
+}
+
+/**
+ * @brief 排队一段原始字节
+ * @return int 0 成功，-1 失败
+ */
+int FrameWriter::push(const uint8_t *data, uint32_t len) {
+  if (broken) {
+    return -1;
+  }
+  if (sock >= 0) {
+    if (segment_count == FRAME_WRITER_SEGMENTS && flush() < 0) {
+      return -1;
+    }
+    segments[segment_count++] = {data, len};
+    return 0;
+  }
+
+  if (len > capacity - used && flush() < 0) {
+    return -1;
+  }
+  if (len > capacity) { // 比缓冲区还大的内容直接写出
+    if (client->write(data, len) != len) {
+      broken = true;
+      return -1;
+    }
+    return 0;
+  }
+  memcpy(buf + used, data, len);
+  used += len;
+  return 0;
+}
+
+/**
+ * @brief 排队一帧：长度前缀 + 内容
+ *
+ * @param data 帧内容；套接字模式下在 flush 之前必须保持有效
+ * @param len 帧内容长度
+ * @return int 0 成功，-1 失败
+ */
+int FrameWriter::queue(const uint8_t *data, uint32_t len) {
+  if (sock >= 0 && (prefix_count == FRAME_WRITER_SEGMENTS / 2 ||
+                    segment_count + 2 > FRAME_WRITER_SEGMENTS)) {
+    if (flush() < 0) {
+      return -1;
+    }
+  }
+  uint8_t *prefix = prefixes[sock >= 0 ? prefix_count++ : 0];
+  uint32_t be_len = htonl(len);
+  memcpy(prefix, &be_len, FRAME_HEADER);
+  if (push(prefix, FRAME_HEADER) < 0) {
+    return -1;
+  }
+  return push(data, len);
+}
+
+/**
+ * @brief 排队不带长度前缀的字节，用于分块写出的长帧（前缀由调用方先行排队）
+ * @return int 0 成功，-1 失败
+ */
+int FrameWriter::queue_raw(const uint8_t *data, uint32_t len) {
+  return push(data, len);
+}
+
+/**
+ * @brief 写出所有排队的字节
+ * @return int 写出的字节数，失败为 -1
+ */
+int FrameWriter::flush() {
+  if (broken) {
+    return -1;
+  }
+  int total = 0;
+  if (sock < 0) {
+    if (used > 0 && client->write(buf, used) != used) {
+      broken = true;
+    }
+    total = used;
+    used = 0;
+    return broken ? -1 : total;
+  }
+
+  struct iovec iov[FRAME_WRITER_SEGMENTS];
+  for (uint32_t i = 0; i < segment_count; ++i) {
+    iov[i].iov_base = const_cast<uint8_t *>(segments[i].data);
+    iov[i].iov_len = segments[i].len;
+  }
+  uint32_t first = 0;
+  unsigned long start = millis();
+  while (first < segment_count) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov + first;
+    msg.msg_iovlen = segment_count - first;
+    ssize_t n = sendmsg(sock, &msg, FRAME_SEND_FLAGS);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+          millis() - start < FRAME_TIMEOUT_MS) {
+        delay(1);
+        continue;
+      }
+      broken = true;
+      break;
+    }
+    total += n;
+    // 跳过已写完的分段，部分写出的分段前移
+    while (first < segment_count && (size_t)n >= iov[first].iov_len) {
+      n -= iov[first].iov_len;
+      ++first;
+    }
+    if (n > 0) {
+      iov[first].iov_base = (uint8_t *)iov[first].iov_base + n;
+      iov[first].iov_len -= n;
+    }
+  }
+  segment_count = 0;
+  prefix_count = 0;
+  return broken ? -1 : total;
+}
+
+/**
+ * @brief 排队一帧并立即写出
+ * @return int 写出的字节数，失败为 -1
+ */
+int FrameWriter::send(const uint8_t *data, uint32_t len) {
+  if (queue(data, len) < 0) {
+    return -1;
+  }
+  return flush();
+}
+
+/**
+ * @brief 开关 TCP_NODELAY。帧已在 flush 处合并，关闭 Nagle 不会再产生碎报文段
+ * @return int 0 成功，-1 失败（Client 模式不支持，请用 WiFiClient::setNoDelay）
+ */
+int FrameWriter::set_nodelay(bool on) {
+  if (sock < 0) {
+    return -1;
+  }
+  int flag = on ? 1 : 0;
+  return setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) < 0
+             ? -1
+             : 0;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <Arduino.h>
+
+#define FRAME_HEADER 4U             // 大端长度前缀
+#define FRAME_TIMEOUT_MS 1000U      // 与 Arduino Stream 的默认超时一致
+#define HANDSHAKE_FRAME_BUFFER 512U // 握手阶段的帧都很小，最大为票据帧
+#define FRAME_WRITER_SEGMENTS 16U   // 套接字模式下一次 sendmsg 的最大分段数
+#define FRAME_WRITER_BUFFER 2304U   // Client 模式的合并缓冲区，容纳一个流式分块与若干小帧
+
+namespace mtlsp {
+
+/// 按连接缓冲的帧解析器
+///
+/// 每次尽量一次性读入套接字中已有的全部字节，从缓冲区中解析长度前缀，返回
+/// 完整帧的零拷贝视图，避免每个字段都单独经过 readBytes 的逐字节读取与超时。
+/// 缓冲区按环形使用：读指针追上写指针时归零，写满时把未读部分搬到开头，
+/// 因此任意时刻的完整帧在内存中都是连续的。
+///
+/// 视图在下一次调用 next / poll / read 之前有效，视图之前紧挨着的
+/// FRAME_HEADER 字节就是该帧的长度前缀（可直接用作附加认证数据）。
+class FrameReader {
+public:
+  FrameReader(Client &client, uint32_t capacity, uint32_t max_frame = 0,
+              uint32_t timeout_ms = FRAME_TIMEOUT_MS);
+  ~FrameReader();
+  FrameReader(const FrameReader &) = delete;
+  FrameReader &operator=(const FrameReader &) = delete;
+
+  int next(uint8_t **frame);
+  int poll(uint8_t **frame);
+  int read(uint8_t *out, uint32_t out_len);
+  int wait(uint32_t ms);
+
+  void set_timeout(uint32_t ms) { timeout_ms = ms; }
+  /// 帧超长、连接断开或内存不足后为 true，字节流已不可用
+  bool failed() const { return broken; }
+  uint32_t buffered() const { return tail - head - pending; }
+  uint32_t frame_limit() const { return max_frame; }
+
+private:
+  void release();
+  bool complete() const;
+  int parse(uint8_t **frame);
+  int fill(bool block);
+
+  Client &client;
+  uint8_t *buf;
+  uint32_t capacity;
+  uint32_t max_frame;
+  uint32_t timeout_ms;
+  uint32_t head;    // 下一个未读字节
+  uint32_t tail;    // 下一个可写位置
+  uint32_t pending; // 上一次返回的帧（含前缀）长度，下次调用时释放
+  bool broken;
+};
+
+/// 合并写出的帧发送器
+///
+/// 把长度前缀、帧内容以及排队的多个帧合并为一次写出，直到 flush 才真正发送，
+/// 避免前缀与内容分成两个小报文段，在 Nagle 与延迟确认下多等一个 RTT。
+/// - Client 模式：帧被拷贝进合并缓冲区，flush 时一次 client.write；
+/// - 套接字模式：直接持有 lwIP / BSD 套接字描述符，帧不拷贝，flush 时以一次
+///   sendmsg 发出所有分段。排队的内存在 flush 之前必须保持有效。
+class FrameWriter {
+public:
+  explicit FrameWriter(Client &client, uint32_t capacity = FRAME_WRITER_BUFFER);
+  explicit FrameWriter(int fd);
+  ~FrameWriter();
+  FrameWriter(const FrameWriter &) = delete;
+  FrameWriter &operator=(const FrameWriter &) = delete;
+
+  int queue(const uint8_t *data, uint32_t len);
+  int queue_raw(const uint8_t *data, uint32_t len);
+  int flush();
+  int send(const uint8_t *data, uint32_t len);
+  int set_nodelay(bool on);
+
+  bool failed() const { return broken; }
+  int fd() const { return sock; }
+
+private:
+  int push(const uint8_t *data, uint32_t len);
+
+  struct Segment {
+    const uint8_t *data;
+    uint32_t len;
+  };
+
+  Client *client; // Client 模式
+  int sock;       // 套接字模式，-1 表示 Client 模式
+  uint8_t *buf;
+  uint32_t capacity;
+  uint32_t used;
+  Segment segments[FRAME_WRITER_SEGMENTS];
+  uint32_t segment_count;
+  uint8_t prefixes[FRAME_WRITER_SEGMENTS / 2][FRAME_HEADER];
+  uint32_t prefix_count;
+  bool broken;
+};
+
+}; // namespace mtlsp
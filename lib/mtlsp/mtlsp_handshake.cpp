@@ -0,0 +1,723 @@
+#include "mtlsp_handshake.h"
+#include "mtlsp_precompute.h"
+#include "mtlsp_trace.h"
+
+using namespace mtlsp;
+
+#define FLIGHT_LEN (2 * BYTE256b + BYTE512b + 1 + crypto_box_SEALBYTES)
+#define FP_FORMATS (FP_FORMAT_JPEG | FP_FORMAT_RESIDUAL) // 本端能上传的指纹格式
+
+HandshakeStateMachine::HandshakeStateMachine(Client &client,
+                                             uint32_t timeout_ms)
+    : client(client), reader(client, HANDSHAKE_FRAME_BUFFER), writer(client),
+      arena(HANDSHAKE_ARENA_SIZE),
+      md(FULL), st(IDLE), res(-1), timeout_ms(timeout_ms), started_ms(0),
+      callback(nullptr), callback_arg(nullptr), failure_msg(nullptr),
+      tickets(nullptr),
+      fingerprint(nullptr), fingerprint_len(0), fingerprint_sent(0),
+      residual(nullptr), residual_len(0), offered(false), rejected(false),
+      fp_format(FP_FORMAT_JPEG), frames_seen(0), t_total(0), t_mark(0), box_us(0), encrypt_us(0),
+      send_us(0) {
+  memset(&ticket, 0, sizeof(ticket));
+}
+
+HandshakeStateMachine::~HandshakeStateMachine() {
+  wipe();
+  sodium_memzero(master, sizeof(master));
+}
+
+/**
+ * @brief 擦除握手过程中的临时秘密，主密钥除外
+ */
+void HandshakeStateMachine::wipe() {
+  sodium_memzero(client_eph_sec, sizeof(client_eph_sec));
+  sodium_memzero(&ticket, sizeof(ticket));
+}
+
+/**
+ * @brief 握手结束时设置结果并通知回调
+ * @return int result
+ */
+int HandshakeStateMachine::finish(int result) {
+  wipe();
+  arena.reset();
+  if (result != 0) {
+    sodium_memzero(master, sizeof(master));
+  }
+  st = FINISHED;
+  res = result;
+  if (callback) {
+    callback(*this, result, callback_arg);
+  }
+  return result;
+}
+
+int HandshakeStateMachine::fail(const char *msg) {
+  handshake_error(msg);
+  failure_msg = msg;
+  return finish(-1);
+}
+
+/**
+ * @brief 各 begin_* 的公共部分：检查前置条件并重置状态
+ * @return int 0 表示成功， -1 表示失败
+ */
+int HandshakeStateMachine::start(Mode mode) {
+  md = mode;
+  res = HS_PENDING;
+  failure_msg = nullptr;
+  started_ms = millis();
+  frames_seen = 0;
+  fingerprint = nullptr;
+  fingerprint_len = fingerprint_sent = 0;
+  offered = residual != nullptr && md != RESUME;
+  rejected = false;
+  fp_format = FP_FORMAT_JPEG;
+  box_us = encrypt_us = send_us = 0;
+  TRACE_MARK(t_total);
+
+  if (precompute_init() < 0) {
+    return fail(
+        "mtlsp handshake failed, cryptologic moduel initalization failed");
+  }
+  if (WiFi.status() != WL_CONNECTED) {
+    return fail("mtlsp handshake failed, wifi not connected");
+  }
+  if (!client.connected()) {
+    return fail("TCP not connected");
+  }
+  arena.reset();
+  if (reader.failed() || writer.failed() || arena.failed()) {
+    return fail("mtlsp handshake buffer allocation failed");
+  }
+  return 0;
+}
+
+/**
+ * @brief 开始完整握手：发送 client_random（请求票据时在前面加一个类型字节）
+ *
+ * @param raw_fingerprint 用于prnu认证的原始指纹字节流，握手结束前须保持有效
+ * @param raw_fingerprint_length raw_fingerprint的长度，单位为Byte
+ * @param tickets 非空时向服务器请求会话恢复票据并存入其中
+ * @return int 0 表示已开始， -1 表示失败
+ */
+int HandshakeStateMachine::begin_full(const uint8_t *raw_fingerprint,
+                                      size_t raw_fingerprint_length,
+                                      TicketStore *tickets) {
+  if (start(FULL) < 0) {
+    return -1;
+  }
+  this->tickets = tickets;
+  fingerprint = raw_fingerprint;
+  fingerprint_len = raw_fingerprint_length;
+
+  esp_fill_random(client_random, BYTE256b);
+  if (tickets || offered) {
+    uint8_t hello[1 + BYTE256b + 1];
+    hello[0] = tickets ? HELLO_FULL_TICKET : HELLO_FULL;
+    memcpy(hello + 1, client_random, BYTE256b);
+    hello[1 + BYTE256b] = FP_FORMATS;
+    writer.queue(hello, offered ? sizeof(hello) : sizeof(hello) - 1);
+  } else {
+    writer.queue(client_random, BYTE256b);
+  }
+  if (writer.flush() < 0) {
+    return fail("client hello not sent");
+  }
+  TRACE_MARK(t_mark);
+  st = WAIT_SERVER_HELLO;
+  return 0;
+}
+
+/**
+ * @brief 开始快速握手：发送 FAST || client_random || BOX_{S_pub}(Q_c||cr)
+ *
+ * @param raw_fingerprint 用于prnu认证的原始指纹字节流，握手结束前须保持有效
+ * @param raw_fingerprint_length raw_fingerprint的长度，单位为Byte
+ * @param tickets 非空时向服务器请求会话恢复票据并存入其中
+ * @return int 0 表示已开始， -1 表示失败
+ */
+int HandshakeStateMachine::begin_fast(const uint8_t *raw_fingerprint,
+                                      size_t raw_fingerprint_length,
+                                      TicketStore *tickets) {
+  if (start(FAST) < 0) {
+    return -1;
+  }
+  this->tickets = tickets;
+  fingerprint = raw_fingerprint;
+  fingerprint_len = raw_fingerprint_length;
+
+  TRACE_BEGIN(t_keygen);
+  take_eph_keypair(client_eph_pub, client_eph_sec);
+  TRACE_END(PHASE_KEYGEN, t_keygen);
+
+  const size_t hello_len =
+      1 + BYTE256b + crypto_box_SEALBYTES + 2 * BYTE256b + 1;
+  ArenaScope scope(arena);
+  uint8_t *hello = arena.alloc(hello_len);
+  uint8_t *tmp_msg_qcc = arena.alloc(2 * BYTE256b); // Q_c||client_random
+  if (!hello || !tmp_msg_qcc) {
+    return fail("handshake arena exhausted");
+  }
+  hello[0] = tickets ? HELLO_FAST_TICKET : HELLO_FAST;
+  esp_fill_random(client_random, BYTE256b);
+  memcpy(hello + 1, client_random, BYTE256b);
+  memcpy(tmp_msg_qcc, client_eph_pub, BYTE256b);
+  memcpy(tmp_msg_qcc + BYTE256b, client_random, BYTE256b);
+  TRACE_BEGIN(t_seal);
+  crypto_box_seal(hello + 1 + BYTE256b, tmp_msg_qcc, 2 * BYTE256b,
+                  server_x25519_pub());
+  TRACE_ACC(box_us, t_seal);
+  hello[hello_len - 1] = FP_FORMATS;
+  if (writer.send(hello, offered ? hello_len : hello_len - 1) < 0) {
+    return fail("client hello not sent");
+  }
+  TRACE_MARK(t_mark);
+  st = WAIT_FLIGHT;
+  return 0;
+}
+
+/**
+ * @brief 开始会话恢复：发送 RESUME || client_random || binder || ticket
+ *
+ * @param tickets 票据存储，成功后存入服务器签发的新票据
+ * @return int 0 表示已开始；1 表示没有可用票据；-1 表示失败
+ */
+int HandshakeStateMachine::begin_resume(TicketStore &tickets) {
+  if (!tickets.take(ticket)) {
+    return 1;
+  }
+  if (start(RESUME) < 0) {
+    return -1;
+  }
+  this->tickets = &tickets;
+
+  ArenaScope scope(arena);
+  uint8_t *hello = arena.alloc(1 + 2 * BYTE256b + TICKET_MAX);
+  if (!hello) {
+    return fail("handshake arena exhausted");
+  }
+  hello[0] = HELLO_RESUME;
+  esp_fill_random(client_random, BYTE256b);
+  memcpy(hello + 1, client_random, BYTE256b);
+  ticket_binder(hello + 1 + BYTE256b, ticket, client_random);
+  memcpy(hello + 1 + 2 * BYTE256b, ticket.blob, ticket.blob_len);
+  if (writer.send(hello, 1 + 2 * BYTE256b + ticket.blob_len) < 0) {
+    return fail("client hello not sent");
+  }
+  st = WAIT_RESUME;
+  return 0;
+}
+
+/**
+ * @brief 提出以噪声残差描述子代替原始指纹上传，须在 begin_full / begin_fast
+ * 之前调用；server 是否接受在 OK 信号中给出，见 mtlsp.md「残差指纹」一节
+ *
+ * @param descriptor prnu_descriptor 生成的描述子，握手结束前须保持有效；
+ * nullptr 表示不提议
+ * @param length descriptor 的长度，单位为Byte
+ */
+void HandshakeStateMachine::offer_residual(const uint8_t *descriptor,
+                                           size_t length) {
+  residual = length ? descriptor : nullptr;
+  residual_len = length;
+}
+
+/**
+ * @brief 设置握手结束时的回调
+ */
+void HandshakeStateMachine::on_complete(HandshakeCallback cb, void *arg) {
+  callback = cb;
+  callback_arg = arg;
+}
+
+/**
+ * @brief 是否在等待 server 的数据（此时 poll 不会有进展，可以去做别的事）
+ */
+bool HandshakeStateMachine::waiting() const {
+  return st == WAIT_SERVER_HELLO || st == WAIT_OK1 || st == WAIT_FLIGHT ||
+         st == WAIT_RESUME || st == WAIT_CONFIRM || st == WAIT_TICKET;
+}
+
+/**
+ * @brief 推进握手，不等待网络
+ * @return int HS_PENDING 表示未结束，否则为握手结果（见类说明）
+ */
+int HandshakeStateMachine::poll() {
+  if (st == IDLE || st == FINISHED) {
+    return res;
+  }
+  if (millis() - started_ms > timeout_ms) {
+    return fail("mtlsp handshake timeout");
+  }
+
+  if (st == SEND_KEY) {
+    return send_key();
+  }
+  if (st == SEND_FINGERPRINT) {
+    return send_fingerprint();
+  }
+
+  uint8_t *frame;
+  int len;
+  while (waiting() && (len = reader.poll(&frame)) >= 0) {
+    int ret = on_frame(frame, len);
+    if (ret != HS_PENDING) {
+      return ret;
+    }
+  }
+  if (reader.failed()) {
+    return fail("mtlsp connection lost");
+  }
+  return HS_PENDING;
+}
+
+/**
+ * @brief 等待 server 的数据到达，最长 ms 毫秒；不在等待状态时立即返回
+ * @return int 1 表示有新数据或无需等待，0 表示超时，-1 表示连接已断开
+ */
+int HandshakeStateMachine::wait(uint32_t ms) {
+  if (!waiting()) {
+    return 1;
+  }
+  return reader.wait(ms);
+}
+
+/**
+ * @brief 阻塞地运行到握手结束
+ *
+ * @param master_secret 传出参数，成功时为 256 bits 主密钥
+ * @return int 与 poll 的结果相同：0 成功，1 回退，-1 失败
+ */
+int HandshakeStateMachine::run(uint8_t master_secret[BYTE256b]) {
+  int ret;
+  while ((ret = poll()) == HS_PENDING) {
+    wait(timeout_ms);
+  }
+  if (ret == 0) {
+    this->master_secret(master_secret);
+  }
+  return ret;
+}
+
+/**
+ * @brief 取出主密钥
+ * @return int 0 表示成功，握手尚未成功时为 -1
+ */
+int HandshakeStateMachine::master_secret(uint8_t out[BYTE256b]) const {
+  if (st != FINISHED || res != 0) {
+    return -1;
+  }
+  memcpy(out, master, BYTE256b);
+  return 0;
+}
+
+int HandshakeStateMachine::on_frame(uint8_t *frame, int len) {
+  switch (st) {
+  case WAIT_SERVER_HELLO:
+    return on_server_hello(frame, len);
+  case WAIT_OK1:
+    return on_ok1(frame, len);
+  case WAIT_FLIGHT:
+    return on_flight(frame, len);
+  case WAIT_RESUME:
+    return on_resume(frame, len);
+  case WAIT_CONFIRM:
+    return on_confirm(frame, len);
+  case WAIT_TICKET:
+    return on_ticket(frame, len);
+  default:
+    return fail("mtlsp unexpected frame");
+  }
+}
+
+/**
+ * @brief 完整握手第 4 步：依次收到 server_random、Q_s、Sig(H(Q_s||cr||sr))
+ */
+int HandshakeStateMachine::on_server_hello(uint8_t *frame, int len) {
+  static const char *missing[] = {"sr not received", "Qs not received",
+                                  "Sig not received"};
+  static const int lens[] = {BYTE256b, BYTE256b, BYTE512b};
+  uint8_t *fields[] = {server_random, server_eph_pub, sig};
+  if (frames_seen == 0 && offered && len == 1 && frame[0] == NOK) {
+    return reject_offer();
+  }
+  if (len != lens[frames_seen]) {
+    return fail(missing[frames_seen]);
+  }
+  memcpy(fields[frames_seen], frame, len);
+  if (++frames_seen < 3) {
+    return HS_PENDING;
+  }
+  TRACE_END(PHASE_SERVER_HELLO, t_mark);
+
+  // 计算 H(Q_s||client_random||server_random) 并验签
+  ArenaScope scope(arena);
+  uint8_t *tmp_msg_qscs = arena.alloc(3 * BYTE256b);
+  if (!tmp_msg_qscs) {
+    return fail("handshake arena exhausted");
+  }
+  memcpy(tmp_msg_qscs, server_eph_pub, BYTE256b);
+  memcpy(tmp_msg_qscs + BYTE256b, client_random, BYTE256b);
+  memcpy(tmp_msg_qscs + 2 * BYTE256b, server_random, BYTE256b);
+  uint8_t hashed_msg[BYTE256b];
+  crypto_hash_sha256(hashed_msg, tmp_msg_qscs, 3 * BYTE256b);
+  TRACE_BEGIN(t_verify);
+  if (crypto_sign_verify_detached(sig, hashed_msg, BYTE256b, ed_server_pub) <
+      0) {
+    client.stop();
+    return fail("mtlsp message verification failed");
+  }
+  TRACE_END(PHASE_SIG_VERIFY, t_verify);
+
+  // 加密发送留到下一次 poll，单次 poll 只做一次公钥运算
+  st = SEND_KEY;
+  return HS_PENDING;
+}
+
+/**
+ * @brief 完整握手第 5 步：确定 Q_c，加密并发送 Q_c||client_random||server_random
+ */
+int HandshakeStateMachine::send_key() {
+  TRACE_BEGIN(t_keygen);
+  take_eph_keypair(client_eph_pub, client_eph_sec);
+  TRACE_END(PHASE_KEYGEN, t_keygen);
+
+  ArenaScope scope(arena);
+  // Q_c||client_random||server_random
+  uint8_t *tmp_msg_qccs = arena.alloc(3 * BYTE256b);
+  uint8_t *cipher_msg = arena.alloc(crypto_box_SEALBYTES + 3 * BYTE256b);
+  if (!tmp_msg_qccs || !cipher_msg) {
+    return fail("handshake arena exhausted");
+  }
+  memcpy(tmp_msg_qccs, client_eph_pub, BYTE256b);
+  memcpy(tmp_msg_qccs + BYTE256b, client_random, BYTE256b);
+  memcpy(tmp_msg_qccs + 2 * BYTE256b, server_random, BYTE256b);
+  TRACE_BEGIN(t_seal);
+  crypto_box_seal(cipher_msg, tmp_msg_qccs, 3 * BYTE256b, server_x25519_pub());
+  TRACE_ACC(box_us, t_seal);
+  if (writer.send(cipher_msg, crypto_box_SEALBYTES + 3 * BYTE256b) < 0) {
+    return fail("mtlsp key not sent");
+  }
+  st = WAIT_OK1;
+  return HS_PENDING;
+}
+
+/**
+ * @brief 完整握手第 8 步：验收 BOX_{Q_c}(OK)
+ */
+int HandshakeStateMachine::on_ok1(uint8_t *frame, int len) {
+  if (len != (int)(1 + offered + crypto_box_SEALBYTES)) {
+    return fail("OK1 not received");
+  }
+  uint8_t unsealed_signal[2]; // OK || 指纹格式（仅在提议时）
+  TRACE_BEGIN(t_open);
+  if (crypto_box_seal_open(unsealed_signal, frame, len, client_eph_pub,
+                           client_eph_sec) < 0) {
+    return fail("ecc crypto error");
+  }
+  TRACE_ACC(box_us, t_open);
+  TRACE_ACC_END(PHASE_BOX, box_us);
+  if (unsealed_signal[0] != OK) {
+    client.stop();
+    return fail("mtlsp denied");
+  }
+  if (select_format(unsealed_signal) < 0) {
+    return -1;
+  }
+  return key_schedule();
+}
+
+/**
+ * @brief 快速握手：server_random || Q_s || Sig(H(Q_s||cr||sr||Q_c)) ||
+ * BOX_{Q_c}(OK)，单字节 NotOK 表示不支持快速握手
+ */
+int HandshakeStateMachine::on_flight(uint8_t *frame, int len) {
+  TRACE_END(PHASE_SERVER_HELLO, t_mark);
+  if (len == 1 && frame[0] == NOK) {
+    if (offered) {
+      return reject_offer();
+    }
+    Serial.println("mtlsp fast handshake not supported, fall back");
+    return finish(1);
+  }
+  if (len != (int)(FLIGHT_LEN + offered)) {
+    return fail("server flight not received");
+  }
+  memcpy(server_random, frame, BYTE256b);
+  memcpy(server_eph_pub, frame + BYTE256b, BYTE256b);
+  const uint8_t *flight_sig = frame + 2 * BYTE256b;
+  const uint8_t *sealed_signal = frame + 2 * BYTE256b + BYTE512b;
+
+  // 验签，签名同时覆盖 Q_c，防止 Q_c 被替换
+  ArenaScope scope(arena);
+  // Q_s||client_random||server_random||Q_c
+  uint8_t *tmp_msg_qscsc = arena.alloc(4 * BYTE256b);
+  if (!tmp_msg_qscsc) {
+    return fail("handshake arena exhausted");
+  }
+  memcpy(tmp_msg_qscsc, server_eph_pub, BYTE256b);
+  memcpy(tmp_msg_qscsc + BYTE256b, client_random, BYTE256b);
+  memcpy(tmp_msg_qscsc + 2 * BYTE256b, server_random, BYTE256b);
+  memcpy(tmp_msg_qscsc + 3 * BYTE256b, client_eph_pub, BYTE256b);
+  uint8_t hashed_msg[BYTE256b];
+  crypto_hash_sha256(hashed_msg, tmp_msg_qscsc, 4 * BYTE256b);
+  TRACE_BEGIN(t_verify);
+  if (crypto_sign_verify_detached(flight_sig, hashed_msg, BYTE256b,
+                                  ed_server_pub) < 0) {
+    client.stop();
+    return fail("mtlsp message verification failed");
+  }
+  TRACE_END(PHASE_SIG_VERIFY, t_verify);
+
+  // 验收同一 flight 中的 OK 信号
+  uint8_t unsealed_signal[2];
+  TRACE_BEGIN(t_open);
+  if (crypto_box_seal_open(unsealed_signal, sealed_signal,
+                           1 + offered + crypto_box_SEALBYTES, client_eph_pub,
+                           client_eph_sec) < 0) {
+    return fail("ecc crypto error");
+  }
+  TRACE_ACC(box_us, t_open);
+  TRACE_ACC_END(PHASE_BOX, box_us);
+  if (unsealed_signal[0] != OK) {
+    client.stop();
+    return fail("mtlsp denied");
+  }
+  if (select_format(unsealed_signal) < 0) {
+    return -1;
+  }
+  return key_schedule();
+}
+
+/**
+ * @brief 按 server 在 OK 信号中选定的格式确定要上传的指纹
+ * @return int 0 表示成功， -1 表示失败
+ */
+int HandshakeStateMachine::select_format(const uint8_t *signal) {
+  if (!offered) {
+    return 0;
+  }
+  switch (signal[1]) {
+  case FP_FORMAT_JPEG:
+    break;
+  case FP_FORMAT_RESIDUAL:
+    fingerprint = residual;
+    fingerprint_len = residual_len;
+    break;
+  default:
+    return fail("unknown fingerprint format");
+  }
+  fp_format = signal[1];
+  return 0;
+}
+
+/**
+ * @brief server 不认识带指纹格式字节的 hello：撤回残差提议，以 1 结束，
+ * 调用方可在同一连接上重新 begin_*
+ */
+int HandshakeStateMachine::reject_offer() {
+  Serial.println("mtlsp fingerprint formats not supported, retry without them");
+  residual = nullptr;
+  residual_len = 0;
+  rejected = true;
+  return finish(1);
+}
+
+/**
+ * @brief 第 9 步：计算预主密钥 Z 与主密钥 M = H(Z || cr || sr)，并准备第 10
+ * 步的指纹上传
+ */
+int HandshakeStateMachine::key_schedule() {
+  uint8_t pre_master_secret[BYTE256b];
+  TRACE_BEGIN(t_scalarmult);
+  if (crypto_scalarmult_curve25519(pre_master_secret, client_eph_sec,
+                                   server_eph_pub) < 0) {
+    return fail("scalarmult crypto error");
+  }
+  TRACE_END(PHASE_SCALARMULT, t_scalarmult);
+  sodium_memzero(client_eph_sec, sizeof(client_eph_sec));
+
+  {
+    ArenaScope scope(arena); // 退出作用域时擦除 Z
+    // Z||client_random||server_random
+    uint8_t *tmp_msg_zcs = arena.alloc(3 * BYTE256b);
+    if (!tmp_msg_zcs) {
+      sodium_memzero(pre_master_secret, sizeof(pre_master_secret));
+      return fail("handshake arena exhausted");
+    }
+    memcpy(tmp_msg_zcs, pre_master_secret, BYTE256b);
+    memcpy(tmp_msg_zcs + BYTE256b, client_random, BYTE256b);
+    memcpy(tmp_msg_zcs + 2 * BYTE256b, server_random, BYTE256b);
+    crypto_hash_sha256(master, tmp_msg_zcs, 3 * BYTE256b);
+    sodium_memzero(pre_master_secret, sizeof(pre_master_secret));
+  }
+
+  // 会话 AEAD 上下文，密钥扩展只做一次，指纹与 OK 信号共用
+  if (aead.setkey(master) < 0) {
+    return fail("aes key schedule failed");
+  }
+
+  // nonce 帧与指纹帧的长度前缀先排队，与第一个密文分块一起写出
+  esp_fill_random(nonce, sizeof(nonce));
+  writer.queue(nonce, sizeof(nonce));
+  uint8_t prefix[FRAME_HEADER];
+  uint32_t be_len = htonl(fingerprint_len + TAG_SIZE);
+  memcpy(prefix, &be_len, FRAME_HEADER);
+  writer.queue_raw(prefix, FRAME_HEADER);
+  if (aead.stream_start(MBEDTLS_GCM_ENCRYPT, nonce) < 0) {
+    return fail("fingerprint stream encryption failed");
+  }
+  st = SEND_FINGERPRINT;
+  return HS_PENDING;
+}
+
+/**
+ * @brief 第 10 步：每次 poll 加密发送 HANDSHAKE_CHUNKS_PER_POLL 个分块，线上
+ * 格式与 send_encrypted 相同
+ */
+int HandshakeStateMachine::send_fingerprint() {
+  // 分块在 flush 之前必须有效，本次 poll 结束后才归还
+  ArenaScope scope(arena);
+  uint8_t *chunk = arena.alloc(STREAM_CHUNK_SIZE);
+  if (!chunk) {
+    return fail("handshake arena exhausted");
+  }
+  for (uint32_t i = 0;
+       i < HANDSHAKE_CHUNKS_PER_POLL && fingerprint_sent < fingerprint_len;
+       ++i) {
+    size_t n = fingerprint_len - fingerprint_sent;
+    if (n > STREAM_CHUNK_SIZE)
+      n = STREAM_CHUNK_SIZE;
+    TRACE_BEGIN(t_encrypt);
+    if (aead.stream_update(chunk, fingerprint + fingerprint_sent, n) < 0) {
+      return fail("fingerprint stream encryption failed");
+    }
+    TRACE_ACC(encrypt_us, t_encrypt);
+    fingerprint_sent += n;
+    // 最后一个分块留到与认证标签一起写出
+    TRACE_BEGIN(t_send);
+    if (writer.queue_raw(chunk, n) < 0 ||
+        (fingerprint_sent < fingerprint_len && writer.flush() < 0)) {
+      return fail("fingerprint not sent");
+    }
+    TRACE_ACC(send_us, t_send);
+  }
+  if (fingerprint_sent < fingerprint_len) {
+    return HS_PENDING;
+  }
+
+  uint8_t tag[TAG_SIZE];
+  if (aead.stream_finish(tag) < 0) {
+    return fail("fingerprint stream encryption failed");
+  }
+  TRACE_BEGIN(t_send);
+  if (writer.queue_raw(tag, TAG_SIZE) < 0 || writer.flush() < 0) {
+    return fail("fingerprint not sent");
+  }
+  TRACE_ACC(send_us, t_send);
+  TRACE_ACC_END(PHASE_FP_ENCRYPT, encrypt_us);
+  TRACE_ACC_END(PHASE_FP_SEND, send_us);
+
+  TRACE_MARK(t_mark);
+  frames_seen = 0;
+  st = WAIT_CONFIRM;
+  return HS_PENDING;
+}
+
+/**
+ * @brief 会话恢复：server_random 表示接受，单字节 NotOK 表示拒绝
+ */
+int HandshakeStateMachine::on_resume(uint8_t *frame, int len) {
+  if (len == 1 && frame[0] == NOK) {
+    Serial.println("mtlsp ticket rejected, fall back to full handshake");
+    return finish(1);
+  }
+  if (len != BYTE256b) {
+    return fail("resume sr not received");
+  }
+  memcpy(server_random, frame, BYTE256b);
+  resume_master(master, ticket.resumption_secret, client_random,
+                server_random);
+  sodium_memzero(&ticket, sizeof(ticket));
+  if (aead.setkey(master) < 0) {
+    return fail("aes key schedule failed");
+  }
+  frames_seen = 0;
+  st = WAIT_CONFIRM;
+  return HS_PENDING;
+}
+
+/**
+ * @brief 第 11 步：nonce 帧与 E_M(OK) 帧
+ */
+int HandshakeStateMachine::on_confirm(uint8_t *frame, int len) {
+  if (frames_seen++ == 0) {
+    if (len != IV_SIZE) {
+      return fail("OK2 nonce not received");
+    }
+    memcpy(nonce, frame, IV_SIZE);
+    return HS_PENDING;
+  }
+  if (len != 1 + TAG_SIZE) {
+    return fail("OK2 cipher not received");
+  }
+  if (aead.decrypt(frame, len, nullptr, 0, nonce) < 0) {
+    return fail("aes crypto error");
+  }
+  if (frame[0] != OK) {
+    return fail("device may not registed");
+  }
+  if (md != RESUME) {
+    TRACE_END(PHASE_CONFIRM, t_mark);
+  }
+  if (!tickets) {
+    return done();
+  }
+  frames_seen = 0;
+  st = WAIT_TICKET;
+  return HS_PENDING;
+}
+
+/**
+ * @brief 服务器签发的会话恢复票据：nonce 帧 + E_M(lifetime_be32 || blob) 帧
+ */
+int HandshakeStateMachine::on_ticket(uint8_t *frame, int len) {
+  if (frames_seen++ == 0) {
+    if (len != IV_SIZE) {
+      return fail("session ticket not received");
+    }
+    memcpy(nonce, frame, IV_SIZE);
+    return HS_PENDING;
+  }
+  if (store_ticket(aead, nonce, frame, len, master, *tickets) < 0) {
+    return fail("session ticket not received");
+  }
+  return done();
+}
+
+/**
+ * @brief 握手成功，(client, master) 可为消息传输模块所用
+ */
+int HandshakeStateMachine::done() {
+  // 握手是一问一答的，此后 server 在 client 发言前不会再发送数据；缓冲区中
+  // 若有剩余字节，说明字节流已错位
+  if (reader.buffered() != 0) {
+    return fail("unexpected data after handshake");
+  }
+  switch (md) {
+  case FULL:
+    TRACE_END(PHASE_TOTAL, t_total);
+    Serial.println("mtlsp handshake succeed!");
+    break;
+  case FAST:
+    TRACE_END(PHASE_TOTAL, t_total);
+    Serial.println("mtlsp fast handshake succeed!");
+    break;
+  case RESUME:
+    TRACE_END(PHASE_RESUME, t_total);
+    Serial.println("mtlsp session resumed!");
+    break;
+  }
+  return finish(0);
+}
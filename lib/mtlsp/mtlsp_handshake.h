@@ -0,0 +1,138 @@
+#pragma once
+#include "mtlsp.h"
+#include "mtlsp_frame.h"
+#include "mtlsp_memory.h"
+#include "mtlsp_ticket.h"
+
+#define HS_PENDING 2                // poll 的返回值：握手尚未结束
+#define HANDSHAKE_TIMEOUT_MS 10000U // 整个握手的期限
+#define HANDSHAKE_CHUNKS_PER_POLL 1U // 每次 poll 最多加密发送的指纹分块数
+#define HANDSHAKE_ARENA_SIZE (STREAM_CHUNK_SIZE + 512U) // 一个指纹分块或一条握手消息
+
+namespace mtlsp {
+
+class HandshakeStateMachine;
+
+/// 握手结束（成功、需要回退或失败）时调用一次，result 与 poll 的返回值相同
+typedef void (*HandshakeCallback)(HandshakeStateMachine &hs, int result,
+                                  void *arg);
+
+/// 非阻塞握手状态机
+///
+/// begin_* 发出第一帧后立即返回，之后反复调用 poll：每次只处理已经到达的帧，
+/// 或加密发送有限个指纹分块，从不等待网络，半帧留在 FrameReader 中。可以在
+/// FreeRTOS 任务或事件循环里与拍照等工作交替运行，也可以同时驱动多条连接。
+/// handshake_client / handshake_client_fast / resume_client 是它的阻塞封装。
+///
+/// poll 返回 HS_PENDING 表示未结束；0 表示成功，可用 master_secret 取出主密钥；
+/// 1 表示服务器要求回退（同一连接上可用另一种 begin_* 重新开始）；-1 表示失败。
+class HandshakeStateMachine {
+public:
+  enum Mode : uint8_t { FULL, FAST, RESUME };
+  enum State : uint8_t {
+    IDLE,
+    WAIT_SERVER_HELLO, // 完整握手：server_random, Q_s, Sig 三帧
+    SEND_KEY,          // 完整握手：发送 BOX(Q_c||cr||sr)
+    WAIT_OK1,          // 完整握手：BOX_{Q_c}(OK)
+    WAIT_FLIGHT,       // 快速握手：server 的一整个 flight
+    WAIT_RESUME,       // 会话恢复：server_random 或 NotOK
+    SEND_FINGERPRINT,  // 分块加密上传指纹
+    WAIT_CONFIRM,      // nonce 帧与 E_M(OK) 帧
+    WAIT_TICKET,       // nonce 帧与票据帧
+    FINISHED,
+  };
+
+  explicit HandshakeStateMachine(Client &client,
+                                 uint32_t timeout_ms = HANDSHAKE_TIMEOUT_MS);
+  ~HandshakeStateMachine();
+  HandshakeStateMachine(const HandshakeStateMachine &) = delete;
+  HandshakeStateMachine &operator=(const HandshakeStateMachine &) = delete;
+
+  int begin_full(const uint8_t *raw_fingerprint, size_t raw_fingerprint_length,
+                 TicketStore *tickets = nullptr);
+  int begin_fast(const uint8_t *raw_fingerprint, size_t raw_fingerprint_length,
+                 TicketStore *tickets = nullptr);
+  int begin_resume(TicketStore &tickets);
+  void offer_residual(const uint8_t *descriptor, size_t length);
+
+  int poll();
+  int wait(uint32_t ms);
+  int run(uint8_t master_secret[BYTE256b]);
+  void on_complete(HandshakeCallback cb, void *arg);
+
+  State state() const { return st; }
+  Mode mode() const { return md; }
+  int result() const { return res; }
+  bool waiting() const;
+  int master_secret(uint8_t out[BYTE256b]) const;
+  /// 上传的指纹格式，FP_FORMAT_JPEG 或 FP_FORMAT_RESIDUAL
+  uint8_t fingerprint_format() const { return fp_format; }
+  /// 上一次握手因 server 不认识指纹格式字节而回退，残差提议已撤回
+  bool offer_rejected() const { return rejected; }
+  /// 失败原因，握手未失败时为 nullptr
+  const char *failure() const { return failure_msg; }
+  /// 临时缓冲区的历史最大占用，用于确定 HANDSHAKE_ARENA_SIZE
+  size_t arena_high_water() const { return arena.high_water(); }
+
+private:
+  int start(Mode mode);
+  int on_frame(uint8_t *frame, int len);
+  int on_server_hello(uint8_t *frame, int len);
+  int on_ok1(uint8_t *frame, int len);
+  int on_flight(uint8_t *frame, int len);
+  int on_resume(uint8_t *frame, int len);
+  int on_confirm(uint8_t *frame, int len);
+  int on_ticket(uint8_t *frame, int len);
+  int select_format(const uint8_t *signal);
+  int reject_offer();
+  int send_key();
+  int key_schedule();
+  int send_fingerprint();
+  int done();
+  int fail(const char *msg);
+  int finish(int result);
+  void wipe();
+
+  Client &client;
+  FrameReader reader;
+  FrameWriter writer;
+  Arena arena; // 握手消息与指纹分块的临时缓冲区，内部 RAM，握手结束时擦除
+  Aes256Gcm aead;
+  Mode md;
+  State st;
+  int res;
+  uint32_t timeout_ms;
+  unsigned long started_ms;
+  HandshakeCallback callback;
+  void *callback_arg;
+  const char *failure_msg;
+
+  TicketStore *tickets;
+  Ticket ticket; // 会话恢复时取出的票据
+  const uint8_t *fingerprint;
+  size_t fingerprint_len;
+  size_t fingerprint_sent;
+  const uint8_t *residual; // 提议的残差描述子，nullptr 表示不提议
+  size_t residual_len;
+  bool offered;            // 本次 hello 带有指纹格式字节
+  bool rejected;
+  uint8_t fp_format;
+  uint8_t frames_seen; // 当前状态下已收到的帧数
+
+  uint8_t client_random[BYTE256b];
+  uint8_t server_random[BYTE256b];
+  uint8_t server_eph_pub[BYTE256b];
+  uint8_t sig[BYTE512b];
+  uint8_t client_eph_pub[BYTE256b];
+  uint8_t client_eph_sec[BYTE256b];
+  uint8_t master[BYTE256b];
+  uint8_t nonce[IV_SIZE];
+
+  int64_t t_total; // 分阶段计时，MTLSP_TRACE=0 时不使用
+  int64_t t_mark;
+  int64_t box_us;
+  int64_t encrypt_us;
+  int64_t send_us;
+};
+
+}; // namespace mtlsp
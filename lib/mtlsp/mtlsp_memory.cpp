@@ -0,0 +1,175 @@
+#include "mtlsp_memory.h"
+#include "sodium.h"
+#if defined(ESP_PLATFORM)
+#include <esp_heap_caps.h>
+#else
+#include <cstdlib>
+#endif
+
+using namespace mtlsp;
+
+struct WatchedTask {
+  TaskHandle_t task;
+  const char *name;
+};
+
+static WatchedTask watched[MEMORY_WATCH_MAX];
+static uint32_t watched_count = 0;
+
+/**
+ * @brief 按放置策略分配内存
+ *
+ * @param size 字节数
+ * @param cls MEM_CRYPTO 只用内部 RAM；MEM_BULK 优先 PSRAM，不够时用内部 RAM
+ * @return void* 失败为 nullptr，用 mem_free 释放
+ */
+void *mtlsp::mem_alloc(size_t size, MemClass cls) {
+#if defined(ESP_PLATFORM)
+  if (cls == MEM_BULK) {
+    void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (p) {
+      return p;
+    }
+  }
+  return heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+#else
+  return malloc(size);
+#endif
+}
+
+void mtlsp::mem_free(void *ptr) {
+#if defined(ESP_PLATFORM)
+  heap_caps_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+Arena::Arena(size_t capacity, MemClass cls)
+    : base(nullptr), cap(capacity), used(0), peak(0) {
+  base = (uint8_t *)mem_alloc(capacity, cls);
+  if (!base) {
+    cap = 0;
+  }
+}
+
+Arena::~Arena() {
+  if (base) {
+    sodium_memzero(base, cap);
+    mem_free(base);
+  }
+}
+
+/**
+ * @brief 分配 ARENA_ALIGN 对齐的一块
+ * @return uint8_t* 空间不足时为 nullptr
+ */
+uint8_t *Arena::alloc(size_t size) {
+  size_t start = (used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (!base || start > cap || size > cap - start) {
+    return nullptr;
+  }
+  used = start + size;
+  if (used > peak) {
+    peak = used;
+  }
+  return base + start;
+}
+
+/**
+ * @brief 退回到 mark() 返回的位置，擦除其后的内容（可能含密钥材料）
+ */
+void Arena::rewind(size_t mark) {
+  if (mark < used) {
+    sodium_memzero(base + mark, used - mark);
+    used = mark;
+  }
+}
+
+void Arena::reset() { rewind(0); }
+
+/**
+ * @brief 登记一个任务，报告其栈余量；传 nullptr 表示调用者所在的任务
+ * @return int 0 表示成功， -1 表示已满
+ */
+int mtlsp::memory_watch_task(TaskHandle_t task, const char *name) {
+#if defined(ESP_PLATFORM)
+  if (task == nullptr) {
+    task = xTaskGetCurrentTaskHandle();
+  }
+#endif
+  if (watched_count >= MEMORY_WATCH_MAX) {
+    return -1;
+  }
+  watched[watched_count++] = {task, name};
+  return 0;
+}
+
+/**
+ * @brief 取消登记，任务删除之前必须调用
+ */
+void mtlsp::memory_unwatch_task(TaskHandle_t task) {
+  for (uint32_t i = 0; i < watched_count; i++) {
+    if (watched[i].task == task) {
+      watched[i] = watched[--watched_count];
+      return;
+    }
+  }
+}
+
+#if defined(ESP_PLATFORM)
+static void heap_usage(HeapUsage &out, uint32_t caps) {
+  out.total = heap_caps_get_total_size(caps);
+  out.free = heap_caps_get_free_size(caps);
+  out.min_free = heap_caps_get_minimum_free_size(caps);
+  out.largest = heap_caps_get_largest_free_block(caps);
+}
+#endif
+
+/**
+ * @brief 内部 RAM 与 PSRAM 的使用情况与高水位，以及登记任务中最小的栈余量
+ */
+void mtlsp::memory_report(MemoryReport &out) {
+  memset(&out, 0, sizeof(out));
+  out.min_stack_free = UINT32_MAX;
+#if defined(ESP_PLATFORM)
+  heap_usage(out.internal, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  heap_usage(out.psram, MALLOC_CAP_SPIRAM);
+  for (uint32_t i = 0; i < watched_count; i++) {
+    // ESP-IDF 中栈以字节计
+    uint32_t left = uxTaskGetStackHighWaterMark(watched[i].task);
+    if (left < out.min_stack_free) {
+      out.min_stack_free = left;
+      out.min_stack_task = watched[i].name;
+    }
+  }
+#endif
+  if (out.min_stack_task == nullptr) {
+    out.min_stack_free = 0;
+  }
+}
+
+/**
+ * @brief 打印 memory_report，每类堆一行，每个登记任务一行
+ */
+void mtlsp::memory_print(Print &out) {
+  MemoryReport r;
+  memory_report(r);
+  out.printf("heap     total    free     min_free largest\n");
+  out.printf("internal %-8u %-8u %-8u %-8u\n", (unsigned)r.internal.total,
+             (unsigned)r.internal.free, (unsigned)r.internal.min_free,
+             (unsigned)r.internal.largest);
+  out.printf("psram    %-8u %-8u %-8u %-8u\n", (unsigned)r.psram.total,
+             (unsigned)r.psram.free, (unsigned)r.psram.min_free,
+             (unsigned)r.psram.largest);
+#if defined(ESP_PLATFORM)
+  for (uint32_t i = 0; i < watched_count; i++) {
+    out.printf("stack %-12s %u bytes left\n", watched[i].name,
+               (unsigned)uxTaskGetStackHighWaterMark(watched[i].task));
+  }
+#endif
+  if (r.min_stack_task) {
+    out.printf("min stack headroom: %u (%s)\n", (unsigned)r.min_stack_free,
+               r.min_stack_task);
+  }
+}
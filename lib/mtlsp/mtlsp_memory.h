@@ -0,0 +1,84 @@
+#pragma once
+#include <Arduino.h>
+
+#define ARENA_ALIGN 8U            // 分配的对齐字节数
+#define MEMORY_WATCH_MAX 8U       // 最多登记的任务数
+
+namespace mtlsp {
+
+/// 内存放置策略
+///
+/// 8 MB OPI PSRAM 旁边只有几百 KB 内部 SRAM：密钥、握手临时数据等加密状态只放
+/// 内部 RAM（不经过外部总线、不进 PSRAM 缓存）；帧缓冲区、记录缓冲区等大块
+/// 数据优先放 PSRAM，不够时才占用内部 RAM。native 环境下都是 malloc。
+enum MemClass : uint8_t {
+  MEM_CRYPTO, // 只用内部 RAM
+  MEM_BULK,   // 优先 PSRAM
+};
+
+void *mem_alloc(size_t size, MemClass cls);
+void mem_free(void *ptr);
+
+/// 每连接的临时缓冲区
+///
+/// 构造时按 MEM_CRYPTO 一次性分配，之后 alloc 只移动指针；握手中各步骤的
+/// 临时消息用 ArenaScope 在步骤结束时归还，reset 在握手结束后擦除并归还全部，
+/// 不在栈上放大块数组，也不反复 malloc / free 造成碎片。
+class Arena {
+public:
+  Arena(size_t capacity, MemClass cls = MEM_CRYPTO);
+  ~Arena();
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  uint8_t *alloc(size_t size);
+  void rewind(size_t mark);
+  void reset();
+
+  size_t mark() const { return used; }
+  size_t capacity() const { return cap; }
+  /// 历史最大占用，用于确定 capacity
+  size_t high_water() const { return peak; }
+  bool failed() const { return base == nullptr; }
+
+private:
+  uint8_t *base;
+  size_t cap;
+  size_t used;
+  size_t peak;
+};
+
+/// 作用域结束时把 arena 退回到进入时的位置，并擦除其间分配的内容
+class ArenaScope {
+public:
+  explicit ArenaScope(Arena &arena) : arena(arena), start(arena.mark()) {}
+  ~ArenaScope() { arena.rewind(start); }
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+  Arena &arena;
+  size_t start;
+};
+
+/// 一类堆的使用情况，单位为字节
+struct HeapUsage {
+  size_t total;
+  size_t free;
+  size_t min_free; // 开机以来的最低空闲量，total - min_free 即高水位
+  size_t largest;  // 最大连续空闲块，远小于 free 说明碎片化
+};
+
+struct MemoryReport {
+  HeapUsage internal;
+  HeapUsage psram;
+  uint32_t min_stack_free;    // 登记任务中最小的栈余量
+  const char *min_stack_task; // 没有登记任务时为 nullptr
+};
+
+int memory_watch_task(TaskHandle_t task, const char *name);
+void memory_unwatch_task(TaskHandle_t task);
+void memory_report(MemoryReport &out);
+void memory_print(Print &out);
+
+}; // namespace mtlsp
@@ -0,0 +1,128 @@
+#include "mtlsp_precompute.h"
+#include <atomic>
+
+using namespace mtlsp;
+
+struct EphKeypair {
+  uint8_t pub[BYTE256b];
+  uint8_t sec[BYTE256b];
+};
+
+enum InitState : uint8_t { INIT_NONE, INIT_RUNNING, INIT_DONE };
+
+static std::atomic<uint8_t> init_state(INIT_NONE); // 握手线程可能同时首次调用
+static uint8_t x_server_pub[BYTE256b];   // 转换后的服务器 X25519 公钥
+static EphKeypair pool[EPH_POOL_SIZE];
+static size_t pool_count = 0;
+static SemaphoreHandle_t pool_lock = nullptr;
+static TaskHandle_t refill_task = nullptr;
+
+/**
+ * @brief 把池补满，每生成一个密钥对只短暂持有一次锁
+ */
+static void refill_pool() {
+  for (;;) {
+    EphKeypair kp;
+    crypto_kx_keypair(kp.pub, kp.sec);
+
+    bool full;
+    xSemaphoreTake(pool_lock, portMAX_DELAY);
+    full = pool_count >= EPH_POOL_SIZE;
+    if (!full) {
+      pool[pool_count++] = kp;
+    }
+    xSemaphoreGive(pool_lock);
+
+    sodium_memzero(&kp, sizeof(kp));
+    if (full) {
+      return;
+    }
+  }
+}
+
+/**
+ * @brief 后台补池任务，被 take_eph_keypair 通知后运行
+ */
+static void refill_loop(void *arg) {
+  for (;;) {
+    refill_pool();
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+}
+
+/**
+ * @brief 初始化预计算服务，可重复、可并发调用
+ *
+ * @param priority 补池任务优先级，默认仅高于 idle
+ * @param core 补池任务所在核，默认 0 号核（Arduino loop 运行在 1 号核）
+ * @return int 0 表示成功， -1 表示失败
+ *
+ * @details 只有一个调用者执行初始化，其余调用者等待它完成；失败后状态复位，
+ * 下一次调用重新尝试
+ */
+int mtlsp::precompute_init(UBaseType_t priority, BaseType_t core) {
+  uint8_t state = INIT_NONE;
+  while (!init_state.compare_exchange_weak(state, INIT_RUNNING,
+                                           std::memory_order_acquire)) {
+    if (state == INIT_DONE) {
+      return 0;
+    }
+    if (state == INIT_RUNNING) {
+      vTaskDelay(1); // 另一个调用者正在初始化
+    }
+    state = INIT_NONE;
+  }
+
+  if (sodium_init() < 0 ||
+      crypto_sign_ed25519_pk_to_curve25519(x_server_pub, ed_server_pub) < 0) {
+    init_state.store(INIT_NONE, std::memory_order_release);
+    return -1;
+  }
+
+  if (!pool_lock) {
+    pool_lock = xSemaphoreCreateMutex();
+  }
+  if (!pool_lock) {
+    init_state.store(INIT_NONE, std::memory_order_release);
+    return -1;
+  }
+  if (xTaskCreatePinnedToCore(refill_loop, "mtlsp_kx", 4096, nullptr, priority,
+                              &refill_task, core) != pdPASS) {
+    refill_task = nullptr; // 没有后台任务时 take_eph_keypair 当场生成
+  }
+
+  init_state.store(INIT_DONE, std::memory_order_release);
+  return 0;
+}
+
+bool mtlsp::precompute_ready() {
+  return init_state.load(std::memory_order_acquire) == INIT_DONE;
+}
+
+/**
+ * @brief 预先转换好的服务器 X25519 公钥，须先调用 precompute_init
+ */
+const uint8_t *mtlsp::server_x25519_pub() { return x_server_pub; }
+
+/**
+ * @brief 取出一个临时 ECDH 公私钥对，取出后的私钥不再保留在池中
+ */
+void mtlsp::take_eph_keypair(uint8_t pub[BYTE256b], uint8_t sec[BYTE256b]) {
+  bool taken = false;
+  xSemaphoreTake(pool_lock, portMAX_DELAY);
+  if (pool_count > 0) {
+    EphKeypair &kp = pool[--pool_count];
+    memcpy(pub, kp.pub, BYTE256b);
+    memcpy(sec, kp.sec, BYTE256b);
+    sodium_memzero(&kp, sizeof(kp));
+    taken = true;
+  }
+  xSemaphoreGive(pool_lock);
+
+  if (!taken) {
+    crypto_kx_keypair(pub, sec);
+  }
+  if (refill_task) {
+    xTaskNotifyGive(refill_task);
+  }
+}
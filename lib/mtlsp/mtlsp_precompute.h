@@ -0,0 +1,22 @@
+#pragma once
+#include "mtlsp.h"
+
+#define EPH_POOL_SIZE 4U // 预生成的临时 ECDH 公私钥对数量
+
+namespace mtlsp {
+
+/// 握手材料预计算服务：
+/// - sodium_init 只执行一次
+/// - 服务器 Ed25519 公钥只转换一次为 X25519 公钥
+/// - 后台低优先级任务（固定在另一个核上）维持一个临时公私钥对池，
+///   握手时直接取用，池空时当场生成
+int precompute_init(UBaseType_t priority = tskIDLE_PRIORITY + 1,
+                    BaseType_t core = 0);
+
+bool precompute_ready();
+
+const uint8_t *server_x25519_pub();
+
+void take_eph_keypair(uint8_t pub[BYTE256b], uint8_t sec[BYTE256b]);
+
+}; // namespace mtlsp
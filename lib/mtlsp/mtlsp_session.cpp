@@ -0,0 +1,307 @@
+#include "mtlsp_session.h"
+#include "mtlsp_memory.h"
+
+using namespace mtlsp;
+
+#define RECORD_HEADER FRAME_HEADER
+
+/**
+ * @brief 由主密钥派生一个方向的密钥或 IV：HMAC-SHA256(M, label || aead_id)
+ */
+static void derive(uint8_t out[BYTE256b], const uint8_t master_secret[BYTE256b],
+                   const char *label, uint8_t aead_id) {
+  crypto_auth_hmacsha256_state hmac;
+  crypto_auth_hmacsha256_init(&hmac, master_secret, BYTE256b);
+  crypto_auth_hmacsha256_update(&hmac, reinterpret_cast<const uint8_t *>(label),
+                                strlen(label));
+  crypto_auth_hmacsha256_update(&hmac, &aead_id, 1);
+  crypto_auth_hmacsha256_final(&hmac, out);
+}
+
+/**
+ * @brief 建立加密会话
+ *
+ * @param client 已完成握手的客户端，相当于套接字
+ * @param master_secret 握手得到的 256 bits 主密钥，构造后调用方即可擦除
+ * @param is_client true 为设备端，false 为服务器端（决定收发方向的密钥）
+ * @param max_record 单条记录明文最大长度，更长的消息由 seal_send 自动分片
+ */
+Session::Session(Client &client, const uint8_t master_secret[BYTE256b],
+                 bool is_client, uint32_t max_record)
+    : client(client),
+      reader(client, 2 * (RECORD_HEADER + max_record + TAG_SIZE),
+             max_record + TAG_SIZE),
+      send_aead(nullptr), recv_aead(nullptr),
+      is_client(is_client), send_seq(0), recv_seq(0), max_record(max_record),
+      record_buf(nullptr), closed(false) {
+  memcpy(traffic_secret, master_secret, BYTE256b);
+  record_buf = (uint8_t *)mem_alloc(RECORD_HEADER + max_record + TAG_SIZE,
+                                    MEM_BULK);
+  if (!record_buf || reader.failed() || rekey(AEAD_MBEDTLS_AES256GCM) < 0) {
+    closed = true;
+  }
+}
+
+Session::~Session() {
+  delete send_aead;
+  delete recv_aead;
+  if (record_buf) {
+    mem_free(record_buf);
+  }
+  sodium_memzero(traffic_secret, sizeof(traffic_secret));
+  sodium_memzero(send_iv, sizeof(send_iv));
+  sodium_memzero(recv_iv, sizeof(recv_iv));
+}
+
+/**
+ * @brief 切换到指定 AEAD 后端，并派生该后端专用的密钥与 IV；序号继续递增
+ * @return int 0 成功，-1 失败
+ */
+int Session::rekey(uint8_t id) {
+  AeadBackend *new_send = aead_create(id);
+  AeadBackend *new_recv = aead_create(id);
+  if (!new_send || !new_recv) {
+    delete new_send;
+    delete new_recv;
+    return -1;
+  }
+
+  uint8_t c2s_key[BYTE256b], s2c_key[BYTE256b];
+  uint8_t c2s_iv[BYTE256b], s2c_iv[BYTE256b];
+  derive(c2s_key, traffic_secret, "mtlsp c2s key", id);
+  derive(s2c_key, traffic_secret, "mtlsp s2c key", id);
+  derive(c2s_iv, traffic_secret, "mtlsp c2s iv", id);
+  derive(s2c_iv, traffic_secret, "mtlsp s2c iv", id);
+
+  int ret = new_send->setkey(is_client ? c2s_key : s2c_key) |
+            new_recv->setkey(is_client ? s2c_key : c2s_key);
+  memcpy(send_iv, is_client ? c2s_iv : s2c_iv, IV_SIZE);
+  memcpy(recv_iv, is_client ? s2c_iv : c2s_iv, IV_SIZE);
+  sodium_memzero(c2s_key, sizeof(c2s_key));
+  sodium_memzero(s2c_key, sizeof(s2c_key));
+  sodium_memzero(c2s_iv, sizeof(c2s_iv));
+  sodium_memzero(s2c_iv, sizeof(s2c_iv));
+
+  delete send_aead;
+  delete recv_aead;
+  send_aead = new_send;
+  recv_aead = new_recv;
+  return ret == 0 ? 0 : -1;
+}
+
+/**
+ * @brief 设备端协商 AEAD 后端：以一条记录发送按偏好排序的后端 id 列表（可由
+ * aead_rank 得到），服务器回复一个选定的 id，双方随即切换
+ *
+ * @return int 0 成功，-1 失败（会话关闭）
+ */
+int Session::negotiate(const uint8_t *offer, size_t offer_len) {
+  if (offer_len == 0 || offer_len > AEAD_OFFER_MAX) {
+    return -1;
+  }
+  if (seal_send(offer, offer_len) < 0) {
+    return -1;
+  }
+  uint8_t choice;
+  if (recv_open(&choice, 1) != 1) {
+    close();
+    return handshake_error("mtlsp aead negotiation failed");
+  }
+  if (choice == AEAD_NONE) {
+    close();
+    return handshake_error("mtlsp no common aead");
+  }
+  if (!memchr(offer, choice, offer_len) || rekey(choice) < 0) {
+    close();
+    return handshake_error("mtlsp aead not offered");
+  }
+  return 0;
+}
+
+/**
+ * @brief 服务器端协商 AEAD 后端：选择设备偏好列表中第一个本端支持的后端
+ *
+ * @return int 0 成功，-1 失败（会话关闭）；都不支持时回复 AEAD_NONE 后关闭，
+ * 不会选择设备没有提出的后端
+ */
+int Session::negotiate_server(const uint8_t *supported, size_t supported_len) {
+  uint8_t offer[AEAD_OFFER_MAX];
+  int offer_len = recv_open(offer, sizeof(offer));
+  if (offer_len <= 0) {
+    close();
+    return -1;
+  }
+  uint8_t choice = AEAD_NONE;
+  for (int i = 0; i < offer_len; ++i) {
+    if (offer[i] != AEAD_NONE && memchr(supported, offer[i], supported_len) &&
+        aead_available(offer[i])) {
+      choice = offer[i];
+      break;
+    }
+  }
+  if (choice == AEAD_NONE) {
+    seal_send(&choice, 1);
+    close();
+    return handshake_error("mtlsp no common aead");
+  }
+  if (seal_send(&choice, 1) < 0 || rekey(choice) < 0) {
+    close();
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief 关闭会话并断开连接，之后所有收发均失败
+ */
+void Session::close() {
+  closed = true;
+  if (send_aead) {
+    send_aead->clear();
+  }
+  if (recv_aead) {
+    recv_aead->clear();
+  }
+  client.stop();
+}
+
+/**
+ * @brief nonce = IV xor (0^4 || seq_be64)
+ */
+void Session::make_nonce(uint8_t nonce[IV_SIZE], const uint8_t iv[IV_SIZE],
+                         uint64_t seq) const {
+  memcpy(nonce, iv, IV_SIZE);
+  for (int i = 0; i < 8; ++i) {
+    nonce[IV_SIZE - 1 - i] ^= (uint8_t)(seq >> (8 * i));
+  }
+}
+
+/**
+ * @brief 加密并发送一条记录，长度前缀作为附加认证数据
+ * @return int 0 成功，-1 失败
+ */
+int Session::seal_record(const uint8_t *data, uint32_t data_len) {
+  if (send_seq >= RECORD_SEQ_LIMIT) {
+    return handshake_error("mtlsp record sequence exhausted, rehandshake");
+  }
+
+  uint32_t be_len = htonl(data_len + TAG_SIZE);
+  memcpy(record_buf, &be_len, RECORD_HEADER);
+  memcpy(record_buf + RECORD_HEADER, data, data_len);
+
+  uint8_t nonce[IV_SIZE];
+  make_nonce(nonce, send_iv, send_seq);
+  if (send_aead->encrypt(record_buf + RECORD_HEADER, data_len, record_buf,
+                        RECORD_HEADER, nonce) < 0) {
+    return -1;
+  }
+  ++send_seq;
+
+  // 前缀与记录一次写出
+  size_t total = RECORD_HEADER + data_len + TAG_SIZE;
+  if (client.write(record_buf, total) != total) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief 加密发送消息，超过 max_record 的消息拆分为多条记录
+ *
+ * @param data 明文
+ * @param data_len 明文长度
+ * @return int 发送的明文字节数，失败为 -1
+ */
+int Session::seal_send(const uint8_t *data, uint32_t data_len) {
+  if (closed) {
+    return -1;
+  }
+
+  uint32_t offset = 0;
+  do {
+    uint32_t n = data_len - offset;
+    if (n > max_record)
+      n = max_record;
+    if (seal_record(data + offset, n) < 0) {
+      close();
+      return -1;
+    }
+    offset += n;
+  } while (offset < data_len);
+  return data_len;
+}
+
+/**
+ * @brief 接收并解密一条记录
+ *
+ * @param buf 传出参数，存放明文的内存块
+ * @param buf_len 内存块的大小
+ * @return int 明文字节数，失败为 -1（认证失败即视为重放/乱序/篡改，会话关闭）
+ */
+int Session::recv_open(uint8_t *buf, uint32_t buf_len) {
+  if (closed) {
+    return -1;
+  }
+  // 超时而没有完整记录时保留已收到的字节，下次继续；超长或断开则关闭
+  uint8_t *record = nullptr;
+  int clen = reader.next(&record);
+  return open_record(clen, record, buf, buf_len);
+}
+
+/**
+ * @brief 非阻塞地接收并解密一条记录，只读取套接字中已有的数据
+ *
+ * @param buf 传出参数，存放明文的内存块
+ * @param buf_len 内存块的大小
+ * @return int 明文字节数；暂无完整记录或失败为 -1，失败时 ok() 为 false
+ *
+ * @details 不等待网络，收发在不同任务时可以在持有发送方的锁时调用
+ */
+int Session::poll_open(uint8_t *buf, uint32_t buf_len) {
+  if (closed) {
+    return -1;
+  }
+  uint8_t *record = nullptr;
+  int clen = reader.poll(&record);
+  return open_record(clen, record, buf, buf_len);
+}
+
+/**
+ * @brief 校验并原地解密 reader 返回的一条记录
+ *
+ * @param clen reader.next / poll 的返回值
+ * @param record 记录（密文 || 标签）在接收缓冲区内的视图
+ * @return int 明文字节数，失败为 -1
+ */
+int Session::open_record(int clen, uint8_t *record, uint8_t *buf,
+                         uint32_t buf_len) {
+  if (clen < 0) {
+    if (reader.failed()) {
+      close();
+    }
+    return -1;
+  }
+  if (recv_seq >= RECORD_SEQ_LIMIT) {
+    close();
+    return handshake_error("mtlsp record sequence exhausted, rehandshake");
+  }
+  if (clen < (int)TAG_SIZE || (uint32_t)clen - TAG_SIZE > buf_len) {
+    close();
+    return handshake_error("mtlsp record length invalid");
+  }
+
+  // 在接收缓冲区内原地解密，紧挨着记录的长度前缀作为附加认证数据
+  uint8_t nonce[IV_SIZE];
+  make_nonce(nonce, recv_iv, recv_seq);
+  if (recv_aead->decrypt(record, clen, record - RECORD_HEADER, RECORD_HEADER,
+                        nonce) < 0) {
+    close();
+    return handshake_error("mtlsp record authentication failed");
+  }
+  ++recv_seq;
+
+  uint32_t mlen = clen - TAG_SIZE;
+  memcpy(buf, record, mlen);
+  sodium_memzero(record, mlen);
+  return mlen;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "aead.h"
+#include "mtlsp.h"
+#include "mtlsp_frame.h"
+
+#define RECORD_MAX 4096U          // 单条记录明文最大长度
+#define RECORD_SEQ_LIMIT (1ULL << 32) // 单方向最大记录数，超出需重新握手
+#define AEAD_OFFER_MAX 8U             // AEAD 协商时最多提供的后端个数
+
+namespace mtlsp {
+
+/// 握手之后的加密记录层（协议第 12 步）
+///
+/// 每个方向各有独立的密钥和 12 字节 IV，由主密钥派生；第 n 条记录的 nonce 为
+/// IV 与 64 位序号（大端，对齐到末尾 8 字节）异或，不再随记录发送。接收方按
+/// 期望序号解密，重放、乱序或丢弃的记录都会认证失败，会话随即关闭。
+/// 会话默认使用 mbedtls AES256-GCM，可通过 negotiate / negotiate_server 在加密
+/// 信道内协商更快的 AEAD 后端。
+class Session {
+public:
+  Session(Client &client, const uint8_t master_secret[BYTE256b],
+          bool is_client = true, uint32_t max_record = RECORD_MAX);
+  ~Session();
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+
+  int seal_send(const uint8_t *data, uint32_t data_len);
+  int recv_open(uint8_t *buf, uint32_t buf_len);
+  int poll_open(uint8_t *buf, uint32_t buf_len);
+
+  int negotiate(const uint8_t *offer, size_t offer_len);
+  int negotiate_server(const uint8_t *supported, size_t supported_len);
+  uint8_t aead_id() const { return send_aead ? send_aead->id() : 0; }
+
+  bool ok() const { return !closed; }
+  void close();
+  uint64_t sent_records() const { return send_seq; }
+  uint64_t received_records() const { return recv_seq; }
+
+private:
+  int rekey(uint8_t id);
+  int open_record(int clen, uint8_t *record, uint8_t *buf, uint32_t buf_len);
+  int seal_record(const uint8_t *data, uint32_t data_len);
+  void make_nonce(uint8_t nonce[IV_SIZE], const uint8_t iv[IV_SIZE],
+                  uint64_t seq) const;
+
+  Client &client;
+  FrameReader reader; // 接收缓冲，可容纳两条最大记录
+  uint8_t traffic_secret[BYTE256b]; // 主密钥副本，仅用于派生各后端的密钥
+  AeadBackend *send_aead;
+  AeadBackend *recv_aead;
+  bool is_client;
+  uint8_t send_iv[IV_SIZE];
+  uint8_t recv_iv[IV_SIZE];
+  uint64_t send_seq;
+  uint64_t recv_seq;
+  uint32_t max_record;
+  uint8_t *record_buf; // 发送用：长度前缀 + 密文 + 标签，构造时一次性分配
+  bool closed;
+};
+
+}; // namespace mtlsp
@@ -0,0 +1,185 @@
+#include "mtlsp_ticket.h"
+#include "mtlsp_handshake.h"
+#if defined(ESP_PLATFORM)
+#include <Preferences.h>
+#endif
+
+using namespace mtlsp;
+
+#define TICKET_NVS_NAMESPACE "mtlsp"
+#define TICKET_NVS_KEY "ticket"
+
+TicketStore::TicketStore(bool persist) : valid(false), persist(persist) {
+  if (persist) {
+    load();
+  }
+}
+
+TicketStore::~TicketStore() { sodium_memzero(&ticket, sizeof(ticket)); }
+
+/**
+ * @brief 取出票据（一次性），过期的票据直接丢弃
+ * @return bool 是否取到可用票据
+ */
+bool TicketStore::take(Ticket &out) {
+  if (!valid) {
+    return false;
+  }
+  bool expired = millis() - ticket.issued_ms >= ticket.lifetime_s * 1000ULL;
+  if (!expired) {
+    memcpy(&out, &ticket, sizeof(ticket));
+  }
+  clear();
+  return !expired;
+}
+
+/**
+ * @brief 存入新票据，覆盖旧票据
+ */
+void TicketStore::put(const Ticket &in) {
+  memcpy(&ticket, &in, sizeof(ticket));
+  valid = true;
+  if (persist) {
+    save();
+  }
+}
+
+/**
+ * @brief 清除票据（RAM 与 NVS）
+ */
+void TicketStore::clear() {
+  sodium_memzero(&ticket, sizeof(ticket));
+  valid = false;
+  if (persist) {
+    save();
+  }
+}
+
+/**
+ * @brief 从 NVS 读取票据；重启后 millis() 归零，有效期从读取时重新计算，
+ * 最终是否过期由服务器判定
+ */
+void TicketStore::load() {
+#if defined(ESP_PLATFORM)
+  Preferences prefs;
+  if (!prefs.begin(TICKET_NVS_NAMESPACE, true)) {
+    return;
+  }
+  valid = prefs.getBytes(TICKET_NVS_KEY, &ticket, sizeof(ticket)) ==
+              sizeof(ticket) &&
+          ticket.blob_len > 0 && ticket.blob_len <= TICKET_MAX;
+  prefs.end();
+  ticket.issued_ms = millis();
+#endif
+}
+
+/**
+ * @brief 把当前票据写入 NVS，无票据时删除
+ */
+void TicketStore::save() {
+#if defined(ESP_PLATFORM)
+  Preferences prefs;
+  if (!prefs.begin(TICKET_NVS_NAMESPACE, false)) {
+    return;
+  }
+  if (valid) {
+    prefs.putBytes(TICKET_NVS_KEY, &ticket, sizeof(ticket));
+  } else {
+    prefs.remove(TICKET_NVS_KEY);
+  }
+  prefs.end();
+#endif
+}
+
+/**
+ * @brief 解开服务器签发的票据帧 E_M(lifetime_be32 || blob) 并存入 tickets
+ *
+ * @param aead 以主密钥设置好的会话 AEAD 上下文
+ * @param nonce 票据帧之前的 nonce 帧
+ * @param cipher 票据帧，原地解密
+ * @param clen 票据帧长度
+ * @param master_secret 本次会话的主密钥，用于派生 resumption_secret
+ * @param tickets 票据存储
+ * @return int 0 表示成功， -1 表示失败
+ */
+int mtlsp::store_ticket(Aes256Gcm &aead, const uint8_t nonce[IV_SIZE],
+                        uint8_t *cipher, uint32_t clen,
+                        const uint8_t master_secret[BYTE256b],
+                        TicketStore &tickets) {
+  if (clen < 4 + 1 + TAG_SIZE || clen > 4 + TICKET_MAX + TAG_SIZE) {
+    return -1;
+  }
+  if (aead.decrypt(cipher, clen, nullptr, 0, nonce) < 0) {
+    return -1;
+  }
+
+  Ticket ticket;
+  uint32_t be_lifetime;
+  memcpy(&be_lifetime, cipher, 4);
+  ticket.lifetime_s = ntohl(be_lifetime);
+  ticket.blob_len = clen - TAG_SIZE - 4;
+  memcpy(ticket.blob, cipher + 4, ticket.blob_len);
+  ticket.issued_ms = millis();
+  const char *label = "mtlsp resumption";
+  crypto_auth_hmacsha256(ticket.resumption_secret,
+                         reinterpret_cast<const uint8_t *>(label),
+                         strlen(label), master_secret);
+  tickets.put(ticket);
+  sodium_memzero(&ticket, sizeof(ticket));
+  return 0;
+}
+
+/**
+ * @brief binder = HMAC_rs("mtlsp binder" || client_random || ticket)
+ */
+void mtlsp::ticket_binder(uint8_t binder[BYTE256b], const Ticket &ticket,
+                          const uint8_t client_random[BYTE256b]) {
+  const char *label = "mtlsp binder";
+  crypto_auth_hmacsha256_state hmac;
+  crypto_auth_hmacsha256_init(&hmac, ticket.resumption_secret, BYTE256b);
+  crypto_auth_hmacsha256_update(
+      &hmac, reinterpret_cast<const uint8_t *>(label), strlen(label));
+  crypto_auth_hmacsha256_update(&hmac, client_random, BYTE256b);
+  crypto_auth_hmacsha256_update(&hmac, ticket.blob, ticket.blob_len);
+  crypto_auth_hmacsha256_final(&hmac, binder);
+}
+
+/**
+ * @brief M = HMAC_rs("mtlsp resume" || client_random || server_random)
+ */
+void mtlsp::resume_master(uint8_t master_secret[BYTE256b],
+                          const uint8_t resumption_secret[BYTE256b],
+                          const uint8_t client_random[BYTE256b],
+                          const uint8_t server_random[BYTE256b]) {
+  const char *label = "mtlsp resume";
+  crypto_auth_hmacsha256_state hmac;
+  crypto_auth_hmacsha256_init(&hmac, resumption_secret, BYTE256b);
+  crypto_auth_hmacsha256_update(
+      &hmac, reinterpret_cast<const uint8_t *>(label), strlen(label));
+  crypto_auth_hmacsha256_update(&hmac, client_random, BYTE256b);
+  crypto_auth_hmacsha256_update(&hmac, server_random, BYTE256b);
+  crypto_auth_hmacsha256_final(&hmac, master_secret);
+  sodium_memzero(&hmac, sizeof(hmac));
+}
+
+/**
+ * @brief 用票据恢复会话，省去 ECDH 与指纹上传，阻塞直到结束
+ *
+ * @param master_secret 传出参数，256 bits 主密钥
+ * @param client 客户端，相当于套接字
+ * @param tickets 票据存储，成功后存入服务器签发的新票据
+ *
+ * @return int 0 表示成功；1 表示没有票据或服务器拒绝，同一连接上可直接改用
+ * handshake_client 完整握手；-1 表示失败
+ *
+ * @details 消息格式见 mtlsp.md「会话恢复」一节，状态机见 HandshakeStateMachine
+ */
+int mtlsp::resume_client(uint8_t master_secret[BYTE256b], Client &client,
+                         TicketStore &tickets) {
+  HandshakeStateMachine hs(client);
+  int ret = hs.begin_resume(tickets);
+  if (ret != 0) {
+    return ret;
+  }
+  return hs.run(master_secret);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "mtlsp.h"
+
+namespace mtlsp {
+
+/// 会话恢复票据
+struct Ticket {
+  uint8_t blob[TICKET_MAX];            // 服务器加密的票据本体，客户端不解析
+  uint16_t blob_len;
+  uint8_t resumption_secret[BYTE256b]; // HMAC_M("mtlsp resumption")
+  uint32_t lifetime_s;                 // 服务器给出的有效期
+  uint32_t issued_ms;                  // 收到票据时的 millis()
+};
+
+/// 票据存储：默认只放在 RAM 中，persist 为 true 时同时写入 NVS，重启后仍可恢复。
+/// 票据只能使用一次，take 取出后即从存储中删除，服务器每次恢复都会签发新票据。
+class TicketStore {
+public:
+  explicit TicketStore(bool persist = false);
+  ~TicketStore();
+
+  bool take(Ticket &out);
+  void put(const Ticket &in);
+  void clear();
+  bool has() const { return valid; }
+
+private:
+  void load();
+  void save();
+
+  Ticket ticket;
+  bool valid;
+  bool persist;
+};
+
+int store_ticket(Aes256Gcm &aead, const uint8_t nonce[IV_SIZE],
+                 uint8_t *cipher, uint32_t clen,
+                 const uint8_t master_secret[BYTE256b], TicketStore &tickets);
+
+void ticket_binder(uint8_t binder[BYTE256b], const Ticket &ticket,
+                   const uint8_t client_random[BYTE256b]);
+
+void resume_master(uint8_t master_secret[BYTE256b],
+                   const uint8_t resumption_secret[BYTE256b],
+                   const uint8_t client_random[BYTE256b],
+                   const uint8_t server_random[BYTE256b]);
+
+}; // namespace mtlsp
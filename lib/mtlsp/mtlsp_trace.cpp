@@ -0,0 +1,154 @@
+#include "mtlsp_trace.h"
+
+using namespace mtlsp;
+
+static TraceStats stats;
+static SemaphoreHandle_t stats_lock = nullptr;
+static TraceSink sink = nullptr;
+static void *sink_arg = nullptr;
+
+static const char *phase_names[PHASE_COUNT] = {
+    "connect",     "server_hello", "sig_verify", "keygen",  "box",
+    "scalarmult",  "fp_encrypt",   "fp_send",    "confirm", "total",
+    "resume",
+};
+
+/// 锁由 trace_init 创建；之前的调用不加锁，此时还没有其他任务在记录
+static bool lock() {
+  return stats_lock && xSemaphoreTake(stats_lock, portMAX_DELAY) == pdTRUE;
+}
+
+static void unlock(bool locked) {
+  if (locked) {
+    xSemaphoreGive(stats_lock);
+  }
+}
+
+/**
+ * @brief 创建统计锁，须在 setup()（native 下为 main）中、握手任务启动前调用
+ *
+ * @return int 0 表示成功， -1 表示失败
+ */
+int mtlsp::trace_init() {
+  if (!stats_lock) {
+    stats_lock = xSemaphoreCreateMutex();
+  }
+  return stats_lock ? 0 : -1;
+}
+
+/**
+ * @brief 记录某阶段的一次耗时
+ */
+void mtlsp::trace_record(TracePhase phase, int64_t us) {
+  if (phase >= PHASE_COUNT) {
+    return;
+  }
+  uint32_t v = us < 0 ? 0 : us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+  uint32_t bucket = 0;
+  while (bucket < TRACE_BUCKETS - 1 && (v >> (bucket + 1)) != 0) {
+    ++bucket;
+  }
+
+  bool locked = lock();
+  TraceHistogram &h = stats.phases[phase];
+  if (h.count == 0 || v < h.min_us) {
+    h.min_us = v;
+  }
+  if (v > h.max_us) {
+    h.max_us = v;
+  }
+  ++h.count;
+  h.total_us += v;
+  ++h.buckets[bucket];
+  TraceSink cb = sink;
+  void *cb_arg = sink_arg;
+  unlock(locked);
+  if (cb) {
+    cb(phase, v, cb_arg);
+  }
+}
+
+/**
+ * @brief 拷贝当前统计
+ */
+void mtlsp::trace_snapshot(TraceStats &out) {
+  bool locked = lock();
+  memcpy(&out, &stats, sizeof(stats));
+  unlock(locked);
+}
+
+void mtlsp::trace_reset() {
+  bool locked = lock();
+  memset(&stats, 0, sizeof(stats));
+  unlock(locked);
+}
+
+/**
+ * @brief 设置记录回调，nullptr 表示取消
+ */
+void mtlsp::trace_set_sink(TraceSink cb, void *arg) {
+  bool locked = lock();
+  sink = cb;
+  sink_arg = arg;
+  unlock(locked);
+}
+
+static uint8_t *put_be32(uint8_t *p, uint32_t v) {
+  for (int i = 3; i >= 0; --i, v >>= 8) {
+    p[i] = (uint8_t)v;
+  }
+  return p + 4;
+}
+
+/**
+ * @brief 把统计序列化为大端字节流，便于通过 Session::seal_send 上报
+ *
+ * @param buf 传出参数，至少 TRACE_EXPORT_SIZE 字节
+ * @param buf_len buf 的大小
+ * @return size_t 写入的字节数，buf 不足时为 0
+ */
+size_t mtlsp::trace_export(uint8_t *buf, size_t buf_len) {
+  if (buf_len < TRACE_EXPORT_SIZE) {
+    return 0;
+  }
+  TraceStats snap;
+  trace_snapshot(snap);
+
+  uint8_t *p = buf;
+  *p++ = TRACE_EXPORT_VERSION;
+  *p++ = PHASE_COUNT;
+  *p++ = TRACE_BUCKETS;
+  for (const TraceHistogram &h : snap.phases) {
+    p = put_be32(p, h.count);
+    p = put_be32(p, h.min_us);
+    p = put_be32(p, h.max_us);
+    p = put_be32(p, (uint32_t)(h.total_us >> 32));
+    p = put_be32(p, (uint32_t)h.total_us);
+    for (uint32_t b : h.buckets) {
+      p = put_be32(p, b);
+    }
+  }
+  return p - buf;
+}
+
+const char *mtlsp::trace_phase_name(TracePhase phase) {
+  return phase < PHASE_COUNT ? phase_names[phase] : "unknown";
+}
+
+/**
+ * @brief 以文本形式打印各阶段的次数、均值、最小值与最大值（微秒）
+ */
+void mtlsp::trace_print(Print &out) {
+  TraceStats snap;
+  trace_snapshot(snap);
+  out.printf("%-13s %6s %10s %10s %10s\n", "phase", "n", "mean_us", "min_us",
+             "max_us");
+  for (uint8_t i = 0; i < PHASE_COUNT; ++i) {
+    const TraceHistogram &h = snap.phases[i];
+    if (h.count == 0) {
+      continue;
+    }
+    out.printf("%-13s %6u %10u %10u %10u\n", phase_names[i], h.count,
+               (uint32_t)(h.total_us / h.count), h.min_us, h.max_us);
+  }
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <Arduino.h>
+#include <esp_timer.h>
+
+// 编译期开关：-DMTLSP_TRACE=0 关闭握手分阶段计时，所有埋点编译为空
+#ifndef MTLSP_TRACE
+#define MTLSP_TRACE 1
+#endif
+
+#define TRACE_BUCKETS 24U // 第 i 个桶统计 [2^i, 2^(i+1)) 微秒，最后一个桶不设上限
+#define TRACE_EXPORT_VERSION 1U
+
+namespace mtlsp {
+
+/// 握手阶段
+enum TracePhase : uint8_t {
+  PHASE_CONNECT = 0,   // TCP 建连（由调用方记录）
+  PHASE_SERVER_HELLO,  // 发出 hello 到收齐 server 第一波消息
+  PHASE_SIG_VERIFY,    // 验签
+  PHASE_KEYGEN,        // 取得临时 ECDH 公私钥
+  PHASE_BOX,           // sealed box 加密与解密
+  PHASE_SCALARMULT,    // 计算预主密钥
+  PHASE_FP_ENCRYPT,    // 指纹加密（累计各分块）
+  PHASE_FP_SEND,       // 指纹写入套接字（累计各分块）
+  PHASE_CONFIRM,       // 等待并确认 E_M(OK)
+  PHASE_TOTAL,         // 整个完整/快速握手
+  PHASE_RESUME,        // 整个会话恢复，单独统计以免拉低 PHASE_TOTAL
+  PHASE_COUNT,
+};
+
+/// 单个阶段的固定大小直方图
+struct TraceHistogram {
+  uint32_t count;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t total_us;
+  uint32_t buckets[TRACE_BUCKETS];
+};
+
+struct TraceStats {
+  TraceHistogram phases[PHASE_COUNT];
+};
+
+/// 序列化后的长度：版本、阶段数、桶数 + 每阶段 (count, min, max, total, buckets)
+#define TRACE_EXPORT_SIZE                                                      \
+  (3U + PHASE_COUNT * (3U * 4U + 8U + TRACE_BUCKETS * 4U))
+
+/// 每次记录时在记录的线程（任务）中调用，用于另行统计（例如分位数）
+typedef void (*TraceSink)(TracePhase phase, uint32_t us, void *arg);
+
+inline int64_t trace_now() { return esp_timer_get_time(); }
+
+int trace_init();
+
+void trace_record(TracePhase phase, int64_t us);
+
+void trace_snapshot(TraceStats &out);
+
+void trace_reset();
+
+void trace_set_sink(TraceSink sink, void *arg);
+
+size_t trace_export(uint8_t *buf, size_t buf_len);
+
+const char *trace_phase_name(TracePhase phase);
+
+void trace_print(Print &out);
+
+}; // namespace mtlsp
+
+#if MTLSP_TRACE
+#define TRACE_BEGIN(var) int64_t var = mtlsp::trace_now()
+#define TRACE_END(phase, var) mtlsp::trace_record(phase, mtlsp::trace_now() - var)
+#define TRACE_MARK(var) var = mtlsp::trace_now()
+#define TRACE_ACC_INIT(acc) int64_t acc = 0
+#define TRACE_ACC(acc, var) acc += mtlsp::trace_now() - var
+#define TRACE_ACC_END(phase, acc) mtlsp::trace_record(phase, acc)
+#else
+#define TRACE_BEGIN(var)
+#define TRACE_END(phase, var)
+#define TRACE_MARK(var)
+#define TRACE_ACC_INIT(acc)
+#define TRACE_ACC(acc, var)
+#define TRACE_ACC_END(phase, acc)
+#endif
@@ -0,0 +1,1116 @@
+#include "mtlsp_epoll.h"
+#include "esp_timer.h"
+#include "mtlsp_handshake.h"
+#include "mtlsp_server_steps.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace mtlsp;
+
+#define EPOLL_MAX_EVENTS 256
+#define EPOLL_TICK_MS 100 // 检查握手期限的间隔
+#define EPOLL_DRAIN_CHUNK 4096U
+
+void LatencyHistogram::reset() {
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; ++i) {
+    buckets[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief 延迟所在的桶：小于 2^LATENCY_SUB_BITS 的值各占一个桶，其余每个
+ * 二倍区间按最高位之后的 LATENCY_SUB_BITS 位再分
+ */
+uint32_t LatencyHistogram::bucket(uint64_t us) {
+  const uint64_t sub = 1U << LATENCY_SUB_BITS;
+  if (us < sub) {
+    return (uint32_t)us;
+  }
+  uint32_t shift = 63 - __builtin_clzll(us) - LATENCY_SUB_BITS;
+  uint32_t b = sub + shift * sub + (uint32_t)((us >> shift) & (sub - 1));
+  return b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1;
+}
+
+/**
+ * @brief 桶的上界（含）
+ */
+uint64_t LatencyHistogram::upper(uint32_t b) {
+  const uint32_t sub = 1U << LATENCY_SUB_BITS;
+  if (b < sub) {
+    return b;
+  }
+  uint32_t shift = (b - sub) / sub;
+  uint64_t low = (uint64_t)(sub + (b - sub) % sub) << shift;
+  return low + ((uint64_t)1 << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us) {
+  buckets[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const {
+  uint64_t n = 0;
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; ++i) {
+    n += buckets[i].load(std::memory_order_relaxed);
+  }
+  return n;
+}
+
+/**
+ * @brief 分位数
+ *
+ * @param q 0~1，例如 0.999
+ * @return uint64_t 分位数所在桶的上界（微秒），没有样本时为 0
+ */
+uint64_t LatencyHistogram::percentile(double q) const {
+  uint64_t total = count();
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t target = (uint64_t)std::ceil(q * total);
+  target = std::max<uint64_t>(1, std::min(target, total));
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < LATENCY_BUCKETS; ++i) {
+    seen += buckets[i].load(std::memory_order_relaxed);
+    if (seen >= target) {
+      return upper(i);
+    }
+  }
+  return upper(LATENCY_BUCKETS - 1);
+}
+
+namespace mtlsp {
+
+enum ConnState : uint8_t {
+  READ_HELLO, // 等待 client 的第一帧（或回退后的新 hello）
+  WAIT_KEY,   // 完整握手：BOX_{S_pub}(Q_c||cr||sr)
+  WAIT_NONCE, // 指纹的 nonce 帧
+  WAIT_FP,    // E_M(fingerprint)
+  DRAIN,      // 握手已结束：发完剩余数据后半关闭，丢弃输入直到 client 断开
+};
+
+enum ConnJob : uint8_t { JOB_HELLO, JOB_KEY, JOB_FINGERPRINT };
+
+/// 工作线程的结果，由事件循环处理
+enum JobResult : uint8_t {
+  JOB_NEXT,       // 进入 state 指定的下一步
+  JOB_RETRY,      // 已回复 NotOK，等待 client 回退
+  JOB_DONE,       // 握手成功，out 中是最后的回复
+  JOB_FAIL,       // 失败，直接关闭
+  JOB_FAIL_FLUSH, // 失败，发完 out（NotOK）后关闭
+};
+
+/// 一条连接。busy 期间只有工作线程访问握手字段与 out，事件循环只看 busy
+/// 与 closing；结果通过完成队列交回，互斥锁保证可见性
+struct EpollConn {
+  EpollLoop *loop;
+  EpollConn *prev, *next;
+  int fd;
+  uint8_t state;
+  uint8_t job;
+  uint8_t job_ret;
+  bool busy;    // 任务在线程池中
+  bool closing; // 任务完成后释放
+  bool parked;  // 等待指纹预算
+  bool counted; // 已计入成功或失败
+  bool shut;    // 已半关闭
+  uint32_t events;
+  int64_t start_us;
+  int64_t deadline_us;
+
+  uint8_t hdr[4];
+  uint32_t hdr_got;
+  uint32_t frame_len;
+  uint32_t frame_got;
+  uint8_t *frame;
+  uint8_t *fp_buf; // 只在上传指纹期间存在，长度为 frame_len
+
+  ServerHello hello;
+  uint8_t client_random[BYTE256b];
+  uint8_t server_random[BYTE256b];
+  uint8_t server_eph_sec[BYTE256b];
+  uint8_t master_secret[BYTE256b];
+  uint8_t nonce[IV_SIZE];
+  uint8_t format;
+  ServerHandshakeInfo info;
+
+  uint32_t out_len, out_sent;
+  uint8_t out[EPOLL_OUT_BUFFER];
+  uint8_t small[SERVER_HELLO_MAX]; // 除指纹外的所有帧
+};
+
+/// 密码学线程池：按提交顺序执行连接的当前任务，完成后交回所属的事件循环
+class EpollWorkers {
+public:
+  EpollWorkers(EpollServer &server, uint32_t n);
+  ~EpollWorkers() { stop(); }
+  bool submit(EpollConn *conn);
+  void stop();
+
+private:
+  void run();
+
+  EpollServer &server;
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<EpollConn *> queue;
+  std::vector<std::thread> threads;
+  bool stopping;
+};
+
+/// 一个事件循环线程：自己的 epoll 实例、监听套接字（SO_REUSEPORT）与连接
+class EpollLoop {
+public:
+  EpollLoop(EpollServer &server, size_t fp_budget);
+  ~EpollLoop();
+  int open(int port);
+  void start();
+  void stop();
+  void adopt(int fd);
+  void complete(EpollConn *conn);
+
+private:
+  void run();
+  void wake();
+  void on_wake();
+  void accept_all();
+  void add(int fd);
+  void on_event(EpollConn *c, uint32_t events);
+  void read_frames(EpollConn *c);
+  bool on_header(EpollConn *c);
+  bool on_frame(EpollConn *c);
+  bool submit(EpollConn *c, uint8_t job);
+  void on_job_done(EpollConn *c);
+  void finish(EpollConn *c);
+  bool progress(EpollConn *c);
+  void drain(EpollConn *c);
+  void update_interest(EpollConn *c);
+  void close_conn(EpollConn *c);
+  void release(EpollConn *c);
+  int alloc_fingerprint(EpollConn *c);
+  void free_fingerprint(EpollConn *c);
+  void check_timeouts();
+
+  EpollServer &server;
+  int epfd;
+  int evfd;
+  int listen_fd;
+  std::thread thread;
+  std::atomic<bool> stopping;
+
+  std::mutex done_lock; // 保护 done 与 adopted
+  std::vector<EpollConn *> done;
+  std::vector<int> adopted;
+
+  EpollConn *conns;                 // 所有连接，双向链表
+  std::vector<EpollConn *> dead;    // 本轮事件处理完后释放
+  std::deque<EpollConn *> parked;   // 等待指纹预算的连接
+  size_t fp_bytes;
+  size_t fp_budget;
+};
+
+}; // namespace mtlsp
+
+static char wake_tag, listen_tag; // epoll_event.data.ptr 的标记
+
+static int64_t deadline_after(uint32_t ms) {
+  return esp_timer_get_time() + (int64_t)ms * 1000;
+}
+
+/**
+ * @brief 在 out 末尾追加一帧
+ * @return bool false 表示 out 放不下
+ */
+static bool queue_frame(EpollConn *c, const uint8_t *data, uint32_t len) {
+  if (c->out_len + 4 + len > sizeof(c->out)) {
+    return false;
+  }
+  uint32_t be_len = htonl(len);
+  memcpy(c->out + c->out_len, &be_len, 4);
+  memcpy(c->out + c->out_len + 4, data, len);
+  c->out_len += 4 + len;
+  return true;
+}
+
+/**
+ * @brief 排队 nonce 帧与 E_M(signal) 帧，ok 且 client 请求时再排队票据
+ */
+static bool queue_confirm(ServerContext &ctx, EpollConn *c, bool ok,
+                          bool ticket) {
+  Aes256Gcm aead(c->master_secret);
+  uint8_t nonce[IV_SIZE];
+  uint8_t cipher[SERVER_CONFIRM_LEN];
+  if (server_confirm(aead, ok ? OK : NOK, nonce, cipher) < 0 ||
+      !queue_frame(c, nonce, sizeof(nonce)) ||
+      !queue_frame(c, cipher, sizeof(cipher))) {
+    return false;
+  }
+  if (!ok || !ticket) {
+    return true;
+  }
+  uint8_t msg[SERVER_TICKET_MSG];
+  return server_ticket(ctx, aead, c->master_secret, c->info.device_id, nonce,
+                       msg) == 0 &&
+         queue_frame(c, nonce, sizeof(nonce)) &&
+         queue_frame(c, msg, sizeof(msg));
+}
+
+static uint8_t job_hello(ServerContext &ctx, EpollConn *c) {
+  switch (c->hello.kind) {
+  case SERVER_HELLO_FULL: {
+    uint8_t server_eph_pub[BYTE256b];
+    uint8_t sig[BYTE512b];
+    server_sign_hello(ctx, c->client_random, c->server_random, server_eph_pub,
+                      c->server_eph_sec, sig);
+    queue_frame(c, c->server_random, BYTE256b);
+    queue_frame(c, server_eph_pub, BYTE256b);
+    queue_frame(c, sig, BYTE512b);
+    c->state = WAIT_KEY;
+    return JOB_NEXT;
+  }
+  case SERVER_HELLO_FAST: {
+    uint8_t flight[SERVER_FLIGHT_MAX];
+    size_t flight_len;
+    if (server_fast_flight(ctx, c->small, c->hello.offered, flight,
+                           &flight_len, c->master_secret, &c->format) < 0 ||
+        !queue_frame(c, flight, flight_len)) {
+      return JOB_FAIL;
+    }
+    c->state = WAIT_NONCE;
+    return JOB_NEXT;
+  }
+  case SERVER_HELLO_RESUME:
+    if (server_check_resume(ctx, c->small, c->frame_len, c->server_random,
+                            c->master_secret, c->info.device_id) != 0) {
+      uint8_t nok = NOK;
+      queue_frame(c, &nok, 1);
+      return JOB_RETRY;
+    }
+    if (!queue_frame(c, c->server_random, BYTE256b) ||
+        !queue_confirm(ctx, c, true, true)) {
+      return JOB_FAIL;
+    }
+    c->info.resumed = true;
+    c->info.fingerprint_len = 0;
+    c->info.fingerprint_format = 0;
+    return JOB_DONE;
+  default:
+    return JOB_FAIL;
+  }
+}
+
+static uint8_t job_key(ServerContext &ctx, EpollConn *c) {
+  uint8_t signal[SERVER_SIGNAL_MAX];
+  size_t signal_len;
+  int ret = server_open_key(ctx, c->small, c->client_random, c->server_random,
+                            c->hello.offered, c->server_eph_sec, signal,
+                            &signal_len, c->master_secret, &c->format);
+  if (ret < 0) {
+    return JOB_FAIL;
+  }
+  queue_frame(c, signal, signal_len);
+  if (ret != 0) {
+    return JOB_FAIL_FLUSH;
+  }
+  c->state = WAIT_NONCE;
+  return JOB_NEXT;
+}
+
+static uint8_t job_fingerprint(ServerContext &ctx, EpollConn *c) {
+  Aes256Gcm aead(c->master_secret);
+  if (aead.decrypt(c->fp_buf, c->frame_len, nullptr, 0, c->nonce) < 0) {
+    return JOB_FAIL;
+  }
+  size_t fp_len = c->frame_len - TAG_SIZE;
+  bool ok = server_verify_fingerprint(ctx, c->format, c->fp_buf, fp_len,
+                                      c->info.device_id);
+  if (!queue_confirm(ctx, c, ok, c->hello.tickets)) {
+    return JOB_FAIL;
+  }
+  c->info.resumed = false;
+  c->info.fingerprint_len = fp_len;
+  c->info.fingerprint_format = c->format;
+  return ok ? JOB_DONE : JOB_FAIL_FLUSH;
+}
+
+EpollWorkers::EpollWorkers(EpollServer &server, uint32_t n)
+    : server(server), stopping(false) {
+  for (uint32_t i = 0; i < n; ++i) {
+    threads.emplace_back([this] { run(); });
+  }
+}
+
+/**
+ * @brief 提交连接的当前任务
+ * @return bool false 表示线程池已停止
+ */
+bool EpollWorkers::submit(EpollConn *conn) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (stopping) {
+      return false;
+    }
+    queue.push_back(conn);
+  }
+  cv.notify_one();
+  return true;
+}
+
+/**
+ * @brief 执行完正在运行的任务后停止，队列中剩余的任务丢弃
+ */
+void EpollWorkers::stop() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+    queue.clear();
+  }
+  cv.notify_all();
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  threads.clear();
+}
+
+void EpollWorkers::run() {
+  for (;;) {
+    EpollConn *c;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      cv.wait(guard, [this] { return stopping || !queue.empty(); });
+      if (stopping) {
+        return;
+      }
+      c = queue.front();
+      queue.pop_front();
+    }
+    switch (c->job) {
+    case JOB_HELLO:
+      c->job_ret = job_hello(server.ctx, c);
+      break;
+    case JOB_KEY:
+      c->job_ret = job_key(server.ctx, c);
+      break;
+    case JOB_FINGERPRINT:
+      c->job_ret = job_fingerprint(server.ctx, c);
+      break;
+    }
+    c->loop->complete(c); // 此后不再访问 c
+  }
+}
+
+EpollLoop::EpollLoop(EpollServer &server, size_t fp_budget)
+    : server(server), epfd(-1), evfd(-1), listen_fd(-1), stopping(false),
+      conns(nullptr), fp_bytes(0), fp_budget(fp_budget) {}
+
+EpollLoop::~EpollLoop() {
+  stop();
+  while (conns) {
+    EpollConn *c = conns;
+    conns = c->next;
+    if (c->fd >= 0) {
+      ::close(c->fd);
+    }
+    free(c->fp_buf);
+    server.active--;
+    delete c;
+  }
+  for (EpollConn *c : dead) {
+    delete c;
+  }
+  for (int fd : adopted) {
+    ::close(fd);
+  }
+  if (listen_fd >= 0) {
+    ::close(listen_fd);
+  }
+  if (evfd >= 0) {
+    ::close(evfd);
+  }
+  if (epfd >= 0) {
+    ::close(epfd);
+  }
+}
+
+/**
+ * @brief 创建 epoll 实例，port >= 0 时再创建监听套接字
+ * @return int 实际监听的端口；不监听时为 0；-1 表示失败
+ */
+int EpollLoop::open(int port) {
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epfd < 0 || evfd < 0) {
+    return -1;
+  }
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = &wake_tag;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev) < 0) {
+    return -1;
+  }
+  if (port < 0) {
+    return 0;
+  }
+
+  listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) {
+    return -1;
+  }
+  int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  socklen_t addr_len = sizeof(addr);
+  if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      listen(listen_fd, SOMAXCONN) < 0 ||
+      getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &addr_len) <
+          0) {
+    return -1;
+  }
+  ev.events = EPOLLIN;
+  ev.data.ptr = &listen_tag;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+    return -1;
+  }
+  return ntohs(addr.sin_port);
+}
+
+void EpollLoop::start() {
+  thread = std::thread([this] { run(); });
+}
+
+void EpollLoop::stop() {
+  if (!thread.joinable()) {
+    return;
+  }
+  stopping = true;
+  wake();
+  thread.join();
+}
+
+void EpollLoop::wake() {
+  uint64_t one = 1;
+  (void)!::write(evfd, &one, sizeof(one));
+}
+
+/**
+ * @brief 从其他线程交给本循环一个已连接的套接字
+ */
+void EpollLoop::adopt(int fd) {
+  {
+    std::lock_guard<std::mutex> guard(done_lock);
+    adopted.push_back(fd);
+  }
+  wake();
+}
+
+/**
+ * @brief 工作线程调用：任务已完成
+ */
+void EpollLoop::complete(EpollConn *conn) {
+  {
+    std::lock_guard<std::mutex> guard(done_lock);
+    done.push_back(conn);
+  }
+  wake();
+}
+
+void EpollLoop::run() {
+  epoll_event events[EPOLL_MAX_EVENTS];
+  int64_t next_tick = deadline_after(EPOLL_TICK_MS);
+  while (!stopping) {
+    int n = epoll_wait(epfd, events, EPOLL_MAX_EVENTS, EPOLL_TICK_MS);
+    for (int i = 0; i < n; ++i) {
+      void *ptr = events[i].data.ptr;
+      if (ptr == &wake_tag) {
+        on_wake();
+      } else if (ptr == &listen_tag) {
+        accept_all();
+      } else {
+        on_event(static_cast<EpollConn *>(ptr), events[i].events);
+      }
+    }
+    if (esp_timer_get_time() >= next_tick) {
+      check_timeouts();
+      next_tick = deadline_after(EPOLL_TICK_MS);
+    }
+    // 同一批事件里可能还有已关闭连接的事件，处理完整批后才释放
+    for (EpollConn *c : dead) {
+      delete c;
+    }
+    dead.clear();
+  }
+}
+
+void EpollLoop::on_wake() {
+  uint64_t count;
+  (void)!::read(evfd, &count, sizeof(count));
+  std::vector<EpollConn *> finished;
+  std::vector<int> fds;
+  {
+    std::lock_guard<std::mutex> guard(done_lock);
+    finished.swap(done);
+    fds.swap(adopted);
+  }
+  for (int fd : fds) {
+    add(fd);
+  }
+  for (EpollConn *c : finished) {
+    on_job_done(c);
+  }
+}
+
+void EpollLoop::accept_all() {
+  for (;;) {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return; // EAGAIN，或 EMFILE 等暂时无法接受，下次再试
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    add(fd);
+  }
+}
+
+void EpollLoop::add(int fd) {
+  if (server.active >= server.opt.max_connections) {
+    ::close(fd);
+    server.refused++;
+    return;
+  }
+  EpollConn *c = new EpollConn();
+  c->loop = this;
+  c->fd = fd;
+  c->state = READ_HELLO;
+  c->start_us = esp_timer_get_time();
+  c->deadline_us = deadline_after(server.opt.timeout_ms);
+  c->events = EPOLLIN;
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = c;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    ::close(fd);
+    delete c;
+    return;
+  }
+  c->next = conns;
+  if (conns) {
+    conns->prev = c;
+  }
+  conns = c;
+  server.accepted++;
+  server.active++;
+}
+
+void EpollLoop::on_event(EpollConn *c, uint32_t events) {
+  if (c->fd < 0) {
+    return; // 本批事件中已被关闭
+  }
+  if (events & EPOLLERR) {
+    close_conn(c);
+    return;
+  }
+  if (c->busy || c->parked) {
+    if (events & EPOLLHUP) {
+      close_conn(c);
+    }
+    return;
+  }
+  if (c->out_sent < c->out_len) {
+    progress(c);
+    return;
+  }
+  if (events & (EPOLLIN | EPOLLHUP)) {
+    read_frames(c);
+  }
+}
+
+/**
+ * @brief 读取并处理已到达的帧，直到需要等待数据、提交了任务或有待发送的回复
+ */
+void EpollLoop::read_frames(EpollConn *c) {
+  if (c->state == DRAIN) {
+    drain(c);
+    return;
+  }
+  while (!c->busy && !c->parked && c->out_len == 0) {
+    uint8_t *dst;
+    uint32_t want;
+    if (c->hdr_got < 4) {
+      dst = c->hdr + c->hdr_got;
+      want = 4 - c->hdr_got;
+    } else {
+      dst = c->frame + c->frame_got;
+      want = c->frame_len - c->frame_got;
+    }
+    ssize_t n = ::read(c->fd, dst, want);
+    if (n == 0) {
+      close_conn(c);
+      return;
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      close_conn(c);
+      return;
+    }
+    if (c->hdr_got < 4) {
+      c->hdr_got += n;
+      if (c->hdr_got == 4 && !on_header(c)) {
+        return;
+      }
+      continue;
+    }
+    c->frame_got += n;
+    if (c->frame_got == c->frame_len) {
+      c->hdr_got = 0;
+      if (!on_frame(c)) {
+        return;
+      }
+    }
+  }
+  if (!c->busy) { // busy 时 out 归工作线程所有
+    progress(c);
+  }
+}
+
+/**
+ * @brief 长度前缀已读完：按当前状态检查帧长并选定接收缓冲区
+ * @return bool false 表示连接已关闭
+ */
+bool EpollLoop::on_header(EpollConn *c) {
+  uint32_t be_len;
+  memcpy(&be_len, c->hdr, 4);
+  c->frame_len = ntohl(be_len);
+  c->frame_got = 0;
+  if (c->state != WAIT_FP) {
+    if (c->frame_len == 0 || c->frame_len > sizeof(c->small)) {
+      close_conn(c);
+      return false;
+    }
+    c->frame = c->small;
+    return true;
+  }
+  if (c->frame_len < TAG_SIZE ||
+      c->frame_len - TAG_SIZE > server.opt.fingerprint_max) {
+    close_conn(c);
+    return false;
+  }
+  if (alloc_fingerprint(c) < 0) {
+    close_conn(c);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief 一帧已读完
+ * @return bool false 表示连接已关闭
+ */
+bool EpollLoop::on_frame(EpollConn *c) {
+  switch (c->state) {
+  case READ_HELLO: {
+    ServerHello h = server_parse_hello(server.ctx, c->small, c->frame_len);
+    c->info.hello = h.type;
+    if (h.kind == SERVER_HELLO_REJECT) {
+      uint8_t nok = NOK;
+      queue_frame(c, &nok, 1);
+      return true;
+    }
+    c->hello = h;
+    memcpy(c->client_random, h.client_random, BYTE256b);
+    c->hello.client_random = c->client_random;
+    return submit(c, JOB_HELLO);
+  }
+  case WAIT_KEY:
+    if (c->frame_len != SERVER_KEY_LEN) {
+      close_conn(c);
+      return false;
+    }
+    return submit(c, JOB_KEY);
+  case WAIT_NONCE:
+    if (c->frame_len != IV_SIZE) {
+      close_conn(c);
+      return false;
+    }
+    memcpy(c->nonce, c->small, IV_SIZE);
+    c->state = WAIT_FP;
+    return true;
+  case WAIT_FP:
+    return submit(c, JOB_FINGERPRINT);
+  }
+  close_conn(c);
+  return false;
+}
+
+/**
+ * @brief 把连接的当前任务交给线程池，完成前不再读取
+ * @return bool false 表示连接已关闭
+ */
+bool EpollLoop::submit(EpollConn *c, uint8_t job) {
+  c->job = job;
+  c->busy = true;
+  update_interest(c);
+  server.jobs++;
+  if (!server.workers->submit(c)) {
+    c->busy = false;
+    close_conn(c);
+    return false;
+  }
+  return true;
+}
+
+void EpollLoop::on_job_done(EpollConn *c) {
+  c->busy = false;
+  if (c->job == JOB_FINGERPRINT) {
+    free_fingerprint(c);
+  }
+  if (c->closing) {
+    release(c);
+    return;
+  }
+  switch (c->job_ret) {
+  case JOB_NEXT:
+  case JOB_RETRY:
+    break;
+  case JOB_DONE:
+    finish(c);
+    break;
+  case JOB_FAIL_FLUSH:
+    server.failed++;
+    c->counted = true;
+    c->state = DRAIN;
+    break;
+  default:
+    close_conn(c);
+    return;
+  }
+  progress(c);
+}
+
+/**
+ * @brief 握手成功：记录延迟并回调，之后只等待 client 断开
+ */
+void EpollLoop::finish(EpollConn *c) {
+  int64_t now = esp_timer_get_time();
+  server.hist.record((uint64_t)(now - c->start_us));
+  server.completed++;
+  if (c->info.resumed) {
+    server.resumed++;
+  }
+  c->counted = true;
+  if (server.callback) {
+    server.callback(c->fd, c->master_secret, c->info, server.callback_arg);
+  }
+  sodium_memzero(c->master_secret, sizeof(c->master_secret));
+  c->state = DRAIN;
+  c->deadline_us = deadline_after(server.opt.timeout_ms);
+}
+
+/**
+ * @brief 尽量写出 out，写完后按状态调整 epoll 关注的事件
+ * @return bool false 表示连接已关闭
+ */
+bool EpollLoop::progress(EpollConn *c) {
+  while (c->out_sent < c->out_len) {
+    ssize_t n = ::send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent,
+                       MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      close_conn(c);
+      return false;
+    }
+    c->out_sent += n;
+  }
+  if (c->out_sent == c->out_len) {
+    c->out_len = c->out_sent = 0;
+    if (c->state == DRAIN && !c->shut) {
+      // 先半关闭再等 client 断开，避免接收缓冲区有残留时 close 发出 RST
+      shutdown(c->fd, SHUT_WR);
+      c->shut = true;
+    }
+  }
+  update_interest(c);
+  return true;
+}
+
+/**
+ * @brief 握手结束后丢弃 client 发来的数据，读到 EOF 时关闭
+ */
+void EpollLoop::drain(EpollConn *c) {
+  uint8_t scratch[EPOLL_DRAIN_CHUNK];
+  for (;;) {
+    ssize_t n = ::read(c->fd, scratch, sizeof(scratch));
+    if (n > 0) {
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    close_conn(c);
+    return;
+  }
+}
+
+void EpollLoop::update_interest(EpollConn *c) {
+  uint32_t events = 0;
+  if (!c->busy) {
+    if (c->out_sent < c->out_len) {
+      events = EPOLLOUT;
+    } else if (!c->parked) {
+      events = EPOLLIN;
+    }
+  }
+  if (events == c->events) {
+    return;
+  }
+  epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = c;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+  c->events = events;
+}
+
+/**
+ * @brief 关闭套接字；任务仍在线程池中时推迟释放
+ */
+void EpollLoop::close_conn(EpollConn *c) {
+  if (c->fd >= 0) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+    ::close(c->fd);
+    c->fd = -1;
+  }
+  if (c->busy) {
+    c->closing = true;
+    return;
+  }
+  release(c);
+}
+
+void EpollLoop::release(EpollConn *c) {
+  if (c->fd >= 0) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+    ::close(c->fd);
+    c->fd = -1;
+  }
+  if (c->parked) {
+    parked.erase(std::find(parked.begin(), parked.end(), c));
+    c->parked = false;
+  }
+  free_fingerprint(c);
+  if (!c->counted) {
+    server.failed++;
+  }
+  if (c->prev) {
+    c->prev->next = c->next;
+  } else {
+    conns = c->next;
+  }
+  if (c->next) {
+    c->next->prev = c->prev;
+  }
+  sodium_memzero(c->master_secret, sizeof(c->master_secret));
+  sodium_memzero(c->server_eph_sec, sizeof(c->server_eph_sec));
+  server.active--;
+  dead.push_back(c);
+}
+
+/**
+ * @brief 按帧长分配指纹缓冲区；超出本循环的预算时暂停读取，等其他连接释放
+ * @return int 0 表示已分配或已暂停，-1 表示内存不足
+ */
+int EpollLoop::alloc_fingerprint(EpollConn *c) {
+  if (fp_bytes > 0 && fp_bytes + c->frame_len > fp_budget) {
+    c->parked = true;
+    parked.push_back(c);
+    return 0;
+  }
+  c->fp_buf = static_cast<uint8_t *>(malloc(c->frame_len));
+  if (c->fp_buf == nullptr) {
+    return -1;
+  }
+  fp_bytes += c->frame_len;
+  c->frame = c->fp_buf;
+  return 0;
+}
+
+void EpollLoop::free_fingerprint(EpollConn *c) {
+  if (c->fp_buf == nullptr) {
+    return;
+  }
+  free(c->fp_buf);
+  c->fp_buf = nullptr;
+  fp_bytes -= c->frame_len;
+
+  while (!parked.empty()) {
+    EpollConn *p = parked.front();
+    if (fp_bytes > 0 && fp_bytes + p->frame_len > fp_budget) {
+      break;
+    }
+    parked.pop_front();
+    p->parked = false;
+    if (alloc_fingerprint(p) < 0) {
+      close_conn(p);
+      continue;
+    }
+    update_interest(p); // 剩余数据仍在内核缓冲区，由 EPOLLIN 继续读取
+  }
+}
+
+void EpollLoop::check_timeouts() {
+  int64_t now = esp_timer_get_time();
+  for (EpollConn *c = conns; c;) {
+    EpollConn *next = c->next;
+    if (!c->busy && c->fd >= 0 && now >= c->deadline_us) {
+      if (!c->counted) {
+        server.timeouts++;
+      }
+      close_conn(c);
+    }
+    c = next;
+  }
+}
+
+EpollServer::EpollServer(ServerContext &ctx, const EpollServerOptions &options)
+    : ctx(ctx), opt(options), workers(nullptr), next_loop(0), bound_port(-1),
+      callback(nullptr), callback_arg(nullptr), accepted(0), completed(0),
+      resumed(0), failed(0), timeouts(0), refused(0), active(0), jobs(0) {}
+
+EpollServer::~EpollServer() { stop(); }
+
+/**
+ * @brief 默认选项：不监听（port 为 -1 时只接受 adopt 的连接），
+ * 每个核一个事件循环和一个工作线程
+ */
+EpollServerOptions EpollServer::default_options() {
+  EpollServerOptions o;
+  o.port = -1;
+  o.loops = 0;
+  o.workers = 0;
+  o.max_connections = EPOLL_MAX_CONNECTIONS;
+  o.fingerprint_max = EPOLL_FINGERPRINT_MAX;
+  o.fingerprint_budget = EPOLL_FINGERPRINT_BUDGET;
+  o.timeout_ms = HANDSHAKE_TIMEOUT_MS;
+  return o;
+}
+
+/**
+ * @brief 启动事件循环与线程池
+ * @return int 0 表示成功， -1 表示失败
+ */
+int EpollServer::start() {
+  uint32_t cores = std::max(1U, std::thread::hardware_concurrency());
+  uint32_t n_loops = opt.loops ? opt.loops : cores;
+  uint32_t n_workers = opt.workers ? opt.workers : cores;
+  workers = new EpollWorkers(*this, n_workers);
+
+  int port = opt.port;
+  for (uint32_t i = 0; i < n_loops; ++i) {
+    EpollLoop *loop =
+        new EpollLoop(*this, std::max<size_t>(opt.fingerprint_budget / n_loops,
+                                              opt.fingerprint_max + TAG_SIZE));
+    loops.push_back(loop);
+    int ret = loop->open(port);
+    if (ret < 0) {
+      stop();
+      return -1;
+    }
+    if (port >= 0) {
+      port = ret; // 端口为 0 时由第一个循环取得，其余循环共享
+    }
+  }
+  bound_port = port;
+  for (EpollLoop *loop : loops) {
+    loop->start();
+  }
+  return 0;
+}
+
+/**
+ * @brief 停止线程池与事件循环，关闭所有连接
+ */
+void EpollServer::stop() {
+  if (workers == nullptr) {
+    return;
+  }
+  workers->stop(); // 先停线程池，事件循环中不会再有新的完成
+  for (EpollLoop *loop : loops) {
+    loop->stop();
+  }
+  for (EpollLoop *loop : loops) {
+    delete loop;
+  }
+  loops.clear();
+  delete workers;
+  workers = nullptr;
+  bound_port = -1;
+}
+
+/**
+ * @brief 接管一个已连接的套接字（例如 socketpair 的一端），轮流分给各事件循环
+ *
+ * @param fd 套接字，此后由服务器关闭
+ * @return int 0 表示成功， -1 表示失败
+ */
+int EpollServer::adopt(int fd) {
+  if (loops.empty()) {
+    return -1;
+  }
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    return -1;
+  }
+  loops[next_loop++ % loops.size()]->adopt(fd);
+  return 0;
+}
+
+/**
+ * @brief 设置握手成功的回调，须在 start 之前调用
+ */
+void EpollServer::on_handshake(EpollHandshakeCallback cb, void *arg) {
+  callback = cb;
+  callback_arg = arg;
+}
+
+void EpollServer::stats(EpollServerStats &out) const {
+  out.accepted = accepted;
+  out.completed = completed;
+  out.resumed = resumed;
+  out.failed = failed;
+  out.timeouts = timeouts;
+  out.refused = refused;
+  out.active = active;
+  out.jobs = jobs;
+}
@@ -0,0 +1,110 @@
+#pragma once
+// 仅用于 native（Linux）环境：可扩展的 mtlsp 参考服务器。每个核一个 epoll
+// 事件循环，套接字全部非阻塞；签名、打开 sealed box 与 AES-GCM 解密交给工作
+// 线程池，事件循环只做 I/O。与 handshake_server 共用 mtlsp_server_steps，
+// 线上格式与 handshake_client 逐字节一致
+#include "mtlsp_server.h"
+#include <atomic>
+#include <vector>
+
+#define EPOLL_FINGERPRINT_MAX (512U * 1024U) // 默认的指纹上限
+#define EPOLL_FINGERPRINT_BUDGET (64U * 1024U * 1024U) // 所有连接的指纹缓冲区之和
+#define EPOLL_MAX_CONNECTIONS 16384U
+#define EPOLL_OUT_BUFFER 1024U // 每条连接的发送缓冲区，放得下最大的一个 server flight
+#define LATENCY_SUB_BITS 3U    // 每个二倍区间分 8 个桶，相对误差不超过 12.5%
+#define LATENCY_BUCKETS 320U
+
+namespace mtlsp {
+
+class EpollLoop;
+class EpollWorkers;
+
+/// 握手成功时在事件循环线程中调用，不要在其中阻塞
+typedef void (*EpollHandshakeCallback)(int fd,
+                                       const uint8_t master_secret[BYTE256b],
+                                       const ServerHandshakeInfo &info,
+                                       void *arg);
+
+struct EpollServerOptions {
+  int port;                   // 监听端口；0 表示由内核选择，-1 表示只接受 adopt
+  uint32_t loops;             // 事件循环线程数，0 表示每个核一个
+  uint32_t workers;           // 密码学工作线程数，0 表示每个核一个
+  uint32_t max_connections;   // 同时存在的连接上限，超出时直接关闭新连接
+  uint32_t fingerprint_max;   // 单个指纹的上限
+  uint32_t fingerprint_budget; // 同时缓存的指纹总量，超出时暂停读取上传
+  uint32_t timeout_ms;        // 握手期限
+};
+
+/// 对数分桶的延迟直方图（微秒），可在多个线程中并发记录
+class LatencyHistogram {
+public:
+  LatencyHistogram() { reset(); }
+  void record(uint64_t us);
+  uint64_t percentile(double q) const;
+  uint64_t count() const;
+  void reset();
+
+private:
+  static uint32_t bucket(uint64_t us);
+  static uint64_t upper(uint32_t b);
+
+  std::atomic<uint64_t> buckets[LATENCY_BUCKETS];
+};
+
+struct EpollServerStats {
+  uint64_t accepted;
+  uint64_t completed; // 握手成功
+  uint64_t resumed;   // 其中的会话恢复
+  uint64_t failed;    // 握手失败，含超时与中途断开
+  uint64_t timeouts;
+  uint64_t refused;   // 超过 max_connections 被直接关闭
+  uint64_t active;    // 当前连接数
+  uint64_t jobs;      // 交给线程池的任务数
+};
+
+/// 事件驱动的 mtlsp 服务器
+///
+/// 每条连接一个状态机：READ_HELLO →（完整握手）WAIT_KEY → WAIT_NONCE →
+/// WAIT_FP → DRAIN；快速握手直接进入 WAIT_NONCE，会话恢复直接完成或回复
+/// NotOK 后回到 READ_HELLO。计算任务在线程池中执行时连接不再读取，协议是
+/// 一问一答的，未读的数据留在内核缓冲区里。每条连接固定占用约 2 KB，
+/// 只有上传指纹时才按帧长分配指纹缓冲区，并受 fingerprint_budget 限制。
+/// ServerContext 的校验回调会在工作线程中并发调用。
+class EpollServer {
+public:
+  EpollServer(ServerContext &ctx, const EpollServerOptions &options);
+  ~EpollServer();
+  EpollServer(const EpollServer &) = delete;
+  EpollServer &operator=(const EpollServer &) = delete;
+
+  static EpollServerOptions default_options();
+
+  int start();
+  void stop();
+  int adopt(int fd);
+  void on_handshake(EpollHandshakeCallback cb, void *arg);
+
+  /// 实际监听的端口，未监听时为 -1
+  int port() const { return bound_port; }
+  void stats(EpollServerStats &out) const;
+  const LatencyHistogram &latency() const { return hist; }
+
+private:
+  friend class EpollLoop;
+  friend class EpollWorkers;
+
+  ServerContext &ctx;
+  EpollServerOptions opt;
+  std::vector<EpollLoop *> loops;
+  EpollWorkers *workers;
+  std::atomic<uint32_t> next_loop;
+  int bound_port;
+  EpollHandshakeCallback callback;
+  void *callback_arg;
+
+  LatencyHistogram hist;
+  std::atomic<uint64_t> accepted, completed, resumed, failed, timeouts,
+      refused, active, jobs;
+};
+
+}; // namespace mtlsp
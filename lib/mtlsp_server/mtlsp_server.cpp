@@ -0,0 +1,657 @@
+#include "mtlsp_server.h"
+#include "mtlsp_server_steps.h"
+#include "mtlsp_frame.h"
+#include "prnu.h"
+#include <ctime>
+
+using namespace mtlsp;
+
+#define TICKET_PLAIN_LEN (8 + 2 * BYTE256b) // expiry_be64 || rs || device_id
+
+/**
+ * @brief 初始化服务器长期状态
+ *
+ * @param ctx 服务器状态
+ * @param seed 32 字节 Ed25519 种子，对应的公钥须烧录到设备的 ed_server_pub
+ * @return int 0 表示成功， -1 表示失败
+ */
+int mtlsp::server_context_init(ServerContext &ctx,
+                               const uint8_t seed[BYTE256b]) {
+  if (sodium_init() < 0) {
+    return -1;
+  }
+  crypto_sign_seed_keypair(ctx.ed_pub, ctx.ed_sec, seed);
+  if (crypto_sign_ed25519_pk_to_curve25519(ctx.x_pub, ctx.ed_pub) < 0 ||
+      crypto_sign_ed25519_sk_to_curve25519(ctx.x_sec, ctx.ed_sec) < 0) {
+    return -1;
+  }
+  randombytes_buf(ctx.ticket_key, sizeof(ctx.ticket_key));
+  ctx.ticket_lifetime_s = 3600;
+  ctx.support_fast = true;
+  ctx.support_resume = true;
+  ctx.support_residual = true;
+  ctx.verify = nullptr;
+  ctx.verify_residual = nullptr;
+  ctx.verify_arg = nullptr;
+  return 0;
+}
+
+static void put_be64(uint8_t *p, uint64_t v) {
+  for (int i = 7; i >= 0; --i, v >>= 8) {
+    p[i] = (uint8_t)v;
+  }
+}
+
+static uint64_t get_be64(const uint8_t *p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; ++i) {
+    v = v << 8 | p[i];
+  }
+  return v;
+}
+
+/**
+ * @brief 按 client 在 hello 中给出的格式字节选定指纹格式
+ *
+ * @param offered 格式位图，0 表示 hello 没有格式字节（只能是 JPEG）
+ */
+static uint8_t choose_format(const ServerContext &ctx, uint8_t offered) {
+  if ((offered & FP_FORMAT_RESIDUAL) && ctx.support_residual) {
+    return FP_FORMAT_RESIDUAL;
+  }
+  return FP_FORMAT_JPEG;
+}
+
+/**
+ * @brief BOX_{Q_c}(OK) 的明文：hello 带格式字节时为 OK || 选定的格式
+ * @return size_t 明文长度
+ */
+static size_t ok_signal(uint8_t signal[2], uint8_t ok, uint8_t offered,
+                        uint8_t format) {
+  signal[0] = ok;
+  signal[1] = format;
+  return offered ? 2 : 1;
+}
+
+/**
+ * @brief Z = X25519(server_eph_sec, Q_c)，M = H(Z||client_random||server_random)
+ * @return int 0 表示成功， -1 表示失败（Q_c 为低阶点）
+ */
+static int derive_master(uint8_t master_secret[BYTE256b],
+                         const uint8_t server_eph_sec[BYTE256b],
+                         const uint8_t client_eph_pub[BYTE256b],
+                         const uint8_t client_random[BYTE256b],
+                         const uint8_t server_random[BYTE256b]) {
+  uint8_t tmp_msg_zcs[3 * BYTE256b]; // Z||client_random||server_random
+  if (crypto_scalarmult_curve25519(tmp_msg_zcs, server_eph_sec,
+                                   client_eph_pub) < 0) {
+    return -1;
+  }
+  memcpy(tmp_msg_zcs + BYTE256b, client_random, BYTE256b);
+  memcpy(tmp_msg_zcs + 2 * BYTE256b, server_random, BYTE256b);
+  crypto_hash_sha256(master_secret, tmp_msg_zcs, sizeof(tmp_msg_zcs));
+  sodium_memzero(tmp_msg_zcs, sizeof(tmp_msg_zcs));
+  return 0;
+}
+
+/**
+ * @brief 解析 client 的第一帧
+ *
+ * @param ctx 服务器长期状态，决定是否接受快速握手与会话恢复
+ * @param hello 第一帧
+ * @param len 第一帧的长度
+ * @return ServerHello 类型为 SERVER_HELLO_REJECT 时应回复 NotOK
+ */
+ServerHello mtlsp::server_parse_hello(const ServerContext &ctx,
+                                      const uint8_t *hello, int len) {
+  ServerHello h = {SERVER_HELLO_REJECT, 0, 0, false, nullptr};
+  if (len == BYTE256b) {
+    h.kind = SERVER_HELLO_FULL;
+    h.client_random = hello;
+    return h;
+  }
+  if (len <= 0) {
+    return h;
+  }
+
+  // 完整握手与快速握手的 hello 末尾可以多一个指纹格式字节
+  h.type = hello[0];
+  h.client_random = hello + 1;
+  switch (hello[0]) {
+  case HELLO_FULL_TICKET:
+  case HELLO_FULL:
+    if (len == 1 + BYTE256b + 1 ||
+        (len == 1 + BYTE256b && hello[0] == HELLO_FULL_TICKET)) {
+      h.kind = SERVER_HELLO_FULL;
+      h.offered =
+          len > 1 + (int)BYTE256b ? hello[1 + BYTE256b] | FP_FORMAT_JPEG : 0;
+      h.tickets = hello[0] == HELLO_FULL_TICKET;
+    }
+    break;
+  case HELLO_FAST:
+  case HELLO_FAST_TICKET:
+    if (ctx.support_fast &&
+        (len == FAST_HELLO_LEN || len == FAST_HELLO_LEN + 1)) {
+      h.kind = SERVER_HELLO_FAST;
+      h.offered =
+          len > (int)FAST_HELLO_LEN ? hello[FAST_HELLO_LEN] | FP_FORMAT_JPEG : 0;
+      h.tickets = hello[0] == HELLO_FAST_TICKET;
+    }
+    break;
+  case HELLO_RESUME:
+    if (ctx.support_resume) {
+      h.kind = SERVER_HELLO_RESUME;
+    }
+    break;
+  }
+  return h;
+}
+
+/**
+ * @brief 完整握手第 4 步：生成 server_random 与 Q_s，并签名 H(Q_s||cr||sr)
+ *
+ * @param ctx 服务器长期状态
+ * @param client_random client 的 32 字节随机数
+ * @param server_random 传出参数
+ * @param server_eph_pub 传出参数，Q_s
+ * @param server_eph_sec 传出参数，Q_s 的私钥，server_open_key 用后清零
+ * @param sig 传出参数，64 字节 Ed25519 签名
+ */
+void mtlsp::server_sign_hello(const ServerContext &ctx,
+                              const uint8_t client_random[BYTE256b],
+                              uint8_t server_random[BYTE256b],
+                              uint8_t server_eph_pub[BYTE256b],
+                              uint8_t server_eph_sec[BYTE256b],
+                              uint8_t sig[BYTE512b]) {
+  randombytes_buf(server_random, BYTE256b);
+  crypto_kx_keypair(server_eph_pub, server_eph_sec);
+
+  uint8_t tmp_msg_qscs[3 * BYTE256b]; // Q_s||client_random||server_random
+  memcpy(tmp_msg_qscs, server_eph_pub, BYTE256b);
+  memcpy(tmp_msg_qscs + BYTE256b, client_random, BYTE256b);
+  memcpy(tmp_msg_qscs + 2 * BYTE256b, server_random, BYTE256b);
+  uint8_t hashed_msg[BYTE256b];
+  crypto_hash_sha256(hashed_msg, tmp_msg_qscs, sizeof(tmp_msg_qscs));
+  crypto_sign_detached(sig, nullptr, hashed_msg, BYTE256b, ctx.ed_sec);
+}
+
+/**
+ * @brief 完整握手第 6~8 步：打开 BOX_{S_pub}(Q_c||cr||sr)，检查新鲜性，
+ * 生成 BOX_{Q_c}(OK||format) 并派生主密钥
+ *
+ * @param cipher SERVER_KEY_LEN 字节的 BOX_{S_pub}(Q_c||cr||sr)
+ * @param offered hello 中的格式位图
+ * @param server_eph_sec Q_s 的私钥，返回前清零
+ * @param signal 传出参数，应发给 client 的 BOX_{Q_c}(OK||format)
+ * @param signal_len 传出参数，signal 的长度
+ * @param master_secret 传出参数，返回 0 时有效
+ * @param format 传出参数，选定的指纹格式
+ * @return int 0 表示成功；1 表示 cr/sr 不匹配，signal 为 NotOK，发出后结束；
+ * -1 表示失败，不发送任何内容
+ */
+int mtlsp::server_open_key(const ServerContext &ctx, const uint8_t *cipher,
+                           const uint8_t client_random[BYTE256b],
+                           const uint8_t server_random[BYTE256b],
+                           uint8_t offered, uint8_t server_eph_sec[BYTE256b],
+                           uint8_t signal[SERVER_SIGNAL_MAX],
+                           size_t *signal_len, uint8_t master_secret[BYTE256b],
+                           uint8_t *format) {
+  uint8_t tmp_msg_qccs[3 * BYTE256b];
+  if (crypto_box_seal_open(tmp_msg_qccs, cipher, SERVER_KEY_LEN, ctx.x_pub,
+                           ctx.x_sec) < 0) {
+    sodium_memzero(server_eph_sec, BYTE256b);
+    return -1;
+  }
+  const uint8_t *client_eph_pub = tmp_msg_qccs;
+  bool fresh = sodium_memcmp(tmp_msg_qccs + BYTE256b, client_random,
+                             BYTE256b) == 0 &&
+               sodium_memcmp(tmp_msg_qccs + 2 * BYTE256b, server_random,
+                             BYTE256b) == 0;
+  *format = choose_format(ctx, offered);
+  uint8_t plain[2];
+  size_t plain_len = ok_signal(plain, fresh ? OK : NOK, offered, *format);
+  crypto_box_seal(signal, plain, plain_len, client_eph_pub);
+  *signal_len = plain_len + crypto_box_SEALBYTES;
+
+  int ret = fresh ? 0 : 1;
+  if (fresh && derive_master(master_secret, server_eph_sec, client_eph_pub,
+                             client_random, server_random) < 0) {
+    ret = -1;
+  }
+  sodium_memzero(server_eph_sec, BYTE256b);
+  return ret;
+}
+
+/**
+ * @brief 快速握手：校验 hello，生成完整的 server flight 并派生主密钥，
+ * 见 mtlsp.md「快速握手」一节
+ *
+ * @param hello FAST_HELLO_LEN 或 FAST_HELLO_LEN + 1 字节的 hello
+ * @param offered hello 中的格式位图
+ * @param flight 传出参数，sr || Q_s || Sig(H(Q_s||cr||sr||Q_c)) || BOX_{Q_c}(OK)
+ * @param flight_len 传出参数，flight 的长度
+ * @param master_secret 传出参数
+ * @param format 传出参数，选定的指纹格式
+ * @return int 0 表示成功， -1 表示失败
+ */
+int mtlsp::server_fast_flight(const ServerContext &ctx, const uint8_t *hello,
+                              uint8_t offered,
+                              uint8_t flight[SERVER_FLIGHT_MAX],
+                              size_t *flight_len,
+                              uint8_t master_secret[BYTE256b],
+                              uint8_t *format) {
+  const uint8_t *client_random = hello + 1;
+  uint8_t tmp_msg_qcc[2 * BYTE256b]; // Q_c||client_random
+  if (crypto_box_seal_open(tmp_msg_qcc, hello + 1 + BYTE256b,
+                           crypto_box_SEALBYTES + 2 * BYTE256b, ctx.x_pub,
+                           ctx.x_sec) < 0 ||
+      sodium_memcmp(tmp_msg_qcc + BYTE256b, client_random, BYTE256b) != 0) {
+    return -1;
+  }
+  const uint8_t *client_eph_pub = tmp_msg_qcc;
+
+  uint8_t *server_random = flight;
+  uint8_t *server_eph_pub = flight + BYTE256b;
+  uint8_t server_eph_sec[BYTE256b];
+  randombytes_buf(server_random, BYTE256b);
+  crypto_kx_keypair(server_eph_pub, server_eph_sec);
+
+  uint8_t tmp_msg_qscsc[4 * BYTE256b];
+  memcpy(tmp_msg_qscsc, server_eph_pub, BYTE256b);
+  memcpy(tmp_msg_qscsc + BYTE256b, client_random, BYTE256b);
+  memcpy(tmp_msg_qscsc + 2 * BYTE256b, server_random, BYTE256b);
+  memcpy(tmp_msg_qscsc + 3 * BYTE256b, client_eph_pub, BYTE256b);
+  uint8_t hashed_msg[BYTE256b];
+  crypto_hash_sha256(hashed_msg, tmp_msg_qscsc, sizeof(tmp_msg_qscsc));
+  crypto_sign_detached(flight + 2 * BYTE256b, nullptr, hashed_msg, BYTE256b,
+                       ctx.ed_sec);
+  *format = choose_format(ctx, offered);
+  uint8_t signal[2];
+  size_t signal_len = ok_signal(signal, OK, offered, *format);
+  crypto_box_seal(flight + 2 * BYTE256b + BYTE512b, signal, signal_len,
+                  client_eph_pub);
+  *flight_len = 2 * BYTE256b + BYTE512b + signal_len + crypto_box_SEALBYTES;
+
+  int ret = derive_master(master_secret, server_eph_sec, client_eph_pub,
+                          client_random, server_random);
+  sodium_memzero(server_eph_sec, sizeof(server_eph_sec));
+  return ret;
+}
+
+/**
+ * @brief 第 10 步：校验已解密的指纹
+ *
+ * @param format 选定的指纹格式
+ * @param fingerprint 明文指纹
+ * @param len 指纹长度
+ * @param device_id 传出参数，识别出的设备身份；未设置校验回调时为指纹的哈希
+ * @return bool true 表示设备合法
+ */
+bool mtlsp::server_verify_fingerprint(ServerContext &ctx, uint8_t format,
+                                      const uint8_t *fingerprint, size_t len,
+                                      uint8_t device_id[BYTE256b]) {
+  uint16_t width, height;
+  FingerprintVerifier verify =
+      format == FP_FORMAT_RESIDUAL ? ctx.verify_residual : ctx.verify;
+  if (format == FP_FORMAT_RESIDUAL &&
+      prnu_parse(fingerprint, len, &width, &height) < 0) {
+    return false;
+  }
+  if (verify) {
+    return verify(fingerprint, len, device_id, ctx.verify_arg);
+  }
+  crypto_hash_sha256(device_id, fingerprint, len);
+  return true;
+}
+
+/**
+ * @brief 第 11 步：nonce 与 E_M(signal)
+ *
+ * @param aead 以主密钥初始化的 AEAD 上下文
+ * @param signal OK 或 NOK
+ * @param nonce 传出参数，随机 nonce 帧
+ * @param cipher 传出参数，E_M(signal) 帧
+ * @return int 0 表示成功， -1 表示失败
+ */
+int mtlsp::server_confirm(Aes256Gcm &aead, uint8_t signal,
+                          uint8_t nonce[IV_SIZE],
+                          uint8_t cipher[SERVER_CONFIRM_LEN]) {
+  randombytes_buf(nonce, IV_SIZE);
+  return aead.encrypt(cipher, nullptr, &signal, 1, nullptr, 0, nonce) < 0 ? -1
+                                                                          : 0;
+}
+
+/**
+ * @brief 签发会话恢复票据：nonce 帧 + E_M(lifetime_be32 || blob) 帧，
+ * blob = nonce || AES256GCM_{ticket_key}(expiry_be64 || rs || device_id)
+ *
+ * @param nonce 传出参数，nonce 帧
+ * @param msg 传出参数，E_M(lifetime_be32 || blob) 帧
+ * @return int 0 表示成功， -1 表示失败
+ */
+int mtlsp::server_ticket(ServerContext &ctx, Aes256Gcm &aead,
+                         const uint8_t master_secret[BYTE256b],
+                         const uint8_t device_id[BYTE256b],
+                         uint8_t nonce[IV_SIZE],
+                         uint8_t msg[SERVER_TICKET_MSG]) {
+  uint32_t be_lifetime = htonl(ctx.ticket_lifetime_s);
+  memcpy(msg, &be_lifetime, 4);
+
+  uint8_t *blob = msg + 4;
+  uint8_t *plain = blob + IV_SIZE;
+  put_be64(plain, (uint64_t)time(nullptr) + ctx.ticket_lifetime_s);
+  const char *label = "mtlsp resumption";
+  crypto_auth_hmacsha256(plain + 8, reinterpret_cast<const uint8_t *>(label),
+                         strlen(label), master_secret);
+  memcpy(plain + 8 + BYTE256b, device_id, BYTE256b);
+  randombytes_buf(blob, IV_SIZE);
+  Aes256Gcm ticket_aead(ctx.ticket_key);
+  if (ticket_aead.encrypt(plain, TICKET_PLAIN_LEN, nullptr, 0, blob) < 0) {
+    return -1;
+  }
+
+  randombytes_buf(nonce, IV_SIZE);
+  if (aead.encrypt(msg, 4 + SERVER_TICKET_BLOB, nullptr, 0, nonce) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief 检查票据是否已被使用过，未使用则登记；顺带清理过期记录
+ * @return bool true 表示首次使用
+ */
+static bool ticket_first_use(ServerContext &ctx, const uint8_t *blob,
+                             uint64_t expiry, uint64_t now) {
+  std::lock_guard<std::mutex> guard(ctx.used_lock);
+  if (ctx.used_tickets.size() > 4096) {
+    for (auto it = ctx.used_tickets.begin(); it != ctx.used_tickets.end();) {
+      it = it->second < now ? ctx.used_tickets.erase(it) : std::next(it);
+    }
+  }
+  return ctx.used_tickets
+      .emplace(std::string(reinterpret_cast<const char *>(blob),
+                           SERVER_TICKET_BLOB),
+               expiry)
+      .second;
+}
+
+/**
+ * @brief 会话恢复：校验票据与 binder，通过后生成 server_random 并派生主密钥，
+ * 见 mtlsp.md「会话恢复」一节
+ *
+ * @param hello RESUME hello
+ * @param len hello 的长度
+ * @param server_random 传出参数
+ * @param master_secret 传出参数
+ * @param device_id 传出参数，票据中记录的设备身份
+ * @return int 0 表示接受，1 表示拒绝（应回复 NotOK）
+ */
+int mtlsp::server_check_resume(ServerContext &ctx, const uint8_t *hello,
+                               int len, uint8_t server_random[BYTE256b],
+                               uint8_t master_secret[BYTE256b],
+                               uint8_t device_id[BYTE256b]) {
+  const uint8_t *client_random = hello + 1;
+  const uint8_t *binder = hello + 1 + BYTE256b;
+  const uint8_t *blob = hello + 1 + 2 * BYTE256b;
+  if (len - (int)(1 + 2 * BYTE256b) != (int)SERVER_TICKET_BLOB) {
+    return 1;
+  }
+
+  uint8_t plain[TICKET_PLAIN_LEN + TAG_SIZE];
+  memcpy(plain, blob + IV_SIZE, sizeof(plain));
+  Aes256Gcm ticket_aead(ctx.ticket_key);
+  if (ticket_aead.decrypt(plain, sizeof(plain), nullptr, 0, blob) < 0) {
+    return 1;
+  }
+  uint64_t expiry = get_be64(plain);
+  const uint8_t *rs = plain + 8;
+
+  uint8_t expect_binder[BYTE256b];
+  const char *binder_label = "mtlsp binder";
+  crypto_auth_hmacsha256_state hmac;
+  crypto_auth_hmacsha256_init(&hmac, rs, BYTE256b);
+  crypto_auth_hmacsha256_update(&hmac,
+                                reinterpret_cast<const uint8_t *>(binder_label),
+                                strlen(binder_label));
+  crypto_auth_hmacsha256_update(&hmac, client_random, BYTE256b);
+  crypto_auth_hmacsha256_update(&hmac, blob, SERVER_TICKET_BLOB);
+  crypto_auth_hmacsha256_final(&hmac, expect_binder);
+
+  uint64_t now = (uint64_t)time(nullptr);
+  if (now > expiry || sodium_memcmp(expect_binder, binder, BYTE256b) != 0 ||
+      !ticket_first_use(ctx, blob, expiry, now)) {
+    sodium_memzero(plain, sizeof(plain));
+    return 1;
+  }
+
+  randombytes_buf(server_random, BYTE256b);
+  const char *resume_label = "mtlsp resume";
+  crypto_auth_hmacsha256_init(&hmac, rs, BYTE256b);
+  crypto_auth_hmacsha256_update(&hmac,
+                                reinterpret_cast<const uint8_t *>(resume_label),
+                                strlen(resume_label));
+  crypto_auth_hmacsha256_update(&hmac, client_random, BYTE256b);
+  crypto_auth_hmacsha256_update(&hmac, server_random, BYTE256b);
+  crypto_auth_hmacsha256_final(&hmac, master_secret);
+  memcpy(device_id, plain + 8 + BYTE256b, BYTE256b);
+  sodium_memzero(plain, sizeof(plain));
+  return 0;
+}
+
+/**
+ * @brief 发送单字节 NotOK 帧，通知 client 回退
+ */
+static void send_reject(Client &client) {
+  uint8_t nok = NOK;
+  send(client, &nok, 1);
+}
+
+/**
+ * @brief 排队 nonce 帧与 E_M(signal) 帧（第 11 步），由调用方 flush
+ */
+static int send_confirm(FrameWriter &writer, Aes256Gcm &aead, uint8_t signal) {
+  uint8_t nonce[IV_SIZE];
+  uint8_t cipher[SERVER_CONFIRM_LEN];
+  if (server_confirm(aead, signal, nonce, cipher) < 0) {
+    return -1;
+  }
+  writer.queue(nonce, sizeof(nonce));
+  writer.queue(cipher, sizeof(cipher));
+  return 0;
+}
+
+/**
+ * @brief 排队会话恢复票据，由调用方 flush
+ */
+static int issue_ticket(FrameWriter &writer, ServerContext &ctx,
+                        Aes256Gcm &aead,
+                        const uint8_t master_secret[BYTE256b],
+                        const uint8_t device_id[BYTE256b]) {
+  uint8_t nonce[IV_SIZE];
+  uint8_t msg[SERVER_TICKET_MSG];
+  if (server_ticket(ctx, aead, master_secret, device_id, nonce, msg) < 0) {
+    return -1;
+  }
+  writer.queue(nonce, sizeof(nonce));
+  writer.queue(msg, sizeof(msg));
+  return 0;
+}
+
+/**
+ * @brief 握手收尾（第 9~11 步），与 client 的 handshake_finish 对应
+ */
+static int server_finish(const uint8_t master_secret[BYTE256b], Client &client,
+                         ServerContext &ctx, uint8_t *fingerprint_buf,
+                         size_t fingerprint_cap, bool tickets, uint8_t format,
+                         ServerHandshakeInfo *info) {
+  Aes256Gcm aead(master_secret);
+  uint8_t nonce_client[IV_SIZE];
+  if (recv(client, nonce_client, sizeof(nonce_client)) != IV_SIZE) {
+    return -1;
+  }
+  int fp_len = recv_decrypted(client, fingerprint_buf, fingerprint_cap,
+                              nonce_client, aead);
+  if (fp_len < 0) {
+    return -1;
+  }
+
+  uint8_t device_id[BYTE256b];
+  bool ok =
+      server_verify_fingerprint(ctx, format, fingerprint_buf, fp_len, device_id);
+  // E_M(OK) 与票据合并为一次写出
+  FrameWriter writer(client);
+  if (send_confirm(writer, aead, ok ? OK : NOK) < 0) {
+    return -1;
+  }
+  if (ok && tickets &&
+      issue_ticket(writer, ctx, aead, master_secret, device_id) < 0) {
+    return -1;
+  }
+  if (writer.flush() < 0 || !ok) {
+    return -1;
+  }
+
+  info->resumed = false;
+  info->fingerprint_len = fp_len;
+  info->fingerprint_format = format;
+  memcpy(info->device_id, device_id, BYTE256b);
+  return 0;
+}
+
+/**
+ * @brief 完整握手（第 4~11 步）
+ */
+static int server_full(uint8_t master_secret[BYTE256b], Client &client,
+                       ServerContext &ctx, const ServerHello &hello,
+                       uint8_t *fingerprint_buf, size_t fingerprint_cap,
+                       ServerHandshakeInfo *info) {
+  uint8_t server_random[BYTE256b];
+  uint8_t server_eph_pub[BYTE256b], server_eph_sec[BYTE256b];
+  uint8_t sig[BYTE512b];
+  server_sign_hello(ctx, hello.client_random, server_random, server_eph_pub,
+                    server_eph_sec, sig);
+  FrameWriter writer(client, HANDSHAKE_FRAME_BUFFER);
+  writer.queue(server_random, sizeof(server_random));
+  writer.queue(server_eph_pub, sizeof(server_eph_pub));
+  writer.queue(sig, sizeof(sig));
+  if (writer.flush() < 0) {
+    sodium_memzero(server_eph_sec, sizeof(server_eph_sec));
+    return -1;
+  }
+
+  uint8_t cipher_msg[SERVER_KEY_LEN];
+  if (recv(client, cipher_msg, sizeof(cipher_msg)) != sizeof(cipher_msg)) {
+    sodium_memzero(server_eph_sec, sizeof(server_eph_sec));
+    return -1;
+  }
+  uint8_t signal[SERVER_SIGNAL_MAX];
+  size_t signal_len;
+  uint8_t format;
+  int ret = server_open_key(ctx, cipher_msg, hello.client_random,
+                            server_random, hello.offered, server_eph_sec,
+                            signal, &signal_len, master_secret, &format);
+  if (ret < 0) {
+    return -1;
+  }
+  send(client, signal, signal_len);
+  if (ret != 0) {
+    return -1;
+  }
+  return server_finish(master_secret, client, ctx, fingerprint_buf,
+                       fingerprint_cap, hello.tickets, format, info);
+}
+
+/**
+ * @brief 快速握手，见 mtlsp.md「快速握手」一节
+ */
+static int server_fast(uint8_t master_secret[BYTE256b], Client &client,
+                       ServerContext &ctx, const uint8_t *hello,
+                       const ServerHello &h, uint8_t *fingerprint_buf,
+                       size_t fingerprint_cap, ServerHandshakeInfo *info) {
+  uint8_t flight[SERVER_FLIGHT_MAX];
+  size_t flight_len;
+  uint8_t format;
+  if (server_fast_flight(ctx, hello, h.offered, flight, &flight_len,
+                         master_secret, &format) < 0) {
+    return -1;
+  }
+  send(client, flight, flight_len);
+  return server_finish(master_secret, client, ctx, fingerprint_buf,
+                       fingerprint_cap, h.tickets, format, info);
+}
+
+/**
+ * @brief 会话恢复，见 mtlsp.md「会话恢复」一节
+ * @return int 0 成功，1 拒绝（已回复 NotOK），-1 失败
+ */
+static int server_resume(uint8_t master_secret[BYTE256b], Client &client,
+                         ServerContext &ctx, const uint8_t *hello, int len,
+                         ServerHandshakeInfo *info) {
+  uint8_t server_random[BYTE256b];
+  uint8_t device_id[BYTE256b];
+  if (server_check_resume(ctx, hello, len, server_random, master_secret,
+                          device_id) != 0) {
+    send_reject(client);
+    return 1;
+  }
+
+  FrameWriter writer(client, HANDSHAKE_FRAME_BUFFER);
+  writer.queue(server_random, sizeof(server_random));
+  Aes256Gcm aead(master_secret);
+  if (send_confirm(writer, aead, OK) < 0 ||
+      issue_ticket(writer, ctx, aead, master_secret, device_id) < 0 ||
+      writer.flush() < 0) {
+    return -1;
+  }
+  info->resumed = true;
+  info->fingerprint_len = 0;
+  info->fingerprint_format = 0;
+  memcpy(info->device_id, device_id, BYTE256b);
+  return 0;
+}
+
+/**
+ * @brief 服务器端握手，按 client 第一帧的类型分派到完整握手、快速握手或会话
+ * 恢复；不支持的类型与被拒绝的票据回复 NotOK，并在同一连接上等待 client 回退
+ *
+ * @param master_secret 传出参数，256 bits 主密钥
+ * @param client 已 accept 的连接
+ * @param ctx 服务器长期状态
+ * @param fingerprint_buf 存放解密后设备指纹的内存块
+ * @param fingerprint_cap fingerprint_buf 的大小
+ * @param info 传出参数，本次握手的类型与设备身份
+ * @return int 0 表示成功， -1 表示失败
+ */
+int mtlsp::handshake_server(uint8_t master_secret[BYTE256b], Client &client,
+                            ServerContext &ctx, uint8_t *fingerprint_buf,
+                            size_t fingerprint_cap, ServerHandshakeInfo *info) {
+  for (;;) {
+    uint8_t hello[SERVER_HELLO_MAX];
+    int len = recv(client, hello, sizeof(hello));
+    if (len <= 0) {
+      return -1;
+    }
+
+    ServerHello h = server_parse_hello(ctx, hello, len);
+    info->hello = h.type;
+    switch (h.kind) {
+    case SERVER_HELLO_FULL:
+      return server_full(master_secret, client, ctx, h, fingerprint_buf,
+                         fingerprint_cap, info);
+    case SERVER_HELLO_FAST:
+      return server_fast(master_secret, client, ctx, hello, h, fingerprint_buf,
+                         fingerprint_cap, info);
+    case SERVER_HELLO_RESUME: {
+      int ret = server_resume(master_secret, client, ctx, hello, len, info);
+      if (ret != 1) {
+        return ret;
+      }
+      continue; // 已回复 NotOK，等待 client 回退
+    }
+    case SERVER_HELLO_REJECT:
+      break;
+    }
+    send_reject(client);
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+// 仅用于 native 环境：mtlsp 协议的参考服务器端实现（第 3~12 步），
+// 用于在主机上测试与基准测试握手，线上格式与 handshake_client 逐字节一致
+#include "mtlsp.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#define SERVER_HELLO_MAX (1 + 2 * BYTE256b + TICKET_MAX)
+#define SERVER_TICKET_BLOB (IV_SIZE + 8 + 2 * BYTE256b + TAG_SIZE)
+
+namespace mtlsp {
+
+/// 指纹校验回调：返回 true 表示设备合法，device_id 为识别出的设备身份
+typedef bool (*FingerprintVerifier)(const uint8_t *fingerprint, size_t len,
+                                    uint8_t device_id[BYTE256b], void *arg);
+
+/// 服务器长期状态，可被多个连接（线程）共享
+struct ServerContext {
+  uint8_t ed_pub[crypto_sign_PUBLICKEYBYTES];
+  uint8_t ed_sec[crypto_sign_SECRETKEYBYTES];
+  uint8_t x_pub[BYTE256b]; // 由 Ed25519 密钥转换得到，用于打开 BOX_{S_pub}
+  uint8_t x_sec[BYTE256b];
+  uint8_t ticket_key[BYTE256b];
+  uint32_t ticket_lifetime_s;
+  bool support_fast;
+  bool support_resume;
+  bool support_residual;
+  FingerprintVerifier verify;          // 校验 JPEG 指纹
+  FingerprintVerifier verify_residual; // 校验噪声残差描述子，可用 prnu_match
+  void *verify_arg;
+
+  std::mutex used_lock; // 已使用的票据，拒绝重放
+  std::unordered_map<std::string, uint64_t> used_tickets;
+};
+
+/// 单次握手的结果
+struct ServerHandshakeInfo {
+  uint8_t hello;          // 0 表示 32 字节 client_random 的原始完整握手
+  bool resumed;
+  size_t fingerprint_len; // 恢复会话时为 0
+  uint8_t fingerprint_format; // FP_FORMAT_JPEG 或 FP_FORMAT_RESIDUAL
+  uint8_t device_id[BYTE256b];
+};
+
+int server_context_init(ServerContext &ctx, const uint8_t seed[BYTE256b]);
+
+int handshake_server(uint8_t master_secret[BYTE256b], Client &client,
+                     ServerContext &ctx, uint8_t *fingerprint_buf,
+                     size_t fingerprint_cap, ServerHandshakeInfo *info);
+
+}; // namespace mtlsp
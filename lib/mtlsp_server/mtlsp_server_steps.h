@@ -0,0 +1,71 @@
+#pragma once
+// 服务器端各步骤的计算部分，不做 I/O：阻塞的 handshake_server 与事件驱动的
+// EpollServer 共用，保证两者的线上格式一致
+#include "mtlsp_server.h"
+
+#define FAST_HELLO_LEN (1 + BYTE256b + crypto_box_SEALBYTES + 2 * BYTE256b)
+#define SERVER_KEY_LEN (crypto_box_SEALBYTES + 3 * BYTE256b) // BOX_{S_pub}(Q_c||cr||sr)
+#define SERVER_SIGNAL_MAX (2 + crypto_box_SEALBYTES)         // BOX_{Q_c}(OK||format)
+#define SERVER_FLIGHT_MAX (2 * BYTE256b + BYTE512b + SERVER_SIGNAL_MAX)
+#define SERVER_CONFIRM_LEN (1 + TAG_SIZE)                     // E_M(OK)
+#define SERVER_TICKET_MSG (4 + SERVER_TICKET_BLOB + TAG_SIZE) // E_M(lifetime || blob)
+
+namespace mtlsp {
+
+/// client 第一帧的类型
+enum ServerHelloKind : uint8_t {
+  SERVER_HELLO_FULL,
+  SERVER_HELLO_FAST,
+  SERVER_HELLO_RESUME,
+  SERVER_HELLO_REJECT, // 不支持或格式不对，回复 NotOK 后等待 client 回退
+};
+
+/// 解析后的 hello
+struct ServerHello {
+  ServerHelloKind kind;
+  uint8_t type;                 // hello 类型字节，0 表示原始完整握手
+  uint8_t offered;              // 指纹格式位图，0 表示 hello 不带格式字节
+  bool tickets;                 // client 请求票据
+  const uint8_t *client_random; // 指向 hello 内部
+};
+
+ServerHello server_parse_hello(const ServerContext &ctx, const uint8_t *hello,
+                               int len);
+
+void server_sign_hello(const ServerContext &ctx,
+                       const uint8_t client_random[BYTE256b],
+                       uint8_t server_random[BYTE256b],
+                       uint8_t server_eph_pub[BYTE256b],
+                       uint8_t server_eph_sec[BYTE256b],
+                       uint8_t sig[BYTE512b]);
+
+int server_open_key(const ServerContext &ctx, const uint8_t *cipher,
+                    const uint8_t client_random[BYTE256b],
+                    const uint8_t server_random[BYTE256b], uint8_t offered,
+                    uint8_t server_eph_sec[BYTE256b],
+                    uint8_t signal[SERVER_SIGNAL_MAX], size_t *signal_len,
+                    uint8_t master_secret[BYTE256b], uint8_t *format);
+
+int server_fast_flight(const ServerContext &ctx, const uint8_t *hello,
+                       uint8_t offered, uint8_t flight[SERVER_FLIGHT_MAX],
+                       size_t *flight_len, uint8_t master_secret[BYTE256b],
+                       uint8_t *format);
+
+bool server_verify_fingerprint(ServerContext &ctx, uint8_t format,
+                               const uint8_t *fingerprint, size_t len,
+                               uint8_t device_id[BYTE256b]);
+
+int server_confirm(Aes256Gcm &aead, uint8_t signal, uint8_t nonce[IV_SIZE],
+                   uint8_t cipher[SERVER_CONFIRM_LEN]);
+
+int server_ticket(ServerContext &ctx, Aes256Gcm &aead,
+                  const uint8_t master_secret[BYTE256b],
+                  const uint8_t device_id[BYTE256b], uint8_t nonce[IV_SIZE],
+                  uint8_t msg[SERVER_TICKET_MSG]);
+
+int server_check_resume(ServerContext &ctx, const uint8_t *hello, int len,
+                        uint8_t server_random[BYTE256b],
+                        uint8_t master_secret[BYTE256b],
+                        uint8_t device_id[BYTE256b]);
+
+}; // namespace mtlsp
@@ -0,0 +1,101 @@
+#pragma once
+// 仅用于 native 环境：提供 mtlsp 用到的 Arduino 接口的最小实现
+#include "freertos_shim.h"
+#include <arpa/inet.h>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t size);
+
+  size_t print(const char *s);
+  size_t print(char c);
+  size_t print(int n);
+  size_t print(unsigned int n);
+  size_t print(long n);
+  size_t print(unsigned long n);
+  size_t print(double n);
+  size_t println();
+  size_t println(const char *s);
+  size_t println(char c);
+  size_t println(int n);
+  size_t println(unsigned int n);
+  size_t println(long n);
+  size_t println(unsigned long n);
+  size_t println(double n);
+  size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long ms) { timeout = ms; }
+  unsigned long getTimeout() const { return timeout; }
+  size_t readBytes(uint8_t *buf, size_t len);
+  size_t readBytes(char *buf, size_t len) {
+    return readBytes(reinterpret_cast<uint8_t *>(buf), len);
+  }
+
+protected:
+  int timedRead();
+  unsigned long timeout = 1000;
+};
+
+class IPAddress {
+public:
+  IPAddress() : addr(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+      : addr((uint32_t)a | (uint32_t)b << 8 | (uint32_t)c << 16 |
+             (uint32_t)d << 24) {}
+  IPAddress(uint32_t addr) : addr(addr) {}
+  operator uint32_t() const { return addr; }
+
+private:
+  uint32_t addr; // 网络字节序
+};
+
+class Client : public Stream {
+public:
+  virtual int connect(IPAddress ip, uint16_t port) = 0;
+  virtual int connect(const char *host, uint16_t port) = 0;
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buf, size_t size) = 0;
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int read(uint8_t *buf, size_t size) = 0;
+  virtual int peek() = 0;
+  virtual void flush() = 0;
+  virtual void stop() = 0;
+  virtual uint8_t connected() = 0;
+  virtual operator bool() = 0;
+};
+
+/// 串口输出到 stdout，mute 后丢弃输出（基准测试时避免日志干扰）
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  void mute(bool on) { muted = on; }
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buf, size_t size) override;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+
+private:
+  bool muted = false;
+};
+
+extern HardwareSerial Serial;
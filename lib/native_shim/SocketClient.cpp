@@ -0,0 +1,145 @@
+#include "SocketClient.h"
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+SocketClient::SocketClient(int fd) : sock(fd) {}
+
+SocketClient::~SocketClient() { stop(); }
+
+/**
+ * @brief 创建一对互连的回环 Client
+ * @return int 0 成功，-1 失败
+ */
+int SocketClient::pair(SocketClient &a, SocketClient &b) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    return -1;
+  }
+  a.attach(fds[0]);
+  b.attach(fds[1]);
+  return 0;
+}
+
+/**
+ * @brief 接管一个已连接的套接字（例如 accept 的结果）
+ */
+void SocketClient::attach(int fd) {
+  stop();
+  sock = fd;
+}
+
+int SocketClient::connect(IPAddress ip, uint16_t port) {
+  stop();
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return 0;
+  }
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = (uint32_t)ip;
+  if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    ::close(fd);
+    return 0;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  sock = fd;
+  return 1;
+}
+
+int SocketClient::connect(const char *host, uint16_t port) {
+  in_addr addr;
+  if (inet_pton(AF_INET, host, &addr) != 1) {
+    return 0;
+  }
+  return connect(IPAddress((uint32_t)addr.s_addr), port);
+}
+
+size_t SocketClient::write(uint8_t c) { return write(&c, 1); }
+
+size_t SocketClient::write(const uint8_t *buf, size_t size) {
+  size_t sent = 0;
+  while (sent < size && sock >= 0) {
+    ssize_t n = ::send(sock, buf + sent, size - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+int SocketClient::available() {
+  int n = 0;
+  if (sock < 0 || ioctl(sock, FIONREAD, &n) < 0) {
+    return 0;
+  }
+  return n;
+}
+
+/**
+ * @brief 等待可读，最长 Stream 超时时间
+ */
+bool SocketClient::wait_readable() {
+  pollfd pfd = {sock, POLLIN, 0};
+  int ret;
+  do {
+    ret = poll(&pfd, 1, (int)timeout);
+  } while (ret < 0 && errno == EINTR);
+  return ret > 0;
+}
+
+int SocketClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+/**
+ * @brief 与 WiFiClient 不同，这里在超时时间内阻塞等待至少一个字节，
+ * 便于 mtlsp::recv 在回环连接上直接使用
+ * @return int 读取的字节数，超时或连接关闭为 -1
+ */
+int SocketClient::read(uint8_t *buf, size_t size) {
+  if (sock < 0 || !wait_readable()) {
+    return -1;
+  }
+  ssize_t n;
+  do {
+    n = ::recv(sock, buf, size, 0);
+  } while (n < 0 && errno == EINTR);
+  return n > 0 ? (int)n : -1;
+}
+
+int SocketClient::peek() {
+  uint8_t c;
+  if (sock < 0 || !wait_readable() || ::recv(sock, &c, 1, MSG_PEEK) != 1) {
+    return -1;
+  }
+  return c;
+}
+
+void SocketClient::stop() {
+  if (sock >= 0) {
+    ::close(sock);
+    sock = -1;
+  }
+}
+
+uint8_t SocketClient::connected() {
+  if (sock < 0) {
+    return 0;
+  }
+  uint8_t c;
+  ssize_t n = ::recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
@@ -0,0 +1,35 @@
+#pragma once
+// 仅用于 native 环境：基于 POSIX 套接字的 Arduino Client，可用 socketpair
+// 在同一进程内搭建回环连接，也可连接本机 TCP 端口
+#include "Arduino.h"
+
+class SocketClient : public Client {
+public:
+  explicit SocketClient(int fd = -1);
+  ~SocketClient();
+  SocketClient(const SocketClient &) = delete;
+  SocketClient &operator=(const SocketClient &) = delete;
+
+  static int pair(SocketClient &a, SocketClient &b);
+
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char *host, uint16_t port) override;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buf, size_t size) override;
+  int available() override;
+  int read() override;
+  int read(uint8_t *buf, size_t size) override;
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return sock >= 0; }
+
+  int fd() const { return sock; }
+  void attach(int fd);
+
+private:
+  bool wait_readable();
+
+  int sock;
+};
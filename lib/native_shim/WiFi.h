@@ -0,0 +1,16 @@
+#pragma once
+// 仅用于 native 环境：主机网络总是视为已连接
+#include "Arduino.h"
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_CONNECTED = 3,
+  WL_DISCONNECTED = 6,
+} wl_status_t;
+
+class WiFiClass {
+public:
+  wl_status_t status() { return WL_CONNECTED; }
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,117 @@
+#include "Arduino.h"
+#include "WiFi.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include <chrono>
+#include <sodium.h>
+#include <thread>
+
+HardwareSerial Serial;
+WiFiClass WiFi;
+
+static const std::chrono::steady_clock::time_point boot_time =
+    std::chrono::steady_clock::now();
+
+int64_t esp_timer_get_time() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - boot_time)
+      .count();
+}
+
+unsigned long millis() { return (unsigned long)(esp_timer_get_time() / 1000); }
+
+unsigned long micros() { return (unsigned long)esp_timer_get_time(); }
+
+void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void esp_fill_random(void *buf, size_t len) {
+  if (sodium_init() < 0) {
+    abort();
+  }
+  randombytes_buf(buf, len);
+}
+
+size_t Print::write(const uint8_t *buf, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    n += write(*buf++);
+  }
+  return n;
+}
+
+size_t Print::printf(const char *fmt, ...) {
+  char stack_buf[128];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(stack_buf, sizeof(stack_buf), fmt, args);
+  va_end(args);
+  if (len < 0) {
+    return 0;
+  }
+  if ((size_t)len < sizeof(stack_buf)) {
+    return write(reinterpret_cast<uint8_t *>(stack_buf), len);
+  }
+
+  char *heap_buf = (char *)malloc(len + 1);
+  if (!heap_buf) {
+    return 0;
+  }
+  va_start(args, fmt);
+  vsnprintf(heap_buf, len + 1, fmt, args);
+  va_end(args);
+  size_t n = write(reinterpret_cast<uint8_t *>(heap_buf), len);
+  free(heap_buf);
+  return n;
+}
+
+size_t Print::print(const char *s) {
+  return write(reinterpret_cast<const uint8_t *>(s), strlen(s));
+}
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(int n) { return printf("%d", n); }
+size_t Print::print(unsigned int n) { return printf("%u", n); }
+size_t Print::print(long n) { return printf("%ld", n); }
+size_t Print::print(unsigned long n) { return printf("%lu", n); }
+size_t Print::print(double n) { return printf("%.2f", n); }
+size_t Print::println() { return print("\r\n"); }
+size_t Print::println(const char *s) { return print(s) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(int n) { return print(n) + println(); }
+size_t Print::println(unsigned int n) { return print(n) + println(); }
+size_t Print::println(long n) { return print(n) + println(); }
+size_t Print::println(unsigned long n) { return print(n) + println(); }
+size_t Print::println(double n) { return print(n) + println(); }
+
+int Stream::timedRead() {
+  unsigned long start = millis();
+  do {
+    int c = read();
+    if (c >= 0) {
+      return c;
+    }
+  } while (millis() - start < timeout);
+  return -1;
+}
+
+size_t Stream::readBytes(uint8_t *buf, size_t len) {
+  size_t count = 0;
+  while (count < len) {
+    int c = timedRead();
+    if (c < 0) {
+      break;
+    }
+    buf[count++] = (uint8_t)c;
+  }
+  return count;
+}
+
+size_t HardwareSerial::write(uint8_t c) { return write(&c, 1); }
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t size) {
+  if (muted) {
+    return size;
+  }
+  return fwrite(buf, 1, size, stdout);
+}
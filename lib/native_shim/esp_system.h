@@ -0,0 +1,5 @@
+#pragma once
+// 仅用于 native 环境
+#include <cstddef>
+
+void esp_fill_random(void *buf, size_t len);
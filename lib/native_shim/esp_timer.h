@@ -0,0 +1,5 @@
+#pragma once
+// 仅用于 native 环境：单调时钟，单位微秒
+#include <cstdint>
+
+int64_t esp_timer_get_time();
@@ -0,0 +1,113 @@
+#include "freertos_shim.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+/// 任务通知计数，对应 FreeRTOS 的 ulTaskNotifyTake / xTaskNotifyGive
+struct ShimTask {
+  std::mutex lock;
+  std::condition_variable cv;
+  uint32_t notify = 0;
+};
+
+/// 互斥量与二值信号量共用的实现
+struct ShimSemaphore {
+  std::mutex lock;
+  std::condition_variable cv;
+  bool available;
+};
+
+static thread_local ShimTask *current_task = nullptr;
+
+/// 等待条件成立，ticks 为 portMAX_DELAY 时无限等待（1 tick = 1 ms）
+template <typename Pred>
+static bool wait_for(std::condition_variable &cv,
+                     std::unique_lock<std::mutex> &guard, TickType_t ticks,
+                     Pred pred) {
+  if (ticks == portMAX_DELAY) {
+    cv.wait(guard, pred);
+    return true;
+  }
+  return cv.wait_for(guard, std::chrono::milliseconds(ticks), pred);
+}
+
+void *pvPortMalloc(size_t size) { return malloc(size); }
+
+void vPortFree(void *ptr) { free(ptr); }
+
+BaseType_t xTaskCreatePinnedToCore(void (*task)(void *), const char *name,
+                                   uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core) {
+  (void)name, (void)stack_depth, (void)priority, (void)core;
+  ShimTask *t = new ShimTask();
+  if (handle) {
+    *handle = t;
+  }
+  std::thread([task, arg, t]() {
+    current_task = t;
+    task(arg);
+  }).detach();
+  return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+  if (!current_task) {
+    current_task = new ShimTask(); // 非 xTaskCreate 创建的线程
+  }
+  ShimTask *t = current_task;
+  std::unique_lock<std::mutex> guard(t->lock);
+  wait_for(t->cv, guard, ticks, [t] { return t->notify > 0; });
+  uint32_t value = t->notify;
+  if (value > 0) {
+    t->notify = clear_on_exit ? 0 : value - 1;
+  }
+  return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  {
+    std::lock_guard<std::mutex> guard(task->lock);
+    ++task->notify;
+  }
+  task->cv.notify_one();
+  return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  ShimSemaphore *sem = new ShimSemaphore();
+  sem->available = true;
+  return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  ShimSemaphore *sem = new ShimSemaphore();
+  sem->available = false;
+  return sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+  std::unique_lock<std::mutex> guard(sem->lock);
+  if (!wait_for(sem->cv, guard, ticks, [sem] { return sem->available; })) {
+    return pdFALSE;
+  }
+  sem->available = false;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  {
+    std::lock_guard<std::mutex> guard(sem->lock);
+    sem->available = true;
+  }
+  sem->cv.notify_one();
+  return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) { delete sem; }
@@ -0,0 +1,19 @@
+#pragma once
+// 仅用于 native 环境的测试密钥，与 mtlsp_server 的 NATIVE_SERVER_SEED 对应，
+// 不得用于实际设备
+#include <cstdint>
+
+#define SERVER_IP "127.0.0.1"
+#define SERVER_PORT 8443
+#define WIFI_SSID ""
+#define WIFI_PASSWORD ""
+
+const uint8_t NATIVE_SERVER_SEED[32] = {
+    0xf3, 0xc0, 0x2b, 0x73, 0xdb, 0xf8, 0x79, 0x4b, 0xf1, 0xa3, 0xe7,
+    0x8b, 0x92, 0xaf, 0x2e, 0x86, 0x3b, 0x3b, 0xd5, 0xe1, 0x17, 0x09,
+    0xca, 0x99, 0x46, 0x7d, 0x82, 0xc6, 0xa2, 0xe2, 0x30, 0x7c};
+
+const uint8_t ed_server_pub[32] = {
+    0xcd, 0xe8, 0x7a, 0xed, 0x9e, 0xbf, 0x03, 0x6f, 0x2a, 0x8b, 0x2e,
+    0x5e, 0xea, 0xe6, 0x30, 0x38, 0xae, 0xb8, 0xff, 0xef, 0x44, 0xa5,
+    0x66, 0xb4, 0x5b, 0x92, 0x3a, 0x21, 0xf3, 0x6f, 0x46, 0xd5};
@@ -0,0 +1,174 @@
+#include "prnu.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CODE_ZERO 0U
+#define CODE_POS 1U
+#define CODE_NEG 3U
+
+static_assert(PRNU_ZERO_LEVEL >= 1, "量化比较按 |残差| >= 阈值化简，阈值须为正");
+
+static uint16_t crop(uint16_t n, uint16_t max) { return n < max ? n : max; }
+
+/**
+ * @brief 图像为 width x height 时描述子的字节数（中心裁剪后每像素 2 bit）
+ */
+size_t prnu_descriptor_size(uint16_t width, uint16_t height) {
+  size_t pixels = (size_t)crop(width, PRNU_MAX_WIDTH) *
+                  crop(height, PRNU_MAX_HEIGHT);
+  return PRNU_HEADER + (pixels + 3) / 4;
+}
+
+/**
+ * @brief 计算噪声残差描述子
+ *
+ * @param gray 8 bit 灰度图像，行优先
+ * @param width 图像宽度，至少 3
+ * @param height 图像高度，至少 3
+ * @param out 传出参数，描述子
+ * @param out_len out 的大小，至少 prnu_descriptor_size(width, height)
+ * @return int 描述子字节数，失败为 -1
+ *
+ * @details 3x3 局部 Wiener 滤波：x 的局部均值为 mu、方差为 var，去噪结果为
+ * mu + max(var - v, 0) / max(var, v) * (x - mu)，残差即
+ * (x - mu) * v / max(var, v)，v 为 PRNU_NOISE_VAR。纹理区域的残差被按方差
+ * 压低，平坦区域保留传感器噪声。全部用整数计算：令 S、Q 为窗口内的和与平方和，
+ * 则 9(x - mu) = 9x - S，81 var = 9Q - S^2。残差按 PRNU_ZERO_LEVEL 三值量化
+ * （+1 / 0 / -1），每像素 2 bit，MSB 在前。
+ *
+ * 量化只需要比较，不需要残差本身：trunc(d * 81v / den) >= 9z 等价于
+ * |d| * 81v >= 9z * den，逐像素只有 32 位乘法与比较，没有除法（Xtensa 上的
+ * 64 位除法是 __divdi3 库调用）。各量的范围：|d| <= 2295，den < 2^21，
+ * 9z * den < 2^25。没有 PIE 向量版本：PIE 的乘法按 8 / 16 位通道输出，完整的
+ * 32 位乘积只能进 QACC 累加器，而这里每像素都要与 21~25 位的乘积逐个比较。
+ */
+int prnu_descriptor(const uint8_t *gray, uint16_t width, uint16_t height,
+                    uint8_t *out, size_t out_len) {
+  if (width < 3 || height < 3 || out_len < prnu_descriptor_size(width, height)) {
+    return -1;
+  }
+  uint16_t cw = crop(width, PRNU_MAX_WIDTH);
+  uint16_t ch = crop(height, PRNU_MAX_HEIGHT);
+  uint16_t x0 = (width - cw) / 2;
+  uint16_t y0 = (height - ch) / 2;
+
+  // 每列三行的和与平方和，左右各多一列用于边界
+  uint32_t *col_s = (uint32_t *)malloc((cw + 2) * sizeof(uint32_t) * 2);
+  if (col_s == NULL) {
+    return -1;
+  }
+  uint32_t *col_q = col_s + cw + 2;
+
+  out[0] = PRNU_MAGIC;
+  out[1] = PRNU_VERSION;
+  out[2] = cw >> 8;
+  out[3] = cw & 0xff;
+  out[4] = ch >> 8;
+  out[5] = ch & 0xff;
+  uint8_t *bits = out + PRNU_HEADER;
+  memset(bits, 0, (cw * ch + 3) / 4);
+
+  const int32_t n81 = 81 * PRNU_NOISE_VAR;
+  const int32_t zero9 = 9 * PRNU_ZERO_LEVEL;
+  size_t idx = 0;
+  for (uint16_t y = y0; y < y0 + ch; ++y) {
+    // 超出图像的行与列按边界像素复制
+    const uint8_t *rows[3] = {
+        gray + (size_t)(y > 0 ? y - 1 : 0) * width,
+        gray + (size_t)y * width,
+        gray + (size_t)(y + 1 < height ? y + 1 : y) * width,
+    };
+    for (int i = 0; i < cw + 2; ++i) {
+      int x = x0 + i - 1;
+      x = x < 0 ? 0 : x >= width ? width - 1 : x;
+      uint32_t a = rows[0][x], b = rows[1][x], c = rows[2][x];
+      col_s[i] = a + b + c;
+      col_q[i] = a * a + b * b + c * c;
+    }
+    const uint8_t *row = rows[1] + x0;
+    for (uint16_t i = 0; i < cw; ++i) {
+      int32_t s = col_s[i] + col_s[i + 1] + col_s[i + 2];
+      int32_t q = col_q[i] + col_q[i + 1] + col_q[i + 2];
+      int32_t d = 9 * (int32_t)row[i] - s; // 9(x - mu)
+      int32_t v81 = 9 * q - s * s;         // 81 var
+      int32_t den = v81 > n81 ? v81 : n81;
+      // |9 倍残差| = |d| * n81 / den >= zero9，不做除法
+      int32_t mag = d < 0 ? -d : d;
+      uint32_t code = mag * n81 < zero9 * den ? CODE_ZERO
+                      : d > 0                 ? CODE_POS
+                                              : CODE_NEG;
+      bits[idx >> 2] |= code << (6 - 2 * (idx & 3));
+      ++idx;
+    }
+  }
+  free(col_s);
+  return (int)prnu_descriptor_size(width, height);
+}
+
+/**
+ * @brief 检查描述子格式并取出尺寸
+ * @return int 0 表示成功， -1 表示格式错误
+ */
+int prnu_parse(const uint8_t *desc, size_t len, uint16_t *width,
+               uint16_t *height) {
+  if (len < PRNU_HEADER || desc[0] != PRNU_MAGIC || desc[1] != PRNU_VERSION) {
+    return -1;
+  }
+  uint16_t w = desc[2] << 8 | desc[3];
+  uint16_t h = desc[4] << 8 | desc[5];
+  if (w == 0 || h == 0 || w > PRNU_MAX_WIDTH || h > PRNU_MAX_HEIGHT ||
+      len != PRNU_HEADER + ((size_t)w * h + 3) / 4) {
+    return -1;
+  }
+  *width = w;
+  *height = h;
+  return 0;
+}
+
+static int code_value(uint8_t bits, int k) {
+  uint32_t code = (bits >> (6 - 2 * k)) & 3;
+  return code == CODE_POS ? 1 : code == CODE_NEG ? -1 : 0;
+}
+
+/**
+ * @brief 两个描述子的归一化相关系数
+ *
+ * @return int 相关系数的千分数（-1000 ~ 1000），尺寸不同或格式错误时为
+ * INT32_MIN
+ */
+int prnu_match(const uint8_t *a, size_t a_len, const uint8_t *b,
+               size_t b_len) {
+  uint16_t aw, ah, bw, bh;
+  if (prnu_parse(a, a_len, &aw, &ah) < 0 || prnu_parse(b, b_len, &bw, &bh) < 0 ||
+      aw != bw || ah != bh) {
+    return INT32_MIN;
+  }
+  int64_t ab = 0, aa = 0, bb = 0;
+  size_t pixels = (size_t)aw * ah;
+  for (size_t i = 0; i < pixels; ++i) {
+    int va = code_value(a[PRNU_HEADER + (i >> 2)], i & 3);
+    int vb = code_value(b[PRNU_HEADER + (i >> 2)], i & 3);
+    ab += va * vb;
+    aa += va * va;
+    bb += vb * vb;
+  }
+  if (aa == 0 || bb == 0) {
+    return 0;
+  }
+  // ab / sqrt(aa * bb)，整数开方
+  uint64_t prod = (uint64_t)aa * (uint64_t)bb;
+  uint64_t root = 0, bit = (uint64_t)1 << 62;
+  while (bit > prod) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (prod >= root + bit) {
+      prod -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (int)(ab * 1000 / (int64_t)root);
+}
@@ -0,0 +1,22 @@
+#pragma once
+// 传感器噪声（PRNU）残差指纹：设备端与主机端共用同一份定点实现，
+// 两端对同一幅灰度图像得到逐字节相同的描述子
+#include <stddef.h>
+#include <stdint.h>
+
+#define PRNU_MAGIC 0x50U   // 'P'
+#define PRNU_VERSION 1U
+#define PRNU_HEADER 6U     // magic || version || width_be16 || height_be16
+#define PRNU_MAX_WIDTH 192U  // 只取图像中心区域，描述子不超过几 KB
+#define PRNU_MAX_HEIGHT 144U
+#define PRNU_NOISE_VAR 9U    // Wiener 滤波假定的噪声方差（灰度级的平方）
+#define PRNU_ZERO_LEVEL 1U   // |残差| 低于该值（灰度级）量化为 0
+#define PRNU_DESCRIPTOR_MAX                                                    \
+  (PRNU_HEADER + (PRNU_MAX_WIDTH * PRNU_MAX_HEIGHT + 3) / 4)
+
+size_t prnu_descriptor_size(uint16_t width, uint16_t height);
+int prnu_descriptor(const uint8_t *gray, uint16_t width, uint16_t height,
+                    uint8_t *out, size_t out_len);
+int prnu_parse(const uint8_t *desc, size_t len, uint16_t *width,
+               uint16_t *height);
+int prnu_match(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len);
@@ -0,0 +1,427 @@
+// native 环境下的 mtlsp 设备群负载生成器：在一台 Linux 主机上模拟大量设备
+// 同时连接。每个设备走完整握手（HandshakeStateMachine，即 handshake_client
+// 的非阻塞内核），随后按思考时间发送加密记录；按阶段统计延迟分位数与失败原因。
+// 默认连接进程内的 EpollServer（127.0.0.1，随机端口），不需要网络
+// 运行：pio run -e native_loadgen -t exec
+//       或 .pio/build/native_loadgen/program -n 2000 -r 500 -f 51200 -m 10 -k 100
+#include "SocketClient.h"
+#include "esp_timer.h"
+#include "mtlsp_epoll.h"
+#include "mtlsp_handshake.h"
+#include "mtlsp_session.h"
+#include "mtlsp_trace.h"
+#include "secret.h"
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace mtlsp;
+
+#define LOAD_POLL_MS 10 // 没有到期工作时最多等待的时间
+
+struct LoadOptions {
+  uint32_t devices;
+  uint32_t threads;
+  double rate;              // 每秒到达的设备数（泊松到达），0 表示同时到达
+  uint32_t fingerprint_len; // 随机指纹的长度
+  const char *corpus;       // 录制的 JPEG 目录，设备轮流使用其中的文件
+  uint32_t think_ms;        // 握手后、记录之间的思考时间
+  uint32_t records;         // 握手后每个设备发送的记录数
+  uint32_t record_len;
+  const char *host;         // nullptr 表示进程内的 EpollServer
+  uint16_t port;
+  uint32_t server_loops;
+  uint32_t server_workers;
+  uint32_t seed;
+};
+
+/// 统计项：握手各阶段沿用 TracePhase，其后是负载生成器自己的两项
+enum LoadStat : uint8_t {
+  STAT_RECORD = PHASE_COUNT, // 一条记录的 seal_send
+  STAT_DEVICE,               // 到达到最后一条记录发出
+  STAT_COUNT,
+};
+
+static LatencyHistogram hist[STAT_COUNT];
+static std::mutex failure_lock;
+static std::map<std::string, uint32_t> failures;
+static std::atomic<uint32_t> succeeded(0), failed(0);
+static std::atomic<uint64_t> records_sent(0);
+
+/// 握手各阶段的耗时由 mtlsp_trace 上报
+static void on_trace(TracePhase phase, uint32_t us, void *) {
+  hist[phase].record(us);
+}
+
+static void count_failure(const char *reason) {
+  failed++;
+  std::lock_guard<std::mutex> guard(failure_lock);
+  failures[reason]++;
+}
+
+/// 一个模拟设备
+struct Device {
+  enum State : uint8_t { PENDING, HANDSHAKE, THINK, DONE };
+
+  State st = PENDING;
+  int64_t arrive_us = 0;
+  int64_t due_us = 0;
+  uint32_t records_left = 0;
+  const std::vector<uint8_t> *fingerprint = nullptr;
+  SocketClient client;
+  std::unique_ptr<HandshakeStateMachine> hs;
+  std::unique_ptr<Session> session;
+};
+
+/**
+ * @brief 设备结束：释放连接与状态机，成功时记录端到端耗时
+ */
+static void finish(Device &d, const char *reason) {
+  if (reason) {
+    count_failure(reason);
+  } else {
+    succeeded++;
+    hist[STAT_DEVICE].record(esp_timer_get_time() - d.arrive_us);
+  }
+  d.session.reset();
+  d.hs.reset();
+  d.client.stop();
+  d.st = Device::DONE;
+}
+
+/**
+ * @brief 到达：建立 TCP 连接并发出 hello
+ */
+static void arrive(Device &d, const LoadOptions &opt) {
+  int64_t start = esp_timer_get_time();
+  if (!d.client.connect(opt.host, opt.port)) {
+    finish(d, "connect failed");
+    return;
+  }
+  trace_record(PHASE_CONNECT, esp_timer_get_time() - start);
+  d.hs.reset(new HandshakeStateMachine(d.client));
+  if (d.hs->begin_full(d.fingerprint->data(), d.fingerprint->size()) < 0) {
+    finish(d, d.hs->failure() ? d.hs->failure() : "begin_full failed");
+    return;
+  }
+  d.st = Device::HANDSHAKE;
+}
+
+static void handshake_done(Device &d, int ret, const LoadOptions &opt) {
+  if (ret != 0) {
+    finish(d, ret == 1 ? "server requested fallback"
+              : d.hs->failure() ? d.hs->failure()
+                                : "handshake failed");
+    return;
+  }
+  if (opt.records == 0) {
+    finish(d, nullptr);
+    return;
+  }
+  uint8_t master_secret[BYTE256b];
+  d.hs->master_secret(master_secret);
+  d.hs.reset(); // 握手缓冲区只在握手期间占用
+  d.session.reset(new Session(d.client, master_secret));
+  sodium_memzero(master_secret, sizeof(master_secret));
+  d.records_left = opt.records;
+  d.due_us = esp_timer_get_time() + (int64_t)opt.think_ms * 1000;
+  d.st = Device::THINK;
+}
+
+static void send_record(Device &d, const std::vector<uint8_t> &payload,
+                        const LoadOptions &opt) {
+  int64_t start = esp_timer_get_time();
+  if (d.session->seal_send(payload.data(), payload.size()) < 0) {
+    finish(d, "record send failed");
+    return;
+  }
+  int64_t now = esp_timer_get_time();
+  hist[STAT_RECORD].record(now - start);
+  records_sent++;
+  if (--d.records_left == 0) {
+    finish(d, nullptr);
+    return;
+  }
+  d.due_us = now + (int64_t)opt.think_ms * 1000;
+}
+
+/**
+ * @brief 一个线程驱动一组设备：到期的设备推进一步，都在等待时阻塞在 poll 上
+ */
+static void drive(std::vector<Device *> devices, const LoadOptions &opt,
+                  const std::vector<uint8_t> &payload) {
+  size_t remaining = devices.size();
+  std::vector<pollfd> waiting;
+  while (remaining > 0) {
+    int64_t now = esp_timer_get_time();
+    int64_t next_due = now + LOAD_POLL_MS * 1000;
+    bool progressed = false;
+    waiting.clear();
+    for (Device *d : devices) {
+      switch (d->st) {
+      case Device::PENDING:
+        if (now < d->arrive_us) {
+          next_due = std::min(next_due, d->arrive_us);
+          continue;
+        }
+        arrive(*d, opt);
+        break;
+      case Device::HANDSHAKE: {
+        int ret = d->hs->poll();
+        if (ret == HS_PENDING) {
+          if (!d->hs->waiting()) {
+            progressed = true; // 还有指纹分块要发送
+          } else {
+            waiting.push_back({d->client.fd(), POLLIN, 0});
+          }
+          continue;
+        }
+        handshake_done(*d, ret, opt);
+        break;
+      }
+      case Device::THINK:
+        if (now < d->due_us) {
+          next_due = std::min(next_due, d->due_us);
+          continue;
+        }
+        send_record(*d, payload, opt);
+        break;
+      case Device::DONE:
+        continue;
+      }
+      progressed = true;
+      if (d->st == Device::DONE) {
+        --remaining;
+      }
+    }
+    if (!progressed && remaining > 0) {
+      int64_t wait_us = std::max<int64_t>(0, next_due - esp_timer_get_time());
+      ::poll(waiting.data(), waiting.size(), (int)((wait_us + 999) / 1000));
+    }
+  }
+}
+
+/**
+ * @brief 读取目录中的 .jpg / .jpeg 文件
+ * @return int 读到的文件数，-1 表示目录无法打开
+ */
+static int load_corpus(const char *dir,
+                       std::vector<std::vector<uint8_t>> &out) {
+  DIR *d = opendir(dir);
+  if (d == nullptr) {
+    return -1;
+  }
+  while (dirent *e = readdir(d)) {
+    std::string name = e->d_name;
+    size_t dot = name.rfind('.');
+    std::string ext = dot == std::string::npos ? "" : name.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (ext != ".jpg" && ext != ".jpeg") {
+      continue;
+    }
+    std::ifstream in(std::string(dir) + "/" + name, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)),
+                              std::istreambuf_iterator<char>());
+    if (!data.empty()) {
+      out.push_back(std::move(data));
+    }
+  }
+  closedir(d);
+  return (int)out.size();
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-n devices] [-t threads] [-r arrivals/s] [-f bytes | -c "
+          "jpeg_dir]\n"
+          "          [-k think_ms] [-m records] [-s record_bytes] [-a "
+          "ip:port]\n"
+          "          [-l server_loops] [-w server_workers] [-S seed]\n",
+          prog);
+}
+
+static void print_row(const char *name, const LatencyHistogram &h) {
+  if (h.count() == 0) {
+    return;
+  }
+  printf("%-13s %8llu %10llu %10llu %10llu\n", name,
+         (unsigned long long)h.count(), (unsigned long long)h.percentile(0.5),
+         (unsigned long long)h.percentile(0.99),
+         (unsigned long long)h.percentile(0.999));
+}
+
+int main(int argc, char **argv) {
+  LoadOptions opt;
+  opt.devices = 200;
+  opt.threads = std::max(1U, std::thread::hardware_concurrency());
+  opt.rate = 0;
+  opt.fingerprint_len = 50 * 1024;
+  opt.corpus = nullptr;
+  opt.think_ms = 0;
+  opt.records = 0;
+  opt.record_len = 512;
+  opt.host = nullptr;
+  opt.port = 0;
+  opt.server_loops = 0;
+  opt.server_workers = 0;
+  opt.seed = 1;
+
+  std::string target;
+  int c;
+  while ((c = getopt(argc, argv, "n:t:r:f:c:k:m:s:a:l:w:S:h")) != -1) {
+    switch (c) {
+    case 'n': opt.devices = atoi(optarg); break;
+    case 't': opt.threads = std::max(1, atoi(optarg)); break;
+    case 'r': opt.rate = atof(optarg); break;
+    case 'f': opt.fingerprint_len = atoi(optarg); break;
+    case 'c': opt.corpus = optarg; break;
+    case 'k': opt.think_ms = atoi(optarg); break;
+    case 'm': opt.records = atoi(optarg); break;
+    case 's': opt.record_len = std::min<uint32_t>(atoi(optarg), RECORD_MAX); break;
+    case 'a': target = optarg; break;
+    case 'l': opt.server_loops = atoi(optarg); break;
+    case 'w': opt.server_workers = atoi(optarg); break;
+    case 'S': opt.seed = atoi(optarg); break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  Serial.mute(true);
+  trace_init();
+
+  std::vector<std::vector<uint8_t>> fingerprints;
+  if (opt.corpus) {
+    if (load_corpus(opt.corpus, fingerprints) <= 0) {
+      fprintf(stderr, "no .jpg files in %s\n", opt.corpus);
+      return 2;
+    }
+  } else {
+    fingerprints.emplace_back(opt.fingerprint_len);
+    esp_fill_random(fingerprints[0].data(), opt.fingerprint_len);
+  }
+  size_t fingerprint_max = 0;
+  for (const std::vector<uint8_t> &fp : fingerprints) {
+    fingerprint_max = std::max(fingerprint_max, fp.size());
+  }
+  std::vector<uint8_t> payload(opt.record_len);
+  esp_fill_random(payload.data(), payload.size());
+
+  // 服务器：默认在本进程内监听回环地址，也可以指向外部的 server_mtlsp
+  static ServerContext ctx;
+  std::unique_ptr<EpollServer> server;
+  std::string host = "127.0.0.1";
+  if (!target.empty()) {
+    size_t colon = target.rfind(':');
+    if (colon == std::string::npos) {
+      usage(argv[0]);
+      return 2;
+    }
+    host = target.substr(0, colon);
+    opt.port = atoi(target.c_str() + colon + 1);
+  } else {
+    if (server_context_init(ctx, NATIVE_SERVER_SEED) < 0) {
+      fprintf(stderr, "server_context_init failed\n");
+      return 1;
+    }
+    EpollServerOptions so = EpollServer::default_options();
+    so.port = 0;
+    so.loops = opt.server_loops;
+    so.workers = opt.server_workers;
+    so.max_connections = std::max(so.max_connections, opt.devices);
+    so.fingerprint_max = std::max<size_t>(so.fingerprint_max, fingerprint_max);
+    server.reset(new EpollServer(ctx, so));
+    if (server->start() < 0) {
+      perror("server start");
+      return 1;
+    }
+    opt.port = server->port();
+  }
+  opt.host = host.c_str();
+
+  trace_reset();
+  trace_set_sink(on_trace, nullptr);
+
+  // 到达时刻：泊松过程，设备轮流分给各线程
+  std::mt19937 rng(opt.seed);
+  std::exponential_distribution<double> gap(opt.rate > 0 ? opt.rate : 1);
+  std::vector<std::unique_ptr<Device>> devices;
+  std::vector<std::vector<Device *>> groups(opt.threads);
+  int64_t start = esp_timer_get_time();
+  double offset_s = 0;
+  for (uint32_t i = 0; i < opt.devices; ++i) {
+    devices.emplace_back(new Device);
+    Device *d = devices.back().get();
+    d->arrive_us = start + (int64_t)(offset_s * 1e6);
+    d->fingerprint = &fingerprints[i % fingerprints.size()];
+    groups[i % opt.threads].push_back(d);
+    if (opt.rate > 0) {
+      offset_s += gap(rng);
+    }
+  }
+
+  std::vector<std::thread> threads;
+  for (std::vector<Device *> &group : groups) {
+    threads.emplace_back(drive, group, std::cref(opt), std::cref(payload));
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  double elapsed_s = (esp_timer_get_time() - start) / 1e6;
+  trace_set_sink(nullptr, nullptr);
+
+  printf("devices %u  threads %u  arrival %s  fingerprint %zu B x %zu  "
+         "records %u x %u B  think %u ms\n",
+         opt.devices, opt.threads, opt.rate > 0 ? "poisson" : "burst",
+         fingerprint_max, fingerprints.size(), opt.records, opt.record_len,
+         opt.think_ms);
+  if (opt.rate > 0) {
+    printf("arrival rate %.1f/s\n", opt.rate);
+  }
+  printf("target %s:%u%s\n", opt.host, opt.port, server ? " (in-process)" : "");
+  printf("elapsed %.2f s  ok %u  failed %u  %.1f handshakes/s  records %llu "
+         "(%.2f MB/s)\n\n",
+         elapsed_s, succeeded.load(), failed.load(),
+         succeeded / elapsed_s, (unsigned long long)records_sent.load(),
+         records_sent * opt.record_len / elapsed_s / 1e6);
+
+  printf("%-13s %8s %10s %10s %10s\n", "phase", "n", "p50_us", "p99_us",
+         "p999_us");
+  for (uint8_t i = 0; i < PHASE_COUNT; ++i) {
+    print_row(trace_phase_name((TracePhase)i), hist[i]);
+  }
+  print_row("record", hist[STAT_RECORD]);
+  print_row("device", hist[STAT_DEVICE]);
+
+  if (!failures.empty()) {
+    printf("\nfailures\n");
+    for (const auto &f : failures) {
+      printf("  %-40s %8u\n", f.first.c_str(), f.second);
+    }
+  }
+  if (server) {
+    EpollServerStats stats;
+    server->stats(stats);
+    printf("\nserver: accepted %llu  completed %llu  failed %llu  timeouts "
+           "%llu  refused %llu  p50 %llu us  p99 %llu us  p999 %llu us\n",
+           (unsigned long long)stats.accepted,
+           (unsigned long long)stats.completed,
+           (unsigned long long)stats.failed,
+           (unsigned long long)stats.timeouts,
+           (unsigned long long)stats.refused,
+           (unsigned long long)server->latency().percentile(0.5),
+           (unsigned long long)server->latency().percentile(0.99),
+           (unsigned long long)server->latency().percentile(0.999));
+    server->stop();
+  }
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+// native 环境下的 mtlsp 参考服务器：每个核一个 epoll 事件循环，密码学运算
+// 交给线程池，每秒打印握手速率与延迟分位数
+// 运行：pio run -e native_server -t exec
+//       或 .pio/build/native_server/program [端口] [事件循环数] [工作线程数]
+#include "mtlsp_epoll.h"
+#include "mtlsp_trace.h"
+#include "secret.h"
+#include <csignal>
+#include <cstdlib>
+#include <thread>
+
+using namespace mtlsp;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+int main(int argc, char **argv) {
+  Serial.mute(true);
+  trace_init();
+  ServerContext ctx;
+  if (server_context_init(ctx, NATIVE_SERVER_SEED) < 0) {
+    fprintf(stderr, "server_context_init failed\n");
+    return 1;
+  }
+
+  EpollServerOptions opt = EpollServer::default_options();
+  opt.port = argc > 1 ? atoi(argv[1]) : SERVER_PORT;
+  opt.loops = argc > 2 ? atoi(argv[2]) : 0;
+  opt.workers = argc > 3 ? atoi(argv[3]) : 0;
+  EpollServer server(ctx, opt);
+  if (server.start() < 0) {
+    perror("start");
+    return 1;
+  }
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  printf("listening on %d\n", server.port());
+  printf("%8s %8s %8s %8s %8s %10s %10s %10s\n", "hs/s", "total", "resumed",
+         "failed", "active", "p50(us)", "p99(us)", "p999(us)");
+
+  EpollServerStats last;
+  server.stats(last);
+  while (!stop_requested) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    EpollServerStats now;
+    server.stats(now);
+    const LatencyHistogram &lat = server.latency();
+    printf("%8llu %8llu %8llu %8llu %8llu %10llu %10llu %10llu\n",
+           (unsigned long long)(now.completed - last.completed),
+           (unsigned long long)now.completed,
+           (unsigned long long)now.resumed, (unsigned long long)now.failed,
+           (unsigned long long)now.active,
+           (unsigned long long)lat.percentile(0.5),
+           (unsigned long long)lat.percentile(0.99),
+           (unsigned long long)lat.percentile(0.999));
+    fflush(stdout);
+    last = now;
+  }
+  server.stop();
+  return 0;
+}
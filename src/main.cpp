@@ -1,53 +1,287 @@
 #include "camera.h"
+#include "bitrate.h"
+#include "boot_timeline.h"
+#include "capture.h"
 #include "esp_camera.h"
+#include "fast_wifi.h"
+#include "fingerprint.h"
+#include "motion.h"
 #include "mtlsp.h"
+#include "mtlsp_memory.h"
+#include "mtlsp_precompute.h"
+#include "mtlsp_session.h"
+#include "mtlsp_ticket.h"
+#include "mtlsp_trace.h"
 #include "secret.h"
 #include "xl9555.h"
 #include <Arduino.h>
 #include <WiFi.h>
 
 
+#define WIFI_CONNECT_TIMEOUT_MS 20000U
+#define MEMORY_REPORT_INTERVAL_MS 60000U // 推流期间打印堆高水位与栈余量的间隔
+
 void log_memory_init();
+int send_frame(camera_fb_t *fb, void *arg);
+void camera_bringup();
+void camera_task(void *arg);
+bool wait_camera();
+bool session_ok();
+
+WiFiClient client;
+mtlsp::Session *session = nullptr; // 握手成功后的加密会话
+SemaphoreHandle_t session_lock = nullptr; // cap_consume 发送与 loop 接收共用 session
+mtlsp::TicketStore *tickets = nullptr; // 会话恢复票据，保存在 NVS 中
+uint8_t record[RECORD_MAX];
+uint8_t residual[PRNU_DESCRIPTOR_MAX]; // 噪声残差指纹，server 支持时代替 JPEG 上传
+CapturePipeline pipeline(send_frame, nullptr, CAMERA_FB_COUNT - 1);
+BitrateController bitrate(pipeline);
+MotionGate motion; // 静止画面只按关键帧间隔发送
+FastWifi wifi(WIFI_SSID, WIFI_PASSWORD); // 缓存 BSSID、信道与租约，重启后跳过扫描与 DHCP
+SemaphoreHandle_t camera_done = nullptr;  // 并行初始化摄像头完成
+bool camera_ready = false;
+uint32_t memory_reported_ms = 0;
 
 void setup() {
   Serial.begin(115200);
   log_memory_init();
+  mtlsp::trace_init(); // 统计锁须在任何任务记录之前创建
+  mtlsp::precompute_init(); // 连接 WiFi 期间在 0 号核上预生成握手材料
 
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  Serial.print("Wifi connecting");
-
-  while (WiFi.status() != WL_CONNECTED) { // 等待拿到 IP
-    Serial.print('.');
-    delay(500);
+  int stage = boot_timeline.begin("wifi");
+  bool cached = wifi.begin() == 0;
+  // 关联与 DHCP 期间在 1 号核上给扩展芯片与摄像头上电、复位并初始化驱动
+  camera_done = xSemaphoreCreateBinary();
+  if (camera_done == nullptr ||
+      xTaskCreatePinnedToCore(camera_task, "cam_init", 8192, nullptr,
+                              tskIDLE_PRIORITY + 1, nullptr, 1) != pdPASS) {
+    camera_bringup(); // 建不了任务就顺序初始化
+  }
+  if (wifi.wait(WIFI_CONNECT_TIMEOUT_MS) < 0) {
+    boot_timeline.end(stage);
+    Serial.println("WiFi connect timeout");
+    return;
   }
-  Serial.println("\nWiFi connected, IP: " + WiFi.localIP().toString());
+  boot_timeline.end(stage);
+  wifi.save();
+  Serial.printf("WiFi connected (%s), IP: %s\n",
+                wifi.fast() ? "fast" : (cached ? "cache stale" : "scan"),
+                WiFi.localIP().toString().c_str());
 
-  WiFiClient client;
+  stage = boot_timeline.begin("connect");
+  TRACE_BEGIN(t_connect);
   if (!client.connect(SERVER_IP, SERVER_PORT)) {
     Serial.println("Failed to reach server");
+    wifi.forget(); // 缓存的地址可能已与别的主机冲突，下次启动重新扫描与 DHCP
     return;
   }
+  TRACE_END(mtlsp::PHASE_CONNECT, t_connect);
+  boot_timeline.end(stage);
+  client.setNoDelay(true); // 帧已在发送端合并，关闭 Nagle 只减少等待
+
+  uint8_t master_secret[32];
+
+  // 优先用票据恢复会话，被拒绝时在同一连接上快速握手，不支持时再完整握手
+  tickets = new mtlsp::TicketStore(true);
+  stage = boot_timeline.begin("resume");
+  int ret = mtlsp::resume_client(master_secret, client, *tickets);
+  boot_timeline.end(stage);
+  if (ret == 1 && wait_camera()) {
+    stage = boot_timeline.begin("fingerprint");
+    camera_fb_t *fb = esp_camera_fb_get();
+    Serial.printf("fb size: %d\n", fb->len);
+    // 多帧平均后的残差更稳定，减少因指纹噪声导致的认证失败与重新握手
+    AccumulateStats acc_stats;
+    int residual_len =
+        accumulate_fingerprint(FP_ACCUMULATE_FRAMES, FRAMESIZE_QCIF, residual,
+                               sizeof(residual), &acc_stats);
+    if (residual_len < 0) {
+      residual_len = 0; // 只上传 JPEG
+    }
+    Serial.printf("residual size: %d, %u frames in %u us (grab %u, decode %u)\n",
+                  residual_len, acc_stats.frames, acc_stats.total_us,
+                  acc_stats.grab_us, acc_stats.decode_us);
+    boot_timeline.end(stage);
+
+    stage = boot_timeline.begin("handshake");
+    ret = mtlsp::handshake_client_fast(master_secret, client, fb->buf,
+                                       fb->len, tickets, residual,
+                                       residual_len);
+    if (ret == 1) {
+      ret = mtlsp::handshake_client(master_secret, client, fb->buf, fb->len,
+                                    tickets, residual, residual_len);
+    }
+    // mtlsp::handshake_client(master_secret, client, monk_pic, sizeof(monk_pic));
+    esp_camera_fb_return(fb);
+    boot_timeline.end(stage);
+  }
+  if (ret == 0 && (session_lock = xSemaphoreCreateMutex()) == nullptr) {
+    Serial.println("Failed to create session lock");
+    ret = -1;
+  }
+  if (ret == 0) {
+    session = new mtlsp::Session(client, master_secret);
+
+    // 按本机实测吞吐量从高到低提出 AEAD 后端
+    uint8_t offer[AEAD_BACKEND_COUNT];
+    size_t offer_len = aead_rank(offer, sizeof(offer), RECORD_MAX);
+    if (session->negotiate(offer, offer_len) == 0) {
+      Serial.printf("record aead: %s\n", aead_name(session->aead_id()));
+    }
+
+    // 0 号核取帧，1 号核加密发送
+    if (!wait_camera()) {
+      Serial.println("Camera not ready");
+      return;
+    }
+    stage = boot_timeline.begin("stream");
+    // 握手用的缓冲区不够大时才重新分配；重新初始化失败后摄像头不可用，重启恢复
+    if (camera_set_profile(CAMERA_PROFILE_STREAM) != 0) {
+      Serial.println("Camera stream profile failed, restarting");
+      Serial.flush();
+      ESP.restart();
+    }
+    camera_timing_t cam;
+    camera_get_timing(&cam);
+    Serial.printf("camera init %u us (ready %u us), stream switch %u us%s\n",
+                  cam.init_us, cam.ready_us, cam.switch_us,
+                  cam.reallocated ? " (reallocated)" : "");
+    bitrate.apply();
+    pipeline.set_max_age(BITRATE_LATENCY_MAX_US); // 拥塞时丢弃旧帧，延迟不再累积
+    if (pipeline.start(0, 1) < 0) {
+      Serial.println("Failed to start capture pipeline");
+    } else {
+      mtlsp::memory_watch_task(pipeline.grab_task(), "cap_grab");
+      mtlsp::memory_watch_task(pipeline.consume_task(), "cap_consume");
+    }
+    boot_timeline.end(stage);
+  }
+  sodium_memzero(master_secret, sizeof(master_secret));
+  mtlsp::trace_print(Serial); // 各握手阶段耗时
+  boot_timeline.print(Serial); // 上电到开始推流的各阶段时间线
+  mtlsp::memory_print(Serial);
+}
 
+/**
+ * @brief 扩展芯片与摄像头初始化，完成后释放 camera_done
+ */
+void camera_bringup() {
+  int stage = boot_timeline.begin("camera");
   xl9555_init();
-  camera_init();
-  camera_fb_t *fb = esp_camera_fb_get();
-  Serial.printf("fb size: %d\n", fb->len);
+  if (i2c_bus_running(xl9555_bus())) {
+    mtlsp::memory_watch_task(xl9555_bus()->task, "i2c_bus");
+  }
+  camera_ready = camera_init() == 0;
+  boot_timeline.end(stage);
+  if (camera_done != nullptr) {
+    xSemaphoreGive(camera_done);
+  }
+}
 
-  uint8_t master_secret[32];
+/**
+ * @brief 与 WiFi 连接并行运行的初始化任务
+ */
+void camera_task(void *arg) {
+  camera_bringup();
+  vTaskDelete(nullptr);
+}
 
-  mtlsp::handshake_client(master_secret,client,fb->buf,fb->len);
-  // mtlsp::handshake_client(master_secret, client, monk_pic, sizeof(monk_pic));
+/**
+ * @brief 等待并行初始化结束
+ *
+ * @return bool 摄像头是否可用
+ */
+bool wait_camera() {
+  if (camera_done != nullptr &&
+      xSemaphoreTake(camera_done, portMAX_DELAY) == pdTRUE) {
+    xSemaphoreGive(camera_done); // 保持置位，后续调用直接返回
+  }
+  return camera_ready;
+}
+
+/**
+ * @brief 会话是否仍可用，与 send_frame 互斥读取
+ */
+bool session_ok() {
+  if (session == nullptr) {
+    return false;
+  }
+  xSemaphoreTake(session_lock, portMAX_DELAY);
+  bool ok = session->ok();
+  xSemaphoreGive(session_lock);
+  return ok;
 }
 
 void loop() {
+  if (session && client.available()) {
+    // poll_open 只取已到达的字节，持锁期间不等待网络，cap_consume 的发送不会
+    // 被半条记录卡住；出错时会 close()，不能与 seal_send 交错
+    bool ok;
+    int len;
+    do {
+      xSemaphoreTake(session_lock, portMAX_DELAY);
+      len = session->poll_open(record, sizeof(record));
+      ok = session->ok();
+      xSemaphoreGive(session_lock);
+      if (len >= 0) {
+        Serial.printf("record received: %d bytes\n", len);
+      }
+    } while (len >= 0); // 一次读入的可能不止一条记录
+    if (ok) {
+      return;
+    }
+  }
+  if (pipeline.running() && !session_ok()) {
+    mtlsp::memory_unwatch_task(pipeline.grab_task());
+    mtlsp::memory_unwatch_task(pipeline.consume_task());
+    pipeline.stop();
+  }
   delay(1000);
+  if (pipeline.running()) {
+    CaptureStats st;
+    pipeline.stats(st);
+    const OperatingPoint &p = bitrate.point();
+    Serial.printf("frames %u sent %u dropped %u failed %u latency %u/%u us\n",
+                  st.captured, st.consumed, st.dropped, st.failed,
+                  st.latency_us, st.latency_max_us);
+    Serial.printf("level %u: framesize %d quality %u fps %u, %u B/s busy %u%%\n",
+                  bitrate.level(), p.frame_size, p.quality, p.fps,
+                  bitrate.throughput(), bitrate.busy());
+    Serial.printf("motion: sent %u (keyframes %u) suppressed %u\n",
+                  motion.passed(), motion.keyframes(), motion.suppressed());
+    if (millis() - memory_reported_ms >= MEMORY_REPORT_INTERVAL_MS) {
+      memory_reported_ms = millis();
+      mtlsp::memory_print(Serial);
+    }
+    return;
+  }
   Serial.print('.');
 }
 
+/**
+ * @brief 流水线消费者：画面有变化时把一帧 JPEG 作为记录加密发送，并把发送耗时
+ * 交给码率控制
+ */
+int send_frame(camera_fb_t *fb, void *arg) {
+  if (motion.check(fb) == 0) {
+    return 0;
+  }
+  int64_t t0 = esp_timer_get_time();
+  xSemaphoreTake(session_lock, portMAX_DELAY);
+  int ret = session->ok() ? session->seal_send(fb->buf, fb->len) : -1;
+  xSemaphoreGive(session_lock);
+  if (ret >= 0) {
+    bitrate.on_frame(fb->len, (uint32_t)(esp_timer_get_time() - t0));
+  }
+  return ret;
+}
+
+/**
+ * @brief 启动时打印内部 RAM 与 PSRAM 的容量，并登记 loop 与 IIC 总线任务的栈
+ */
 void log_memory_init() {
-  Serial.print("Available RAM size:");
-  Serial.println(heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
-  Serial.print("EEPROM size:");
+  mtlsp::memory_watch_task(nullptr, "loop");
+  mtlsp::memory_print(Serial);
+  Serial.print("Flash size:");
   Serial.println(ESP.getFlashChipSize());
 }
\ No newline at end of file
@@ -0,0 +1,755 @@
+// native 环境下的 mtlsp 回环测试：设备端与参考服务器端分别运行在两个线程，
+// 通过 socketpair 相连
+#include "SocketClient.h"
+#include "aead.h"
+#include "gray_diff.h"
+#include "mtlsp.h"
+#include "mtlsp_frame.h"
+#include "mtlsp_handshake.h"
+#include "mtlsp_epoll.h"
+#include "mtlsp_memory.h"
+#include "mtlsp_server.h"
+#include "mtlsp_session.h"
+#include "mtlsp_ticket.h"
+#include "mtlsp_trace.h"
+#include "prnu.h"
+#include <map>
+#include <sys/socket.h>
+#include <thread>
+#include <unity.h>
+#include <vector>
+
+using namespace mtlsp;
+
+#define FINGERPRINT_LEN (10 * 1024)
+
+static ServerContext server_ctx;
+static std::vector<uint8_t> fingerprint(FINGERPRINT_LEN);
+
+struct ServerResult {
+  int ret;
+  uint8_t master_secret[BYTE256b];
+  ServerHandshakeInfo info;
+  std::vector<uint8_t> fingerprint;
+};
+
+/// 在另一个线程上运行服务器端握手
+static std::thread serve(SocketClient &conn, ServerResult &result) {
+  return std::thread([&conn, &result] {
+    result.fingerprint.resize(FINGERPRINT_LEN);
+    result.ret = handshake_server(result.master_secret, conn, server_ctx,
+                                  result.fingerprint.data(), FINGERPRINT_LEN,
+                                  &result.info);
+  });
+}
+
+void setUp() {
+  server_ctx.support_fast = true;
+  server_ctx.support_resume = true;
+  server_ctx.support_residual = true;
+  server_ctx.verify_residual = nullptr;
+}
+
+void tearDown() {}
+
+void test_aes256gcm_inplace_and_stream() {
+  uint8_t key[AES_KEY_SIZE], nonce[IV_SIZE];
+  esp_fill_random(key, sizeof(key));
+  esp_fill_random(nonce, sizeof(nonce));
+  std::vector<uint8_t> buf(fingerprint.begin(), fingerprint.end());
+  buf.resize(FINGERPRINT_LEN + TAG_SIZE);
+
+  Aes256Gcm aead(key);
+  TEST_ASSERT_EQUAL(0, aead.encrypt(buf.data(), FINGERPRINT_LEN, nullptr, 0,
+                                    nonce));
+
+  // 流式解密与一次性加密的结果一致
+  std::vector<uint8_t> plain(FINGERPRINT_LEN);
+  TEST_ASSERT_EQUAL(0, aead.stream_start(MBEDTLS_GCM_DECRYPT, nonce));
+  for (size_t off = 0; off < FINGERPRINT_LEN; off += STREAM_CHUNK_SIZE) {
+    size_t n = FINGERPRINT_LEN - off < STREAM_CHUNK_SIZE
+                   ? FINGERPRINT_LEN - off
+                   : STREAM_CHUNK_SIZE;
+    TEST_ASSERT_EQUAL(0, aead.stream_update(&plain[off], &buf[off], n));
+  }
+  TEST_ASSERT_EQUAL(0, aead.stream_verify(&buf[FINGERPRINT_LEN]));
+  TEST_ASSERT_EQUAL_MEMORY(fingerprint.data(), plain.data(), FINGERPRINT_LEN);
+
+  buf[0] ^= 1;
+  TEST_ASSERT_EQUAL(-1, aead.decrypt(buf.data(), FINGERPRINT_LEN + TAG_SIZE,
+                                     nullptr, 0, nonce));
+}
+
+void test_aead_backends_roundtrip() {
+  uint8_t key[AES_KEY_SIZE], nonce[IV_SIZE] = {0};
+  esp_fill_random(key, sizeof(key));
+  for (uint8_t id = 1; id <= AEAD_BACKEND_COUNT; ++id) {
+    AeadBackend *aead = aead_create(id);
+    if (!aead) {
+      TEST_ASSERT_FALSE(aead_available(id));
+      continue;
+    }
+    uint8_t buf[64 + TAG_SIZE];
+    memcpy(buf, fingerprint.data(), 64);
+    TEST_ASSERT_EQUAL(0, aead->setkey(key));
+    TEST_ASSERT_EQUAL(0, aead->encrypt(buf, 64, nullptr, 0, nonce));
+    TEST_ASSERT_EQUAL(0, aead->decrypt(buf, sizeof(buf), nullptr, 0, nonce));
+    TEST_ASSERT_EQUAL_MEMORY(fingerprint.data(), buf, 64);
+    delete aead;
+  }
+}
+
+void test_full_handshake_and_session() {
+  SocketClient device, server;
+  TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+  ServerResult result;
+  std::thread t = serve(server, result);
+
+  uint8_t master_secret[BYTE256b];
+  int ret = handshake_client(master_secret, device, fingerprint.data(),
+                             FINGERPRINT_LEN);
+  t.join();
+  TEST_ASSERT_EQUAL(0, ret);
+  TEST_ASSERT_EQUAL(0, result.ret);
+  TEST_ASSERT_EQUAL_MEMORY(master_secret, result.master_secret, BYTE256b);
+  TEST_ASSERT_EQUAL(FINGERPRINT_LEN, result.info.fingerprint_len);
+  TEST_ASSERT_EQUAL_MEMORY(fingerprint.data(), result.fingerprint.data(),
+                           FINGERPRINT_LEN);
+
+  // 记录层：协商后端并收发一条跨多条记录的消息
+  Session dev_session(device, master_secret, true);
+  Session srv_session(server, result.master_secret, false);
+  uint8_t offer[AEAD_BACKEND_COUNT] = {AEAD_SODIUM_CHACHA20POLY1305,
+                                       AEAD_MBEDTLS_AES256GCM};
+  std::thread n([&srv_session, &offer] {
+    srv_session.negotiate_server(offer, 2);
+  });
+  TEST_ASSERT_EQUAL(0, dev_session.negotiate(offer, 2));
+  n.join();
+  TEST_ASSERT_EQUAL(AEAD_SODIUM_CHACHA20POLY1305, dev_session.aead_id());
+
+  TEST_ASSERT_EQUAL(RECORD_MAX + 100,
+                    dev_session.seal_send(fingerprint.data(), RECORD_MAX + 100));
+  std::vector<uint8_t> rx(RECORD_MAX);
+  TEST_ASSERT_EQUAL(RECORD_MAX, srv_session.recv_open(rx.data(), RECORD_MAX));
+  TEST_ASSERT_EQUAL(100, srv_session.recv_open(rx.data(), RECORD_MAX));
+  TEST_ASSERT_EQUAL_MEMORY(fingerprint.data() + RECORD_MAX, rx.data(), 100);
+
+  // 没有共同的后端时双方都关闭，服务器不会替设备选择
+  Session dev_none(device, master_secret, true);
+  Session srv_none(server, result.master_secret, false);
+  uint8_t only_chacha = AEAD_SODIUM_CHACHA20POLY1305;
+  uint8_t only_mbedtls = AEAD_MBEDTLS_AES256GCM;
+  std::thread m([&srv_none, &only_mbedtls] {
+    TEST_ASSERT_EQUAL(-1, srv_none.negotiate_server(&only_mbedtls, 1));
+  });
+  TEST_ASSERT_EQUAL(-1, dev_none.negotiate(&only_chacha, 1));
+  m.join();
+  TEST_ASSERT_FALSE(dev_none.ok());
+  TEST_ASSERT_FALSE(srv_none.ok());
+
+  AeadBenchResult bench[AEAD_BACKEND_COUNT];
+  uint32_t zero_size = 0;
+  TEST_ASSERT_EQUAL(0, aead_benchmark(bench, AEAD_BACKEND_COUNT, &zero_size,
+                                      1, 1024));
+}
+
+void test_session_rejects_replayed_record() {
+  SocketClient device, server;
+  TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+  uint8_t master_secret[BYTE256b];
+  esp_fill_random(master_secret, sizeof(master_secret));
+
+  // 截获一条记录，把它原样发送两次
+  SocketClient tap_in, tap_out;
+  TEST_ASSERT_EQUAL(0, SocketClient::pair(tap_in, tap_out));
+  Session sender(tap_in, master_secret, true);
+  Session receiver(server, master_secret, false);
+  uint8_t msg[16] = {1, 2, 3};
+  sender.seal_send(msg, sizeof(msg));
+  uint8_t record[4 + sizeof(msg) + TAG_SIZE];
+  TEST_ASSERT_EQUAL(sizeof(record), tap_out.readBytes(record, sizeof(record)));
+  // 非阻塞接收：半条记录不返回也不关闭会话
+  uint8_t rx[16];
+  device.write(record, 10);
+  TEST_ASSERT_EQUAL(-1, receiver.poll_open(rx, sizeof(rx)));
+  TEST_ASSERT_TRUE(receiver.ok());
+  device.write(record + 10, sizeof(record) - 10);
+  TEST_ASSERT_EQUAL(sizeof(msg), receiver.poll_open(rx, sizeof(rx)));
+  TEST_ASSERT_EQUAL_MEMORY(msg, rx, sizeof(msg));
+
+  device.write(record, sizeof(record));
+  TEST_ASSERT_EQUAL(-1, receiver.recv_open(rx, sizeof(rx)));
+  TEST_ASSERT_FALSE(receiver.ok());
+}
+
+void test_fast_handshake_with_ticket_then_resume() {
+  TicketStore tickets;
+  uint8_t master_secret[BYTE256b];
+  {
+    SocketClient device, server;
+    TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+    ServerResult result;
+    std::thread t = serve(server, result);
+    int ret = handshake_client_fast(master_secret, device, fingerprint.data(),
+                                    FINGERPRINT_LEN, &tickets);
+    t.join();
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_EQUAL(0, result.ret);
+    TEST_ASSERT_EQUAL(HELLO_FAST_TICKET, result.info.hello);
+    TEST_ASSERT_EQUAL_MEMORY(master_secret, result.master_secret, BYTE256b);
+    TEST_ASSERT_TRUE(tickets.has());
+  }
+
+  // 复制一份票据，用于验证重放被拒绝
+  Ticket replay;
+  TEST_ASSERT_TRUE(tickets.take(replay));
+  tickets.put(replay);
+
+  {
+    SocketClient device, server;
+    TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+    ServerResult result;
+    std::thread t = serve(server, result);
+    int ret = resume_client(master_secret, device, tickets);
+    t.join();
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_TRUE(result.info.resumed);
+    TEST_ASSERT_EQUAL_MEMORY(master_secret, result.master_secret, BYTE256b);
+    TEST_ASSERT_TRUE(tickets.has());
+  }
+
+  {
+    SocketClient device, server;
+    TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+    ServerResult result;
+    std::thread t = serve(server, result);
+    TicketStore stale;
+    stale.put(replay);
+    int ret = resume_client(master_secret, device, stale);
+    TEST_ASSERT_EQUAL(1, ret); // 服务器拒绝，同一连接回退到完整握手
+    ret = handshake_client(master_secret, device, fingerprint.data(),
+                           FINGERPRINT_LEN);
+    t.join();
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_EQUAL(0, result.ret);
+    TEST_ASSERT_FALSE(result.info.resumed);
+  }
+}
+
+void test_fast_handshake_falls_back() {
+  server_ctx.support_fast = false;
+  SocketClient device, server;
+  TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+  ServerResult result;
+  std::thread t = serve(server, result);
+
+  uint8_t master_secret[BYTE256b];
+  int ret = handshake_client_fast(master_secret, device, fingerprint.data(),
+                                  FINGERPRINT_LEN);
+  TEST_ASSERT_EQUAL(1, ret);
+  ret = handshake_client(master_secret, device, fingerprint.data(),
+                         FINGERPRINT_LEN);
+  t.join();
+  TEST_ASSERT_EQUAL(0, ret);
+  TEST_ASSERT_EQUAL_MEMORY(master_secret, result.master_secret, BYTE256b);
+}
+
+static void count_trace(TracePhase phase, uint32_t us, void *arg) {
+  static_cast<uint32_t *>(arg)[phase]++;
+}
+
+void test_trace_records_handshake_phases() {
+  trace_reset();
+  uint32_t sunk[PHASE_COUNT] = {0};
+  trace_set_sink(count_trace, sunk);
+  SocketClient device, server;
+  TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+  ServerResult result;
+  std::thread t = serve(server, result);
+
+  uint8_t master_secret[BYTE256b];
+  int ret = handshake_client(master_secret, device, fingerprint.data(),
+                             FINGERPRINT_LEN);
+  t.join();
+  trace_set_sink(nullptr, nullptr);
+  TEST_ASSERT_EQUAL(0, ret);
+
+  TraceStats stats;
+  trace_snapshot(stats);
+  for (uint8_t p = PHASE_SERVER_HELLO; p <= PHASE_TOTAL; ++p) {
+    const TraceHistogram &h = stats.phases[p];
+    TEST_ASSERT_EQUAL(1, h.count);
+    TEST_ASSERT_EQUAL(1, sunk[p]);
+    TEST_ASSERT_EQUAL(h.min_us, h.max_us);
+    uint32_t in_buckets = 0;
+    for (uint32_t b : h.buckets) {
+      in_buckets += b;
+    }
+    TEST_ASSERT_EQUAL(1, in_buckets);
+  }
+  TEST_ASSERT_EQUAL(0, stats.phases[PHASE_RESUME].count);
+  TEST_ASSERT_TRUE(stats.phases[PHASE_TOTAL].max_us >=
+                   stats.phases[PHASE_FP_ENCRYPT].max_us);
+
+  uint8_t exported[TRACE_EXPORT_SIZE];
+  TEST_ASSERT_EQUAL(0, trace_export(exported, sizeof(exported) - 1));
+  TEST_ASSERT_EQUAL(TRACE_EXPORT_SIZE, trace_export(exported, sizeof(exported)));
+  TEST_ASSERT_EQUAL(TRACE_EXPORT_VERSION, exported[0]);
+  TEST_ASSERT_EQUAL(PHASE_COUNT, exported[1]);
+  TEST_ASSERT_EQUAL(TRACE_BUCKETS, exported[2]);
+}
+
+void test_frame_reader_batches_and_limits() {
+  SocketClient device, server;
+  TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+  FrameReader reader(device, 64, 16, 50);
+
+  // 一次写入三帧，第三帧只写一半
+  uint8_t a[3] = {1, 2, 3}, b[5] = {4, 5, 6, 7, 8};
+  send(server, a, sizeof(a));
+  send(server, b, sizeof(b));
+  uint8_t half[6] = {0, 0, 0, 4, 9, 10};
+  server.write(half, sizeof(half));
+
+  uint8_t *frame;
+  TEST_ASSERT_EQUAL(3, reader.next(&frame));
+  TEST_ASSERT_EQUAL_MEMORY(a, frame, 3);
+  TEST_ASSERT_EQUAL(5, reader.poll(&frame));
+  TEST_ASSERT_EQUAL_MEMORY(b, frame, 5);
+  TEST_ASSERT_EQUAL(-1, reader.poll(&frame)); // 半帧不可取出
+  TEST_ASSERT_EQUAL(-1, reader.next(&frame)); // 超时，但不是错误
+  TEST_ASSERT_FALSE(reader.failed());
+
+  uint8_t rest[2] = {11, 12};
+  server.write(rest, sizeof(rest));
+  TEST_ASSERT_EQUAL(4, reader.next(&frame));
+  TEST_ASSERT_EQUAL(9, frame[0]);
+  TEST_ASSERT_EQUAL(12, frame[3]);
+  TEST_ASSERT_EQUAL_MEMORY(frame - FRAME_HEADER, half, FRAME_HEADER);
+
+  // 来回多次，触发缓冲区回绕搬移
+  uint8_t big[16];
+  for (int i = 0; i < 20; ++i) {
+    memset(big, i, sizeof(big));
+    send(server, big, sizeof(big));
+    TEST_ASSERT_EQUAL(16, reader.read(big, sizeof(big)));
+    TEST_ASSERT_EQUAL(i, big[15]);
+  }
+
+  // 超过最大帧长度视为协议错误
+  uint8_t too_big[17] = {0};
+  send(server, too_big, sizeof(too_big));
+  TEST_ASSERT_EQUAL(-1, reader.next(&frame));
+  TEST_ASSERT_TRUE(reader.failed());
+}
+
+void test_frame_writer_coalesces() {
+  SocketClient device, server;
+  TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+  FrameReader reader(server, 1024);
+  uint8_t *frame;
+
+  // 套接字模式：排队超过分段上限的帧会自动分批 sendmsg
+  FrameWriter raw(device.fd());
+  uint8_t msgs[12][8];
+  for (int i = 0; i < 12; ++i) {
+    memset(msgs[i], i, sizeof(msgs[i]));
+    TEST_ASSERT_EQUAL(0, raw.queue(msgs[i], sizeof(msgs[i])));
+  }
+  TEST_ASSERT_TRUE(raw.flush() > 0);
+  for (int i = 0; i < 12; ++i) {
+    TEST_ASSERT_EQUAL(8, reader.next(&frame));
+    TEST_ASSERT_EQUAL(i, frame[7]);
+  }
+
+  // Client 模式：小帧合并，大于缓冲区的内容直接写出
+  FrameWriter buffered(device, 64);
+  std::vector<uint8_t> big(200, 0x77);
+  TEST_ASSERT_EQUAL(0, buffered.queue(msgs[3], 8));
+  TEST_ASSERT_EQUAL(0, buffered.queue(big.data(), big.size()));
+  TEST_ASSERT_EQUAL(0, buffered.queue(msgs[5], 8));
+  TEST_ASSERT_EQUAL(12 + 204, server.available()); // 最后一帧仍在缓冲区
+  TEST_ASSERT_TRUE(buffered.flush() >= 0);
+  TEST_ASSERT_EQUAL(8, reader.next(&frame));
+  TEST_ASSERT_EQUAL(3, frame[0]);
+  TEST_ASSERT_EQUAL(200, reader.next(&frame));
+  TEST_ASSERT_EQUAL_MEMORY(big.data(), frame, 200);
+  TEST_ASSERT_EQUAL(8, reader.next(&frame));
+  TEST_ASSERT_EQUAL(5, frame[0]);
+}
+
+static void count_completion(HandshakeStateMachine &hs, int result,
+                             void *arg) {
+  if (result == 0) {
+    ++*static_cast<int *>(arg);
+  }
+}
+
+void test_state_machine_drives_two_connections() {
+  SocketClient device[2], server[2];
+  ServerResult result[2];
+  std::thread t[2];
+  for (int i = 0; i < 2; ++i) {
+    TEST_ASSERT_EQUAL(0, SocketClient::pair(device[i], server[i]));
+    t[i] = serve(server[i], result[i]);
+  }
+
+  // 一条完整握手、一条快速握手，在同一个循环里交替推进
+  int completed = 0;
+  HandshakeStateMachine full(device[0]), fast(device[1]);
+  full.on_complete(count_completion, &completed);
+  fast.on_complete(count_completion, &completed);
+  TEST_ASSERT_EQUAL(0, full.begin_full(fingerprint.data(), FINGERPRINT_LEN));
+  TEST_ASSERT_EQUAL(0, fast.begin_fast(fingerprint.data(), FINGERPRINT_LEN));
+  int polls = 0;
+  int a = HS_PENDING, b = HS_PENDING;
+  while (a == HS_PENDING || b == HS_PENDING) {
+    a = full.poll();
+    b = fast.poll();
+    ++polls;
+  }
+  t[0].join();
+  t[1].join();
+  TEST_ASSERT_EQUAL(0, a);
+  TEST_ASSERT_EQUAL(0, b);
+  TEST_ASSERT_EQUAL(2, completed);
+  TEST_ASSERT_TRUE(polls > 1);
+
+  uint8_t master_secret[BYTE256b];
+  TEST_ASSERT_EQUAL(0, full.master_secret(master_secret));
+  TEST_ASSERT_EQUAL_MEMORY(master_secret, result[0].master_secret, BYTE256b);
+  TEST_ASSERT_EQUAL(0, fast.master_secret(master_secret));
+  TEST_ASSERT_EQUAL_MEMORY(master_secret, result[1].master_secret, BYTE256b);
+  TEST_ASSERT_EQUAL(HELLO_FAST, result[1].info.hello);
+}
+
+void test_arena_scopes_and_handshake_high_water() {
+  Arena arena(256);
+  TEST_ASSERT_FALSE(arena.failed());
+  uint8_t *a = arena.alloc(3);
+  TEST_ASSERT_NOT_NULL(a);
+  memset(a, 0xAA, 3);
+  {
+    ArenaScope scope(arena);
+    uint8_t *b = arena.alloc(100);
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_EQUAL(0, (uintptr_t)(b - a) % ARENA_ALIGN);
+    memset(b, 0x55, 100);
+    TEST_ASSERT_NULL(arena.alloc(200)); // 超出容量
+  }
+  TEST_ASSERT_EQUAL(3, arena.mark()); // 作用域结束后归还并擦除
+  TEST_ASSERT_EQUAL(8 + 100, arena.high_water());
+  TEST_ASSERT_EQUAL_UINT8(0, a[8]);
+  arena.reset();
+  TEST_ASSERT_EQUAL(0, arena.mark());
+  TEST_ASSERT_EQUAL_UINT8(0, a[0]);
+
+  // 完整握手的临时消息都从 arena 分配，峰值不超过容量，结束后全部归还
+  SocketClient device, server;
+  ServerResult result;
+  TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+  std::thread t = serve(server, result);
+  HandshakeStateMachine hs(device);
+  TEST_ASSERT_EQUAL(0, hs.begin_full(fingerprint.data(), FINGERPRINT_LEN));
+  uint8_t master_secret[BYTE256b];
+  TEST_ASSERT_EQUAL(0, hs.run(master_secret));
+  t.join();
+  TEST_ASSERT_EQUAL_MEMORY(result.master_secret, master_secret, BYTE256b);
+  TEST_ASSERT_TRUE(hs.arena_high_water() >= STREAM_CHUNK_SIZE);
+  TEST_ASSERT_TRUE(hs.arena_high_water() <= HANDSHAKE_ARENA_SIZE);
+}
+
+/// 合成一帧灰度图像：平滑场景 + 固定的传感器噪声模式 + 随机噪声
+static std::vector<uint8_t> synth_frame(const std::vector<int8_t> &pattern,
+                                        int scene) {
+  std::vector<uint8_t> img(176 * 144);
+  for (int y = 0; y < 144; ++y) {
+    for (int x = 0; x < 176; ++x) {
+      int v = 60 + (x * (scene + 1) + y * (3 - scene)) / 3;
+      v += pattern[y * 176 + x] + (int)(randombytes_uniform(5)) - 2;
+      img[y * 176 + x] = v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+  }
+  return img;
+}
+
+static bool match_enrolled(const uint8_t *fp, size_t len,
+                           uint8_t device_id[BYTE256b], void *arg) {
+  auto *enrolled = static_cast<std::vector<uint8_t> *>(arg);
+  memset(device_id, 0, BYTE256b);
+  return prnu_match(fp, len, enrolled->data(), enrolled->size()) > 300;
+}
+
+void test_residual_fingerprint_negotiated() {
+  std::vector<int8_t> sensor_a(176 * 144), sensor_b(176 * 144);
+  for (size_t i = 0; i < sensor_a.size(); ++i) {
+    sensor_a[i] = (int8_t)randombytes_uniform(9) - 4;
+    sensor_b[i] = (int8_t)randombytes_uniform(9) - 4;
+  }
+  size_t desc_len = prnu_descriptor_size(176, 144);
+  std::vector<uint8_t> a1(desc_len), a2(desc_len), b1(desc_len);
+  TEST_ASSERT_EQUAL(desc_len, prnu_descriptor(synth_frame(sensor_a, 0).data(),
+                                              176, 144, a1.data(), desc_len));
+  prnu_descriptor(synth_frame(sensor_a, 1).data(), 176, 144, a2.data(),
+                  desc_len);
+  prnu_descriptor(synth_frame(sensor_b, 2).data(), 176, 144, b1.data(),
+                  desc_len);
+  // 同一传感器的不同画面相关，不同传感器不相关
+  int same = prnu_match(a1.data(), desc_len, a2.data(), desc_len);
+  int other = prnu_match(a1.data(), desc_len, b1.data(), desc_len);
+  TEST_ASSERT_TRUE(same > 300);
+  TEST_ASSERT_TRUE(other < 100 && other > -100);
+
+  // server 选用残差描述子，并用主机端参考实现与登记的描述子比对
+  server_ctx.verify_residual = match_enrolled;
+  server_ctx.verify_arg = &a1;
+  uint8_t master_secret[BYTE256b];
+  {
+    SocketClient device, server;
+    TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+    ServerResult result;
+    std::thread t = serve(server, result);
+    int ret = handshake_client_fast(master_secret, device, fingerprint.data(),
+                                    FINGERPRINT_LEN, nullptr, a2.data(),
+                                    desc_len);
+    t.join();
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_EQUAL(0, result.ret);
+    TEST_ASSERT_EQUAL(FP_FORMAT_RESIDUAL, result.info.fingerprint_format);
+    TEST_ASSERT_EQUAL(desc_len, result.info.fingerprint_len);
+    TEST_ASSERT_EQUAL_MEMORY(a2.data(), result.fingerprint.data(), desc_len);
+  }
+
+  // 其他传感器的描述子被拒绝
+  {
+    SocketClient device, server;
+    TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+    ServerResult result;
+    std::thread t = serve(server, result);
+    int ret = handshake_client(master_secret, device, fingerprint.data(),
+                               FINGERPRINT_LEN, nullptr, b1.data(), desc_len);
+    t.join();
+    TEST_ASSERT_EQUAL(-1, ret);
+    TEST_ASSERT_EQUAL(-1, result.ret);
+  }
+
+  // server 不支持残差时照常上传 JPEG
+  server_ctx.support_residual = false;
+  {
+    SocketClient device, server;
+    TEST_ASSERT_EQUAL(0, SocketClient::pair(device, server));
+    ServerResult result;
+    std::thread t = serve(server, result);
+    int ret = handshake_client(master_secret, device, fingerprint.data(),
+                               FINGERPRINT_LEN, nullptr, a2.data(), desc_len);
+    t.join();
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_EQUAL(HELLO_FULL, result.info.hello);
+    TEST_ASSERT_EQUAL(FP_FORMAT_JPEG, result.info.fingerprint_format);
+    TEST_ASSERT_EQUAL(FINGERPRINT_LEN, result.info.fingerprint_len);
+  }
+  server_ctx.verify_arg = nullptr;
+}
+
+struct EpollResults {
+  std::mutex lock;
+  std::map<int, std::vector<uint8_t>> master_secret; // 服务器端 fd → 主密钥
+};
+
+static void record_epoll_master(int fd, const uint8_t master_secret[BYTE256b],
+                                const ServerHandshakeInfo &info, void *arg) {
+  EpollResults *results = static_cast<EpollResults *>(arg);
+  std::lock_guard<std::mutex> guard(results->lock);
+  results->master_secret[fd].assign(master_secret, master_secret + BYTE256b);
+}
+
+/// 交给 EpollServer 一条 socketpair，返回服务器端的 fd
+static int adopt_pair(EpollServer &srv, SocketClient &device) {
+  int fds[2];
+  TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  device.attach(fds[0]);
+  TEST_ASSERT_EQUAL(0, srv.adopt(fds[1]));
+  return fds[1];
+}
+
+static int poll_all(std::vector<HandshakeStateMachine *> &hs) {
+  std::vector<int> ret(hs.size(), HS_PENDING);
+  bool pending = true;
+  while (pending) {
+    pending = false;
+    for (size_t i = 0; i < hs.size(); ++i) {
+      if (ret[i] == HS_PENDING) {
+        ret[i] = hs[i]->poll();
+        pending |= ret[i] == HS_PENDING;
+      }
+    }
+  }
+  int failures = 0;
+  for (int r : ret) {
+    failures += r != 0;
+  }
+  return failures;
+}
+
+void test_epoll_server_concurrent_handshakes() {
+  EpollServerOptions opt = EpollServer::default_options();
+  opt.loops = 2;
+  opt.workers = 2;
+  opt.fingerprint_max = FINGERPRINT_LEN;
+  opt.fingerprint_budget = 2 * FINGERPRINT_LEN; // 每个循环同时只缓存一个指纹
+  EpollServer srv(server_ctx, opt);
+  EpollResults results;
+  srv.on_handshake(record_epoll_master, &results);
+  TEST_ASSERT_EQUAL(0, srv.start());
+  TEST_ASSERT_EQUAL(-1, srv.port());
+
+  // 完整、快速、快速并请求票据三种握手交错进行
+  const int n = 12;
+  SocketClient device[n];
+  int server_fd[n];
+  TicketStore tickets[n];
+  std::vector<HandshakeStateMachine *> hs;
+  for (int i = 0; i < n; ++i) {
+    server_fd[i] = adopt_pair(srv, device[i]);
+    hs.push_back(new HandshakeStateMachine(device[i]));
+    int ret = i % 3 == 0 ? hs[i]->begin_full(fingerprint.data(),
+                                             FINGERPRINT_LEN)
+              : i % 3 == 1
+                  ? hs[i]->begin_fast(fingerprint.data(), FINGERPRINT_LEN)
+                  : hs[i]->begin_fast(fingerprint.data(), FINGERPRINT_LEN,
+                                      &tickets[i]);
+    TEST_ASSERT_EQUAL(0, ret);
+  }
+  TEST_ASSERT_EQUAL(0, poll_all(hs));
+  for (int i = 0; i < n; ++i) {
+    uint8_t master_secret[BYTE256b];
+    TEST_ASSERT_EQUAL(0, hs[i]->master_secret(master_secret));
+    std::lock_guard<std::mutex> guard(results.lock);
+    TEST_ASSERT_EQUAL(1, results.master_secret.count(server_fd[i]));
+    TEST_ASSERT_EQUAL_MEMORY(master_secret,
+                             results.master_secret[server_fd[i]].data(),
+                             BYTE256b);
+    TEST_ASSERT_EQUAL(i % 3 == 2, tickets[i].has());
+    delete hs[i];
+  }
+
+  // 会话恢复；重放的票据被拒绝后在同一连接上回退到完整握手
+  Ticket replay;
+  TEST_ASSERT_TRUE(tickets[2].take(replay));
+  tickets[2].put(replay);
+  SocketClient resume_dev, replay_dev;
+  adopt_pair(srv, resume_dev);
+  HandshakeStateMachine resume(resume_dev);
+  TEST_ASSERT_EQUAL(0, resume.begin_resume(tickets[2]));
+  int ret;
+  while ((ret = resume.poll()) == HS_PENDING) {
+  }
+  TEST_ASSERT_EQUAL(0, ret);
+
+  adopt_pair(srv, replay_dev);
+  TicketStore stale;
+  stale.put(replay);
+  HandshakeStateMachine fallback(replay_dev);
+  TEST_ASSERT_EQUAL(0, fallback.begin_resume(stale));
+  while ((ret = fallback.poll()) == HS_PENDING) {
+  }
+  TEST_ASSERT_EQUAL(1, ret);
+  TEST_ASSERT_EQUAL(0, fallback.begin_full(fingerprint.data(), FINGERPRINT_LEN));
+  while ((ret = fallback.poll()) == HS_PENDING) {
+  }
+  TEST_ASSERT_EQUAL(0, ret);
+
+  EpollServerStats stats;
+  srv.stats(stats);
+  TEST_ASSERT_EQUAL(n + 2, stats.accepted);
+  TEST_ASSERT_EQUAL(n + 2, stats.completed);
+  TEST_ASSERT_EQUAL(1, stats.resumed);
+  TEST_ASSERT_EQUAL(0, stats.failed);
+  TEST_ASSERT_EQUAL(n + 2, srv.latency().count());
+  TEST_ASSERT_TRUE(srv.latency().percentile(0.5) <=
+                   srv.latency().percentile(0.99));
+  srv.stop();
+}
+
+/// 逐像素的参考实现，与 block_sad 的 7 bit 语义一致
+static uint32_t sad_reference(const uint8_t *a, const uint8_t *b, size_t n) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < n; ++i) {
+    sum += (uint32_t)abs((a[i] >> 1) - (b[i] >> 1));
+  }
+  return sum;
+}
+
+void test_block_sad_and_changed_blocks_match_reference() {
+  // 任意起点与长度，含不是 4 的倍数的尾部与超过 4*255 的分段
+  std::vector<uint8_t> a(2048 + 3), b(2048 + 3);
+  randombytes_buf(a.data(), a.size());
+  randombytes_buf(b.data(), b.size());
+  const size_t lengths[] = {0, 1, 3, 4, 5, 7, 8, 13, 1019, 1020, 1021, 2048};
+  for (size_t n : lengths) {
+    for (size_t off = 0; off < 4; ++off) {
+      TEST_ASSERT_EQUAL(sad_reference(a.data() + off, b.data() + 3 - off, n),
+                        block_sad(a.data() + off, b.data() + 3 - off, n));
+    }
+  }
+  memset(a.data(), 0xff, 1024);
+  memset(b.data(), 0x00, 1024);
+  TEST_ASSERT_EQUAL(127 * 1024, block_sad(a.data(), b.data(), 1024));
+
+  // 宽高不是 4 或 8 的倍数时，右边与下边的残块也按面积计阈值
+  const uint16_t sizes[][2] = {{13, 7}, {37, 23}, {100, 75}, {4, 4}, {1, 9}};
+  for (auto &sz : sizes) {
+    uint16_t w = sz[0], h = sz[1];
+    std::vector<uint8_t> gray(w * h), ref(w * h);
+    randombytes_buf(ref.data(), ref.size());
+    for (size_t i = 0; i < gray.size(); ++i) {
+      gray[i] = randombytes_uniform(4) == 0
+                    ? (uint8_t)randombytes_uniform(256)
+                    : (uint8_t)(ref[i] ^ randombytes_uniform(8));
+    }
+    for (uint32_t threshold : {0U, 2U, 6U, 20U}) {
+      uint16_t expected = 0;
+      for (uint16_t by = 0; by < h; by += 4) {
+        for (uint16_t bx = 0; bx < w; bx += 4) {
+          uint32_t sad = 0, area = 0;
+          for (uint16_t y = by; y < h && y < by + 4; ++y) {
+            for (uint16_t x = bx; x < w && x < bx + 4; ++x) {
+              sad += sad_reference(&gray[y * w + x], &ref[y * w + x], 1);
+              ++area;
+            }
+          }
+          expected += sad > threshold * area;
+        }
+      }
+      uint16_t changed =
+          gray_changed_blocks(gray.data(), ref.data(), w, h, 4, threshold);
+      TEST_ASSERT_EQUAL(expected, changed);
+    }
+    TEST_ASSERT_EQUAL(0, gray_changed_blocks(ref.data(), ref.data(), w, h, 4, 0));
+  }
+}
+
+int main(int argc, char **argv) {
+  Serial.mute(true);
+  trace_init();
+  server_context_init(server_ctx, NATIVE_SERVER_SEED);
+  esp_fill_random(fingerprint.data(), FINGERPRINT_LEN);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_aes256gcm_inplace_and_stream);
+  RUN_TEST(test_aead_backends_roundtrip);
+  RUN_TEST(test_full_handshake_and_session);
+  RUN_TEST(test_session_rejects_replayed_record);
+  RUN_TEST(test_fast_handshake_with_ticket_then_resume);
+  RUN_TEST(test_fast_handshake_falls_back);
+  RUN_TEST(test_trace_records_handshake_phases);
+  RUN_TEST(test_frame_reader_batches_and_limits);
+  RUN_TEST(test_frame_writer_coalesces);
+  RUN_TEST(test_state_machine_drives_two_connections);
+  RUN_TEST(test_residual_fingerprint_negotiated);
+  RUN_TEST(test_arena_scopes_and_handshake_high_water);
+  RUN_TEST(test_epoll_server_concurrent_handshakes);
+  RUN_TEST(test_block_sad_and_changed_blocks_match_reference);
+  return UNITY_END();
+}